@@ -328,6 +328,7 @@ SOURCES += \
     App.cpp \
     BTC.cpp \
     BTC_Address.cpp \
+    BinWire.cpp \
     BitcoinD.cpp \
     BitcoinD_RPCInfo.cpp \
     BlockProc.cpp \
@@ -345,6 +346,7 @@ SOURCES += \
     main.cpp \
     Mempool.cpp \
     Merkle.cpp \
+    Metrics.cpp \
     Mixins.cpp \
     Mgr.cpp \
     Options.cpp \
@@ -363,6 +365,8 @@ SOURCES += \
     SubsMgr.cpp \
     SubStatus.cpp \
     ThreadPool.cpp \
+    ThreadTopology.cpp \
+    TxHashIndex.cpp \
     TXO.cpp \
     UPnP.cpp \
     Util.cpp \
@@ -377,6 +381,7 @@ HEADERS += \
     App.h \
     BTC.h \
     BTC_Address.h \
+    BinWire.h \
     BitcoinD.h \
     BitcoinD_RPCInfo.h \
     BlockProc.h \
@@ -394,6 +399,7 @@ HEADERS += \
     Logger.h \
     Mempool.h \
     Merkle.h \
+    Metrics.h \
     Mgr.h \
     Mixins.h \
     Options.h \
@@ -414,6 +420,8 @@ HEADERS += \
     SubStatus.h \
     ThreadPool.h \
     ThreadSafeHashTable.h \
+    ThreadTopology.h \
+    TxHashIndex.h \
     TXO.h \
     TXO_Compact.h \
     UPnP.h \
@@ -167,6 +167,11 @@ void AbstractConnection::socketConnectSignals()
 }
 
 bool AbstractConnection::do_write(const QByteArray & data)
+{
+    return do_write_custom(data.length(), [this, &data]{ return socket->write(data); });
+}
+
+bool AbstractConnection::do_write_custom(const qint64 n2write, const std::function<qint64()> &writeFunc)
 {
     QString err = "";
     if (!socket) {
@@ -186,9 +191,8 @@ bool AbstractConnection::do_write(const QByteArray & data)
     // Note: we temorarily allow the writeBackLog to grow beyond MAX_BUFFER here.  If we run through this function
     // again in the future before bytes were actually written to the socket and we are over MAX_BUFFER, only then will
     // the above error be triggered.
-    const auto n2write = data.length();
     writeBackLog += n2write;
-    const qint64 written = socket->write(data);
+    const qint64 written = writeFunc();
     if (UNLIKELY(written < 0)) {
         Error() << __func__ << ": " << prettyName() << " -- error on write " << socket->error() << " (" << socket->errorString() << ")";
         do_disconnect();
@@ -26,6 +26,7 @@
 #include <QTcpSocket>
 
 #include <atomic>
+#include <functional>
 
 class QTimer;
 
@@ -125,6 +126,10 @@ protected:
     virtual void on_disconnected(); ///< overrides can chain to this as well
 
     bool do_write(const QByteArray & = "");
+    /// Like do_write(), but `writeFunc` does the actual writing to `socket` and returns what it wrote (or -1 on error).
+    /// `n2write` must be the byte count the socket's bytesWritten() signal will later report for this write. This is
+    /// for subclasses that need to bypass the socket's own write() (e.g. to send an already-framed WebSocket message).
+    bool do_write_custom(qint64 n2write, const std::function<qint64()> &writeFunc);
     /// does a socket->abort, sets status. Chain to this if you want on override. Named this way so as not to clash with QObject::disconnect
     virtual void do_disconnect(bool graceful = false);
 
@@ -22,12 +22,14 @@
 #include "Controller.h"
 #include "Json/Json.h"
 #include "Logger.h"
+#include "Metrics.h"
 #include "Rpa.h"
 #include "ServerMisc.h"
 #include "Servers.h"
 #include "Storage.h"
 #include "SSLCertMonitor.h"
 #include "ThreadPool.h"
+#include "ThreadTopology.h"
 #include "UPnP.h"
 #include "Util.h"
 #include "ZmqSubNotifier.h"
@@ -93,6 +95,12 @@ App::App(int argc, char *argv[])
     if (options->syslogMode) {
         _logger = std::make_unique<SysLogger>(this);
     }
+    if (options->logAsync.enabled) {
+        _logger = std::make_unique<AsyncLogger>(std::move(_logger), options->logAsync.queueSize,
+                                                options->logAsync.blockOnOverflow ? AsyncLogger::OverflowPolicy::Block
+                                                                                  : AsyncLogger::OverflowPolicy::Drop,
+                                                this);
+    }
 
     connect(this, &App::aboutToQuit, this, &App::cleanup);
     connect(this, &App::setVerboseDebug, this, &App::on_setVerboseDebug);
@@ -1094,6 +1102,16 @@ void App::parseArgs()
         Util::AsyncOnObject(this, [val,this]{ Debug() << "config: worker_threads = " << val << " (configured: " << tpool->maxThreadCount() << ")"; });
     } else
         options->workerThreads = tpool->maxThreadCount(); // so stats() knows what was auto-configured
+    if (conf.hasValue("workqueue_timeout")) {
+        bool ok;
+        const double val = conf.doubleValue("workqueue_timeout", options->defaultWorkQueueTimeout, &ok);
+        if (!ok || val < 0. || val > options->maxWorkQueueTimeout)
+            throw BadArgs(QString("workqueue_timeout: bad value. Specify a number of seconds in the range [0, %1]")
+                          .arg(options->maxWorkQueueTimeout));
+        options->workQueueTimeout = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: workqueue_timeout = " << val; });
+    }
     // max_pending_connections
     if (conf.hasValue("max_pending_connections")) {
         bool ok;
@@ -1259,6 +1277,100 @@ void App::parseArgs()
         // log this later in case we are in syslog mode
         Util::AsyncOnObject(this, [val]{ Debug() << "config: db_use_fsync = " << (val ? "true" : "false"); });
     }
+    if (conf.hasValue("db_verify_balance")) {
+        bool ok;
+        const bool val = conf.boolValue("db_verify_balance", options->db.defaultVerifyBalance, &ok);
+        if (!ok)
+            throw BadArgs("db_verify_balance: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->db.verifyBalance = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: db_verify_balance = " << (val ? "true" : "false"); });
+    }
+    if (conf.hasValue("db_compact_headers")) {
+        bool ok;
+        const bool val = conf.boolValue("db_compact_headers", options->db.defaultCompactHeaders, &ok);
+        if (!ok)
+            throw BadArgs("db_compact_headers: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->db.compactHeaders = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: db_compact_headers = " << (val ? "true" : "false"); });
+    }
+    for (const auto & [nameStr, val] : {std::pair{"db_flush_threads", &options->db.flushThreads},
+                                        std::pair{"db_compaction_threads", &options->db.compactionThreads}}) {
+        const QString name = nameStr;
+        if (!conf.hasValue(name)) continue;
+        bool ok;
+        const int n = conf.intValue(name, 0, &ok);
+        if (!ok || n < 0 || unsigned(n) > options->db.maxBackgroundThreads)
+            throw BadArgs(QString("%1: bad value. Specify an integer in the range [0, %2]")
+                          .arg(name).arg(options->db.maxBackgroundThreads));
+        *val = unsigned(n);
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [name, n]{ Debug() << "config: " << name << " = " << n; });
+    }
+
+    if (conf.hasValue("db_block_cache_type")) {
+        const QString val = conf.value("db_block_cache_type").trimmed().toLower();
+        if (val == "lru")
+            options->db.blockCacheType = Options::DBOpts::BlockCacheType::LRU;
+        else if (val == "hyperclock")
+            options->db.blockCacheType = Options::DBOpts::BlockCacheType::HyperClock;
+        else
+            throw BadArgs("db_block_cache_type: bad value. Specify one of: lru, hyperclock");
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: db_block_cache_type = " << val; });
+    }
+    if (conf.hasValue("db_block_cache_per_table")) {
+        bool ok;
+        const bool val = conf.boolValue("db_block_cache_per_table", options->db.defaultBlockCachePerTable, &ok);
+        if (!ok)
+            throw BadArgs("db_block_cache_per_table: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->db.blockCachePerTable = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: db_block_cache_per_table = " << (val ? "true" : "false"); });
+    }
+    if (conf.hasValue("db_pin_index_filter")) {
+        bool ok;
+        const bool val = conf.boolValue("db_pin_index_filter", options->db.defaultPinIndexFilter, &ok);
+        if (!ok)
+            throw BadArgs("db_pin_index_filter: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->db.pinIndexFilter = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: db_pin_index_filter = " << (val ? "true" : "false"); });
+    }
+    if (conf.hasValue("db_secondary_cache_mem")) {
+        bool ok;
+        const double mb = conf.doubleValue("db_secondary_cache_mem", 0., &ok);
+        if (const size_t bytes = mb*size_t(1024*1024); !ok || mb < 0. || (bytes && !options->db.isMaxMemInBounds(bytes)))
+            throw BadArgs(QString("db_secondary_cache_mem: bad value. Specify 0 (off) or a value in the range [%1, %2]")
+                          .arg(options->db.maxMemMin / 1024. / 1024., 0, 'f', 1).arg(options->db.maxMemMax / 1024. / 1024., 0, 'f', 1));
+        else {
+            options->db.secondaryCacheMem = bytes;
+            // log this later in case we are in syslog mode
+            Util::AsyncOnObject(this, [mb]{ Debug() << "config: db_secondary_cache_mem = " << mb; });
+        }
+    }
+
+    // thread placement: cpu_affinity_workers, cpu_affinity_db, cpu_affinity_cotask, cpu_affinity_io
+    for (const auto & [group, pval] : {std::pair{ThreadTopology::Group::Workers, &options->cpuAffinity.workers},
+                                      std::pair{ThreadTopology::Group::DB, &options->cpuAffinity.db},
+                                      std::pair{ThreadTopology::Group::CoTask, &options->cpuAffinity.cotask},
+                                      std::pair{ThreadTopology::Group::IO, &options->cpuAffinity.io}}) {
+        const QString name = QString("cpu_affinity_%1").arg(ThreadTopology::groupName(group));
+        if (!conf.hasValue(name)) continue;
+        if (!ThreadTopology::isSupported())
+            throw BadArgs(QString("%1: thread placement is only supported on Linux").arg(name));
+        ThreadTopology::CpuSet cpus;
+        try {
+            cpus = ThreadTopology::parseCpuList(conf.value(name));
+        } catch (const BadArgs &e) {
+            throw BadArgs(QString("%1: %2").arg(name, e.what()));
+        }
+        ThreadTopology::setGroupCpus(group, cpus);
+        const QString val = *pval = ThreadTopology::toCpuList(cpus);
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [name, val]{ Debug() << "config: " << name << " = " << val; });
+    }
 
     // warn user that no hostname was specified if they have peerDiscover turned on
     if (!options->hostName.has_value() && options->peerDiscovery && options->peerAnnounceSelf) {
@@ -1336,6 +1448,17 @@ void App::parseArgs()
         Util::AsyncOnObject(this, [n, name]{ DebugM("config: ", name, " = ", n); });
     }
 
+    // conf: bitcoind_batch
+    if (conf.hasValue("bitcoind_batch")) {
+        bool ok{};
+        const int val = conf.intValue("bitcoind_batch", int(Options::defaultBdBatchMax), &ok);
+        if (!ok || val < 0 || !options->isBdBatchMaxInRange(unsigned(val)))
+            throw BadArgs(QString("bitcoind_batch: please specify a value in the range [0, %1]")
+                          .arg(options->bdBatchMaxMax));
+        options->bdBatchMax = unsigned(val);
+        Util::AsyncOnObject(this, [val]{ DebugM("config: bitcoind_batch = ", val); });
+    }
+
     // conf: max_reorg
     if (conf.hasValue("max_reorg")) {
         bool ok{};
@@ -1359,6 +1482,16 @@ void App::parseArgs()
         Util::AsyncOnObject(this, [val=val/1e6]{ DebugM("config: txhash_cache = ", val); });
     }
 
+    // conf: txhash_mem_index
+    if (conf.hasValue("txhash_mem_index")) {
+        bool ok{};
+        const bool val = conf.boolValue("txhash_mem_index", Options::defaultTxHashMemIndex, &ok);
+        if (!ok)
+            throw BadArgs("txhash_mem_index: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->txHashMemIndex = val;
+        Util::AsyncOnObject(this, [val]{ DebugM("config: txhash_mem_index = ", val); });
+    }
+
     // CLI: --compact-dbs
     if (parser.isSet("compact-dbs")) {
         options->compactDBs = true;
@@ -1376,6 +1509,16 @@ void App::parseArgs()
         Util::AsyncOnObject(this, [val]{ DebugM("config: max_batch = ", val); });
     }
 
+    // conf: binary_protocol
+    if (conf.hasValue("binary_protocol")) {
+        bool ok{};
+        const bool val = conf.boolValue("binary_protocol", Options::defaultBinaryProtocol, &ok);
+        if (!ok)
+            throw BadArgs("binary_protocol: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->binaryProtocol = val;
+        Util::AsyncOnObject(this, [val]{ DebugM("config: binary_protocol = ", val); });
+    }
+
     // parse --dump-*
     if (const auto outFile = parser.value("dump-sh"); !outFile.isEmpty()) {
         options->dumpScriptHashes = outFile; // we do no checking here, but Controller::startup will throw BadArgs if it cannot open this file for writing.
@@ -1425,6 +1568,37 @@ void App::parseArgs()
         Util::AsyncOnObject(this, [val]{ DebugM("config: anon_logs = ", val); });
     }
 
+    // conf: log_async
+    if (conf.hasValue("log_async")) {
+        bool ok{};
+        const bool val = conf.boolValue("log_async", Options::LogAsync::defaultEnabled, &ok);
+        if (!ok)
+            throw BadArgs("log_async: bad value. Specify a boolean value such as 0, 1, true, false, yes, no");
+        options->logAsync.enabled = val;
+        Util::AsyncOnObject(this, [val]{ DebugM("config: log_async = ", val); });
+    }
+    // conf: log_async_queue
+    if (conf.hasValue("log_async_queue")) {
+        bool ok{};
+        const unsigned val = unsigned(conf.intValue("log_async_queue", Options::LogAsync::defaultQueueSize, &ok));
+        if (!ok || !Options::LogAsync::isQueueSizeInRange(val))
+            throw BadArgs(QString("log_async_queue: please specify a value in the range [%1, %2]")
+                          .arg(Options::LogAsync::queueSizeMin).arg(Options::LogAsync::queueSizeMax));
+        options->logAsync.queueSize = val;
+        Util::AsyncOnObject(this, [val]{ DebugM("config: log_async_queue = ", val); });
+    }
+    // conf: log_async_overflow
+    if (conf.hasValue("log_async_overflow")) {
+        const auto val = conf.value("log_async_overflow").toLower().trimmed();
+        if (val == "block")
+            options->logAsync.blockOnOverflow = true;
+        else if (val == "drop")
+            options->logAsync.blockOnOverflow = false;
+        else
+            throw BadArgs(QString("log_async_overflow: unrecognized value \"%1\", please specify one of: drop, block").arg(val));
+        Util::AsyncOnObject(this, [val]{ DebugM("config: log_async_overflow = ", val); });
+    }
+
     // CLI: --pidfile
     // conf: pidfile
     if (const bool pset = parser.isSet("pidfile"); pset || conf.hasValue("pidfile")) {
@@ -1579,7 +1753,7 @@ void App::start_httpServer(const Options::Interface &iface)
     std::shared_ptr<SimpleHttpServer> server(new SimpleHttpServer(iface.first, iface.second, 16384));
     httpServers.push_back(server);
     server->tryStart(); // may throw, waits for server to start
-    server->set404Message("Error: Unknown endpoint. /stats & /debug are the only valid endpoint I understand.\r\n");
+    server->set404Message("Error: Unknown endpoint. /stats, /debug & /metrics are the only valid endpoints I understand.\r\n");
     static const auto CRLF = QByteArrayLiteral("\r\n");
     server->addEndpoint("/stats",[this](SimpleHttpServer::Request &req){
         req.response.contentType = "application/json; charset=utf-8";
@@ -1594,6 +1768,11 @@ void App::start_httpServer(const Options::Interface &iface)
         stats = stats.isNull() ? QVariantList{QVariant()} : stats;
         req.response.data = Json::toUtf8(stats, false) + CRLF; // may throw -- caller will handle exception
     });
+    server->addEndpoint("/metrics",[](SimpleHttpServer::Request &req){
+        // Unlike the above, this never blocks on (or calls into) other threads: it only reads atomic counters.
+        req.response.contentType = "text/plain; version=0.0.4; charset=utf-8";
+        req.response.data = Metrics::Registry::instance().prometheusText();
+    });
 }
 
 /* static */ App::QtLogSuppressionList App::qlSuppressions;
@@ -158,6 +158,7 @@ namespace BTC
             Debug() << "Bypassing header validation for RandomX block at height " << height;
             prevHeight = height;
             prev = header;
+            prevLinkHash.clear();
             if (err) err->clear();
             return true;
         }
@@ -167,6 +168,7 @@ namespace BTC
             
         prevHeight = height;
         prev = header;
+        prevLinkHash.clear();
         if (err) err->clear();
         return true;
     }
@@ -181,6 +183,7 @@ namespace BTC
             QByteArray header = Serialize(curHdr);
             prevHeight = height;
             prev = header;
+            prevLinkHash.clear();
             if (err) err->clear();
             return true;
         }
@@ -222,6 +225,7 @@ namespace BTC
             
         prevHeight = height;
         prev = header;
+        prevLinkHash.clear();
         if (err) err->clear();
         return true;
     }
@@ -241,64 +245,11 @@ namespace BTC
         }
         
         if (!prev.isEmpty()) {
-            QByteArray prevHash;
-            
-            // For the previous block, determine how to calculate its hash
-            
-            const bool prevIsRandomX = IsRandomXBlock(prevHeight);
-            // For clarity in code below
-            const bool prevIsAlphaRandomX = prevIsRandomX;
-            
-            // Accept both 80-byte (standard) and 112-byte (padded) headers for previous block
-            if (prev.size() != FIXED_HEADER_RECORD_SIZE && prev.size() != 80) {
-                if (err) *err = QString("Invalid header size for block %1: expected %2 or 80 bytes, got %3")
-                    .arg(prevHeight).arg(FIXED_HEADER_RECORD_SIZE).arg(prev.size());
+            if (!computePrevLinkHash(err))
                 return false;
-            }
-            
-            // Add debug info for the first few blocks
-            if (height < 10) {
-                Debug() << "checkInner: previous header at height " << prevHeight 
-                       << ": header size=" << prev.size() 
-                       << ", isRandomX=" << (prevIsRandomX ? "true" : "false");
-            }
-            
-            /* 
-             * IMPORTANT: Handling the transition between standard blocks and RandomX blocks
-             * 
-             * There are several cases to consider:
-             * 1. Previous block is before activation height (standard header)
-             *    - Use standard double-SHA256 hash
-             * 
-             * 2. Previous block is after activation height (RandomX header)
-             *    - If hashRandomX is set, use it directly (most efficient)
-             *    - If hashRandomX is not set, throw an error (malformed header)
-             * 
-             * 3. We're at the transition point (current block is the first RandomX block)
-             *    - Previous block must be verified using standard double-SHA256
-             *    - Current block will bypass validation (due to the isRandomXBlock check above)
-             */
-            if (prevIsAlphaRandomX) {
-                // If the previous block is an Alpha RandomX header, check if it has a hashRandomX field
-                bitcoin::CBlockHeader prevHdr = Deserialize<bitcoin::CBlockHeader>(prev);
-                if (!prevHdr.hashRandomX.IsNull()) {
-                    // Use the pre-computed RandomX hash stored in the header
-                    prevHash = QByteArray::fromRawData(reinterpret_cast<const char *>(prevHdr.hashRandomX.begin()), 
-                                                    int(prevHdr.hashRandomX.width()));
-                } else if (prevIsRandomX) {
-                    // For post-activation blocks, hashRandomX should always be set
-                    // If we get here, it means there's an error in the header format
-                    if (err) *err = QString("RandomX block at height %1 is missing hashRandomX field").arg(prevHeight);
-                    return false;
-                } else {
-                    // For standard block hashing, always use just the first 80 bytes
-                    prevHash = Hash(prev.left(80));
-                }
-            } else {
-                // For standard block hashing, always use just the first 80 bytes
-                prevHash = Hash(prev.left(80));
-            }
-            
+            const QByteArray & prevHash = prevLinkHash;
+            const bool prevIsRandomX = IsRandomXBlock(prevHeight);
+
             // Enhanced diagnostic logging for early blocks (height < 10)
             if (height < 10) {
                 QString prevHashHex = Util::ToHexFast(prevHash).toLower();
@@ -321,6 +272,113 @@ namespace BTC
         
         return true;
     }
+    bool HeaderVerifier::computePrevLinkHash(QString *err)
+    {
+        if (!prevLinkHash.isEmpty() || prev.isEmpty())
+            return true;
+        const bool prevIsRandomX = IsRandomXBlock(prevHeight);
+
+        // Accept both 80-byte (standard) and 112-byte (padded) headers for previous block
+        if (prev.size() != FIXED_HEADER_RECORD_SIZE && prev.size() != 80) {
+            if (err) *err = QString("Invalid header size for block %1: expected %2 or 80 bytes, got %3")
+                .arg(prevHeight).arg(FIXED_HEADER_RECORD_SIZE).arg(prev.size());
+            return false;
+        }
+
+        // Add debug info for the first few blocks
+        if (prevHeight + 1 < 10) {
+            Debug() << "checkInner: previous header at height " << prevHeight
+                   << ": header size=" << prev.size()
+                   << ", isRandomX=" << (prevIsRandomX ? "true" : "false");
+        }
+
+        /*
+         * IMPORTANT: Handling the transition between standard blocks and RandomX blocks
+         *
+         * There are several cases to consider:
+         * 1. Previous block is before activation height (standard header)
+         *    - Use standard double-SHA256 hash
+         *
+         * 2. Previous block is after activation height (RandomX header)
+         *    - If hashRandomX is set, use it directly (most efficient)
+         *    - If hashRandomX is not set, throw an error (malformed header)
+         *
+         * 3. We're at the transition point (current block is the first RandomX block)
+         *    - Previous block must be verified using standard double-SHA256
+         *    - Current block will bypass validation (due to the isRandomXBlock check in checkInner)
+         */
+        if (prevIsRandomX) {
+            // If the previous block is an Alpha RandomX header, check if it has a hashRandomX field
+            const bitcoin::CBlockHeader prevHdr = Deserialize<bitcoin::CBlockHeader>(prev);
+            if (prevHdr.hashRandomX.IsNull()) {
+                // For post-activation blocks, hashRandomX should always be set
+                // If we get here, it means there's an error in the header format
+                if (err) *err = QString("RandomX block at height %1 is missing hashRandomX field").arg(prevHeight);
+                return false;
+            }
+            // Use the pre-computed RandomX hash stored in the header
+            prevLinkHash = QByteArray(reinterpret_cast<const char *>(prevHdr.hashRandomX.begin()),
+                                      int(prevHdr.hashRandomX.width()));
+        } else {
+            // For standard block hashing, always use just the first 80 bytes
+            prevLinkHash = Hash(prev.left(80));
+        }
+        return true;
+    }
+
+    /* static */
+    auto HeaderVerifier::prepare(unsigned height, const bitcoin::CBlockHeader &hdr, QString *err) -> std::optional<Prepared>
+    {
+        std::optional<Prepared> ret;
+        // Same invariants as operator()(const CBlockHeader &), which also skips them for RandomX blocks
+        if (!IsRandomXBlock(int(height))) {
+            if (!hdr.hashRandomX.IsNull()) {
+                if (err) *err = QString("Non-RandomX block at height %1 has unexpected hashRandomX field").arg(height);
+                return ret;
+            }
+            if (hdr.IsNull()) {
+                if (err) *err = QString("Header verification failed for header at height %1: failed to deserialize").arg(height);
+                return ret;
+            }
+        }
+        Prepared p;
+        p.raw = Serialize(hdr);
+        if (p.raw.size() != FIXED_HEADER_RECORD_SIZE && p.raw.size() != 80) {
+            if (err) *err = QString("Header verification failed for header at height %1: wrong size (expected %2 or 80 bytes, got %3)")
+                .arg(height).arg(FIXED_HEADER_RECORD_SIZE).arg(p.raw.size());
+            return ret;
+        }
+        p.hash = Hash(QByteArray::fromRawData(p.raw.constData(), 80));
+        ret.emplace(std::move(p));
+        return ret;
+    }
+
+    bool HeaderVerifier::checkPrepared(const bitcoin::CBlockHeader &hdr, const Prepared &prepared, QString *err)
+    {
+        const long height = prevHeight+1;
+        // RandomX blocks bypass linkage validation, exactly as in operator() (but without the per-header logging)
+        if (!IsRandomXBlock(height) && !prev.isEmpty()) {
+            if (!computePrevLinkHash(err))
+                return false;
+            if (prevLinkHash != QByteArray::fromRawData(reinterpret_cast<const char *>(hdr.hashPrevBlock.begin()),
+                                                        int(hdr.hashPrevBlock.width()))) {
+                if (err) *err = QString("Header %1 'hashPrevBlock' does not match the contents of the previous block").arg(height);
+                return false;
+            }
+        }
+        prevHeight = height;
+        prev = prepared.raw;
+        // cache the hash the next header must link to, saving a re-hash (or, for RandomX, a re-deserialize) of `prev`
+        if (IsRandomXBlock(height)) {
+            prevLinkHash.clear();
+            if (!hdr.hashRandomX.IsNull())
+                prevLinkHash = QByteArray(reinterpret_cast<const char *>(hdr.hashRandomX.begin()), int(hdr.hashRandomX.width()));
+        } else
+            prevLinkHash = prepared.hash;
+        if (err) err->clear();
+        return true;
+    }
+
     std::pair<int, QByteArray> HeaderVerifier::lastHeaderProcessed() const
     {
         return { int(prevHeight), prev };
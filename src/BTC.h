@@ -37,6 +37,7 @@
 #include <cstring> // for memcpy
 #include <ios>
 #include <iterator>
+#include <optional>
 #include <type_traits>
 #include <utility> // for pair, etc
 
@@ -236,8 +237,10 @@ namespace BTC
     class HeaderVerifier {
         QByteArray prev; // 80 byte header data or empty
         long prevHeight = -1;
+        QByteArray prevLinkHash; // cached hash of `prev` that the next header's hashPrevBlock must match, or empty
 
         bool checkInner(long height, const bitcoin::CBlockHeader &, QString *err, bool isAlphaRandomX = false);
+        bool computePrevLinkHash(QString *err); // fills prevLinkHash from prev, if empty
     public:
         HeaderVerifier() = default;
         HeaderVerifier(unsigned fromHeight) : prevHeight(long(fromHeight)-1) {}
@@ -245,6 +248,18 @@ namespace BTC
         /// keep calling this from a loop. Returns false if current header's hashPrevBlock  != the last header's hash.
         bool operator()(const QByteArray & header, QString *err = nullptr);
         bool operator()(const bitcoin::CBlockHeader & header, QString *err = nullptr);
+
+        /// The context-free part of the checks done by operator() for a header at `height` (field and size
+        /// invariants), plus the serialization and hashing that operator() would do. Thread-safe; the download
+        /// pipeline calls this on worker threads so that addBlock need only call checkPrepared().
+        struct Prepared {
+            QByteArray raw; ///< the serialized header (80 or 112 bytes), as stored in the headers file
+            QByteArray hash; ///< sha256d of the first 80 bytes of `raw`, in memory order (not reversed)
+        };
+        static std::optional<Prepared> prepare(unsigned height, const bitcoin::CBlockHeader & header, QString *err = nullptr);
+        /// Equivalent to operator()(header), for a header whose `prepared` data came from prepare(). Only checks that
+        /// it links to the last header seen, which is a memcmp against a cached hash in the common case.
+        bool checkPrepared(const bitcoin::CBlockHeader & header, const Prepared & prepared, QString *err = nullptr);
         /// returns the height, 80 byte header of the last header seen. If no headers seen, returns (-1, Empty QByteArray)
         std::pair<int, QByteArray> lastHeaderProcessed() const;
 
@@ -252,7 +267,7 @@ namespace BTC
             // Since all headers are stored as fixed-size records, we check for that size only
             return prev.length() == FIXED_HEADER_RECORD_SIZE;
         }
-        void reset(unsigned nextHeight = 0, QByteArray prevHeader = QByteArray()) { prevHeight = long(nextHeight)-1; prev = prevHeader; }
+        void reset(unsigned nextHeight = 0, QByteArray prevHeader = QByteArray()) { prevHeight = long(nextHeight)-1; prev = prevHeader; prevLinkHash.clear(); }
     };
 
     /// Trivial hasher for sha256, rmd160, etc hashed byte arrays (for use with std::unordered_map,
@@ -0,0 +1,507 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#include "BinWire.h"
+#include "Compat.h"
+#include "Util.h"
+
+#include <QtEndian>
+
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace BinWire {
+
+Error::~Error() {} // for vtable
+ParseError::~ParseError() {} // for vtable
+
+namespace {
+    constexpr unsigned kMaxDepth = 1024; ///< same as the Json serializer's limit
+
+    bool IsLowerHex(const QString &s) {
+        if (s.isEmpty() || s.size() % 2) return false;
+        for (const QChar c : s) {
+            const unsigned u = c.unicode();
+            if (!((u >= '0' && u <= '9') || (u >= 'a' && u <= 'f'))) return false;
+        }
+        return true;
+    }
+    bool IsLowerHex(const QByteArray &s) {
+        if (s.isEmpty() || s.size() % 2) return false;
+        for (const char c : s)
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+        return true;
+    }
+
+    class Writer {
+    public:
+        QByteArray out;
+
+        void value(const QVariant &v, unsigned depth) {
+            const Tag t = tagFor(v);
+            put(char(t));
+            body(t, v, depth);
+        }
+
+    private:
+        void put(char c) { out.append(c); }
+        void putVarInt(uint64_t n) {
+            char buf[10];
+            int i = 0;
+            for ( ; n >= 0x80u; n >>= 7) buf[i++] = char(n | 0x80u);
+            buf[i++] = char(n);
+            out.append(buf, i);
+        }
+        void putBytes(const QByteArray &b) { putVarInt(uint64_t(b.size())); out.append(b); }
+        void putKey(const QString &k) { putBytes(k.toUtf8()); }
+
+        static Tag tagFor(const QVariant &v) {
+            const auto typ = Compat::GetVarType(v);
+            if (v.isNull()) // mirror Json::serialize(): a null QString is "", anything else null is null
+                return typ == QMetaType::QString ? String : Null;
+            switch (typ) {
+            case QMetaType::QByteArray: {
+                const auto ba = v.toByteArray();
+                return ba.isEmpty() ? Null : (IsLowerHex(ba) ? (ba.size() == 64 ? Hash : Hex) : String);
+            }
+            case QMetaType::QString: {
+                const auto s = v.toString();
+                return IsLowerHex(s) ? (s.size() == 64 ? Hash : Hex) : String;
+            }
+            case QMetaType::QStringList:
+            case QMetaType::QByteArrayList:
+                return List;
+            case QMetaType::QVariantList:
+                return IsTable(v.toList()) ? Table : List;
+            case QMetaType::QVariantMap:
+            case QMetaType::QVariantHash:
+                return Map;
+            case QMetaType::Bool:
+                return Bool;
+            case QMetaType::Int:
+            case QMetaType::Long:
+            case QMetaType::LongLong:
+                return Int;
+            case QMetaType::UInt:
+            case QMetaType::ULong:
+            case QMetaType::ULongLong:
+                return UInt;
+            case QMetaType::Double:
+            case QMetaType::Float:
+                return Double;
+            default:
+                throw Error(QString("Unsupported type %1 for '%2'").arg(int(typ)).arg(v.toString()));
+            }
+        }
+
+        /// A list of >= 2 maps that all have the same keys
+        static bool IsTable(const QVariantList &l) {
+            if (l.size() < 2) return false;
+            QList<QString> keys;
+            for (const auto & item : l) {
+                if (!Compat::IsMetaType(item, QMetaType::QVariantMap)) return false;
+                const auto & m = *static_cast<const QVariantMap *>(item.constData());
+                if (keys.isEmpty()) {
+                    if (m.isEmpty()) return false;
+                    keys = m.keys();
+                } else if (m.size() != keys.size() || m.keys() != keys)
+                    return false;
+            }
+            return true;
+        }
+
+        void hexBody(Tag t, const QVariant &v) {
+            const QByteArray raw = Util::ParseHexFast(Compat::IsMetaType(v, QMetaType::QByteArray) ? v.toByteArray()
+                                                                                                   : v.toString().toLatin1());
+            if (t == Hex) putVarInt(uint64_t(raw.size()));
+            out.append(raw);
+        }
+
+        void body(Tag t, const QVariant &v, unsigned depth) {
+            if (UNLIKELY(depth > kMaxDepth))
+                throw Error(QString("The nesting limit of %1 was exceeded").arg(kMaxDepth));
+            switch (t) {
+            case Null: break;
+            case Bool: put(v.toBool() ? 1 : 0); break;
+            case Int: {
+                const int64_t n = v.toLongLong();
+                putVarInt((uint64_t(n) << 1) ^ uint64_t(n >> 63)); // zigzag
+                break;
+            }
+            case UInt: putVarInt(v.toULongLong()); break;
+            case Double: {
+                const double d = v.toDouble();
+                uint64_t bits;
+                std::memcpy(&bits, &d, sizeof(bits));
+                bits = qToLittleEndian(bits);
+                out.append(reinterpret_cast<const char *>(&bits), sizeof(bits));
+                break;
+            }
+            case String:
+                putBytes(Compat::IsMetaType(v, QMetaType::QByteArray) ? v.toByteArray() : v.toString().toUtf8());
+                break;
+            case Hash:
+            case Hex:
+                hexBody(t, v);
+                break;
+            case List: {
+                const QVariantList l = v.toList(); // also converts QStringList and QByteArrayList
+                putVarInt(uint64_t(l.size()));
+                for (const auto & item : l)
+                    value(item, depth + 1);
+                break;
+            }
+            case Map: {
+                const QVariantMap m = v.toMap(); // also converts QVariantHash
+                putVarInt(uint64_t(m.size()));
+                for (auto it = m.cbegin(); it != m.cend(); ++it) {
+                    putKey(it.key());
+                    value(it.value(), depth + 1);
+                }
+                break;
+            }
+            case Table:
+                table(v.toList(), depth);
+                break;
+            default:
+                throw Error(QString("Bad tag %1").arg(int(t))); // cannot happen
+            }
+        }
+
+        void table(const QVariantList &rows, unsigned depth) {
+            const auto & first = *static_cast<const QVariantMap *>(rows.front().constData());
+            const size_t nCols = size_t(first.size()), nRows = size_t(rows.size());
+            putVarInt(nCols);
+            for (auto it = first.cbegin(); it != first.cend(); ++it)
+                putKey(it.key());
+            putVarInt(nRows);
+            // classify every cell once, then see which columns have a single type
+            std::vector<Tag> tags(nRows * nCols);
+            std::vector<Tag> colTags(nCols);
+            for (size_t r = 0; r < nRows; ++r) {
+                const auto & m = *static_cast<const QVariantMap *>(rows[r].constData());
+                size_t c = 0;
+                for (auto it = m.cbegin(); it != m.cend(); ++it, ++c) {
+                    const Tag t = tags[r * nCols + c] = tagFor(it.value());
+                    colTags[c] = r == 0 || colTags[c] == t ? t : Mixed;
+                }
+            }
+            // An all-Null column is sent as Mixed so that every row takes at least 1 byte, which lets the Reader
+            // reject absurd row counts up front.
+            for (auto & t : colTags)
+                if (t == Null) t = Mixed;
+            for (const auto t : colTags)
+                put(char(t));
+            for (size_t r = 0; r < nRows; ++r) {
+                const auto & m = *static_cast<const QVariantMap *>(rows[r].constData());
+                size_t c = 0;
+                for (auto it = m.cbegin(); it != m.cend(); ++it, ++c) {
+                    const Tag t = tags[r * nCols + c];
+                    if (colTags[c] == Mixed) put(char(t));
+                    body(t, it.value(), depth + 1);
+                }
+            }
+        }
+    };
+
+    class Reader {
+        const char *p, * const end;
+    public:
+        Reader(const QByteArray &b) : p(b.constData()), end(b.constData() + b.size()) {}
+
+        bool atEnd() const { return p == end; }
+
+        QVariant value(unsigned depth) { return body(tag(), depth); }
+
+    private:
+        size_t remaining() const { return size_t(end - p); }
+        void need(size_t n) const { if (UNLIKELY(remaining() < n)) throw ParseError("Unexpected end of data"); }
+        uint8_t byte() { need(1); return uint8_t(*p++); }
+        Tag tag() {
+            const uint8_t t = byte();
+            if (UNLIKELY(t >= NumTags)) throw ParseError(QString("Bad tag %1").arg(int(t)));
+            return Tag(t);
+        }
+        uint64_t varInt() {
+            uint64_t ret = 0;
+            for (unsigned shift = 0; shift < 64u; shift += 7u) {
+                const uint8_t b = byte();
+                ret |= uint64_t(b & 0x7fu) << shift;
+                if (!(b & 0x80u)) return ret;
+            }
+            throw ParseError("VarInt too long");
+        }
+        /// A count of things that each take at least 1 byte: can't exceed what is left, which also bounds reserve()
+        size_t count() {
+            const uint64_t n = varInt();
+            if (UNLIKELY(n > remaining())) throw ParseError("Bad count");
+            return size_t(n);
+        }
+        QByteArray bytes(size_t n) {
+            need(n);
+            QByteArray ret(p, qsizetype(n));
+            p += n;
+            return ret;
+        }
+        QString key() { return QString::fromUtf8(bytes(count())); }
+
+        QVariant body(Tag t, unsigned depth) {
+            if (UNLIKELY(depth > kMaxDepth))
+                throw ParseError(QString("The nesting limit of %1 was exceeded").arg(kMaxDepth));
+            switch (t) {
+            case Null: return QVariant();
+            case Bool: return bool(byte());
+            case Int: {
+                const uint64_t z = varInt();
+                return qlonglong(int64_t(z >> 1) ^ -int64_t(z & 1u));
+            }
+            case UInt: return qulonglong(varInt());
+            case Double: {
+                need(8);
+                uint64_t bits;
+                std::memcpy(&bits, p, sizeof(bits));
+                p += sizeof(bits);
+                bits = qFromLittleEndian(bits);
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                return d;
+            }
+            case String: return QString::fromUtf8(bytes(count()));
+            case Hash: return QString::fromLatin1(Util::ToHexFast(bytes(32)));
+            case Hex: return QString::fromLatin1(Util::ToHexFast(bytes(count())));
+            case List: {
+                const size_t n = count();
+                QVariantList l;
+                l.reserve(qsizetype(n));
+                for (size_t i = 0; i < n; ++i)
+                    l.push_back(value(depth + 1));
+                return l;
+            }
+            case Map: {
+                const size_t n = count();
+                QVariantMap m;
+                for (size_t i = 0; i < n; ++i) {
+                    QString k = key();
+                    m.insert(k, value(depth + 1));
+                }
+                return m;
+            }
+            case Table: return table(depth);
+            default: break;
+            }
+            throw ParseError(QString("Bad tag %1").arg(int(t)));
+        }
+
+        QVariant table(unsigned depth) {
+            const size_t nCols = count();
+            QStringList keys;
+            keys.reserve(qsizetype(nCols));
+            for (size_t c = 0; c < nCols; ++c)
+                keys.push_back(key());
+            const uint64_t nRows = varInt();
+            // every row takes at least 1 byte (the Writer never sends a Null column tag), which bounds the reserve() below
+            if (UNLIKELY(!nCols || nRows > remaining())) throw ParseError("Bad table dimensions");
+            std::vector<uint8_t> colTags(nCols);
+            for (auto & t : colTags) {
+                t = byte();
+                if (UNLIKELY(t == Null || (t >= NumTags && t != Mixed))) throw ParseError(QString("Bad column tag %1").arg(int(t)));
+            }
+            QVariantList rows;
+            rows.reserve(qsizetype(nRows));
+            for (uint64_t r = 0; r < nRows; ++r) {
+                QVariantMap m;
+                for (size_t c = 0; c < nCols; ++c)
+                    m.insert(keys[qsizetype(c)], body(colTags[c] == Mixed ? tag() : Tag(colTags[c]), depth + 1));
+                rows.push_back(std::move(m));
+            }
+            return rows;
+        }
+    };
+} // namespace
+
+QByteArray serialize(const QVariant &v)
+{
+    Writer w;
+    w.value(v, 0);
+    return std::move(w.out);
+}
+
+QByteArray serializeFramed(const QVariant &v)
+{
+    Writer w;
+    w.out.resize(kFrameHeaderSize); // placeholder for the length, filled in below
+    w.value(v, 0);
+    const uint32_t len = qToLittleEndian(uint32_t(w.out.size() - kFrameHeaderSize));
+    std::memcpy(w.out.data(), &len, sizeof(len));
+    return std::move(w.out);
+}
+
+QByteArray frame(QByteArray &&payload)
+{
+    const uint32_t len = qToLittleEndian(uint32_t(payload.size()));
+    payload.prepend(reinterpret_cast<const char *>(&len), kFrameHeaderSize);
+    return std::move(payload);
+}
+
+uint32_t frameLength(const char *buf) noexcept
+{
+    uint32_t len;
+    std::memcpy(&len, buf, sizeof(len));
+    return qFromLittleEndian(len);
+}
+
+QVariant parse(const QByteArray &payload)
+{
+    Reader r(payload);
+    QVariant ret = r.value(0);
+    if (UNLIKELY(!r.atEnd())) throw ParseError("Trailing data after value");
+    return ret;
+}
+
+} // namespace BinWire
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+#include "Json/Json.h"
+
+#include <QRandomGenerator>
+
+namespace {
+    QByteArray RandomHashHex() {
+        QByteArray h(32, Qt::Uninitialized);
+        QRandomGenerator::global()->fillRange(reinterpret_cast<quint32 *>(h.data()), h.size() / int(sizeof(quint32)));
+        return Util::ToHexFast(h);
+    }
+
+    /// Like the result of blockchain.scripthash.get_history
+    QVariantList MakeHistory(int n) {
+        QVariantList ret;
+        for (int i = 0; i < n; ++i) {
+            QVariantMap m{{"tx_hash", RandomHashHex()}, {"height", 700'000 + i}};
+            if (i + 1 == n) { m["height"] = -1; m["fee"] = 226; } // a mempool tx, which has an extra "fee" key
+            ret.push_back(m);
+        }
+        return ret;
+    }
+
+    /// Like the result of blockchain.scripthash.listunspent
+    QVariantList MakeUtxos(int n) {
+        QVariantList ret;
+        auto *rng = QRandomGenerator::global();
+        for (int i = 0; i < n; ++i)
+            ret.push_back(QVariantMap{{"tx_hash", RandomHashHex()}, {"tx_pos", int(rng->bounded(4))},
+                                      {"height", 700'000 + i}, {"value", qlonglong(rng->bounded(1'000'000'000))}});
+        return ret;
+    }
+
+    void testBinWire() {
+        // Round trips must produce exactly the JSON the original would have produced
+        const QVariantList cases = {
+            QVariant(), true, false, 0, -1, 123456789, qlonglong(std::numeric_limits<qint64>::min()),
+            qulonglong(std::numeric_limits<quint64>::max()), 1.5, -0.25, QString(), QString(""), QString("héllo"),
+            QByteArray(), QByteArray("not hex"), QByteArray("abcd"), QString("ABCD") /* not lowercase: a String */,
+            QString("abc") /* odd length: a String */, RandomHashHex(), QString(RandomHashHex()),
+            QStringList{"a", "b"}, QVariantList{}, QVariantMap{},
+            QVariantMap{{"jsonrpc", "2.0"}, {"id", 7}, {"method", "blockchain.scripthash.get_history"},
+                        {"params", QVariantList{RandomHashHex()}}},
+            QVariantMap{{"jsonrpc", "2.0"}, {"id", "x"}, {"result", MakeHistory(50)}},
+            MakeUtxos(20),
+            // a table with a column whose type varies between rows
+            QVariantList{QVariantMap{{"a", 1}, {"b", "x"}}, QVariantMap{{"a", QVariant()}, {"b", RandomHashHex()}},
+                         QVariantMap{{"a", 2.5}, {"b", QVariantList{1, 2}}}},
+            // an all-null column
+            QVariantList{QVariantMap{{"a", QVariant()}}, QVariantMap{{"a", QVariant()}}},
+            // same-sized maps with different keys: not a table
+            QVariantList{QVariantMap{{"a", 1}}, QVariantMap{{"b", 1}}},
+        };
+        for (const auto & v : cases) {
+            const QByteArray bin = BinWire::serialize(v);
+            const QVariant back = BinWire::parse(bin);
+            const auto j1 = Json::toUtf8(v, true), j2 = Json::toUtf8(back, true);
+            if (j1 != j2)
+                throw Exception(QString("Round trip mismatch: %1 -> %2").arg(QString(j1), QString(j2)));
+            // every proper prefix must be rejected as truncated (not crash, not succeed)
+            for (int i = 0; i < bin.size(); ++i) {
+                bool threw = false;
+                try { BinWire::parse(bin.left(i)); } catch (const BinWire::ParseError &) { threw = true; }
+                if (!threw) throw Exception(QString("Truncated input of %1/%2 bytes was accepted").arg(i).arg(bin.size()));
+            }
+        }
+        // a table whose row count claims more rows than there could possibly be bytes for
+        bool threw = false;
+        try { BinWire::parse(QByteArray::fromHex("0a0101610a02")); } catch (const BinWire::ParseError &) { threw = true; }
+        if (!threw) throw Exception("Bad table dimensions were accepted");
+        threw = false;
+        try { BinWire::parse(QByteArray::fromHex("0000")); } catch (const BinWire::ParseError &) { threw = true; }
+        if (!threw) throw Exception("Trailing data was accepted");
+        // framing
+        const auto framed = BinWire::serializeFramed(cases.back());
+        if (BinWire::frameLength(framed.constData()) != uint32_t(framed.size() - BinWire::kFrameHeaderSize)
+                || framed.mid(BinWire::kFrameHeaderSize) != BinWire::serialize(cases.back())
+                || BinWire::frame(BinWire::serialize(cases.back())) != framed)
+            throw Exception("Bad framing");
+        // hashes must take 32 bytes, not 64
+        const auto hist = MakeHistory(100);
+        const auto binSize = BinWire::serialize(hist).size(), jsonSize = Json::toUtf8(hist, true).size();
+        if (binSize * 2 > jsonSize)
+            throw Exception(QString("Binary history is not compact enough: %1 vs %2 bytes of JSON").arg(binSize).arg(jsonSize));
+        Log() << "BinWire: ok (100-item history: " << binSize << " bytes vs " << jsonSize << " bytes of JSON)";
+    }
+
+    /// Encode and decode throughput of BinWire vs. JSON for get_history and listunspent sized replies
+    void benchBinWire() {
+        bool ok{};
+        const int envItems = qEnvironmentVariableIntValue("BENCH_ITEMS", &ok);
+        const int nItems = ok && envItems > 0 ? envItems : 1000;
+        constexpr int nIters = 200;
+        const auto jsonBackend = Json::isParserAvailable(Json::ParserBackend::SimdJson) ? Json::ParserBackend::SimdJson
+                                                                                       : Json::ParserBackend::Default;
+        const auto Bench = [&](const char *what, const QVariantList &items) {
+            const QVariant reply = QVariantMap{{"jsonrpc", "2.0"}, {"id", 1}, {"result", items}};
+            const auto Report = [&](const char *codec, const char *op, const Tic &t, qsizetype bytes) {
+                const double secs = t.secs<double>();
+                Log() << what << " " << codec << " " << op << ": " << QString::number(secs * 1e6 / nIters, 'f', 1)
+                      << " usec/reply, " << QString::number(double(nItems) * nIters / secs / 1e6, 'f', 2) << " M items/sec, "
+                      << QString::number(double(bytes) * nIters / secs / 1e6, 'f', 1) << " MB/sec";
+            };
+            QByteArray json, bin;
+            Tic t;
+            for (int i = 0; i < nIters; ++i) json = Json::toUtf8(reply, true);
+            Report("JSON", "encode", t, json.size());
+            t = Tic();
+            for (int i = 0; i < nIters; ++i) bin = BinWire::serialize(reply);
+            Report("BinWire", "encode", t, bin.size());
+            t = Tic();
+            for (int i = 0; i < nIters; ++i) Json::parseUtf8(json, Json::ParseOption::RequireObject, jsonBackend);
+            Report("JSON", "decode", t, json.size());
+            t = Tic();
+            for (int i = 0; i < nIters; ++i) BinWire::parse(bin);
+            Report("BinWire", "decode", t, bin.size());
+            Log() << what << " reply size: " << json.size() << " bytes JSON, " << bin.size() << " bytes BinWire ("
+                  << QString::number(100.0 * double(bin.size()) / double(json.size()), 'f', 1) << "%)";
+        };
+        Log() << "Items per reply: " << nItems << " (set BENCH_ITEMS to change), iterations: " << nIters;
+        Bench("get_history", MakeHistory(nItems));
+        Bench("listunspent", MakeUtxos(nItems));
+    }
+
+    const auto t_binwire = App::registerTest("binwire", testBinWire);
+    const auto b_binwire = App::registerBench("binwire", benchBinWire);
+} // namespace
+#endif
@@ -0,0 +1,69 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "Common.h"
+
+#include <QByteArray>
+#include <QVariant>
+
+#include <cstdint>
+
+/// A compact binary encoding of the same QVariant trees that we otherwise send and receive as JSON, for use by
+/// trusted clients that negotiate it (see the "binary" argument to server.version). Every JSON-RPC message, request
+/// or reply, is encoded as one tagged value, and sent on the wire as a frame: a 4-byte little-endian payload length
+/// followed by the payload.
+///
+/// The encoding is lossless with respect to what the JSON encoding would produce, with two space-saving tricks:
+///  - Strings that are lowercase hex (as produced by Util::ToHexFast(), which is how we send all hashes, headers and
+///    raw txs) are sent as raw bytes; a 64-character one (a hash) as exactly 32 bytes with no length prefix. They are
+///    decoded back to the same hex string, so the RPC handlers never see the difference.
+///  - A list of 2 or more maps that all have the same keys (a history, or a list of UTXOs) is sent as a table: the
+///    keys once, then for each column one type tag if every row agrees on it, then the rows as bare values.
+///
+/// Integers are zigzag LEB128 varints, doubles are 8 bytes little-endian, strings are a varint length plus UTF-8.
+namespace BinWire {
+    struct Error : Exception { using Exception::Exception; ~Error() override; };
+    /// Thrown by parse() on malformed or truncated input
+    struct ParseError : Error { using Error::Error; ~ParseError() override; };
+
+    enum Tag : uint8_t {
+        Null = 0, Bool, Int, UInt, Double, String, Hash, Hex, List, Map, Table,
+        NumTags,
+        Mixed = 0xff, ///< only ever used as a Table column tag: each row's value in that column carries its own tag
+    };
+
+    /// Size of the length prefix of a frame
+    inline constexpr int kFrameHeaderSize = 4;
+
+    /// Encodes `v`. Throws Error if `v` contains a type that has no JSON representation either, or if it is nested
+    /// more deeply than Json::serialize() allows.
+    QByteArray serialize(const QVariant &v);
+    /// Like serialize(), but prepends the frame length.
+    QByteArray serializeFramed(const QVariant &v);
+    /// Prepends the frame length to an already-serialized payload.
+    QByteArray frame(QByteArray &&payload);
+    /// Returns the payload length announced by the frame header at the start of `buf`, which must have at least
+    /// kFrameHeaderSize bytes.
+    uint32_t frameLength(const char *buf) noexcept;
+
+    /// Decodes a payload produced by serialize() (the frame header must already have been stripped).
+    /// Throws ParseError on malformed input, including trailing garbage.
+    QVariant parse(const QByteArray &payload);
+} // namespace BinWire
@@ -18,6 +18,7 @@
 //
 
 #include "BitcoinD.h"
+#include "Metrics.h"
 #include "ZmqSubNotifier.h"
 
 #include "bitcoin/rpc/protocol.h"
@@ -32,6 +33,7 @@
 #include <algorithm>
 #include <mutex>
 #include <tuple>
+#include <utility>
 
 namespace {
     enum class PingTimes : int {
@@ -44,8 +46,8 @@ namespace {
     const QVariantList kPingParamsFast = {}, kPingParamsSlow = {{"help"}};
 }
 
-BitcoinDMgr::BitcoinDMgr(unsigned nClients, const BitcoinD_RPCInfo &rinf)
-    : Mgr(nullptr), IdMixin(newId()), nClients(nClients), rpcInfo(rinf)
+BitcoinDMgr::BitcoinDMgr(unsigned nClients, const BitcoinD_RPCInfo &rinf, unsigned autoBatchMax)
+    : Mgr(nullptr), IdMixin(newId()), nClients(nClients), autoBatchMax(autoBatchMax), rpcInfo(rinf)
 {
     setObjectName("BitcoinDMgr");
     _thread.setObjectName(objectName());
@@ -67,7 +69,7 @@ void BitcoinDMgr::startup() {
     for (auto & client : clients) {
         // initial resolvedAddress may be invalid if user specified a hostname, in which case we will resolve it and
         // tell bitcoind's to update themselves and reconnect
-        client = std::make_unique<BitcoinD>(rpcInfo);
+        client = std::make_unique<BitcoinD>(rpcInfo, autoBatchMax);
 
         // connect client to us -- TODO: figure out workflow: how requests for work and results will get dispatched
         connect(client.get(), &BitcoinD::gotMessage, this, &BitcoinDMgr::on_Message);
@@ -596,8 +598,9 @@ void BitcoinDMgr::setHasDSProofRPC(bool b)
 
 /// This is safe to call from any thread. Internally it dispatches messages to this obejct's thread.
 /// Does not throw. Results/Error/Fail functions are called in the context of the `sender` thread.
-void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, const QString & method, const QVariantList & params,
-                                const ResultsF & resf, const ErrorF & errf, const FailF & failf, int timeout)
+auto BitcoinDMgr::makeRequestContext(QObject *sender, const RPC::Message::Id &rid, const ResultsF & resf,
+                                     const ErrorF & errf, const FailF & failf, int timeout)
+    -> std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj>
 {
     using namespace BitcoinDMgrHelper;
     constexpr bool debugDeletes = false; // set this to true to print debug messages tracking all the below object deletions (tested: no leaks!)
@@ -650,6 +653,67 @@ void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, co
     // send the context to our thread
     context->moveToThread(this->thread());
 
+    return context;
+}
+
+bool BitcoinDMgr::registerRequestContext(BitcoinD *bd, const std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj> &context,
+                                         const RPC::Message::Id &rid)
+{
+    constexpr bool debugDeletes = false; // see makeRequestContext()
+    context->bd = bd; // record which bitcoind is servicing this request for notifyFailForRequestsMatchingBitcoinD()
+
+    // Note: there is a small chance of a race condition here because the `bd` that getBitcoinD() returns runs in
+    // its own thread, and it may have "gone bad" from underneath our feet as this code executes by losing its
+    // connection; we must defensively handle that situation just in case the "lostConnection" signal is emitted
+    // when we are here.  In that very unlikely case, if a request has not completed in 15 seconds, eventually
+    // requestTimeoutChecker() will tell the sender that the request timed out.  Also, it is theoretically possible
+    // for BitcoinD to just never respond, so we need to be able to handle that situation as well with a guaranteed
+    // `fail` signal delivery "some time later".
+
+    // put context in table -- this table is consulted in handleMessageCommon to dispatch
+    // the reply directly to this context object
+    if (auto it = reqContextTable.find(rid); LIKELY(it == reqContextTable.end() || it.value().expired())) {
+        // does not exist in table, put in table
+        context->ts = Util::getTime(); // set timestamp; used by requestTimeoutChecker()
+        context->tsNS = Util::getTimeNS();
+        reqContextTable[rid] = context; // weak ref inserted into table
+        // Install cleanup handler to remove object from table on `destroyed`.
+        // NOTE: it's not clear to me if the destroyed signal is guaranteed to be delivered if
+        // context->thread() != this->thread().  Currently the two live in the same thread but
+        // if that changes -- update this code and/or test that the signal is in fact delivered
+        // reliably.
+        connect(context.get(), &QObject::destroyed, this, [this, rid](QObject *context) {
+            // remove context from table and also check it's what we expect
+            if (const auto ref = reqContextTable.take(rid).lock(); ref && ref.get() != context) {
+                // this should never happen
+                Error() << "Context in table with rid " << rid << " differs from what we expected! FIXME!";
+            }
+            if constexpr (debugDeletes)
+                DebugM(__func__, " - req context table size now: ", reqContextTable.size());
+        });
+    } else {
+        // this indicates a bug the calling code; it is sending dupe id's which we do not support
+        emit context->fail(rid, QString("Request id %1 already exists in table! FIXME!").arg(rid.toString()));
+        return false;
+    }
+
+    /*
+       Notes:
+         - The "Results" and "Error" responses are handled in on_Message and on_ErrorMessage by looking up the
+           proper context object in the hash table directly.
+         - BitcoinD losing connection (lostConnection signal) is handled by notifyFailForRequestsMatchingBitcoinD().
+         - BitcoinD being deleted (destroyed signal) is handled by notifyFailForRequestsMatchingBitcoinD().
+         - If BitcoinD goes out to lunch for >15 seconds the periodic requestTimeoutChecker() will eventually
+           notify the sender of a timeout.
+    */
+    return true;
+}
+
+void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, const QString & method, const QVariantList & params,
+                                const ResultsF & resf, const ErrorF & errf, const FailF & failf, int timeout)
+{
+    auto context = makeRequestContext(sender, rid, resf, errf, failf, timeout);
+
     // schedule this ASAP
     Util::AsyncOnObject(this, [this, context, rid, method, params] {
         auto bd = getBitcoinD();
@@ -657,58 +721,58 @@ void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, co
             emit context->fail(rid, "Unable to find a good BitcoinD connection");
             return;
         }
-        context->bd = bd; // record which bitcoind is servicing this request for notifyFailForRequestsMatchingBitcoinD()
-
-        // Note: there is a small chance of a race condition here because the `bd` that getBitcoinD() returns runs in
-        // its own thread, and it may have "gone bad" from underneath our feet as this code executes by losing its
-        // connection; we must defensively handle that situation just in case the "lostConnection" signal is emitted
-        // when we are here.  In that very unlikely case, if a request has not completed in 15 seconds, eventually
-        // requestTimeoutChecker() will tell the sender that the request timed out.  Also, it is theoretically possible
-        // for BitcoinD to just never respond, so we need to be able to handle that situation as well with a guaranteed
-        // `fail` signal delivery "some time later".
-
-        // put context in table -- this table is consulted in handleMessageCommon to dispatch
-        // the reply directly to this context object
-        if (auto it = reqContextTable.find(rid); LIKELY(it == reqContextTable.end() || it.value().expired())) {
-            // does not exist in table, put in table
-            context->ts = Util::getTime(); // set timestamp; used by requestTimeoutChecker()
-            reqContextTable[rid] = context; // weak ref inserted into table
-            // Install cleanup handler to remove object from table on `destroyed`.
-            // NOTE: it's not clear to me if the destroyed signal is guaranteed to be delivered if
-            // context->thread() != this->thread().  Currently the two live in the same thread but
-            // if that changes -- update this code and/or test that the signal is in fact delivered
-            // reliably.
-            connect(context.get(), &QObject::destroyed, this, [this, rid](QObject *context) {
-                // remove context from table and also check it's what we expect
-                if (const auto ref = reqContextTable.take(rid).lock(); ref && ref.get() != context) {
-                    // this should never happen
-                    Error() << "Context in table with rid " << rid << " differs from what we expected! FIXME!";
-                }
-                if constexpr (debugDeletes)
-                    DebugM(__func__, " - req context table size now: ", reqContextTable.size());
-            });
-        } else {
-            // this indicates a bug the calling code; it is sending dupe id's which we do not support
-            emit context->fail(rid, QString("Request id %1 already exists in table! FIXME!").arg(rid.toString()));
-            return;
-        }
-
-        /*
-           Notes:
-             - The "Results" and "Error" responses are handled in on_Message and on_ErrorMessage by looking up the
-               proper context object in the hash table directly.
-             - BitcoinD losing connection (lostConnection signal) is handled by notifyFailForRequestsMatchingBitcoinD().
-             - BitcoinD being deleted (destroyed signal) is handled by notifyFailForRequestsMatchingBitcoinD().
-             - If BitcoinD goes out to lunch for >15 seconds the periodic requestTimeoutChecker() will eventually
-               notify the sender of a timeout.
-        */
-
-        emit bd->sendRequest(rid, method, params);
+        if (registerRequestContext(bd, context, rid))
+            sendOrQueueRequest(bd, rid, method, params);
     });
 
     // .. aand.. return right away
 }
 
+bool BitcoinDMgr::sendOrQueueRequest(BitcoinD *bd, const RPC::Message::Id &rid, const QString &method,
+                                     const QVariantList &params)
+{
+    // "getblock" replies are huge and are hex-decoded in place by HttpConnection, which only works for a reply
+    // that isn't part of a batch, so never hold those back.
+    if (autoBatchMax > 1 && method != QStringLiteral("getblock")) {
+        emit bd->queueRequest(rid, method, params);
+        return true;
+    }
+    emit bd->sendRequest(rid, method, params);
+    return false;
+}
+
+void BitcoinDMgr::submitBatch(QObject *sender, const std::vector<BatchItem> & items, int timeout)
+{
+    if (items.empty()) return;
+    struct Req {
+        std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj> context;
+        RPC::Message::Id id;
+        QString method;
+        QVariantList params;
+    };
+    std::vector<Req> reqs;
+    reqs.reserve(items.size());
+    for (const auto & item : items)
+        reqs.push_back({makeRequestContext(sender, item.id, item.resultsF, item.errorF, item.failF, timeout),
+                        item.id, item.method, item.params});
+
+    // schedule this ASAP
+    Util::AsyncOnObject(this, [this, reqs = std::move(reqs)] {
+        auto bd = getBitcoinD();
+        if (UNLIKELY(!bd)) {
+            for (const auto & r : reqs)
+                emit r.context->fail(r.id, "Unable to find a good BitcoinD connection");
+            return;
+        }
+        bool queued = false;
+        for (const auto & r : reqs)
+            if (registerRequestContext(bd, r.context, r.id))
+                queued = sendOrQueueRequest(bd, r.id, r.method, r.params) || queued;
+        if (queued)
+            emit bd->flushQueuedRequests(); // don't wait for the auto-batch timer: the batch is complete
+    });
+}
+
 void BitcoinDMgr::requestTimeoutChecker()
 {
     const auto now = Util::getTime();
@@ -761,6 +825,9 @@ void BitcoinDMgr::handleMessageCommon(const RPC::Message &msg, ReqCtxResultsOrEr
         }
         return;
     }
+    static const Metrics::HistogramFamily bitcoindLatency("fulcrum_bitcoind_rpc_seconds",
+                                                          "Round-trip time of RPC requests to bitcoind", "method");
+    bitcoindLatency[msg.method].recordNanos(Util::getTimeNS() - context->tsNS);
     // call member function pointer
     emit (context.get()->*resultsOrErrorFunc)(msg);
 }
@@ -803,12 +870,14 @@ auto BitcoinD::stats() const -> Stats
     m.remove("nResultsSent"); // again, 0
     m["fastPing"] = fastPing;
     m["inBlockDownload"] = inBlockDownload;
+    m["nBatchesSent"] = nBatchesSent;
+    m["queuedRequests"] = qulonglong(queuedRequests.size());
     return m;
 }
 
-BitcoinD::BitcoinD(const BitcoinD_RPCInfo &rinfo)
+BitcoinD::BitcoinD(const BitcoinD_RPCInfo &rinfo, unsigned autoBatchMax)
     : RPC::HttpConnection(nullptr, newId(), nullptr, 0 /* = unlimited read buffer -- no limit to response size */),
-      rpcInfo(rinfo)
+      rpcInfo(rinfo), autoBatchMax(std::min(autoBatchMax, kMaxBatchItems))
 {
     static int N = 1;
     setObjectName(QString("BitcoinD.%1").arg(N++));
@@ -923,11 +992,53 @@ void BitcoinD::on_connected()
     badAuth = false;
     needAuth = true;
     fastPing = false; // reset since we don't know if fast is supported
+    // connections will be auto-disconnected on socket disconnect
+    connectedConns.push_back(connect(this, &BitcoinD::queueRequest, this, &BitcoinD::_queueRequest));
+    connectedConns.push_back(connect(this, &BitcoinD::flushQueuedRequests, this, &BitcoinD::_flushQueuedRequests));
     emit connected(this);
     // note that the 'authenticated' signal is only emitted after good auth is confirmed via the reply from the do_ping below
     do_ping();
 }
 
+void BitcoinD::on_disconnected()
+{
+    RPC::HttpConnection::on_disconnected(); // chain to super
+    // BitcoinDMgr fails the requests in here when it sees our lostConnection signal. Note: we may be called from
+    // within the batch timer's callback, so we leave that timer alone; it will find nothing to send.
+    queuedRequests.clear();
+}
+
+void BitcoinD::_queueRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params)
+{
+    queuedRequests.push_back({reqid, method, params});
+    if (queuedRequests.size() >= (autoBatchMax > 1 ? autoBatchMax : kMaxBatchItems))
+        _flushQueuedRequests();
+    else if (queuedRequests.size() == 1)
+        callOnTimerSoonNoRepeat(kBatchWindowMS, kBatchTimer, [this]{ sendQueuedRequests(); }, false, Qt::PreciseTimer);
+}
+
+void BitcoinD::_flushQueuedRequests()
+{
+    stopTimer(kBatchTimer); // no-op if not active
+    sendQueuedRequests();
+}
+
+void BitcoinD::sendQueuedRequests()
+{
+    if (queuedRequests.empty())
+        return;
+    // take the queue first: the sends below may disconnect us, which clears queuedRequests
+    const auto reqs = std::exchange(queuedRequests, {});
+    if (reqs.size() == 1) {
+        // no point in wrapping a lone request in a batch
+        const auto & r = reqs.front();
+        _sendRequest(r.id, r.method, r.params);
+    } else {
+        _sendRequestBatch(reqs);
+        ++nBatchesSent;
+    }
+}
+
 void BitcoinD::do_ping()
 {
     if constexpr (DEBUG_PINGS)
@@ -998,3 +1109,200 @@ QVariantMap BitcoinDInfo::toVariantMap() const
     ret["zmqNotifications"] = zmqs;
     return ret;
 }
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+#include <QEventLoop>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace {
+    /// A minimal stand-in for bitcoind's HTTP JSON-RPC server. Every request gets {"result": "<method>"}, except for
+    /// method "fail" which gets an error. Batches are answered in reverse order, which bitcoind doesn't do but which the
+    /// JSON-RPC spec permits, so that the test can't pass by accident.
+    class StubRpcServer : public QTcpServer {
+    public:
+        using QTcpServer::QTcpServer;
+        std::vector<int> batchSizes; ///< one entry per HTTP request received: its batch size, or 0 if not a batch
+        std::vector<QStringList> batchMethods; ///< one entry per HTTP request received: the method(s) it contained
+
+    protected:
+        void incomingConnection(qintptr fd) override {
+            auto *sock = new QTcpSocket(this);
+            sock->setSocketDescriptor(fd);
+            auto buf = std::make_shared<QByteArray>();
+            connect(sock, &QTcpSocket::readyRead, this, [this, sock, buf]{
+                *buf += sock->readAll();
+                for (;;) {
+                    const auto hdrEnd = buf->indexOf("\r\n\r\n");
+                    if (hdrEnd < 0) return;
+                    qsizetype clen = -1;
+                    for (const auto & line : buf->left(hdrEnd).split('\n'))
+                        if (const auto toks = line.split(':'); toks.size() == 2 && toks[0].trimmed().toLower() == "content-length")
+                            clen = toks[1].trimmed().toInt();
+                    if (clen < 0 || buf->size() < hdrEnd + 4 + clen) return;
+                    const QByteArray body = buf->mid(hdrEnd + 4, clen);
+                    buf->remove(0, hdrEnd + 4 + clen);
+                    const QByteArray reply = Json::toUtf8(handle(Json::parseUtf8(body)), true);
+                    sock->write("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+                                + QByteArray::number(reply.size()) + "\r\n\r\n" + reply);
+                }
+            });
+        }
+
+    private:
+        QVariant handle(const QVariant &req) {
+            if (req.canConvert<QVariantMap>()) {
+                batchSizes.push_back(0);
+                batchMethods.push_back({req.toMap().value("method").toString()});
+                return reply(req.toMap());
+            }
+            const auto reqs = req.toList();
+            batchSizes.push_back(int(reqs.size()));
+            batchMethods.emplace_back();
+            QVariantList ret;
+            for (auto it = reqs.crbegin(); it != reqs.crend(); ++it) {
+                batchMethods.back().push_back(it->toMap().value("method").toString());
+                ret.push_back(reply(it->toMap()));
+            }
+            return ret;
+        }
+        static QVariantMap reply(const QVariantMap &req) {
+            const auto method = req.value("method").toString();
+            if (method == "fail")
+                return {{"result", QVariant()}, {"error", QVariantMap{{"code", -1}, {"message", method}}}, {"id", req.value("id")}};
+            return {{"result", method}, {"error", QVariant()}, {"id", req.value("id")}};
+        }
+    };
+
+    void testBatching() {
+        StubRpcServer srv;
+        if (!srv.listen(QHostAddress::LocalHost))
+            throw Exception("Unable to listen: " + srv.errorString());
+        BitcoinD_RPCInfo info;
+        info.hostPort = {QHostAddress(QHostAddress::LocalHost).toString(), srv.serverPort()};
+        info.setStaticUserPass("user", "pass");
+        BitcoinD bd(info, 4 /* autoBatchMax */);
+
+        QEventLoop loop;
+        std::map<int64_t, QString> results, errors; // id -> method
+        size_t expected = 0;
+        QString failure; // set by the handlers below, since they can't throw through the event loop
+        const auto Got = [&](std::map<int64_t, QString> &map, const RPC::Message &m) {
+            if (m.id.isNull() || m.method == kPingMethodFast || m.method == kPingMethodSlow) return;
+            if (!m.isError() && m.result().toString() != m.method) {
+                failure = QString("Reply for id %1 has the wrong result: %2").arg(m.id.toString(), m.result().toString());
+                loop.exit(2);
+            }
+            map[m.id.toVariant().toLongLong()] = m.method;
+            if (results.size() + errors.size() == expected) loop.exit(0);
+        };
+        QObject::connect(&bd, &BitcoinD::gotMessage, &loop, [&](IdMixin::Id, RPC::BatchId, const RPC::Message &m) {
+            Got(results, m);
+        });
+        QObject::connect(&bd, &BitcoinD::gotErrorMessage, &loop, [&](IdMixin::Id, const RPC::Message &m) {
+            Got(errors, m);
+        });
+        QObject::connect(&bd, &BitcoinD::authenticated, &loop, [&loop]{ loop.exit(0); });
+        const auto Run = [&](const char *what) {
+            QTimer::singleShot(10'000, &loop, [&loop]{ loop.exit(1); }); // fail-safe
+            if (const int rc = loop.exec(); rc == 2)
+                throw Exception(failure);
+            else if (rc != 0)
+                throw Exception(QString("Timed out waiting for ") + what);
+        };
+        bd.start();
+        Run("authentication");
+
+        // 1. explicit batch: 3 requests, flushed together, one of which gets an error reply
+        const QStringList methods = {"a", "fail", "b"};
+        expected = size_t(methods.size());
+        for (int i = 0; i < methods.size(); ++i)
+            emit bd.queueRequest(int64_t(100 + i), methods[i], {});
+        emit bd.flushQueuedRequests();
+        Run("explicit batch replies");
+        for (int i = 0; i < methods.size(); ++i)
+            if ((methods[i] == "fail" ? errors : results)[100 + i] != methods[i])
+                throw Exception(QString("Reply for %1 was not dispatched properly").arg(methods[i]));
+
+        // 2. auto-batching: 6 requests -> one batch of autoBatchMax (flushed right away), then one of 2 (on the timer)
+        expected += 6;
+        for (int i = 0; i < 6; ++i)
+            emit bd.queueRequest(int64_t(200 + i), "e", {});
+        Run("auto batch replies");
+
+        std::vector<int> batches;
+        std::copy_if(srv.batchSizes.begin(), srv.batchSizes.end(), std::back_inserter(batches), [](int n){ return n > 0; });
+        if (batches != std::vector<int>{3, 4, 2}) {
+            QStringList sizes;
+            for (const int n : batches) sizes.push_back(QString::number(n));
+            throw Exception("Unexpected batches sent: " + sizes.join(", "));
+        }
+        bd.stop();
+        Log() << "BitcoinD batching: ok";
+    }
+
+    /// BitcoinDMgr::submitBatch: with auto-batching on the items go out as one batch, with it off as one request each
+    void testMgrSubmitBatch(const unsigned autoBatchMax) {
+        StubRpcServer srv; // declared first so that it outlives `mgr` below
+        if (!srv.listen(QHostAddress::LocalHost))
+            throw Exception("Unable to listen: " + srv.errorString());
+        BitcoinD_RPCInfo info;
+        info.hostPort = {QHostAddress(QHostAddress::LocalHost).toString(), srv.serverPort()};
+        info.setStaticUserPass("user", "pass");
+        BitcoinDMgr mgr(1, info, autoBatchMax);
+
+        QEventLoop loop;
+        QObject sender; // the callbacks below run in this thread, inside loop.exec()
+        const auto Run = [&loop](const char *what) {
+            QTimer::singleShot(10'000, &loop, [&loop]{ loop.exit(1); }); // fail-safe
+            if (loop.exec() != 0)
+                throw Exception(QString("Timed out waiting for ") + what);
+        };
+        QObject::connect(&mgr, &BitcoinDMgr::gotFirstGoodConnection, &loop, [&loop]{ loop.exit(0); });
+        mgr.startup();
+        Run("a good bitcoind connection");
+
+        const QStringList methods = {"m1", "fail", "m2"};
+        std::map<QString, QString> outcomes; // method -> "result" / "error" / "fail: <msg>"
+        std::vector<BitcoinDMgr::BatchItem> items;
+        for (const auto & method : methods) {
+            const auto Done = [&, method](const QString &outcome) {
+                outcomes[method] = outcome;
+                if (outcomes.size() == size_t(methods.size())) loop.exit(0);
+            };
+            items.push_back({IdMixin::newId(), method, {},
+                             [Done, method](const RPC::Message &m) { Done(m.result().toString() == method ? "result" : "bad result"); },
+                             [Done](const RPC::Message &) { Done("error"); },
+                             [Done](const RPC::Message::Id &, const QString &msg) { Done("fail: " + msg); }});
+        }
+        mgr.submitBatch(&sender, items);
+        Run("submitBatch replies");
+        for (const auto & method : methods)
+            if (const QString expected = method == "fail" ? "error" : "result"; outcomes[method] != expected)
+                throw Exception(QString("submitBatch (autoBatchMax: %1): %2 got \"%3\", expected \"%4\"")
+                                .arg(autoBatchMax).arg(method, outcomes[method], expected));
+
+        // which of the HTTP requests the stub got carried our items?
+        std::vector<int> sizes;
+        for (size_t i = 0; i < srv.batchMethods.size(); ++i)
+            if (std::any_of(methods.begin(), methods.end(), [&](const QString &m){ return srv.batchMethods[i].contains(m); }))
+                sizes.push_back(srv.batchSizes[i]);
+        // other requests the mgr issues on connect may share the batch, hence >=
+        const bool ok = autoBatchMax > 1 ? sizes.size() == 1 && sizes.front() >= int(methods.size())
+                                         : sizes == std::vector<int>(size_t(methods.size()), 0);
+        if (!ok)
+            throw Exception(QString("submitBatch (autoBatchMax: %1): items were not sent as expected").arg(autoBatchMax));
+        mgr.cleanup();
+        Log() << "BitcoinDMgr submitBatch (autoBatchMax: " << autoBatchMax << "): ok";
+    }
+
+    const auto t_bdbatch = App::registerTest("bdbatch", []{
+        testBatching();
+        for (const unsigned autoBatchMax : {BitcoinD::kMaxBatchItems, 0u})
+            testMgrSubmitBatch(autoBatchMax);
+    });
+} // namespace
+#endif
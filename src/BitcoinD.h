@@ -73,13 +73,16 @@ class BitcoinDMgr : public Mgr, public IdMixin, public ThreadObjectMixin, public
 {
     Q_OBJECT
 public:
-    BitcoinDMgr(unsigned nClients, const BitcoinD_RPCInfo &rpcInfo);
+    BitcoinDMgr(unsigned nClients, const BitcoinD_RPCInfo &rpcInfo, unsigned autoBatchMax = 0);
     ~BitcoinDMgr() override;
 
     void startup() override; ///< from Mgr
     void cleanup() override; ///< from Mgr
 
     const unsigned nClients; ///< The number of simultaneous BitcoinD clients we spawn. Always >=1. Comes ultimately from Options::bdNClients.
+    /// If > 1, requests submitted via submitRequest() are coalesced per BitcoinD into JSON-RPC batches of up to this
+    /// many requests (see BitcoinD::kBatchWindowMS). 0 or 1 disables auto-batching. Comes from Options::bdBatchMax.
+    const unsigned autoBatchMax;
 
     using ResultsF = std::function<void(const RPC::Message &response)>;
     using ErrorF = ResultsF; // identical to ResultsF above except the message passed in is an error="" message.
@@ -110,6 +113,22 @@ public:
                        const ResultsF & = ResultsF(), const ErrorF & = ErrorF(), const FailF & = FailF(),
                        int timeout = kDefaultTimeoutMS);
 
+    /// One request of a batch submitted via submitBatch(). The callbacks have the same semantics as for submitRequest().
+    struct BatchItem {
+        RPC::Message::Id id;
+        QString method;
+        QVariantList params;
+        ResultsF resultsF;
+        ErrorF errorF;
+        FailF failF;
+    };
+
+    /// Like calling submitRequest() for each item, except that all of `items` go to the same BitcoinD and, if
+    /// auto-batching is enabled (autoBatchMax > 1), are sent to bitcoind right away as JSON-RPC batches of at most
+    /// autoBatchMax requests each (with the same "getblock" exception as submitRequest()). Each item still gets
+    /// exactly one of its own callbacks called, as per submitRequest(). This is safe to call from any thread.
+    void submitBatch(QObject *sender, const std::vector<BatchItem> & items, int timeout = kDefaultTimeoutMS);
+
     /// Thread-safe.  Returns a copy of the BitcoinDInfo object.  This object is refreshed each time we
     /// reconnect to BitcoinD.  This is called by ServerBase in various places.
     BitcoinDInfo getBitcoinDInfo() const;
@@ -213,6 +232,18 @@ private:
     void resetPingTimers(int timeout_ms);
 
     // -- Request context table and request handler function --
+    /// Used by submitRequest() and submitBatch(): creates the context object for a request, wired up to call the
+    /// callbacks in `sender`'s thread, and moves it to our thread.
+    std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj> makeRequestContext(QObject *sender, const RPC::Message::Id &id,
+                                                                     const ResultsF &, const ErrorF &, const FailF &,
+                                                                     int timeout);
+    /// Called in this thread: puts `context` into reqContextTable as being serviced by `bd`. Returns false (after
+    /// having failed the request) if `id` is already extant.
+    bool registerRequestContext(BitcoinD *bd, const std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj> &context,
+                                const RPC::Message::Id &id);
+    /// Called in this thread: hands a registered request to `bd`, queued for the next batch if auto-batching is
+    /// enabled (returns true), or else sent on its own (returns false).
+    bool sendOrQueueRequest(BitcoinD *bd, const RPC::Message::Id &id, const QString &method, const QVariantList &params);
     QHash<RPC::Message::Id, std::weak_ptr<BitcoinDMgrHelper::ReqCtxObj>> reqContextTable; // this should only be accessed from this thread
     // called in on_Message and on_ErrorMessage -- dispatches message by emitting proper signal
     template <typename ReqCtxObjT> // <-- we must template this here because ReqCtxObj is not defined yet. :/
@@ -245,7 +276,7 @@ class BitcoinD : public RPC::HttpConnection, public ThreadObjectMixin /* NB: als
     Q_OBJECT
 
 public:
-    explicit BitcoinD(const BitcoinD_RPCInfo &rpcInfo);
+    explicit BitcoinD(const BitcoinD_RPCInfo &rpcInfo, unsigned autoBatchMax = 0);
     ~BitcoinD() override;
 
     using ThreadObjectMixin::start;
@@ -253,6 +284,12 @@ public:
 
     bool isGood() const override; ///< from AbstractConnection -- returns true iff Status==Connected AND auth confirmed ok.
 
+    /// Requests queued via queueRequest() are sent after at most this long, or as soon as autoBatchMax of them are
+    /// queued. This is the finest timer granularity Qt offers; requests arriving within it share one HTTP round trip.
+    static constexpr int kBatchWindowMS = 1;
+    /// Upper bound on the size of any JSON-RPC batch we send.
+    static constexpr unsigned kMaxBatchItems = 100;
+
     /// Resets the pingTimer to the specified interval in ms. Specify an interval <= 0 to disable the ping timer for
     /// this instance. (Thread-safe).
     ///
@@ -273,9 +310,16 @@ signals:
     void connected(BitcoinD *me);
     void authenticated(BitcoinD *me); ///< This is emitted after we have successfully connected and auth'd.
 
+    /// Like sendRequest(), but the request is held back for a short while (see kBatchWindowMS) and sent together with
+    /// any others queued in the meantime, as a single JSON-RPC batch.
+    void queueRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params);
+    /// Emit this to send all requests queued via queueRequest() right away.
+    void flushQueuedRequests();
+
 protected:
     void on_started() override;
     void on_connected() override;
+    void on_disconnected() override;
 
     void do_ping() override;
 
@@ -288,6 +332,13 @@ private:
     void connectMiscSignals(); ///< some signals/slots to self to do bookkeeping
 
     const BitcoinD_RPCInfo rpcInfo;
+    const unsigned autoBatchMax; ///< if > 1, queued requests are also flushed as soon as this many are queued
+    std::vector<OutgoingRequest> queuedRequests; ///< requests from queueRequest() not yet sent
+    quint64 nBatchesSent = 0;
+    static constexpr auto kBatchTimer = "+BatchTimer";
+    void _queueRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params);
+    void _flushQueuedRequests();
+    void sendQueuedRequests(); ///< sends (and clears) queuedRequests: as a batch if there are 2 or more
     std::atomic_bool badAuth = false, needAuth = true;
     bool fastPing = false;
     bool inBlockDownload = false;
@@ -309,6 +360,7 @@ namespace BitcoinDMgrHelper {
         bool timedOut = false;
         const int timeout; //< request timeout in milliseconds. Must be >= 0.
         qint64 ts; ///<--- intentionally uninitialized to save cycles
+        qint64 tsNS; ///< same moment as `ts` but in nanoseconds; used for the bitcoind round-trip latency metric
         /// The BitcoinD instance that is handling our request. This pointer should *not* be dereferenced but only be
         /// used for == compare (since it's running in another thread). The reason why it's a QObject * and not a
         /// BitcoinD * is because we connect to the `destroyed` signal and check for equality on the (now) QObject
@@ -20,6 +20,7 @@
 #include "BTC.h"
 #include "Common.h"
 #include "CoTask.h"
+#include "Metrics.h"
 #include "Rpa.h"
 #include "Util.h"
 
@@ -29,10 +30,52 @@
 #include <QThread>
 
 #include <algorithm>
+#include <atomic>
 #include <unordered_set>
 
 /* static */ const TxHash PreProcessedBlock::nullhash;
 
+namespace {
+    /// Forwards to operator new/delete, counting the allocations. Upstream of every block arena.
+    class CountingResource final : public std::pmr::memory_resource {
+    public:
+        Metrics::Counter & nAllocs = Metrics::Registry::instance().counter(
+            "fulcrum_block_heap_allocs_total", "Heap allocations made by the containers of PreProcessedBlock instances");
+        Metrics::Counter & nBytes = Metrics::Registry::instance().counter(
+            "fulcrum_block_heap_alloc_bytes_total", "Bytes allocated on the heap by the containers of PreProcessedBlock instances");
+
+    private:
+        void *do_allocate(size_t bytes, size_t align) override {
+            nAllocs.add();
+            nBytes.add(bytes);
+            return std::pmr::new_delete_resource()->allocate(bytes, align);
+        }
+        void do_deallocate(void *p, size_t bytes, size_t align) override {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+        }
+        bool do_is_equal(const std::pmr::memory_resource &o) const noexcept override { return this == &o; }
+    };
+
+    CountingResource & countingResource() { static CountingResource r; return r; }
+
+    std::atomic_bool arenaEnabled{true};
+
+    /// Size of the first chunk of a block arena. It is enough for a typical small block; each chunk after the first
+    /// is bigger than the last, so that even huge blocks need only a couple of dozen chunks.
+    constexpr size_t kInitialArenaSize = 64 * 1024;
+} // namespace
+
+/* static */
+std::shared_ptr<PreProcessedBlock::Arena> PreProcessedBlock::makeArena()
+{
+    if (!arenaEnabled.load(std::memory_order_relaxed))
+        return std::shared_ptr<Arena>(std::shared_ptr<Arena>{}, &countingResource()); // non-owning alias
+    return std::make_shared<std::pmr::monotonic_buffer_resource>(kInitialArenaSize, &countingResource());
+}
+
+/* static */
+void PreProcessedBlock::setArenaEnabled(bool b) { arenaEnabled = b; }
+
 /// fill this struct's data with all the txdata, etc from a bitcoin CBlock. Alternative to using the second c'tor.
 void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bitcoin::CBlock &b, CoTask *rpaTask) {
     if (!header.IsNull() || !txInfos.empty())
@@ -42,7 +85,20 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
     header = b.GetBlockHeader();
     estimatedThisSizeBytes = sizeof(*this) + size_t(BTC::GetBlockHeaderSize());
     txInfos.reserve(b.vtx.size());
-    std::unordered_map<TxHash, unsigned, HashHasher> txHashToIndex; // since we know the size ahead of time here, we can set max_load_factor to 1.0 and avoid over-allocating the hash table
+    {
+        // Reserve exactly, since growing a container in the arena leaves the old buffer behind until the block dies
+        size_t nIns = 0, nOuts = 0;
+        for (const auto & tx : b.vtx) {
+            nIns += tx->vin.size();
+            nOuts += tx->vout.size();
+        }
+        inputs.reserve(nIns);
+        outputs.reserve(nOuts);
+    }
+    // This map is only needed until the end of this function, so it gets its own scratch arena rather than bloating
+    // the block's arena.
+    std::pmr::monotonic_buffer_resource scratch(kInitialArenaSize, &countingResource());
+    std::pmr::unordered_map<TxHash, unsigned, HashHasher> txHashToIndex(&scratch); // since we know the size ahead of time here, we can set max_load_factor to 1.0 and avoid over-allocating the hash table
     txHashToIndex.max_load_factor(1.0);
     txHashToIndex.reserve(b.vtx.size());
     std::optional<CoTask::Future> rpaFut; // NB: rpaFut will auto-wait for work (if any) to complete as part of its d'tor
@@ -171,10 +227,6 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
         ++txIdx;
     }
 
-    // shrink inputs/outputs to fit now to conserve memory
-    inputs.shrink_to_fit();
-    outputs.shrink_to_fit();
-
     // at this point we have a partially constructed object. we must run through all the inputs again
     // and figure out which if any refer to tx's in this block, and assign those to our hashXIns.
     // Also: to save memory on txhash's for such inputs, we make sure the txhash refers to the same underlying
@@ -216,9 +268,7 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
         std::sort(ag.txNumsInvolvingHashX.begin(), ag.txNumsInvolvingHashX.end());
         auto last = std::unique(ag.txNumsInvolvingHashX.begin(), ag.txNumsInvolvingHashX.end());
         ag.txNumsInvolvingHashX.erase(last, ag.txNumsInvolvingHashX.end());
-        ag.ins.shrink_to_fit();
-        ag.outs.shrink_to_fit();
-        ag.txNumsInvolvingHashX.shrink_to_fit();
+        // Note: no shrink_to_fit() here; in the arena that would only add a copy, since nothing is freed individually
         // tally up space usage
         estimatedThisSizeBytes +=
                 sizeof(ag) + size_t(hashX.size()) + ag.ins.size() * sizeof(decltype(ag.ins)::value_type)
@@ -293,3 +343,71 @@ PreProcessedBlock::hashXsByTx() const
     }
     return ret;
 }
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+#include <deque>
+
+namespace {
+    /// Returns a synthetic block of `nTx` txns with 2 inputs and 2 P2PKH outputs each. Half of the inputs spend an
+    /// output of the previous txn in the block, like a chain of payments.
+    bitcoin::CBlock MakeBlock(size_t nTx, uint32_t salt) {
+        uint32_t x = salt * 2654435761u + 1u;
+        const auto Rand = [&x]{ return x = x * 1664525u + 1013904223u; };
+        bitcoin::CBlock b;
+        b.nVersion = 1;
+        b.nTime = salt;
+        b.vtx.reserve(nTx);
+        for (size_t i = 0; i < nTx; ++i) {
+            bitcoin::CMutableTransaction tx;
+            for (uint32_t n = 0; n < 2; ++n) {
+                if (i && !n) {
+                    tx.vin.emplace_back(b.vtx.back()->GetId(), 1u);
+                } else {
+                    bitcoin::uint256 h;
+                    for (auto *p = h.begin(); p < h.end(); ++p) *p = uint8_t(Rand() >> 24);
+                    tx.vin.emplace_back(bitcoin::TxId(h), n);
+                }
+                std::vector<uint8_t> spk = {0x76, 0xa9, 0x14};
+                for (int j = 0; j < 20; ++j) spk.push_back(uint8_t(Rand() >> 24));
+                spk.insert(spk.end(), {0x88, 0xac});
+                tx.vout.emplace_back(int64_t(Rand() % 100'000'000u) * bitcoin::SATOSHI, bitcoin::CScript(spk.cbegin(), spk.cend()));
+            }
+            b.vtx.push_back(bitcoin::MakeTransactionRef(std::move(tx)));
+        }
+        return b;
+    }
+
+    void benchBlockArena() {
+        constexpr size_t nDistinct = 16, nTx = 4000, nBlocks = 400, nInFlight = 32;
+        Log() << "Generating " << nDistinct << " synthetic blocks of " << nTx << " txns ...";
+        std::vector<bitcoin::CBlock> blocks;
+        for (size_t i = 0; i < nDistinct; ++i)
+            blocks.push_back(MakeBlock(nTx, uint32_t(i)));
+        const auto Rss = []{ return qint64(Util::getProcessMemoryUsage().phys); };
+        for (const bool useArena : {false, true}) {
+            PreProcessedBlock::setArenaEnabled(useArena);
+            auto & cr = countingResource();
+            const uint64_t allocs0 = cr.nAllocs.value(), bytes0 = cr.nBytes.value();
+            const auto rss0 = Rss();
+            std::deque<PreProcessedBlockPtr> inFlight; // like the download pipeline, keep a few blocks alive at once
+            Tic t0;
+            for (size_t i = 0; i < nBlocks; ++i) {
+                inFlight.push_back(PreProcessedBlock::makeShared(unsigned(i), 0, blocks[i % nDistinct], nullptr));
+                if (inFlight.size() > nInFlight) inFlight.pop_front();
+            }
+            inFlight.clear();
+            t0.fin();
+            Log() << (useArena ? "Arena:   " : "No arena:") << " processed " << nBlocks << " blocks in " << t0.msecStr()
+                  << " msec, container heap allocs per block: " << (cr.nAllocs.value() - allocs0) / nBlocks
+                  << " (" << QString::number((cr.nBytes.value() - bytes0) / double(nBlocks) / 1e6, 'f', 2) << " MB)"
+                  << ", RSS growth: " << QString::number((Rss() - rss0) / 1e6, 'f', 1) << " MB";
+        }
+        PreProcessedBlock::setArenaEnabled(true);
+        Log() << "(Note: the per-txn hash QByteArrays are allocated by Qt and are not counted above.)";
+    }
+
+    const auto b_blockarena = App::registerBench("blockarena", benchBlockArena);
+} // namespace
+#endif
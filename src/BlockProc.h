@@ -19,6 +19,7 @@
 #pragma once
 
 #include "BlockProcTypes.h"
+#include "BTC.h"
 
 #include "bitcoin/amount.h"
 #include "bitcoin/block.h"
@@ -28,6 +29,7 @@
 #include <cassert>
 #include <cstdint>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <unordered_map>
 #include <unordered_set>
@@ -43,11 +45,27 @@ using PreProcessedBlockPtr = std::shared_ptr<PreProcessedBlock>;  ///< For clari
 /// for later serving up to EX clients.
 struct PreProcessedBlock
 {
+    /// Per-block monotonic arena that the containers below (and the vectors nested in hashXAggregated) allocate from.
+    /// Nothing in it is freed individually; it is all released at once when the block is destroyed, which saves
+    /// millions of small malloc/free pairs (and a lot of heap fragmentation) during initial sync. Declared first so
+    /// that it is destroyed last. Not thread-safe: the containers may only be grown from one thread at a time.
+    using Arena = std::pmr::memory_resource;
+    std::shared_ptr<Arena> arena = makeArena();
+    /// Returns a new, empty arena. If disabled via setArenaEnabled(false), returns a resource that simply forwards to
+    /// operator new/delete instead. Either way, the allocations that reach the heap are tallied in the
+    /// fulcrum_block_heap_allocs_total and fulcrum_block_heap_alloc_bytes_total metrics.
+    static std::shared_ptr<Arena> makeArena();
+    /// Defaults to true. Intended for benchmarking.
+    static void setArenaEnabled(bool);
+
     BlockHeight height = 0; ///< the height (block number) of the block
     size_t sizeBytes = 0; ///< the size of the original serialized block in bytes (not the size of this data structure which is significantly smaller)
     size_t estimatedThisSizeBytes = 0; ///< the estimated size of this data structure -- may be off by a bit but is useful for rough estimation of memory costs of block processing
     /// deserialized header as came in from bitcoind
     bitcoin::CBlockHeader header;
+    /// If set, `header` was serialized, hashed and checked by BTC::HeaderVerifier::prepare() in the download pipeline,
+    /// so Storage::addBlock only needs to check that it links to the tip. If not set, addBlock does the full check.
+    std::optional<BTC::HeaderVerifier::Prepared> preparedHeader;
 
     struct TxInfo {
         TxHash hash; ///< 32 byte txid. These txid's are *reversed* from bitcoind's internal memory order. (so as to be closer to the final hex encoded format).
@@ -56,7 +74,8 @@ struct PreProcessedBlock
     };
 
     /// The info for all the tx's in the block, in the order in which they appeared in the block.
-    std::vector<TxInfo> txInfos;
+    using TxInfoVec = std::pmr::vector<TxInfo>;
+    TxInfoVec txInfos{arena.get()};
 
     struct OutPt {
         unsigned txIdx = 0;  ///< this is an index into the `txInfos` vector declared above
@@ -73,31 +92,44 @@ struct PreProcessedBlock
         std::optional<unsigned> parentTxOutIdx; ///< if the input's prevout was in this block, the index into the `outputs` array declared in BlockProcBase, otherwise undefined.
     };
 
-    std::vector<OutPt> outputs; ///< all the outpoints for *all* the tx's in this block, in the order they were encountered!
+    std::pmr::vector<OutPt> outputs{arena.get()}; ///< all the outpoints for *all* the tx's in this block, in the order they were encountered!
 
-    std::vector<InputPt> inputs; ///< all the inputs for *all* the tx's in this block, in the order they were encountered!
+    std::pmr::vector<InputPt> inputs{arena.get()}; ///< all the inputs for *all* the tx's in this block, in the order they were encountered!
 
     /// 'Value' type for the hashXAggregated map below. Contains 2 lists of output and input indices into the `outputs`
     /// and `inputs` arrays present in concrete subclasses.
     struct AggregatedOutsIns {
         /// collection of all outputs in this block that are *TO* a particular HashX (data items are indices into the
         /// `outputs`array above)
-        std::vector<unsigned> outs;
+        std::pmr::vector<unsigned> outs;
         /// collection of all inputs in this block that are *FROM* a particular HashX (data items are indices into the
         /// `inputs` arrays above). Note this will only include inputs that were from prevout tx's also in this block
         /// for PreProcessedBlock instances before final processing (full resolution requires a utxo set).
-        std::vector<unsigned> ins;
+        std::pmr::vector<unsigned> ins;
 
         /// Tx indices, always sorted. Initially it's just a list of txIdx into the txInfos array but gets transformed
         /// down the block processing pipeline (in addBlock) to be a list of globally-mapped TxNums involving this
         /// HashX.
-        std::vector<TxNum> txNumsInvolvingHashX;
+        std::pmr::vector<TxNum> txNumsInvolvingHashX;
+
+        // allocator-aware, so that the vectors above get the arena of the map they live in
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+        AggregatedOutsIns() = default;
+        explicit AggregatedOutsIns(const allocator_type &a) : outs(a), ins(a), txNumsInvolvingHashX(a) {}
+        AggregatedOutsIns(const AggregatedOutsIns &o, const allocator_type &a)
+            : outs(o.outs, a), ins(o.ins, a), txNumsInvolvingHashX(o.txNumsInvolvingHashX, a) {}
+        AggregatedOutsIns(AggregatedOutsIns &&o, const allocator_type &a)
+            : outs(std::move(o.outs), a), ins(std::move(o.ins), a), txNumsInvolvingHashX(std::move(o.txNumsInvolvingHashX), a) {}
+        AggregatedOutsIns(const AggregatedOutsIns &) = default;
+        AggregatedOutsIns(AggregatedOutsIns &&) = default;
+        AggregatedOutsIns & operator=(const AggregatedOutsIns &) = default;
+        AggregatedOutsIns & operator=(AggregatedOutsIns &&) = default;
     };
 
     /// Node map preferable here. Even though a flat map uses move construction, it would still have to move ~72
     /// bytes around (3 pointers per std::vector * 3 vectors * 8 bytes per pointer), so the Node* of the node map is
     /// preferred here.
-    std::unordered_map<HashX, AggregatedOutsIns, HashHasher> hashXAggregated;
+    std::pmr::unordered_map<HashX, AggregatedOutsIns, HashHasher> hashXAggregated{arena.get()};
 
     /*
     // If we decide to track OpReturn:
@@ -162,13 +194,22 @@ struct PreProcessedBlock
 
     // -- Methods:
 
-    // c'tors, etc... note this class is fully copyable and moveable
+    // c'tors, etc... note this class is copy and move constructible, but not assignable, since the containers above
+    // can't be assigned across arenas. A copy's containers use the default heap, a move's keep using the arena.
     PreProcessedBlock() = default;
     PreProcessedBlock(BlockHeight bheight, size_t rawBlockSizeBytes, const bitcoin::CBlock &b, CoTask *rpaTask /* nullable */) {
         fill(bheight, rawBlockSizeBytes, b, rpaTask);
     }
-    /// reset this to empty
-    inline void clear() { *this = PreProcessedBlock(); }
+    PreProcessedBlock(const PreProcessedBlock &) = default;
+    PreProcessedBlock(PreProcessedBlock &&) = default;
+    PreProcessedBlock & operator=(const PreProcessedBlock &) = delete;
+    PreProcessedBlock & operator=(PreProcessedBlock &&) = delete;
+    /// reset this to empty, with a fresh arena
+    inline void clear() {
+        // despite the way this looks, below is 100% well defined
+        this->~PreProcessedBlock();   // end current lifetime (calling d'tors for all members, arena last)
+        new (this) PreProcessedBlock; // start a new lifetime at this's memory location (default re-construct this)
+    }
     /// fill this block with data from bitcoin's CBlock
     void fill(BlockHeight blockHeight, size_t rawSizeBytes, const bitcoin::CBlock &b, CoTask *rpaTask /* nullable */);
 
@@ -17,6 +17,7 @@
 // <https://www.gnu.org/licenses/>.
 //
 #include "CoTask.h"
+#include "ThreadTopology.h"
 #include "Util.h"
 
 CoTask::CoTask(const QString &name_)
@@ -24,6 +25,7 @@ CoTask::CoTask(const QString &name_)
 {
     thr = std::thread([this] {
         if (!name.isEmpty()) Util::ThreadName::Set(name);
+        ThreadTopology::placeCurrentThread(ThreadTopology::Group::CoTask);
         thrFunc();
     });
 }
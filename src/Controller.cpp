@@ -23,9 +23,12 @@
 #include "Controller_SynchDSPsTask.h"
 #include "Controller_SynchMempoolTask.h"
 #include "CoTask.h"
+#include "Logger.h"
 #include "Mempool.h"
+#include "Metrics.h"
 #include "SubsMgr.h"
 #include "ThreadPool.h"
+#include "ThreadTopology.h"
 #include "ZmqSubNotifier.h"
 
 #include "bitcoin/amount.h"
@@ -38,6 +41,7 @@
 #include <cmath>
 #include <ios>
 #include <iterator>
+#include <limits>
 #include <list>
 #include <map>
 #include <mutex>
@@ -66,7 +70,27 @@ void Controller::startup()
     stopFlag = false;
 
     storage = std::make_shared<Storage>(options);
-    storage->startup(); // may throw here
+    if (! options->dumpScriptHashes.isEmpty())
+        storage->startup(); // may throw here
+    else {
+        // The slow startup checks run in the background. When they are done, finish the storage startup (on its
+        // thread, which is this thread) and only then connect to bitcoind, since synching writes to the db.
+        storage->beginStartup([this]{ // may throw here
+            Util::AsyncOnObject(storage.get(), [this]{
+                if (stopFlag || !bitcoindmgr || storage->isStartupComplete()) return;
+                try {
+                    storage->completeStartup();
+                    bitcoindmgr->startup();
+                } catch (const std::exception & e) {
+                    Fatal() << e.what();
+                }
+            });
+        });
+        // A fresh db has no headers to serve meanwhile and its checks are trivial, so it keeps the old synchronous
+        // startup: wait for the checks here (the callback above then finds the startup complete and does nothing).
+        if (storage->isNewlyInitialized())
+            storage->completeStartup(); // may throw here
+    }
 
     // check that the coin from DB is known and supported
     {
@@ -97,7 +121,7 @@ void Controller::startup()
         // this may take a long time but normally this branch is not taken
         dumpScriptHashes(options->dumpScriptHashes);
 
-    bitcoindmgr = std::make_shared<BitcoinDMgr>(options->bdNClients, options->bdRPCInfo);
+    bitcoindmgr = std::make_shared<BitcoinDMgr>(options->bdNClients, options->bdRPCInfo, options->bdBatchMax);
     {
         auto constexpr waitTimer = "wait4bitcoind", callProcessTimer = "callProcess";
         int constexpr msgPeriod = 10000, // 10sec
@@ -125,7 +149,7 @@ void Controller::startup()
 
                 // also (re)start the zmq notifier(s) if we had any before and bitcoind came back (but only if we are
                 // "ready" and able to serve connections)
-                if (srvmgr)
+                if (srvmgr && !srvmgr->isHeadersOnly())
                     zmqStartAllKnown();
             }
         });
@@ -141,7 +165,7 @@ void Controller::startup()
                     DebugM("\"", topic.str(), "\" topic address: ", state.lastKnownAddr);
                     // We only start the ZMQ notifier once we are "ready" and the servers are started
                     // (see also one of the upToDate triggered slots below)
-                    if (srvmgr) {
+                    if (srvmgr && !srvmgr->isHeadersOnly()) {
                         // maybe restart if it was running (to apply new address)
                         if (state.notifier && state.notifier->isRunning()) {
                             DebugM("applying new ", topic.str(), " address to already-running zmq notifier");
@@ -171,15 +195,19 @@ void Controller::startup()
         conns += connect(this, &Controller::downloadingBlocks, bitcoindmgr.get(), &BitcoinDMgr::inBlockDownload);
     }
 
-    bitcoindmgr->startup(); // may throw
+    if (storage->isStartupComplete()) // fresh db or --dump-sh: storage started up synchronously above
+        bitcoindmgr->startup(); // may throw
+    else
+        // While the rest of the db is checked, and then until we are synched, serve just the headers we have.
+        startSrvMgr(true); // may throw
 
-    // We defer listening for connections until we hit the "upToDate" state at least once, to prevent problems
-    // for clients.
+    // We defer listening for connections (or, if we started in header-only mode above, serving anything but headers)
+    // until we hit the "upToDate" state at least once, to prevent problems for clients.
     auto connPtr = std::make_shared<QMetaObject::Connection>();
     *connPtr = connect(this, &Controller::upToDate, this, [this, connPtr] {
         // the below code runs precisely once after the first upToDate signal
         if (connPtr) disconnect(*connPtr);
-        if (!srvmgr) {
+        if (!srvmgr || srvmgr->isHeadersOnly()) {
             if (!origThread) {
                 Fatal() << "INTERNAL ERROR: Controller's creation thread is null; cannot start SrvMgr, exiting!";
                 return;
@@ -187,22 +215,10 @@ void Controller::startup()
 
             masterNotifySubsFlag = true; // permanently latch this to true. notifications enabled.
 
-            srvmgr = std::make_unique<SrvMgr>(options, sslCertMonitor, storage, bitcoindmgr);
-            // this object will live on our creation thread (normally the main thread)
-            srvmgr->moveToThread(origThread);
-            // now, start it up on our creation thread (normally the main thread)
-            Util::VoidFuncOnObjectNoThrow(srvmgr.get(), [this]{
-                // creation thread (normally the main thread)
-                try {
-                    srvmgr->startup(); // may throw Exception, waits for servers to bind
-                } catch (const Exception & e) {
-                    // exit app on bind/listen failure.
-                    Fatal() << e.what();
-                }
-            }); // wait for srvmgr's thread (usually the main thread)
-
-            // connect the header subscribe signal
-            conns += connect(this, &Controller::newHeader, srvmgr.get(), &SrvMgr::newHeader);
+            if (!srvmgr)
+                startSrvMgr(false);
+            else
+                Util::VoidFuncOnObjectNoThrow(srvmgr.get(), [this]{ srvmgr->setHeadersOnly(false); });
 
             // If BitcoinDMgr told us about a ZMQ notification address for a topic we care about, start the ZMQ notifier
             // (this does not happen if no ZMQ enabled at compile-time)
@@ -267,32 +283,6 @@ void Controller::startup()
         conns += connect(bitcoindmgr.get(), &BitcoinDMgr::allConnectionsLost, this, [this]{ stopTimer(mempoolLogTimer);});
     }
 
-    {
-        // set up periodic refresh of mempool fee histogram
-        constexpr const char *feeHistogramTimer = "feeHistogramTimer";
-        constexpr int feeHistogramTimerInterval = 10 * 1000; // every 10 seconds
-        conns += connect(this, &Controller::upToDate, this, [this] {
-            callOnTimerSoon(feeHistogramTimerInterval, feeHistogramTimer, [this]{
-                storage->refreshMempoolHistogram();
-                return true;
-            }, false, Qt::TimerType::CoarseTimer);
-        });
-        conns += connect(this, &Controller::synchedMempool, this, [this]{
-            // If we just synched the mempool after a new block arrived, or for the first time after app start,
-            // refresh the fee histogram immediately.
-            if (needFeeHistogramUpdate) {
-                needFeeHistogramUpdate = false;
-                storage->refreshMempoolHistogram();
-                restartTimer(feeHistogramTimer);
-            }
-        });
-        // disable the timer if downloading blocks and restart it later when up-to-date
-        conns += connect(this, &Controller::synchronizing, this, [this]{
-            stopTimer(feeHistogramTimer);
-            needFeeHistogramUpdate = true; // indicate that the next time synchedMempool() is emitted, do a fee histogram refresh
-        });
-    }
-
     {
         // Small utility function to add "ignore" txhashes coming from SynchMempoolTask to our somewhat-persistent
         // mempoolIgnoreTxns set (this set is cleared each time the tip changes, but persists across mempool synchs
@@ -312,6 +302,29 @@ void Controller::startup()
     start();  // start our thread
 }
 
+void Controller::startSrvMgr(bool headersOnly)
+{
+    // this object will live on our creation thread (normally the main thread), which is still our thread if we are
+    // called from startup()
+    QThread * const creationThread = origThread ? origThread : thread();
+    srvmgr = std::make_unique<SrvMgr>(options, sslCertMonitor, storage, bitcoindmgr);
+    srvmgr->moveToThread(creationThread);
+    // now, start it up on our creation thread (normally the main thread)
+    Util::VoidFuncOnObjectNoThrow(srvmgr.get(), [this, headersOnly]{
+        // creation thread (normally the main thread)
+        try {
+            srvmgr->setHeadersOnly(headersOnly);
+            srvmgr->startup(); // may throw Exception, waits for servers to bind
+        } catch (const Exception & e) {
+            // exit app on bind/listen failure.
+            Fatal() << e.what();
+        }
+    }); // wait for srvmgr's thread (usually the main thread)
+
+    // connect the header subscribe signal
+    conns += connect(this, &Controller::newHeader, srvmgr.get(), &SrvMgr::newHeader);
+}
+
 void Controller::on_coinDetected(const BTC::Coin detectedtype)
 {
     // NOTE: This runs in the bitcoindmgr thread, and not in our thread. Any operations here should bear that in mind
@@ -487,17 +500,237 @@ QString ChainInfo::toString() const
 
 using VarDLTaskResult = std::variant<PreProcessedBlockPtr, Controller::RpaOnlyModeDataPtr>;
 
+namespace {
+    /// Estimated in-memory footprint of a downloaded block awaiting commit; this is what counts against the
+    /// DownloadScheduler's byte budget.
+    size_t DLResultBytes(const PreProcessedBlockPtr &ppb) { return ppb->estimatedThisSizeBytes; }
+    size_t DLResultBytes(const Controller::RpaOnlyModeDataPtr &romd) {
+        return romd->serializedPrefixTable.size() + sizeof(*romd);
+    }
+} // namespace
+
+/// Hands out the block heights of a synch, in order, to whichever DownloadBlocksTask has a free request slot, so that
+/// faster bitcoind connections simply end up doing more of the work. Memory is bounded by a byte budget: the blocks in
+/// flight (estimated from the running average block size) plus the blocks downloaded but not yet committed may not
+/// exceed it. The block the Controller needs next (the "head") is exempt, so that the synch can never deadlock.
+///
+/// If the head has been in flight for too long it is handed out a second time to another task, so that one slow
+/// connection can't hold up the commit order; whichever copy arrives first is used.
+///
+/// It is also where the download tasks verify header linkage: since heights are handed out in order to whichever task
+/// is free, a contiguous run is spread across tasks, so each task registers its prepared headers here and checks them
+/// against whichever neighbours were prepared before them. Thread-safe.
+class DownloadScheduler
+{
+public:
+    struct Claim {
+        enum Status : uint8_t { Ok, Wait, Done };
+        Status status = Done;
+        unsigned height = 0; ///< valid if status == Ok
+        unsigned waitMsec = 0; ///< valid if status == Wait
+    };
+
+    DownloadScheduler(unsigned from, unsigned to, uint64_t budgetBytes);
+    ~DownloadScheduler();
+
+    const unsigned from, to;
+    const uint64_t budget;
+
+    /// Called by the download tasks, from their threads, whenever they have a free request slot. A Wait result means
+    /// "try again in waitMsec", and Done means there is nothing left to download.
+    Claim claim();
+    /// Called by the Controller when a block arrives. Returns false if it's a duplicate (the late copy of a re-issued
+    /// block) which the caller should discard.
+    bool downloaded(unsigned height, size_t bytes);
+    /// Called by the Controller after it has committed `height` to the db. `bytes` must match what was passed to
+    /// downloaded().
+    void committed(unsigned height, size_t bytes);
+    /// Called by the Controller when it has nothing to commit because the head hasn't arrived yet. The time until it
+    /// does arrive is recorded in the commit-wait histogram.
+    void headMissing();
+    /// Called by the download tasks, from their threads, with a block's header once BTC::HeaderVerifier::prepare()
+    /// has accepted it (`hash` being Prepared::hash). Checks that this header links to the one below it, and that the
+    /// one above it links to this one, for whichever of the two were prepared already, so that the linkage of every
+    /// contiguous run of downloaded blocks ends up verified on the download threads. Returns false if a link is
+    /// broken: the chain changed under us during the download. Heights past the break are then no longer handed out;
+    /// addBlock will reject the block at the break, and the Controller rewinds and retries as it always has.
+    bool headerPrepared(unsigned height, const bitcoin::CBlockHeader &header, const QByteArray &hash);
+
+    /// Fraction of the range that has been handed out so far, in [0, 1].
+    double progress() const;
+    QVariantMap stats() const;
+
+    /// 1/4 of available physical RAM, clamped to [256 MiB, 4 GiB].
+    static uint64_t defaultBudget();
+
+private:
+    static constexpr int64_t kReissueAfterNanos = 10'000'000'000LL; ///< 10 seconds
+    static constexpr unsigned kMaxCopies = 2, kBudgetWaitMsec = 20, kIdleWaitMsec = 100;
+    static constexpr double kInitialAvgBlockBytes = 64. * 1024.;
+
+    struct InFlight { int64_t issuedNanos; unsigned copies; };
+    struct Link { QByteArray prevHash, hash; }; ///< a prepared header's hashPrevBlock and own hash, in memory order
+
+    mutable std::mutex mut;
+    unsigned next; ///< the next height that has never been handed out
+    unsigned head; ///< the next height the Controller will commit
+    std::map<unsigned, InFlight> inFlight; ///< heights handed out but not yet received by the Controller
+    std::map<unsigned, Link> links; ///< prepared headers from head-1 onward
+    unsigned brokenAt = std::numeric_limits<unsigned>::max(); ///< lowest height whose header didn't link to the one below
+    uint64_t pendingBytes = 0; ///< sum of the sizes of the blocks received by the Controller but not yet committed
+    double avgBlockBytes = kInitialAvgBlockBytes; ///< exponentially weighted moving average
+    int64_t headWaitT0 = 0; ///< nonzero while the Controller is waiting for the head
+    uint64_t nReissued = 0, nBudgetWaits = 0, nDupes = 0, nLinksChecked = 0;
+
+    Metrics::Gauge &gBudget, &gUsed;
+    Metrics::Counter &cReissued;
+    Metrics::Histogram &hCommitWait;
+
+    uint64_t usedBytes() const { return pendingBytes + uint64_t(double(inFlight.size()) * avgBlockBytes); } // call with lock held
+};
+
+DownloadScheduler::DownloadScheduler(unsigned from, unsigned to, uint64_t budgetBytes)
+    : from(from), to(to), budget(budgetBytes), next(from), head(from),
+      gBudget(Metrics::Registry::instance().gauge("fulcrum_sync_dl_budget_bytes",
+                                                  "Memory budget for blocks being downloaded or awaiting commit during a synch")),
+      gUsed(Metrics::Registry::instance().gauge("fulcrum_sync_dl_budget_used_bytes",
+                                                "Estimated memory used by blocks being downloaded or awaiting commit during a synch")),
+      cReissued(Metrics::Registry::instance().counter("fulcrum_sync_dl_reissued_total",
+                                                      "Stalled block downloads that were handed out again to another download task")),
+      hCommitWait(Metrics::Registry::instance().histogram("fulcrum_sync_commit_wait_seconds",
+                                                          "Time the Controller spent idle waiting for the next block in height order during a synch"))
+{
+    gBudget.set(int64_t(budget));
+    gUsed.set(0);
+}
+
+DownloadScheduler::~DownloadScheduler()
+{
+    gBudget.set(0);
+    gUsed.set(0);
+}
+
+uint64_t DownloadScheduler::defaultBudget()
+{
+    constexpr uint64_t MiB = 1024u * 1024u;
+    return std::clamp<uint64_t>(Util::getAvailablePhysicalRAM() / 4u, 256u * MiB, 4096u * MiB);
+}
+
+auto DownloadScheduler::claim() -> Claim
+{
+    std::unique_lock g(mut);
+    const int64_t now = Util::getTimeNS();
+    if (auto it = inFlight.find(head); it != inFlight.end() && it->second.copies < kMaxCopies
+            && now - it->second.issuedNanos > kReissueAfterNanos) {
+        // the head is stalled -- hand it out again
+        it->second.issuedNanos = now;
+        ++it->second.copies;
+        ++nReissued;
+        cReissued.add();
+        return {Claim::Ok, head, 0u};
+    }
+    if (next > std::min(to, brokenAt))
+        // Nothing left to hand out (that is worth downloading). Stay around while blocks are still in flight, in case the head needs re-issuing.
+        return inFlight.empty() ? Claim{} : Claim{Claim::Wait, 0u, kIdleWaitMsec};
+    if (next != head && pendingBytes + uint64_t(double(inFlight.size() + 1u) * avgBlockBytes) > budget) {
+        ++nBudgetWaits;
+        return {Claim::Wait, 0u, kBudgetWaitMsec};
+    }
+    inFlight.emplace(next, InFlight{now, 1u});
+    gUsed.set(int64_t(usedBytes()));
+    return {Claim::Ok, next++, 0u};
+}
+
+bool DownloadScheduler::downloaded(unsigned height, size_t bytes)
+{
+    std::unique_lock g(mut);
+    if (inFlight.erase(height) == 0) {
+        ++nDupes;
+        return false;
+    }
+    pendingBytes += bytes;
+    avgBlockBytes += (double(bytes) - avgBlockBytes) / 16.;
+    if (height == head && headWaitT0) {
+        hCommitWait.recordNanos(Util::getTimeNS() - headWaitT0);
+        headWaitT0 = 0;
+    }
+    gUsed.set(int64_t(usedBytes()));
+    return true;
+}
+
+void DownloadScheduler::committed(unsigned height, size_t bytes)
+{
+    std::unique_lock g(mut);
+    pendingBytes -= std::min<uint64_t>(pendingBytes, bytes);
+    head = std::max(head, height + 1u);
+    links.erase(links.begin(), links.lower_bound(head - 1u)); // keep head-1, which head must link to
+    gUsed.set(int64_t(usedBytes()));
+}
+
+void DownloadScheduler::headMissing()
+{
+    std::unique_lock g(mut);
+    if (!headWaitT0) headWaitT0 = Util::getTimeNS();
+}
+
+bool DownloadScheduler::headerPrepared(unsigned height, const bitcoin::CBlockHeader &header, const QByteArray &hash)
+{
+    Link link{QByteArray(reinterpret_cast<const char *>(header.hashPrevBlock.begin()), int(header.hashPrevBlock.width())),
+              hash};
+    std::unique_lock g(mut);
+    if (height + 1u < head) return true; // no longer needed; the Controller has moved past it
+    const auto [it, inserted] = links.try_emplace(height, std::move(link));
+    if (!inserted) return true; // the late copy of a re-issued block, which was checked already
+    bool ok = true;
+    const auto Check = [&](unsigned h, const Link &below, const Link &cur) {
+        if (BTC::IsRandomXBlock(int(h))) return; // RandomX blocks bypass linkage validation, as in BTC::HeaderVerifier
+        ++nLinksChecked;
+        if (below.hash != cur.prevHash) {
+            ok = false;
+            brokenAt = std::min(brokenAt, h);
+        }
+    };
+    if (it != links.begin())
+        if (const auto below = std::prev(it); below->first + 1u == height) Check(height, below->second, it->second);
+    if (const auto above = std::next(it); above != links.end() && above->first == height + 1u)
+        Check(height + 1u, it->second, above->second);
+    return ok;
+}
+
+double DownloadScheduler::progress() const
+{
+    std::unique_lock g(mut);
+    return double(next - from) / double(to - from + 1u);
+}
+
+QVariantMap DownloadScheduler::stats() const
+{
+    std::unique_lock g(mut);
+    return {
+        { "budget", QString("%1 MB").arg(QString::number(double(budget) / 1e6, 'f', 3)) },
+        { "used (est.)", QString("%1 MB").arg(QString::number(double(usedBytes()) / 1e6, 'f', 3)) },
+        { "avgBlockBytes", qulonglong(avgBlockBytes) },
+        { "inFlight", qulonglong(inFlight.size()) },
+        { "nextHeight", next },
+        { "headHeight", head },
+        { "nBudgetWaits", qulonglong(nBudgetWaits) },
+        { "nReissued", qulonglong(nReissued) },
+        { "nDupes", qulonglong(nDupes) },
+        { "nLinksChecked", qulonglong(nLinksChecked) },
+        { "brokenAt", brokenAt != std::numeric_limits<unsigned>::max() ? QVariant(brokenAt) : QVariant() },
+    };
+}
+
 struct DownloadBlocksTask : CtlTask
 {
-    DownloadBlocksTask(unsigned from, unsigned to, unsigned stride, unsigned numBitcoinDClients,
+    DownloadBlocksTask(std::shared_ptr<DownloadScheduler> sched, unsigned index, unsigned numBitcoinDClients,
                        int rpaStartHeight/* <0 means disabled*/, Controller *ctl);
     ~DownloadBlocksTask() override { stop(); } // paranoia
     void process() override final;
 
-    const unsigned from = 0, to = 0, stride = 1, expectedCt = 1;
-    unsigned next = 0;
+    const std::shared_ptr<DownloadScheduler> sched;
     std::atomic_uint goodCt = 0;
-    bool maybeDone = false;
+    bool exhausted = false, waitScheduled = false, emittedSuccess = false;
     const bool TRACE = Trace::isEnabled();
 
     int q_ct = 0;
@@ -515,72 +748,62 @@ struct DownloadBlocksTask : CtlTask
 
     void do_get(unsigned height);
 
-    // basically computes expectedCt. Use expectedCt member to get the actual expected ct. this is used only by c'tor as a utility function
-    static size_t nToDL(unsigned from, unsigned to, unsigned stride)  { return size_t( (((to-from)+1) + stride-1) / qMax(stride, 1U) ); }
-    // thread safe, this is a rough estimate and not 100% accurate
-    size_t nSoFar(double prog=-1) const { if (prog<0.) prog = lastProgress; return size_t(qRound(expectedCt * prog)); }
-    // given a position in the headers array, return the height
-    size_t index2Height(size_t index) { return size_t( from + (index * stride) ); }
-    // given a block height, return the index into our array
-    size_t height2Index(size_t h) { return size_t( ((h-from) + stride-1) / stride ); }
+    // thread safe
+    size_t nSoFar() const { return goodCt; }
 protected:
     virtual VarDLTaskResult process_block_guts(unsigned bnum, const QByteArray &rawblock, const bitcoin::CBlock &cblock);
 };
 
-DownloadBlocksTask::DownloadBlocksTask(unsigned from, unsigned to, unsigned stride, unsigned nClients, int rpaHeight, Controller *ctl_)
-    : CtlTask(ctl_, QStringLiteral("Task.DL %1 -> %2").arg(from).arg(to)), from(from), to(to), stride(stride),
-      expectedCt(unsigned(nToDL(from, to, stride))), max_q(int(nClients)+1),
+DownloadBlocksTask::DownloadBlocksTask(std::shared_ptr<DownloadScheduler> sched_, unsigned index, unsigned nClients, int rpaHeight, Controller *ctl_)
+    : CtlTask(ctl_, QStringLiteral("Task.DL %1 -> %2 #%3").arg(sched_->from).arg(sched_->to).arg(index)), sched(std::move(sched_)),
+      max_q(int(nClients)+1),
       allowSegWit(ctl_->isSegWitCoin()), allowMimble(ctl_->isMimbleWimbleCoin()), allowCashTokens(ctl_->isBCHCoin()),
       rpaStartHeight(rpaHeight)
 {
-    FatalAssert( (to >= from) && (ctl_) && (stride > 0), "Invalid params to DonloadBlocksTask c'tor, FIXME!");
-    if (stride > 1 || expectedCt > 1) {
+    FatalAssert( (sched) && (sched->to >= sched->from) && (ctl_), "Invalid params to DonloadBlocksTask c'tor, FIXME!");
+    if (sched->to > sched->from) {
         // tolerate slow request responses (up to 10 mins) if downloading multiple blocks
         // fixes issue #116
         reqTimeout = Options::bdTimeoutMax; // 10 mins
         DebugM(objectName(), ": multi-block download, will use very long RPC request timeout of ",
                QString::number(reqTimeout/1e3, 'f', 1), " sec");
     }
-    next = from;
 }
 
 void DownloadBlocksTask::process()
 {
-    if (next > to) {
-        if (maybeDone) {
-            if (goodCt >= expectedCt)
-                emit success();
-            else {
-                errorCode = int(expectedCt - goodCt);
-                errorMessage = QString("missing %1 blocks").arg(errorCode);
-                emit errored();
-            }
+    if (ctl->isStopping()) return; // short-circuit early return if controller is stopping
+    // Pull as many heights from the scheduler as we have free request slots. If it tells us to back off (memory
+    // budget exhausted, or waiting to see if the remaining blocks need re-issuing), try again later.
+    while (!exhausted && !waitScheduled && q_ct < max_q) {
+        const auto c = sched->claim();
+        if (c.status == DownloadScheduler::Claim::Done) {
+            exhausted = true;
+        } else if (c.status == DownloadScheduler::Claim::Wait) {
+            waitScheduled = true;
+            Util::AsyncOnObject(this, [this]{ waitScheduled = false; process(); }, c.waitMsec, Qt::TimerType::PreciseTimer);
+        } else {
+            ++q_ct;
+            do_get(c.height);
         }
-        return;
     }
-
-    do_get(next);
-    next += stride;
+    if (exhausted && !q_ct && !emittedSuccess) {
+        emittedSuccess = true;
+        emit success();
+    }
 }
 
 void DownloadBlocksTask::do_get(unsigned int bnum)
 {
     if (ctl->isStopping())  return; // short-circuit early return if controller is stopping
-    if (unsigned msec = ctl->downloadTaskRecommendedThrottleTimeMsec(bnum); msec > 0) {
-        // Controller told us to back off because it is backlogged.
-        // Schedule ourselves to run again soon and return.
-        Util::AsyncOnObject(this, [this, bnum]{
-            do_get(bnum);
-        }, msec, Qt::TimerType::PreciseTimer);
-        return;
-    }
     submitRequest("getblockhash", {bnum}, [this, bnum](const RPC::Message & resp){
         QVariant var = resp.result();
         const auto hash = Util::ParseHexFast(var.toByteArray());
         if (hash.length() == HashLen) {
             submitRequest("getblock", {var, false}, [this, bnum, hash](const RPC::Message & resp){
                 try {
-                    auto rawblock = Util::ParseHexFast(resp.result().toByteArray());
+                    // Normally already decoded by the HttpConnection, in its own receive buffer (no copies).
+                    auto rawblock = resp.resultHexDecoded();
                     // Check if this might be a RandomX block based on block height
                     // RandomX blocks are all blocks at or after the activation height
                     const bool isRandomXBlock = BTC::IsRandomXBlock(bnum);
@@ -616,6 +839,19 @@ void DownloadBlocksTask::do_get(unsigned int bnum)
                                         [&](Controller::RpaOnlyModeDataPtr & r) { maybe_rpaOnlyMode = std::move(r); }
                                     }, var);
                             }
+                            if (maybe_ppb) {
+                                // Header verification stage: serialize, hash and check the header here on this worker
+                                // thread, and check its linkage to the neighbouring downloaded headers, so that
+                                // Storage::addBlock need only check that it links to the tip. On failure we leave it
+                                // unprepared and addBlock does (and fails) the full check instead.
+                                QString err;
+                                maybe_ppb->preparedHeader = BTC::HeaderVerifier::prepare(bnum, maybe_ppb->header, &err);
+                                if (!maybe_ppb->preparedHeader)
+                                    DebugM("Header at height ", bnum, " failed pre-verification: ", err);
+                                else if (!sched->headerPrepared(bnum, maybe_ppb->header, maybe_ppb->preparedHeader->hash))
+                                    DebugM("Header at height ", bnum, " does not link to a neighbouring header; the chain"
+                                           " changed during the download");
+                            }
                             if (allowMimble && Debug::isEnabled()) {
                                 // Litecoin only
                                 bool doSerChk{};
@@ -684,10 +920,9 @@ void DownloadBlocksTask::do_get(unsigned int bnum)
                         nOuts += numOuts;
                         nIns += numIns;
 
-                        const size_t index = height2Index(bnum);
                         ++goodCt;
                         q_ct = qMax(q_ct-1, 0);
-                        lastProgress = double(index) / double(expectedCt);
+                        lastProgress = sched->progress();
                         if (!(bnum % 1000) && bnum) {
                             emit progress(lastProgress);
                         }
@@ -702,17 +937,7 @@ void DownloadBlocksTask::do_get(unsigned int bnum)
                             emit ctl->putRpaIndex(this, maybe_rpaOnlyMode);
                         }
 
-                        if (goodCt >= expectedCt) {
-                            // flag state to maybeDone to do checks when process() called again
-                            maybeDone = true;
-                            AGAIN();
-                            return;
-                        }
-                        while (goodCt + unsigned(q_ct) < expectedCt && q_ct < max_q) {
-                            // queue multiple at once
-                            AGAIN();
-                            ++q_ct;
-                        }
+                        AGAIN(); // claim the next height(s) from the scheduler
                     } else if (!sizeOk) {
                         Warning() << resp.method << ": at height " << bnum << " header not valid (decoded size: " << header.length() << ")";
                         errorCode = int(bnum);
@@ -854,6 +1079,7 @@ struct Controller::StateMachine
              endHeight = 0; ///< the final (inclusive) block height we expect to receive to pronounce the synch done
 
     std::atomic<unsigned> dlResultsHtNext = 0;  ///< the next unprocessed block height we need to process in series
+    std::shared_ptr<DownloadScheduler> dlSched; ///< shared with the DownloadBlocksTasks; valid while downloading blocks
 
     // todo: tune this
     const size_t DL_CONCURRENCY = std::max<size_t>(Util::getNPhysicalProcessors(), 1u);
@@ -892,39 +1118,6 @@ struct Controller::StateMachine
     std::optional<Storage::InitialSyncRAII> initialSyncRaii;
 };
 
-unsigned Controller::downloadTaskRecommendedThrottleTimeMsec(unsigned bnum) const
-{
-    std::shared_lock g(smLock); // this lock guarantees that 'sm' won't be deleted from underneath us
-    if (sm) {
-        int maxBackLog = 1000; // <--- TODO: have this be a more dynamic value based on current average blocksize.
-        if (sm->net == BTC::Net::MainNet) {
-            // mainnet
-            if (bnum > 150'000) // beyond this height the blocks are starting to be big enough that we want to not eat memory.
-                maxBackLog = 250;
-            else if (bnum > 550'000 && !isSegWitCoin()) // beyond this height we may start to see 32MB blocks in the future
-                maxBackLog = 100;
-        } else if (sm->net == BTC::ScaleNet) {
-            if (bnum > 10'000)
-                maxBackLog = 10; // on ScaleNet, after block 10,000 -- we may start to hit big blocks.
-        } else if (sm->net == BTC::TestNet4 || sm->net == BTC::ChipNet) {
-            // nothing, use 1000 always, testnet4 & chipnet have 2MB blocks.
-        } else {
-            // testnet
-            if (bnum > 1'300'000) // beyond this height 32MB blocks may be common, esp. in the future
-                maxBackLog = isSegWitCoin() ? 250 : 100;
-        }
-
-        const int diff = int(bnum) - int(sm->dlResultsHtNext.load()); // note: dlResultsHtNext is not guarded by the lock but it is an atomic value, so that's fine.
-        if ( diff > maxBackLog ) {
-            // Make the backoff time be from 10ms to 50ms, depending on how far in the future this block height is from
-            // what we are processing.  The hope is that this enforces some order on future block arrivals and also
-            // prevents excessive polling for blocks that are too far ahead of us.
-            return std::min(10u + 5u*unsigned(diff - maxBackLog - 1), 50u); // TODO: also have this be tuneable
-        }
-    }
-    return 0u;
-}
-
 void Controller::rmTask(CtlTask *t)
 {
     if (auto it = tasks.find(t); it != tasks.end()) {
@@ -936,16 +1129,15 @@ void Controller::rmTask(CtlTask *t)
 
 bool Controller::isTaskDeleted(CtlTask *t) const { return tasks.count(t) == 0; }
 
-CtlTask * Controller::add_DLBlocksTask(unsigned int from, unsigned int to, size_t nTasks, bool isRpaOnlyMode)
+CtlTask * Controller::add_DLBlocksTask(std::shared_ptr<DownloadScheduler> sched, unsigned index, bool isRpaOnlyMode)
 {
     const int rpaStartHeight = storage->getConfiguredRpaStartHeight(); // -1 here means "rpa disabled"
     DownloadBlocksTask *t = [&]() -> DownloadBlocksTask * {
         if (isRpaOnlyMode)
-            return newTask<DownloadBlocksTask_SynchRpa>(false, unsigned(from), unsigned(to), unsigned(nTasks),
-                                                        options->bdNClients, rpaStartHeight, this);
+            return newTask<DownloadBlocksTask_SynchRpa>(false, std::move(sched), index, options->bdNClients,
+                                                        rpaStartHeight, this);
         else
-            return newTask<DownloadBlocksTask>(false, unsigned(from), unsigned(to), unsigned(nTasks),
-                                               options->bdNClients, rpaStartHeight, this);
+            return newTask<DownloadBlocksTask>(false, std::move(sched), index, options->bdNClients, rpaStartHeight, this);
     }();
     // notify BitcoinDMgr that we are in a block download when the first task starts
     connect(t, &CtlTask::started, this, [this]{
@@ -1046,9 +1238,10 @@ bool Controller::checkRpaIndexNeedsSync(int tipHeight)
         sm->lastProgTs = Util::getTimeSecs();
         sm->dlResultsHtNext = sm->startheight = from;
         sm->endHeight = to;
+        sm->dlSched = std::make_shared<DownloadScheduler>(from, to, DownloadScheduler::defaultBudget());
         auto errct = std::make_shared<int>(0); // so that all the error callbacks below to share same state..
         for (size_t i = 0; i < nTasks; ++i) {
-            CtlTask *t = add_DLBlocksTask(from + i, to, nTasks, true);
+            CtlTask *t = add_DLBlocksTask(sm->dlSched, unsigned(i), true);
             // In case DL fails, we need to flag DB as needing a full check, and also retry
             connect(t, &CtlTask::errored, this, [this, errct] {
                 if ((*errct)++) return; // guard to ensure we do this only once if any tasks fail
@@ -1260,8 +1453,9 @@ void Controller::process(bool beSilentIfUpToDate)
         sm->lastProgTs = Util::getTimeSecs();
         sm->dlResultsHtNext = sm->startheight = unsigned(base);
         sm->endHeight = unsigned(sm->ht);
+        sm->dlSched = std::make_shared<DownloadScheduler>(unsigned(base), unsigned(sm->ht), DownloadScheduler::defaultBudget());
         for (size_t i = 0; i < nTasks; ++i) {
-            add_DLBlocksTask(unsigned(base + i), unsigned(sm->ht), nTasks, false);
+            add_DLBlocksTask(sm->dlSched, unsigned(i), false);
         }
         sm->state = State::DownloadingBlocks; // advance state now. we will be called back by download task in on_putBlock()
     } else if (sm->state == State::DownloadingBlocks || sm->state == State::DownloadingBlocks_RPA) {
@@ -1469,6 +1663,10 @@ void Controller::on_putCommon(CtlTask *task, const T &p, const int expectedState
                expectedStateName, "\" (", int(expectedState), ") but rather is: \"", sm->stateStr(), "\" (", int(sm->state), ")");
         return;
     }
+    if (sm->dlSched && !sm->dlSched->downloaded(p->height, DLResultBytes(p))) {
+        DebugM("Ignoring duplicate copy of re-issued block ", p->height);
+        return;
+    }
     sm->dlResults[p->height] = p;
     process_DownloadingBlocks();
 }
@@ -1549,7 +1747,7 @@ void Controller::process_DownloadingBlocks()
 
     for (auto it = sm->dlResults.find(sm->dlResultsHtNext); it != sm->dlResults.end() && !stopFlag; it = sm->dlResults.find(sm->dlResultsHtNext)) {
         auto varDlResult = std::move(it->second);
-        ++sm->dlResultsHtNext;
+        const unsigned height = sm->dlResultsHtNext++;
         sm->dlResults.erase(it); // remove immediately from q
         const bool ok =
         std::visit(Overloaded{
@@ -1583,14 +1781,17 @@ void Controller::process_DownloadingBlocks()
         }, varDlResult);
         if (!ok) return;
         ++ct;
+        if (sm->dlSched) sm->dlSched->committed(height, std::visit([](const auto &p) { return DLResultBytes(p); }, varDlResult));
 
         if (sm->dlResultsHtNext > sm->endHeight) {
+            sm->dlSched.reset(); // the tasks hold the remaining references; they are about to finish
             sm->state = !isRpa ? StateMachine::State::FinishedDL : StateMachine::State::FinishedDL_RPA;
             AGAIN();
             return;
         }
 
     }
+    if (sm->dlSched && !stopFlag) sm->dlSched->headMissing();
 
     // testing debug
     //if (auto backlog = sm->dlResults.size(); backlog < 100 || ct > 100) {
@@ -1711,6 +1912,16 @@ quint64 CtlTask::submitRequest(const QString &method, const QVariantList &params
                                     reqTimeout);
     return id;
 }
+void CtlTask::submitBatch(std::vector<BatchItem> items)
+{
+    for (auto & item : items) {
+        item.id = IdMixin::newId();
+        if (!item.errorF)
+            item.errorF = [this](const RPC::Message &m){ on_error(m); };
+        item.failF = [this](const RPC::Message::Id &id, const QString &msg){ on_failure(id, msg); };
+    }
+    ctl->bitcoindmgr->submitBatch(this, items, reqTimeout);
+}
 
 
 
@@ -1758,12 +1969,12 @@ auto Controller::stats() const -> Stats
                     [&](const PreProcessedBlockPtr &ppb) {
                         backlogBytes += ppb->sizeBytes;
                         backlogTxs += ppb->txInfos.size();
-                        backlogInMemoryBytes += ppb->estimatedThisSizeBytes;
+                        backlogInMemoryBytes += DLResultBytes(ppb);
                     },
                     [&](const RpaOnlyModeDataPtr &romd) {
                         backlogBytes += romd->rawBlockSizeBytes;;
                         backlogTxs += romd->nTx;
-                        backlogInMemoryBytes += romd->serializedPrefixTable.size() + sizeof(*romd);
+                        backlogInMemoryBytes += DLResultBytes(romd);
                     }
                 }, varResult);
             }
@@ -1774,9 +1985,11 @@ auto Controller::stats() const -> Stats
         } else {
             m2["BackLog"] = QVariant(); // null
         }
+        m2["Download scheduler"] = sm->dlSched ? QVariant(sm->dlSched->stats()) : QVariant();
         m["StateMachine"] = m2;
     } else
         m["StateMachine"] = QVariant(); // null
+    m["Mempool prevout resolver"] = SynchMempoolTask::prevoutResolverStats();
     m["activeTimers"] = activeTimerMapForStats();
     QVariantList l;
     { // task list
@@ -1805,6 +2018,9 @@ auto Controller::stats() const -> Stats
     st["Storage"] = storage->statsSafe();
     QVariantMap misc;
     misc["Job Queue (Thread Pool)"] = ::AppThreadPool()->stats();
+    misc["Thread Placement"] = ThreadTopology::stats();
+    if (auto *a = ::app(); a && a->logger())
+        misc["Logger"] = a->logger()->stats();
     st["Misc"] = misc;
     st["SubsMgr"] = storage->subs()->statsSafe(kDefaultTimeout/2);
     st["SubsMgr (DSPs)"] = storage->dspSubs()->statsSafe(kDefaultTimeout/4);
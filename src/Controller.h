@@ -37,8 +37,10 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <utility> // for std::pair
+#include <vector>
 
 class CtlTask;
+class DownloadScheduler;
 class SSLCertMonitor;
 class ZmqSubNotifier;
 
@@ -56,13 +58,6 @@ public:
 
     inline bool isStopping() const { return stopFlag; }
 
-    /// Returns a positive nonzero value if the calling download task should throttle because the backlog is too large.
-    /// In that case the caller should try again in the returned value ms.
-    /// If the return value is 0, the caller may proceed immediately to continue downloading headers.
-    /// This function is not intended to be used by code outside this subsystem -- it is intended to be called by the
-    /// internal DownloadBlocksTask only.
-    unsigned downloadTaskRecommendedThrottleTimeMsec(unsigned forBlockHeight) const;
-
     QVariantMap statsDebug(const QMap<QString, QString> & params) const;
 
     /// Helper for log printing mempool status. Called this instance (from a timer), also called from the SynchMempoolTask
@@ -190,7 +185,7 @@ private:
     std::unordered_map<CtlTask *, std::unique_ptr<CtlTask>, Util::PtrHasher> tasks;
     int nDLBlocksTasks = 0;
 
-    CtlTask * add_DLBlocksTask(unsigned from, unsigned to, size_t nTasks, bool isRpaOnlyMode);
+    CtlTask * add_DLBlocksTask(std::shared_ptr<DownloadScheduler> sched, unsigned index, bool isRpaOnlyMode);
     void process_DownloadingBlocks();
     bool process_VerifyAndAddBlock(PreProcessedBlockPtr); ///< helper called from within DownloadingBlocks state -- makes sure block is sane and adds it to db
     void process_PrintProgress(const QString &verb, unsigned height, size_t nTx, size_t nIns, size_t nOuts, size_t nSH,
@@ -276,6 +271,9 @@ private:
     /// (re)starts all zmq notifiers that have a non-empty lastKnownAddr
     void zmqStartAllKnown();
 
+    /// Creates and starts srvmgr (in header-only mode, or not -- see SrvMgr::setHeadersOnly)
+    void startSrvMgr(bool headersOnly);
+
     /// Stops all notifiers that are running. If cleanup==true also deletes all notifier instances.
     void zmqStopAll(bool cleanup = false);
 
@@ -284,9 +282,6 @@ private:
     /// for that block, until a new block arrives, then is cleared again.
     std::unordered_set<TxHash, HashHasher> mempoolIgnoreTxns;
 
-    /// Used to update the mempool fee histogram early right after the synchedMempool() signal is emitted
-    bool needFeeHistogramUpdate = true;
-
     /// Latched to true as soon as on_coinDetected is called at least once. This allows us to wait until bitcoind tells
     /// us what coin we are connected to before we proceed with initial synch. Also latched to true if we already have
     /// a "coin" defined in storage already.
@@ -357,6 +352,10 @@ protected:
     using ErrorF = BitcoinDMgr::ErrorF;
     quint64 submitRequest(const QString &method, const QVariantList &params, const ResultsF &resultsFunc,
                           const ErrorF &errorFunc = {});
+    using BatchItem = BitcoinDMgr::BatchItem;
+    /// Like calling submitRequest() for each of `items` (whose ids and FailF's are filled-in here, as are any missing
+    /// ErrorF's), except that they are handed to bitcoind together via BitcoinDMgr::submitBatch().
+    void submitBatch(std::vector<BatchItem> items);
 
     Controller * const ctl; ///< initted in c'tor. Is always valid since all tasks' lifecycles are managed by the Controller.
     int reqTimeout; ///< initted in c'tor, cached from ctl->options->bdTimeout. DownloadBlocksTask overrides this with a custom value if doing multi-block DL
@@ -33,7 +33,9 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <deque>
 #include <exception>
 #include <mutex>
 #include <thread>
@@ -43,27 +45,71 @@
 
 /// --- Pre-Cache thread mechanism ---
 /// Precache the confirmed spends with the mempool lock held in shared mode, for concurrency during mempool synch.
+///
+/// Inputs of the downloaded txs are resolved by a small pool of threads, each of which grabs whatever txs are queued
+/// (up to kBatchInputs inputs' worth) and resolves all of their confirmed prevouts in one batch via
+/// Storage::utxoGetManyFromDB() (a single sorted RocksDB MultiGet, after consulting the UTXO cache, if any).
 struct SynchMempoolTask::Precache {
     Precache(SynchMempoolTask &parent_) : parent{parent_} {}
     ~Precache() { stopThread(); /* paranoia */ }
     SynchMempoolTask &parent;
 
+    static constexpr size_t kBatchInputs = 1024; ///< target number of inputs per MultiGet
+    static constexpr size_t kInputsPerThread = 4096; ///< don't start more threads than expected inputs / this
+    static constexpr unsigned kMaxThreads = 4;
+
     using ConfirmedSpendCache = std::unordered_map<TXO, std::optional<TXOInfo>>;
-    ConfirmedSpendCache cache; ///< written-to by the precache thread, when done, read by parent object in processResults()
+    ConfirmedSpendCache cache; ///< populated from `partials` by waitUntilDone(), read by parent object in processResults()
+    std::vector<ConfirmedSpendCache> partials; ///< one per thread, written-to only by that thread
+    Mempool::TxHashSet tentativeMempoolTxHashes; ///< read-only while the threads are running
     std::condition_variable cond;
     std::mutex mut;
-    std::vector<bitcoin::CTransactionRef> workQueue; ///< guarded by mut, signaled by cond
+    std::deque<bitcoin::CTransactionRef> workQueue; ///< guarded by mut, signaled by cond
     std::atomic_bool stopFlag = false, doneSubmittingWorkFlag = false, threadIsRunning = false;
-    std::thread thread;
+    std::vector<std::thread> threads;
     std::atomic_bool didErrorOut = false;
 
+    /// Counters for this run, summed over all threads.
+    std::atomic<size_t> nInputs{0u}, nResolved{0u}, nFromCache{0u}, nBatches{0u}, maxBatch{0u};
+    std::atomic<int64_t> lookupNanos{0};
+    size_t nThreads = 0u;
+    Tic tStart;
+
+    bool isRunning() const { return !threads.empty(); }
     void startThread(size_t reserve, Mempool::TxHashSet tentativeMempoolTxHashes);
     [[nodiscard]] bool waitUntilDone();
     void stopThread();
     void submitWork(const bitcoin::CTransactionRef &tx);
-    void threadFunc(size_t reserve, Mempool::TxHashSet tentativeMempoolTxHashes);
+    void threadFunc(size_t index);
+    void publishStats();
 };
 
+namespace {
+    /// Stats of the most recent Precache run, plus lifetime totals, for SynchMempoolTask::prevoutResolverStats().
+    struct PrevoutStats {
+        std::mutex mut;
+        QVariantMap last;
+        uint64_t totInputs = 0u, totResolved = 0u, totFromCache = 0u, totBatches = 0u;
+        double totSecs = 0.;
+    };
+    PrevoutStats & prevoutStats() { static PrevoutStats st; return st; }
+} // namespace
+
+QVariantMap SynchMempoolTask::prevoutResolverStats()
+{
+    auto & st = prevoutStats();
+    std::unique_lock g(st.mut);
+    QVariantMap ret;
+    ret["last run"] = st.last.isEmpty() ? QVariant() : QVariant(st.last);
+    ret["total inputs"] = qulonglong(st.totInputs);
+    ret["total resolved"] = qulonglong(st.totResolved);
+    ret["total from utxo cache"] = qulonglong(st.totFromCache);
+    ret["total batches"] = qulonglong(st.totBatches);
+    ret["avg batch size"] = st.totBatches ? std::round(double(st.totResolved) / double(st.totBatches) * 10.) / 10. : 0.;
+    ret["total secs"] = std::round(st.totSecs * 1e3) / 1e3;
+    return ret;
+}
+
 SynchMempoolTask::SynchMempoolTask(Controller *ctl_, std::shared_ptr<Storage> storage, const std::atomic_bool & notifyFlag,
                                    const std::unordered_set<TxHash, HashHasher> & ignoreTxns)
     : CtlTask(ctl_, "SynchMempool"), storage(storage), notifyFlag(notifyFlag),
@@ -112,43 +158,65 @@ void SynchMempoolTask::clear() {
     // Note 4: we never clear txidsAffected
 }
 
-void SynchMempoolTask::Precache::startThread(const size_t reserve, Mempool::TxHashSet tentativeMempoolTxHashes)
+void SynchMempoolTask::Precache::startThread(const size_t reserve, Mempool::TxHashSet tentativeMempoolTxHashes_)
 {
     stopThread();
+    tentativeMempoolTxHashes = std::move(tentativeMempoolTxHashes_);
+    // `reserve` is the number of txs we expect; assume ~2.5 inputs each to decide how many threads are worth it
+    const unsigned hwThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    nThreads = std::clamp<size_t>(reserve * 5u / 2u / kInputsPerThread, 1u, std::min(kMaxThreads, hwThreads));
+    partials.resize(nThreads);
+    for (auto & c : partials)
+        if (const size_t n = reserve * 5u / 2u / nThreads; n > c.bucket_count()) c.reserve(n);
+    tStart = Tic();
     threadIsRunning = true;
-    thread = std::thread([this, reserve, txHashes = std::move(tentativeMempoolTxHashes)]() mutable {
-        Defer d([this]{ threadIsRunning = false; });
-        threadFunc(reserve, std::move(txHashes));
-    });
+    threads.reserve(nThreads);
+    for (size_t i = 0; i < nThreads; ++i)
+        threads.emplace_back([this, i] { threadFunc(i); });
 }
 
 void SynchMempoolTask::Precache::stopThread()
 {
-    if (thread.joinable()) {
+    if (!threads.empty()) {
         {
             std::unique_lock g(mut);
             stopFlag = true;
         }
         cond.notify_all();
-        thread.join();
+        for (auto & t : threads) t.join();
+        threads.clear();
     }
     std::unique_lock g(mut); // keep TSAN happy
     doneSubmittingWorkFlag = stopFlag = threadIsRunning = didErrorOut = false;
     workQueue.clear();
+    partials.clear();
+    tentativeMempoolTxHashes.clear();
+    nInputs = nResolved = nFromCache = nBatches = maxBatch = 0u;
+    lookupNanos = 0;
 }
 
 bool SynchMempoolTask::Precache::waitUntilDone()
 {
-    if (thread.joinable()) {
+    if (!threads.empty()) {
         Tic t0;
         {
             std::unique_lock g(mut);
             doneSubmittingWorkFlag = true;
         }
         cond.notify_all();
-        thread.join();
+        for (auto & t : threads) t.join();
+        threads.clear();
+        threadIsRunning = false;
         if (const double el = t0.msec<double>(); el >= 500.)
-            DebugM("Waited ", QString::number(el, 'f', 3), " msec for precache thread to finish");
+            DebugM("Waited ", QString::number(el, 'f', 3), " msec for precache threads to finish");
+        if (!didErrorOut) {
+            // gather up the per-thread results; start from the biggest to move the fewest nodes
+            std::sort(partials.begin(), partials.end(), [](const auto &a, const auto &b) { return a.size() > b.size(); });
+            if (!partials.empty()) cache = std::move(partials.front());
+            for (size_t i = 1; i < partials.size(); ++i) cache.merge(partials[i]);
+            partials.clear();
+            publishStats();
+        }
     }
     return !didErrorOut;
 }
@@ -163,11 +231,11 @@ void SynchMempoolTask::Precache::submitWork(const bitcoin::CTransactionRef &tx)
     cond.notify_one();
 }
 
-void SynchMempoolTask::Precache::threadFunc(const size_t reserve, const Mempool::TxHashSet tentativeMempoolTxHashes)
+void SynchMempoolTask::Precache::threadFunc(const size_t index)
 {
-    Util::ThreadName::Set("SyncMempoolPreCache");
+    Defer d0([this]{ cond.notify_all(); }); // wake up siblings in case we exit early on error
+    Util::ThreadName::Set(QString("SyncMempoolPreCache.%1").arg(index));
     static auto constexpr funcName = "SynchMempoolTask::Precache::threadFunc";
-    didErrorOut = false;
     DebugM("Thread started");
     size_t tot = 0u, ctr = 0u;
     Tic t0;
@@ -176,56 +244,109 @@ void SynchMempoolTask::Precache::threadFunc(const size_t reserve, const Mempool:
         DebugM("Precached ", ctr, "/" , tot, " inputs in ", t0.msecStr(), " msec, of which ",
                QString::number(tProc, 'f', 3), " msec was spent processing, thread exiting.");
     });
-    if (reserve && reserve < cache.bucket_count()) cache.reserve(reserve);
-    auto pred = [this] { return !workQueue.empty() || stopFlag.load() || doneSubmittingWorkFlag.load(); };
+    auto & myCache = partials[index];
+    const auto Fail = [this] {
+        if (!didErrorOut.exchange(true))
+            emit parent.errored();
+    };
+    auto pred = [this] { return !workQueue.empty() || stopFlag.load() || doneSubmittingWorkFlag.load() || didErrorOut.load(); };
     std::vector<bitcoin::CTransactionRef> txns;
-    while (!stopFlag) {
+    std::vector<TXO> txos;
+    std::vector<const bitcoin::CTransaction *> txoTxns; ///< parallel to `txos`, for error messages
+    while (!stopFlag && !didErrorOut) {
         txns.clear();
         {
             std::unique_lock g(mut);
             while ( ! cond.wait_for(g, std::chrono::seconds{1}, pred)) {} // paranoia: loop in a wait_for just in case future updates to code introduce lost cond signaling
-            txns.swap(workQueue);
-            if (stopFlag) return;
+            if (stopFlag || didErrorOut) return;
+            // take up to a batch's worth of inputs, leaving the rest for our siblings
+            size_t nIns = 0u;
+            while (!workQueue.empty() && nIns < kBatchInputs) {
+                nIns += workQueue.front()->vin.size();
+                txns.push_back(std::move(workQueue.front()));
+                workQueue.pop_front();
+            }
+            if (!workQueue.empty()) cond.notify_one(); // more work remains, wake a sibling
         }
         // If finished processing work, exit thread.
         if (doneSubmittingWorkFlag && txns.empty()) return;
         // Otherwise process enqueued precache lookups
         Tic t1;
+        txos.clear();
+        txoTxns.clear();
+        const size_t totBefore = tot;
         for (const auto & tx : txns) {
             for (const auto & in : tx->vin) {
-                const TXO txo{BTC::Hash2ByteArrayRev(in.prevout.GetTxId()), IONum(in.prevout.GetN())};
+                TXO txo{BTC::Hash2ByteArrayRev(in.prevout.GetTxId()), IONum(in.prevout.GetN())};
                 ++tot;
                 if (tentativeMempoolTxHashes.contains(txo.txHash))
                     continue; // unconfirmed spend, we don't pre-cache this, continue
-                // if doesn't appear to be in mempool, look it up in the db and cache the resulting answer
-                // may throw on very low level db error; returns nullopt if not found (may be not found for mempool txn)
-                try {
-                    // we intentionally use unordered_map::operator[] here to overwrite existing (if any)
-                    const auto & opt = cache[txo] = parent.storage->utxoGetFromDB(txo, false);
-                    if (!opt.has_value()) {
-                        // Potential race-condition with bitcoind confirming blocks before we realized it,
-                        // and then a mempool txn appearing refering to a txn that was block-only.
-                        // Signal error and on retry things should settle ok.
-                        Warning() << funcName << ": Unable to find prevout " << txo.toString()
-                                  << " in DB for tx " << tx->GetId().ToString()
-                                  << " (possibly a block arrived while synching mempool, will retry)";
-                        didErrorOut = true;
-                        emit parent.errored();
-                        return;
-                    }
-                    ++ctr;
-                } catch (const std::exception & e) {
-                    Error() << funcName << ": Got low-level DB error retrieving " << txo.toString() << ": " << e.what();
-                    didErrorOut = true;
-                    emit parent.errored();
+                txos.push_back(std::move(txo));
+                txoTxns.push_back(tx.get());
+            }
+        }
+        nInputs += tot - totBefore;
+        if (txos.empty()) { tProc += t1.msec<double>(); continue; }
+        // if doesn't appear to be in mempool, look it up in the db and cache the resulting answer
+        // may throw on very low level db error; returns nullopt if not found (may be not found for mempool txn)
+        try {
+            size_t fromCache = 0u;
+            const int64_t tL0 = Util::getTimeNS();
+            auto results = parent.storage->utxoGetManyFromDB(txos, &fromCache);
+            lookupNanos += Util::getTimeNS() - tL0;
+            for (size_t i = 0; i < txos.size(); ++i) {
+                if (!results[i].has_value()) {
+                    // Potential race-condition with bitcoind confirming blocks before we realized it,
+                    // and then a mempool txn appearing refering to a txn that was block-only.
+                    // Signal error and on retry things should settle ok.
+                    Warning() << funcName << ": Unable to find prevout " << txos[i].toString()
+                              << " in DB for tx " << txoTxns[i]->GetId().ToString()
+                              << " (possibly a block arrived while synching mempool, will retry)";
+                    Fail();
                     return;
                 }
+                // we intentionally use unordered_map::operator[] here to overwrite existing (if any)
+                myCache[std::move(txos[i])] = std::move(results[i]);
             }
+            ctr += txos.size();
+            nResolved += txos.size();
+            nFromCache += fromCache;
+            ++nBatches;
+            for (size_t m = maxBatch; txos.size() > m && !maxBatch.compare_exchange_weak(m, txos.size()); ) {}
+        } catch (const std::exception & e) {
+            Error() << funcName << ": Got low-level DB error retrieving " << txos.size() << " prevouts: " << e.what();
+            Fail();
+            return;
         }
         tProc += t1.msec<double>();
     }
 }
 
+void SynchMempoolTask::Precache::publishStats()
+{
+    if (!nInputs) return;
+    const double secs = tStart.secs<double>(), lookupSecs = lookupNanos / 1e9;
+    QVariantMap m;
+    m["inputs"] = qulonglong(nInputs.load());
+    m["resolved"] = qulonglong(nResolved.load());
+    m["from utxo cache"] = qulonglong(nFromCache.load());
+    m["batches"] = qulonglong(nBatches.load());
+    m["avg batch size"] = nBatches ? std::round(double(nResolved) / double(nBatches) * 10.) / 10. : 0.;
+    m["max batch size"] = qulonglong(maxBatch.load());
+    m["threads"] = qulonglong(nThreads);
+    m["elapsed secs"] = std::round(secs * 1e3) / 1e3;
+    m["lookup secs"] = std::round(lookupSecs * 1e3) / 1e3;
+    m["resolved/sec (lookup time)"] = lookupSecs > 0. ? std::round(double(nResolved) / lookupSecs) : 0.;
+    auto & st = prevoutStats();
+    std::unique_lock g(st.mut);
+    st.last = std::move(m);
+    st.totInputs += nInputs;
+    st.totResolved += nResolved;
+    st.totFromCache += nFromCache;
+    st.totBatches += nBatches;
+    st.totSecs += lookupSecs;
+}
+
 void SynchMempoolTask::stop()
 {
     CtlTask::stop(); // call superclass
@@ -405,6 +526,8 @@ void SynchMempoolTask::doDLNextTx()
     }
     const size_t chunkSize = maxDLBacklogSize - txsWaitingForResponse.size();
     const size_t nIters = std::min<size_t>(chunkSize, txsNeedingDownload.size());
+    std::vector<BatchItem> batch; // the whole chunk goes to bitcoind together, as one JSON-RPC batch if batching is on
+    batch.reserve(nIters);
     for (size_t i = 0; i < nIters; ++i) {
         Mempool::TxRef tx;
         if (auto it = txsNeedingDownload.begin(); UNLIKELY(it == txsNeedingDownload.end())) {
@@ -418,7 +541,7 @@ void SynchMempoolTask::doDLNextTx()
         assert(bool(tx));
         const auto hashHex = Util::ToHexFast(tx->hash);
         txsWaitingForResponse.emplace(tx->hash, tx);
-        submitRequest("getrawtransaction", {hashHex, false}, [this, hashHex, tx, t0 = Tic()](const RPC::Message & resp){
+        batch.push_back({{}, "getrawtransaction", {hashHex, false}, [this, hashHex, tx, t0 = Tic()](const RPC::Message & resp){
             if (TRACE)
                 DebugM(resp.method, ": got reply for ", QString::fromLatin1(hashHex).left(8), " in ", t0.msecStr(), " msec",
                        ", needDL: ", txsNeedingDownload.size(), ", waitingForResp: ", txsWaitingForResponse.size());
@@ -538,8 +661,9 @@ void SynchMempoolTask::doDLNextTx()
             }
             // otherwise, keep going (do a direct call for better performance, rather than calling AGAIN)
             process();
-        });
+        }});
     }
+    submitBatch(std::move(batch));
 }
 
 void SynchMempoolTask::processResults()
@@ -558,13 +682,13 @@ void SynchMempoolTask::processResults()
 
     // precache of the confirmed spends done in another thread, wait for it to complete now
     if (!txsDownloaded.empty()) {
-        if (!precache->thread.joinable()) {
-            Error() << __PRETTY_FUNCTION__ << ": precache->thread should be running -- FIXME!";
+        if (!precache->isRunning()) {
+            Error() << __PRETTY_FUNCTION__ << ": precache threads should be running -- FIXME!";
             emit errored();
             return;
         }
         if (!precache->waitUntilDone()) {
-            Error() << __func__ << ": precache->thread errored out, aborting SynchMempoolTask";
+            Error() << __func__ << ": precache threads errored out, aborting SynchMempoolTask";
             emit errored();
             return;
         }
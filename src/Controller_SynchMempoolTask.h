@@ -39,6 +39,10 @@ struct SynchMempoolTask final : public CtlTask
     ~SynchMempoolTask() override;
     void process() override;
 
+    /// Thread-safe. Returns stats on the resolution of confirmed prevouts for new mempool txs: the most recent run
+    /// (inputs, batch sizes, inputs/sec) as well as lifetime totals. Used by Controller::stats().
+    static QVariantMap prevoutResolverStats();
+
 protected:
     void stop() override;
 
@@ -86,7 +90,7 @@ private:
     /// Update the lastProgress stat for /stats endpoint
     void updateLastProgress(std::optional<double> val = std::nullopt);
 
-    // Parallel pre-cacher of confirmed utxo spends
+    // Parallel, batched pre-cacher of confirmed utxo spends
     struct Precache;
     friend struct SynchMempoolTask::Precache;
     std::unique_ptr<Precache> precache;
@@ -32,6 +32,7 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <QString>
 #include <QVariant>
 
+#include <cstdint>
 #include <optional>
 #include <stdexcept>
 #include <vector>
@@ -112,6 +113,31 @@ namespace Json {
     /// May throw NestingLimitExceeded if the supplied QVariant has a recursive nesting depth larger than 1024.
     extern qsizetype estimateMemoryFootprint(const QVariant &);
 
+    /// A JSON-RPC request (or notification) object as decoded by parseRpcRequests(). This is a Fulcrum extension.
+    struct RpcRequest {
+        enum class IdType : uint8_t { Absent, Null, Int, String };
+        IdType idType = IdType::Absent;
+        qint64 idInt = 0;           ///< valid if idType == Int
+        QString idString;           ///< valid if idType == String
+        QString method;             ///< always present (objects lacking a string "method" are not decoded)
+        bool hasJsonRpc = false, hasParams = false;
+        QString jsonrpc;            ///< valid if hasJsonRpc
+        QVariantList params;        ///< valid if hasParams; each item is a QString, qlonglong, qulonglong, bool or null
+    };
+
+    struct RpcRequests {
+        std::vector<RpcRequest> requests;
+        bool isBatch = false; ///< true if the JSON was an array of request objects, false if it was a single object
+    };
+
+    /// Decodes `json` straight into typed RpcRequest objects, without building a QVariant tree for it first. Only
+    /// handles the common shape: a request object (or if `allowBatch`, a non-empty array of them) having only the keys
+    /// "jsonrpc", "id", "method" (a string) and optionally "params" (an array of strings, integers, bools or nulls).
+    /// Returns an empty optional for anything else, including malformed JSON, in which case the caller should fall
+    /// back to parseUtf8() (which also produces the proper error). Always uses the SimdJson backend, and throws
+    /// ParserUnavailable if it is not available. This is a Fulcrum extension.
+    extern std::optional<RpcRequests> parseRpcRequests(const QByteArray &json, bool allowBatch);
+
     // --
     // -- Below are extra utility and other functions for querying the simdjson impl, checking the locale, etc.
     // --
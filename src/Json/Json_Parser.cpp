@@ -25,6 +25,7 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 #include "Json.h"
 
+#include <QHash>
 #include <QMetaType>
 #include <QtDebug>
 #include <QVariant>
@@ -37,6 +38,8 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <memory>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -1011,6 +1014,122 @@ bool sjParse(QVariant &out, const QByteArray &bytes)
 } // namespace
 } // namespace detail
 
+namespace {
+#if HAVE_SIMDJSON
+/// Returns a shared copy of the QString for `sv`. Used for the strings that repeat from request to request ("2.0",
+/// method names), so that decoding them is usually allocation-free. The per-thread cache is bounded so that a peer
+/// sending random method names can't grow it without limit.
+QString internedString(std::string_view sv)
+{
+    constexpr int maxLen = 64, maxEntries = 256;
+    if (sv.size() > size_t(maxLen))
+        return QString::fromUtf8(sv.data(), qsizetype(sv.size()));
+    thread_local QHash<QByteArray, QString> cache;
+    if (const auto it = cache.constFind(QByteArray::fromRawData(sv.data(), qsizetype(sv.size()))); it != cache.cend())
+        return it.value();
+    QString ret = QString::fromUtf8(sv.data(), qsizetype(sv.size()));
+    if (cache.size() < maxEntries)
+        cache.insert(QByteArray(sv.data(), qsizetype(sv.size())), ret); // deep copy of the key
+    return ret;
+}
+
+/// Returns false if `e` is not a request object of the shape parseRpcRequests() handles.
+bool sjDecodeRpcRequest(const simdjson::dom::element &e, RpcRequest &r)
+{
+    using T = simdjson::dom::element_type;
+    if (e.type() != T::OBJECT) return false;
+    bool hasId = false, hasMethod = false;
+    const simdjson::dom::object obj = e.get_object().value(); // by value: value() on a temporary returns T&&
+    for (auto && [k, v] : obj) {
+        if (k == "id") {
+            if (hasId) return false; // duplicate keys are left to the general parser
+            hasId = true;
+            switch (v.type()) {
+            case T::NULL_VALUE: r.idType = RpcRequest::IdType::Null; break;
+            case T::INT64: r.idType = RpcRequest::IdType::Int; r.idInt = v.get_int64().value(); break;
+            case T::STRING: {
+                const std::string_view sv = v.get_string().value();
+                r.idType = RpcRequest::IdType::String;
+                r.idString = QString::fromUtf8(sv.data(), qsizetype(sv.size()));
+                break;
+            }
+            default: return false; // uint64, double, bool, etc: let the general path accept or reject it
+            }
+        } else if (k == "method") {
+            if (hasMethod || v.type() != T::STRING) return false;
+            hasMethod = true;
+            r.method = internedString(v.get_string().value());
+        } else if (k == "jsonrpc") {
+            if (r.hasJsonRpc || v.type() != T::STRING) return false;
+            r.hasJsonRpc = true;
+            r.jsonrpc = internedString(v.get_string().value());
+        } else if (k == "params") {
+            if (r.hasParams || v.type() != T::ARRAY) return false;
+            r.hasParams = true;
+            const auto arr = v.get_array().value();
+            r.params.reserve(qsizetype(arr.size()));
+            for (const auto & p : arr) {
+                switch (p.type()) {
+                case T::STRING: {
+                    const std::string_view sv = p.get_string().value();
+                    r.params.push_back(QString::fromUtf8(sv.data(), qsizetype(sv.size())));
+                    break;
+                }
+                case T::INT64: r.params.push_back(static_cast<qlonglong>(p.get_int64().value())); break;
+                case T::UINT64: r.params.push_back(static_cast<qulonglong>(p.get_uint64().value())); break;
+                case T::BOOL: r.params.push_back(p.get_bool().value()); break;
+                case T::NULL_VALUE: r.params.push_back(QVariant{}); break;
+                default: return false; // nested containers and doubles take the general path
+                }
+            }
+        } else {
+            return false; // "result", "error", or unknown keys
+        }
+    }
+    return hasMethod;
+}
+#endif
+} // namespace
+
+std::optional<RpcRequests> parseRpcRequests(const QByteArray &json, bool allowBatch)
+{
+    std::optional<RpcRequests> ret;
+#if HAVE_SIMDJSON
+    // Reuse the parser's internal buffers across calls on the same thread, so that the common case of many smallish
+    // request lines doesn't allocate. Huge payloads get a one-off parser so as to not pin their memory forever.
+    constexpr qsizetype maxReusedParserCapacity = 64 * 1024;
+    thread_local simdjson::dom::parser reusedParser;
+    std::unique_ptr<simdjson::dom::parser> oneOff;
+    simdjson::dom::parser *parser = &reusedParser;
+    if (json.size() > maxReusedParserCapacity)
+        parser = (oneOff = std::make_unique<simdjson::dom::parser>()).get();
+    simdjson::dom::element root;
+    // If the QByteArray happens to have enough slack after its end, simdjson can read it in place without copying.
+    const bool padded = json.capacity() - json.size() >= qsizetype(simdjson::SIMDJSON_PADDING);
+    if (parser->parse(json.constData(), size_t(json.size()), !padded).get(root))
+        return ret; // malformed; the general parser will produce the error message
+    RpcRequests reqs;
+    if (root.type() == simdjson::dom::element_type::ARRAY) {
+        if (!allowBatch) return ret;
+        const auto arr = root.get_array().value();
+        if (arr.size() == 0) return ret;
+        reqs.isBatch = true;
+        reqs.requests.resize(arr.size());
+        size_t i = 0;
+        for (const auto & e : arr)
+            if (!sjDecodeRpcRequest(e, reqs.requests[i++]))
+                return ret;
+    } else if (!sjDecodeRpcRequest(root, reqs.requests.emplace_back())) {
+        return ret;
+    }
+    ret = std::move(reqs);
+#else
+    (void)json; (void)allowBatch;
+    throw ParserUnavailable("Json Error: The SimdJson parser is not available");
+#endif
+    return ret;
+}
+
 namespace SimdJson {
 std::optional<const Info> getInfo()
 {
@@ -18,12 +18,18 @@
 //
 #include "Common.h"
 #include "Logger.h"
+#include "Util.h"
 
 #include <QCoreApplication>
 #include <QTimer>
 
+#include <bit>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
+#include <mutex>
+#include <thread>
 
 #ifdef Q_OS_UNIX
 #  include <stdio.h>   // fileno
@@ -53,11 +59,22 @@ Logger::Logger(QObject *parent) : QObject(parent)
     connect(this, &Logger::log, this, [this](int level, const QString &line){
         // we do it in a closure because in this c'tor gotLine isn't defined yet (pure virtual)
         gotLine(level, line);
+        ++nLinesWritten;
     });
 }
 
 Logger::~Logger() {}
 
+void Logger::submit(int level, QString && line) { emit log(level, line); }
+
+QVariantMap Logger::stats() const
+{
+    return QVariantMap{
+        { "mode", "synchronous" },
+        { "records written", qulonglong(nLinesWritten.load(std::memory_order_relaxed)) },
+    };
+}
+
 ConsoleLogger::ConsoleLogger(QObject *p, bool stdOut_)
     : Logger(p), stdOut(stdOut_), isATty(calcIsATty(stdOut_))
 {}
@@ -121,3 +138,234 @@ void SysLogger::gotLine(int level, const QString &l)
     loggerCommon(level, l);
 }
 #endif
+
+// --- AsyncLogger
+struct AsyncLogger::Impl
+{
+    struct Record {
+        int level = 0;
+        QString line;
+    };
+
+    /// Bounded MPSC ring buffer (D. Vyukov's bounded queue, with the consumer side simplified since there is only ever
+    /// 1 consumer: the writer thread). Each cell carries a sequence number which tells producers and the consumer
+    /// whether the cell is free, or whether it is ready to be consumed.
+    struct Cell {
+        std::atomic<std::size_t> seq;
+        Record rec;
+    };
+
+    const std::unique_ptr<Logger> sink;
+    const std::size_t capacity, mask;
+    const OverflowPolicy policy;
+    const std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<std::size_t> enqueuePos{0};
+    alignas(64) std::size_t dequeuePos = 0; ///< only touched by the writer thread
+
+    // counters
+    std::atomic<std::uint64_t> nSubmitted{0}, nWritten{0}, nDropped{0}, nBlocked{0}, nSyncWrites{0};
+    std::atomic<std::size_t> highWater{0};
+    const qint64 tStart = Util::getTimeNS();
+    mutable std::mutex statsMut;
+    mutable qint64 tLastStats = tStart;
+    mutable std::uint64_t nWrittenLastStats = 0;
+
+    // wake-up machinery
+    std::mutex mut;
+    std::condition_variable condNotEmpty, condNotFull;
+    std::atomic_bool writerSleeping{false}, stopFlag{false}, stopped{false};
+    std::atomic<unsigned> nBlockedProducers{0};
+    std::mutex syncMut; ///< guards writes to the sink that happen outside the writer thread (after it has stopped)
+    std::thread thread;
+    static thread_local bool isWriterThread;
+
+    Impl(std::unique_ptr<Logger> && s, std::size_t cap, OverflowPolicy pol)
+        : sink(std::move(s)), capacity(std::bit_ceil(std::max<std::size_t>(cap, 2))), mask(capacity - 1), policy(pol),
+          cells(std::make_unique<Cell[]>(capacity))
+    {
+        for (std::size_t i = 0; i < capacity; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        thread = std::thread([this]{ threadFunc(); });
+    }
+
+    ~Impl() { stop(); }
+
+    bool tryPush(Record & r) {
+        Cell *cell;
+        std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & mask];
+            const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            const auto dif = std::intptr_t(seq) - std::intptr_t(pos);
+            if (dif == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0)
+                return false; // full
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+        cell->rec = std::move(r);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        if (const auto depth = pos + 1 - std::min(pos + 1, dequeuePosApprox()); depth > highWater.load(std::memory_order_relaxed))
+            highWater.store(depth, std::memory_order_relaxed); // racy but good enough for stats
+        return true;
+    }
+
+    // Writer thread only
+    bool tryPop(Record & r) {
+        Cell & cell = cells[dequeuePos & mask];
+        const std::size_t seq = cell.seq.load(std::memory_order_acquire);
+        if (std::intptr_t(seq) - std::intptr_t(dequeuePos + 1) < 0)
+            return false; // empty
+        r = std::move(cell.rec);
+        cell.rec.line = QString(); // release memory now rather than when this cell is next reused
+        cell.seq.store(dequeuePos + capacity, std::memory_order_release);
+        lastDequeuePos.store(++dequeuePos, std::memory_order_relaxed);
+        return true;
+    }
+    std::atomic<std::size_t> lastDequeuePos{0}; ///< published copy of dequeuePos, for stats only
+    std::size_t dequeuePosApprox() const { return lastDequeuePos.load(std::memory_order_relaxed); }
+
+    // Writer thread only
+    bool isEmpty() const {
+        return std::intptr_t(cells[dequeuePos & mask].seq.load(std::memory_order_acquire)) - std::intptr_t(dequeuePos + 1) < 0;
+    }
+
+    void writeToSink(const Record & r) {
+        sink->gotLine(r.level, r.line);
+        nWritten.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void push(int level, QString && line) {
+        nSubmitted.fetch_add(1, std::memory_order_relaxed);
+        if (stopped.load(std::memory_order_acquire) || isWriterThread) {
+            // Writer thread is gone (or it is the writer thread itself that is logging): write synchronously.
+            nSyncWrites.fetch_add(1, std::memory_order_relaxed);
+            std::unique_lock g(syncMut);
+            writeToSink(Record{level, std::move(line)});
+            return;
+        }
+        Record r{level, std::move(line)};
+        if (!tryPush(r)) {
+            if (policy == OverflowPolicy::Drop && level != Logger::Level::Fatal) {
+                nDropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            // Block until there is room
+            nBlocked.fetch_add(1, std::memory_order_relaxed);
+            ++nBlockedProducers;
+            Defer d([this]{ --nBlockedProducers; });
+            for (unsigned spins = 0; !tryPush(r); ++spins) {
+                wakeWriter(true);
+                if (spins < 64) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::unique_lock g(mut);
+                condNotFull.wait_for(g, std::chrono::milliseconds(10));
+            }
+        }
+        wakeWriter();
+    }
+
+    void wakeWriter(bool force = false) {
+        // Pairs with the fence in threadFunc() -- either the writer sees our push, or we see that it is sleeping.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (force || writerSleeping.load(std::memory_order_relaxed)) {
+            std::unique_lock g(mut);
+            condNotEmpty.notify_one();
+        }
+    }
+
+    void threadFunc() {
+        Util::ThreadName::Set(QStringLiteral("AsyncLogger"));
+        isWriterThread = true;
+        Record r;
+        for (;;) {
+            std::size_t n = 0;
+            while (tryPop(r)) {
+                writeToSink(r);
+                ++n;
+                // Periodically let blocked producers proceed
+                if (!(n % 64) && nBlockedProducers.load(std::memory_order_relaxed))
+                    condNotFull.notify_all();
+            }
+            if (n && nBlockedProducers.load(std::memory_order_relaxed)) {
+                std::unique_lock g(mut);
+                condNotFull.notify_all();
+            }
+            if (stopFlag.load(std::memory_order_acquire) && isEmpty())
+                break;
+            std::unique_lock g(mut);
+            writerSleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // The timeout is a safety net only; producers wake us up if we are sleeping.
+            condNotEmpty.wait_for(g, std::chrono::milliseconds(100), [this]{
+                return stopFlag.load(std::memory_order_relaxed) || !isEmpty();
+            });
+            writerSleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void stop() {
+        if (stopped.load()) return;
+        {
+            std::unique_lock g(mut);
+            stopFlag = true;
+            condNotEmpty.notify_one();
+        }
+        if (thread.joinable()) thread.join();
+        stopped = true;
+        // Drain anything that may have raced in after the writer thread's last check.
+        std::unique_lock g(syncMut);
+        for (Record r; tryPop(r); )
+            writeToSink(r);
+    }
+};
+
+/* static */ thread_local bool AsyncLogger::Impl::isWriterThread = false;
+
+AsyncLogger::AsyncLogger(std::unique_ptr<Logger> sink, std::size_t capacity, OverflowPolicy policy, QObject *parent)
+    : Logger(parent)
+{
+    if (!sink) throw BadArgs("AsyncLogger: sink may not be nullptr");
+    sink->setParent(nullptr); // we own it now
+    p = std::make_unique<Impl>(std::move(sink), capacity, policy);
+}
+
+AsyncLogger::~AsyncLogger() { p.reset(); /* flushes & joins writer thread */ }
+
+bool AsyncLogger::isaTTY() const { return p->sink->isaTTY(); }
+
+void AsyncLogger::submit(int level, QString && line) { p->push(level, std::move(line)); }
+
+void AsyncLogger::gotLine(int level, const QString &line) { p->push(level, QString(line)); }
+
+QVariantMap AsyncLogger::stats() const
+{
+    const qint64 now = Util::getTimeNS();
+    const auto nWritten = p->nWritten.load(std::memory_order_relaxed);
+    double recentRate = 0.;
+    {
+        std::unique_lock g(p->statsMut);
+        if (const qint64 el = now - p->tLastStats; el > 0)
+            recentRate = double(nWritten - p->nWrittenLastStats) / (el / 1e9);
+        p->tLastStats = now;
+        p->nWrittenLastStats = nWritten;
+    }
+    const auto enq = p->enqueuePos.load(std::memory_order_relaxed), deq = p->dequeuePosApprox();
+    return QVariantMap{
+        { "mode", "asynchronous" },
+        { "overflow policy", p->policy == OverflowPolicy::Drop ? "drop" : "block" },
+        { "queue capacity", qulonglong(p->capacity) },
+        { "queue depth", qulonglong(enq - std::min(enq, deq)) },
+        { "queue high water", qulonglong(p->highWater.load(std::memory_order_relaxed)) },
+        { "records submitted", qulonglong(p->nSubmitted.load(std::memory_order_relaxed)) },
+        { "records written", qulonglong(nWritten) },
+        { "records dropped", qulonglong(p->nDropped.load(std::memory_order_relaxed)) },
+        { "producer blocks", qulonglong(p->nBlocked.load(std::memory_order_relaxed)) },
+        { "records/sec (avg)", double(nWritten) / std::max((now - p->tStart) / 1e9, 1e-9) },
+        { "records/sec (since last stats)", recentRate },
+    };
+}
@@ -20,6 +20,12 @@
 
 #include <QObject>
 #include <QString>
+#include <QVariantMap>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 
 /** Abstract base class for a line-based logger */
 class Logger : public QObject
@@ -36,11 +42,22 @@ public:
     /// returns true if the logger is logging to a tty (and thus supports ANSI color codes, etc)
     virtual bool isaTTY() const { return false; }
 
+    /// Called by the Log() class (from any thread) to log a fully formatted line. The default implementation just
+    /// emits the log() signal. Thread-safe.
+    virtual void submit(int level, QString && line);
+
+    /// Returns some stats suitable for the /stats endpoint. Thread-safe.
+    virtual QVariantMap stats() const;
+
 signals:
     void log(int level, const QString & line); ///< call this or emit it to log a line
 
 protected:
     virtual void gotLine(int level, const QString &) = 0;
+
+    std::atomic<std::uint64_t> nLinesWritten{0};
+
+    friend class AsyncLogger;
 };
 
 class ConsoleLogger : public Logger
@@ -77,3 +94,32 @@ public:
     using ConsoleLogger::ConsoleLogger;
 #endif
 };
+
+/// Wraps another Logger (the "sink"), such that log lines are pushed by the producer threads (already formatted) into a
+/// bounded, lock-free MPSC ring buffer. A dedicated writer thread drains the ring buffer and calls the sink's
+/// gotLine(). This keeps console/syslog I/O off of the threads that are doing the logging.
+///
+/// If the ring buffer is full, lines are either dropped (and counted), or the producer blocks until there is room,
+/// depending on the OverflowPolicy. Fatal lines are never dropped.
+class AsyncLogger : public Logger
+{
+public:
+    enum class OverflowPolicy { Drop, Block };
+
+    /// `capacity` is rounded up to the next power of 2. Takes ownership of `sink`, which may not be nullptr.
+    AsyncLogger(std::unique_ptr<Logger> sink, std::size_t capacity, OverflowPolicy policy, QObject *parent = nullptr);
+    /// Stops the writer thread, flushing all extant lines to the sink first.
+    ~AsyncLogger() override;
+
+    bool isaTTY() const override;
+    void submit(int level, QString && line) override;
+    QVariantMap stats() const override;
+
+protected:
+    /// Called if the log() signal is emitted directly; just enqueues the line.
+    void gotLine(int level, const QString &) override;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> p;
+};
@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <cassert>
 #include <functional>
+#include <limits>
 #include <map>
 #include <optional>
 #include <utility>
@@ -31,25 +32,42 @@ Mempool::ConsistencyError::~ConsistencyError() {} // for vtable
 void Mempool::clear() {
     txs.clear();
     hashXTxs.clear();
+    feeRateSizes.clear();
     dsps.clear(); // <-- this always frees capacity
     if (optPrefixTable) optPrefixTable->clear();
     txs.rehash(0); // this should free previous capacity
     hashXTxs.rehash(0);
 }
 
+std::optional<unsigned> Mempool::feeRateBucket(const Tx &tx)
+{
+    if (tx.fee < bitcoin::Amount::zero()) return std::nullopt; // skip negative fees (coinbase txn, etc)
+    return unsigned(tx.fee / bitcoin::Amount::satoshi()) // sats
+           / std::max(tx.vsizeBytes, 1u); // per vbyte
+}
+
+void Mempool::feeRateSizesAdd(const Tx &tx)
+{
+    if (const auto feeRate = feeRateBucket(tx))
+        feeRateSizes[*feeRate] += tx.vsizeBytes; // accumulate size by feeRate
+}
+
+void Mempool::feeRateSizesRemove(const Tx &tx)
+{
+    const auto feeRate = feeRateBucket(tx);
+    if (!feeRate) return;
+    auto it = feeRateSizes.find(*feeRate);
+    if (UNLIKELY(it == feeRateSizes.end())) return; // tx was never accounted for (addNewTxs threw midway); ignore
+    if (it->second > tx.vsizeBytes) it->second -= tx.vsizeBytes;
+    else feeRateSizes.erase(it); // bucket now empty, drop it so the compaction below never sees 0-sized bins
+}
+
 auto Mempool::calcCompactFeeHistogram(unsigned binSizeBytes) const -> FeeHistogramVec
 {
     // This algorithm is taken from:
     // https://github.com/spesmilo/electrumx/blob/bbd985a95db63cada13254bb766f174e9ab674d0/electrumx/server/mempool.py#L154
+    // The per-feeRate sizes it starts from are maintained incrementally in `feeRateSizes` as txs come and go.
     FeeHistogramVec ret;
-    std::map<unsigned, unsigned, std::greater<unsigned>> histogram; // sorted map, descending order by key
-
-    for (const auto & [txid, tx] : txs) {
-        if (tx->fee < bitcoin::Amount::zero()) continue; // skip negative fees (coinbase txn, etc)
-        const auto feeRate = unsigned(tx->fee / bitcoin::Amount::satoshi()) // sats
-                             / std::max(tx->vsizeBytes, 1u); // per vbyte
-        histogram[feeRate] += tx->vsizeBytes; // accumulate size by feeRate
-    }
 
     // Now, compact the bins
     ret.reserve(8);
@@ -57,7 +75,8 @@ auto Mempool::calcCompactFeeHistogram(unsigned binSizeBytes) const -> FeeHistogr
     double binSize = static_cast<double>(binSizeBytes);
     std::optional<unsigned> prevFeeRate;
 
-    for (const auto & [feeRate, size] : histogram) {
+    for (const auto & [feeRate, size64] : feeRateSizes) {
+        const auto size = static_cast<unsigned>(std::min<uint64_t>(size64, std::numeric_limits<unsigned>::max()));
         // If there is a big lump of txns at this specific size,
         // add the previous item now (if not added already)
         if (double(size) > 2.0 * binSize && prevFeeRate && cumSize > 0) {
@@ -270,6 +289,9 @@ auto Mempool::addNewTxs(ScriptHashesAffectedSet & scriptHashesAffected,
         // we do this once for each new tx we see.. and it can end up saving tons of space. Note the below structures
         // are either fixed in size or will only ever shrink as the mempool evolves so this is a good time to do this.
         tx->hashXs.rehash(tx->hashXs.size());
+
+        // fee is now final (ins - outs), so this tx can be accounted for in the fee histogram
+        feeRateSizesAdd(*tx);
     }
 
     // now, sort and uniqueify data structures made temporarily inconsistent above (have dupes, are out-of-order)
@@ -464,6 +486,8 @@ auto Mempool::dropTxs(ScriptHashesAffectedSet & scriptHashesAffectedOut, TxHashS
         // unlink parent/child relationships
         tx->unlinkFromParentsAndChildren();
 
+        feeRateSizesRemove(*tx);
+
         // and finally remove this tx from `txs` now, while we have its iterator .. this is faster
         // than doing the remove later, since we already have the iterator now!
         txs.erase(it);
@@ -728,6 +752,7 @@ auto Mempool::confirmedInBlock(ScriptHashesAffectedSet & scriptHashesAffectedOut
 
         // unlink parent/child relationships
         tx->unlinkFromParentsAndChildren();
+        feeRateSizesRemove(*tx);
         // erase this entry
         txs.erase(it);
     }
@@ -1022,6 +1047,10 @@ bool Mempool::deepCompareEqual(const Mempool &o, QString *estr) const
         }
         // otherwise equal so far...
     }
+    if (feeRateSizes != o.feeRateSizes) {
+        if (estr) *estr = "feeRateSizes members differ";
+        return false;
+    }
     if (dsps != o.dsps) {
         if (estr) *estr = "DSPs members differ";
         return false;
@@ -29,6 +29,7 @@
 
 #include <QVariantMap>
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <optional>
@@ -148,6 +149,11 @@ struct Mempool
     HashXTxMap hashXTxs;
     std::optional<Rpa::MempoolPrefixTable> optPrefixTable; ///< only has_value() if RPA is enabled. For mempool RPA queries.
     DSPs dsps;
+    /// Accumulated vsize (in bytes) of all txs in `txs`, keyed by fee rate (sats/vB, truncated), sorted descending.
+    /// Kept up-to-date incrementally by addNewTxs(), dropTxs(), confirmedInBlock() and clear() so that
+    /// calcCompactFeeHistogram() need only walk the distinct fee rates rather than the entire mempool.
+    using FeeRateSizeMap = std::map<unsigned, uint64_t, std::greater<unsigned>>;
+    FeeRateSizeMap feeRateSizes;
 
 
     // -- Add to mempool
@@ -240,9 +246,8 @@ struct Mempool
         FeeHistogramItem(unsigned fr, unsigned cs) : feeRate{fr}, cumulativeSize{cs} {}
     };
     using FeeHistogramVec = std::vector<FeeHistogramItem>;
-    /// This function is potentially going to take a couple of ms at worst on very large mempools.  Even a 1.5k tx
-    /// mempool takes under 1 ms on average hardware, so it's very fast. Storage calls this in refreshMempoolHistogram
-    /// from a periodic background task kicked off in Controller.
+    /// This is O(distinct fee rates) since it just compacts the incrementally-maintained `feeRateSizes` map, and
+    /// is thus cheap enough to call on every mempool.get_fee_histogram request (Storage::mempoolHistogram does so).
     FeeHistogramVec calcCompactFeeHistogram(unsigned binSize = 30'000 /* binSize in bytes */) const;
 
     // -- Dump (for JSONesque debug support)
@@ -258,6 +263,13 @@ struct Mempool
     void clear();
 
 private:
+    /// Returns the fee rate bucket for `tx` in `feeRateSizes`, or nothing if tx has a negative fee (coinbase, etc).
+    static std::optional<unsigned> feeRateBucket(const Tx &tx);
+    /// Account for `tx` in `feeRateSizes`. Call once its fee and vsize are final.
+    void feeRateSizesAdd(const Tx &tx);
+    /// Undo the above for `tx`. Call just before the tx is removed from `txs`.
+    void feeRateSizesRemove(const Tx &tx);
+
     /// Given a set of txids in this Mempool, grow the set to encompass all descendant tx's that spend
     /// from the initial set.  Will keep iterating until it cannot grow the set any longer.
     /// dropTxs() implicitly calls this.
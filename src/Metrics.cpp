@@ -0,0 +1,260 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#include "Metrics.h"
+#include "Util.h"
+
+#include <QHash>
+#include <QPair>
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace Metrics {
+
+size_t shardIndex() noexcept
+{
+    static std::atomic<size_t> next{0u};
+    thread_local const size_t idx = next.fetch_add(1u, std::memory_order_relaxed) % kShards;
+    return idx;
+}
+
+uint64_t Counter::value() const noexcept
+{
+    uint64_t ret = 0u;
+    for (const auto & s : shards)
+        ret += s.v.load(std::memory_order_relaxed);
+    return ret;
+}
+
+auto Histogram::snapshot() const noexcept -> Snapshot
+{
+    Snapshot ret;
+    for (const auto & s : shards) {
+        for (unsigned b = 0; b < kNumBuckets; ++b)
+            ret.buckets[b] += s.buckets[b].load(std::memory_order_relaxed);
+        ret.sumUsec += s.sum.load(std::memory_order_relaxed);
+    }
+    for (const auto n : ret.buckets)
+        ret.count += n;
+    return ret;
+}
+
+uint64_t Histogram::Snapshot::quantile(double q) const noexcept
+{
+    if (!count) return 0u;
+    const uint64_t rank = std::max<uint64_t>(1u, uint64_t(std::ceil(std::clamp(q, 0.0, 1.0) * double(count))));
+    uint64_t cum = 0u;
+    for (unsigned b = 0; b < kNumBuckets; ++b)
+        if ((cum += buckets[b]) >= rank)
+            return bucketUpperBound(b);
+    return bucketUpperBound(kNumBuckets - 1u);
+}
+
+Stopwatch::Stopwatch() noexcept : t0(Util::getTimeNS()) {}
+
+void Stopwatch::lap(Histogram &h) noexcept
+{
+    const int64_t now = Util::getTimeNS();
+    h.recordNanos(now - t0);
+    t0 = now;
+}
+
+namespace {
+    QByteArray EscapeLabelValue(const QString &v) {
+        QByteArray ret = v.toUtf8();
+        ret.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+        return ret;
+    }
+
+    QByteArray RenderLabels(const Labels &labels) {
+        if (labels.empty()) return {};
+        QByteArray ret = "{";
+        for (const auto & [k, v] : labels) {
+            if (ret.size() > 1) ret += ',';
+            ret += k.toUtf8() + "=\"" + EscapeLabelValue(v) + '"';
+        }
+        ret += '}';
+        return ret;
+    }
+
+    /// Appends `extra` (e.g. le="0.5") to a rendered label set (which may be empty).
+    QByteArray WithLabel(const QByteArray &rendered, const QByteArray &extra) {
+        if (rendered.isEmpty()) return "{" + extra + "}";
+        return rendered.left(rendered.size() - 1) + "," + extra + "}";
+    }
+
+    QByteArray Seconds(uint64_t usec) { return QByteArray::number(double(usec) / 1e6, 'g', 10); }
+
+    /// The le="..." boundaries we export, in usec: powers of two from 16 usec to ~1.2 hours. These coincide with
+    /// histogram bucket edges, and are the same for every series so that series can be aggregated.
+    constexpr unsigned kExportMinExp = 4, kExportMaxExp = 32;
+} // namespace
+
+Registry & Registry::instance()
+{
+    static Registry reg;
+    return reg;
+}
+
+auto Registry::family(const QString &name, const QString &help, Type type) -> Family &
+{
+    auto it = families.find(name);
+    if (it == families.end())
+        it = families.emplace(name, Family{help, type, {}, {}, {}}).first;
+    return it->second;
+}
+
+Counter & Registry::counter(const QString &name, const QString &help, const Labels &labels)
+{
+    const QByteArray key = RenderLabels(labels);
+    {
+        std::shared_lock g(mut);
+        if (const auto it = families.find(name); it != families.end())
+            if (const auto it2 = it->second.counters.find(key); it2 != it->second.counters.end())
+                return *it2->second;
+    }
+    std::unique_lock g(mut);
+    auto & ptr = family(name, help, Type::Counter).counters[key];
+    if (!ptr) ptr = std::make_unique<Counter>();
+    return *ptr;
+}
+
+Histogram & Registry::histogram(const QString &name, const QString &help, const Labels &labels)
+{
+    const QByteArray key = RenderLabels(labels);
+    {
+        std::shared_lock g(mut);
+        if (const auto it = families.find(name); it != families.end())
+            if (const auto it2 = it->second.histograms.find(key); it2 != it->second.histograms.end())
+                return *it2->second;
+    }
+    std::unique_lock g(mut);
+    auto & ptr = family(name, help, Type::Histogram).histograms[key];
+    if (!ptr) ptr = std::make_unique<Histogram>();
+    return *ptr;
+}
+
+Gauge & Registry::gauge(const QString &name, const QString &help, const Labels &labels)
+{
+    const QByteArray key = RenderLabels(labels);
+    {
+        std::shared_lock g(mut);
+        if (const auto it = families.find(name); it != families.end())
+            if (const auto it2 = it->second.gauges.find(key); it2 != it->second.gauges.end())
+                return *it2->second;
+    }
+    std::unique_lock g(mut);
+    auto & ptr = family(name, help, Type::Gauge).gauges[key];
+    if (!ptr) ptr = std::make_unique<Gauge>();
+    return *ptr;
+}
+
+QByteArray Registry::prometheusText() const
+{
+    QByteArray ret;
+    std::shared_lock g(mut);
+    for (const auto & [name, fam] : families) {
+        const QByteArray n = name.toUtf8();
+        ret += "# HELP " + n + " " + fam.help.toUtf8() + "\n";
+        if (fam.type == Type::Counter) {
+            ret += "# TYPE " + n + " counter\n";
+            for (const auto & [labels, c] : fam.counters)
+                ret += n + labels + " " + QByteArray::number(qulonglong(c->value())) + "\n";
+            continue;
+        }
+        if (fam.type == Type::Gauge) {
+            ret += "# TYPE " + n + " gauge\n";
+            for (const auto & [labels, gg] : fam.gauges)
+                ret += n + labels + " " + QByteArray::number(qlonglong(gg->value())) + "\n";
+            continue;
+        }
+        ret += "# TYPE " + n + " histogram\n";
+        for (const auto & [labels, h] : fam.histograms) {
+            const auto snap = h->snapshot();
+            uint64_t cum = 0u;
+            unsigned b = 0;
+            for (unsigned e = kExportMinExp; e <= kExportMaxExp; ++e) {
+                const uint64_t le = uint64_t(1) << e;
+                for ( ; b < Histogram::kNumBuckets && Histogram::bucketUpperBound(b) <= le; ++b)
+                    cum += snap.buckets[b];
+                ret += n + "_bucket" + WithLabel(labels, "le=\"" + Seconds(le) + "\"") + " "
+                       + QByteArray::number(qulonglong(cum)) + "\n";
+            }
+            ret += n + "_bucket" + WithLabel(labels, "le=\"+Inf\"") + " " + QByteArray::number(qulonglong(snap.count)) + "\n";
+            ret += n + "_sum" + labels + " " + Seconds(snap.sumUsec) + "\n";
+            ret += n + "_count" + labels + " " + QByteArray::number(qulonglong(snap.count)) + "\n";
+        }
+    }
+    return ret;
+}
+
+Histogram & HistogramFamily::operator[](const QString &labelValue) const
+{
+    thread_local QHash<QPair<const HistogramFamily *, QString>, Histogram *> cache;
+    Histogram * & h = cache[qMakePair(this, labelValue)];
+    if (!h)
+        h = &Registry::instance().histogram(name, help, {{labelName, labelValue}});
+    return *h;
+}
+
+} // namespace Metrics
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+namespace {
+    void testMetrics() {
+        using H = Metrics::Histogram;
+        // bucket math: every value must land in a bucket whose bounds contain it, with <= 25% relative width
+        for (uint64_t v : {0ull, 1ull, 3ull, 4ull, 5ull, 7ull, 8ull, 9ull, 15ull, 16ull, 1000ull, 1023ull, 1024ull,
+                           123456789ull, (1ull << H::kMaxExp) - 1ull}) {
+            const unsigned b = H::bucketFor(v);
+            const uint64_t hi = H::bucketUpperBound(b), lo = b ? H::bucketUpperBound(b - 1u) : 0u;
+            if (b >= H::kNumBuckets || v < lo || v >= hi)
+                throw Exception(QString("Value %1 mapped to bucket %2 [%3, %4)").arg(v).arg(b).arg(lo).arg(hi));
+            if (v >= H::kSub && double(hi - lo) > 0.25 * double(lo) + 1e-9)
+                throw Exception(QString("Bucket %1 for value %2 is too wide: [%3, %4)").arg(b).arg(v).arg(lo).arg(hi));
+        }
+        if (H::bucketFor(~uint64_t(0)) != H::kNumBuckets - 1u)
+            throw Exception("Huge values must clamp to the last bucket");
+        H h;
+        for (unsigned i = 1; i <= 1000; ++i)
+            h.record(i);
+        const auto snap = h.snapshot();
+        if (snap.count != 1000u || snap.sumUsec != 500500u)
+            throw Exception(QString("Bad snapshot count/sum: %1/%2").arg(snap.count).arg(snap.sumUsec));
+        if (const auto p50 = snap.quantile(0.5); p50 < 500u || p50 > 640u)
+            throw Exception(QString("Bad p50: %1").arg(p50));
+        auto & c = Metrics::Registry::instance().counter("fulcrum_test_total", "test counter", {{"k", "v\"q"}});
+        c.add(3);
+        auto & gg = Metrics::Registry::instance().gauge("fulcrum_test_gauge", "test gauge");
+        gg.set(10);
+        gg.add(-12);
+        const auto text = Metrics::Registry::instance().prometheusText();
+        if (!text.contains("fulcrum_test_total{k=\"v\\\"q\"} 3\n"))
+            throw Exception("Counter missing from Prometheus text: " + QString::fromUtf8(text));
+        if (!text.contains("# TYPE fulcrum_test_gauge gauge\nfulcrum_test_gauge -2\n"))
+            throw Exception("Gauge missing from Prometheus text: " + QString::fromUtf8(text));
+        Log() << "Metrics: ok";
+    }
+
+    const auto t_metrics = App::registerTest("metrics", testMetrics);
+} // namespace
+#endif
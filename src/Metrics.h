@@ -0,0 +1,168 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+/// A small, process-wide metrics subsystem: counters, gauges and latency histograms that any thread can update without
+/// taking a lock, plus a registry that can render all of them in the Prometheus text exposition format (served at
+/// the /metrics endpoint of the stats HTTP server).
+///
+/// Unlike StatsMixin::statsSafe(), reading the metrics never calls into (or blocks) the threads being measured: each
+/// metric is a set of relaxed atomics, sharded per thread to keep hot counters from bouncing a cache line around.
+namespace Metrics {
+
+    /// Number of shards per metric. Threads are assigned a shard round-robin the first time they record something.
+    inline constexpr size_t kShards = 8;
+
+    /// Returns this thread's shard index in [0, kShards).
+    size_t shardIndex() noexcept;
+
+    /// Monotonic counter.
+    class Counter {
+        struct alignas(64) Shard { std::atomic<uint64_t> v{0u}; };
+        std::array<Shard, kShards> shards;
+    public:
+        void add(uint64_t n = 1u) noexcept { shards[shardIndex()].v.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const noexcept;
+    };
+
+    /// A value that can go up and down (e.g. bytes currently in use). Unsharded: gauges are mostly set() from a single
+    /// place, so there is nothing to gain from spreading them over several cache lines.
+    class Gauge {
+        std::atomic<int64_t> v{0};
+    public:
+        void set(int64_t n) noexcept { v.store(n, std::memory_order_relaxed); }
+        void add(int64_t n) noexcept { v.fetch_add(n, std::memory_order_relaxed); }
+        int64_t value() const noexcept { return v.load(std::memory_order_relaxed); }
+    };
+
+    /// HDR-style log-linear histogram of microsecond values: each power of two is split into kSub linear sub-buckets,
+    /// so any recorded value is known to within 1/kSub (25%) of itself, from 1 usec up to ~2^kMaxExp usec (~13 days).
+    class Histogram {
+    public:
+        static constexpr unsigned kSubBits = 2, kSub = 1u << kSubBits, kMaxExp = 40;
+        static constexpr unsigned kNumBuckets = (kMaxExp - kSubBits + 2u) * kSub;
+
+        /// Returns the bucket index for `usec`. Values past the last bucket are clamped into it.
+        static constexpr unsigned bucketFor(uint64_t usec) noexcept {
+            if (usec < kSub) return unsigned(usec);
+            unsigned e = 63u - unsigned(__builtin_clzll(usec)); // e >= kSubBits here
+            if (e > kMaxExp) return kNumBuckets - 1u;
+            const unsigned sub = unsigned(usec >> (e - kSubBits)) & (kSub - 1u);
+            return (e - kSubBits + 1u) * kSub + sub;
+        }
+        /// Exclusive upper bound, in usec, of the values that land in bucket `b`.
+        static constexpr uint64_t bucketUpperBound(unsigned b) noexcept {
+            if (b < kSub) return b + 1u;
+            const unsigned e = b / kSub + kSubBits - 1u, sub = b % kSub;
+            return (uint64_t(kSub + sub) << (e - kSubBits)) + (uint64_t(1) << (e - kSubBits));
+        }
+
+        void record(uint64_t usec) noexcept {
+            auto & s = shards[shardIndex()];
+            s.buckets[bucketFor(usec)].fetch_add(1u, std::memory_order_relaxed);
+            s.sum.fetch_add(usec, std::memory_order_relaxed);
+        }
+        void recordNanos(int64_t nanos) noexcept { record(nanos > 0 ? uint64_t(nanos) / 1000u : 0u); }
+
+        struct Snapshot {
+            std::array<uint64_t, kNumBuckets> buckets{};
+            uint64_t count = 0, sumUsec = 0;
+            /// Returns an estimate of the q-th quantile (0 <= q <= 1) in usec: the upper bound of the bucket it falls in.
+            uint64_t quantile(double q) const noexcept;
+        };
+        /// Sums all shards. The result is not an atomic snapshot with respect to concurrent record() calls, but each
+        /// bucket is individually consistent, which is all a scrape needs.
+        Snapshot snapshot() const noexcept;
+
+    private:
+        struct alignas(64) Shard {
+            std::array<std::atomic<uint64_t>, kNumBuckets> buckets{};
+            std::atomic<uint64_t> sum{0u};
+        };
+        std::array<Shard, kShards> shards;
+    };
+
+    /// Measures a duration into a histogram. Not thread-safe; intended to live on the stack.
+    class Stopwatch {
+        int64_t t0;
+    public:
+        Stopwatch() noexcept;
+        /// Records the time since construction (or the last lap()) into `h` and restarts the stopwatch.
+        void lap(Histogram &h) noexcept;
+    };
+
+    using Labels = std::vector<std::pair<QString, QString>>;
+
+    /// Process-wide registry. Metrics are created on first lookup and live until process exit, so references returned
+    /// by the lookup functions remain valid forever. Lookups take a shared lock; use the *Family helpers below for
+    /// metrics looked up on a hot path.
+    class Registry {
+    public:
+        static Registry & instance();
+
+        /// `name` should follow Prometheus conventions (e.g. "fulcrum_foo_total" for a counter, and
+        /// "fulcrum_foo_seconds" for a latency histogram; histograms are exported in seconds).
+        Counter & counter(const QString &name, const QString &help, const Labels &labels = {});
+        Histogram & histogram(const QString &name, const QString &help, const Labels &labels = {});
+        Gauge & gauge(const QString &name, const QString &help, const Labels &labels = {});
+
+        /// Renders every metric in the Prometheus text exposition format (version 0.0.4). Thread-safe; only reads
+        /// atomics, and holds the registry's shared lock for the duration.
+        QByteArray prometheusText() const;
+
+    private:
+        Registry() = default;
+        enum class Type { Counter, Histogram, Gauge };
+        struct Family {
+            QString help;
+            Type type;
+            std::map<QByteArray, std::unique_ptr<Counter>> counters; ///< keyed by rendered label set e.g. {a="b"}
+            std::map<QByteArray, std::unique_ptr<Histogram>> histograms; ///< ditto
+            std::map<QByteArray, std::unique_ptr<Gauge>> gauges; ///< ditto
+        };
+        Family & family(const QString &name, const QString &help, Type type); // call with lock held exclusively
+        mutable std::shared_mutex mut;
+        std::map<QString, Family> families;
+    };
+
+    /// A histogram family with a single label (e.g. "method"), whose per-label-value lookups are cached per thread
+    /// so that the registry lock is only taken the first time a given thread sees a given label value.
+    /// Instances must have static storage duration.
+    class HistogramFamily {
+        const QString name, help, labelName;
+    public:
+        HistogramFamily(QString name, QString help, QString labelName)
+            : name(std::move(name)), help(std::move(help)), labelName(std::move(labelName)) {}
+        Histogram & operator[](const QString &labelValue) const;
+    };
+
+} // namespace Metrics
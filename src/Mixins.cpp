@@ -18,6 +18,7 @@
 //
 #include "App.h"
 #include "Mixins.h"
+#include "ThreadTopology.h"
 
 #include <utility>
 
@@ -62,6 +63,7 @@ void ThreadObjectMixin::start()
     qobj()->moveToThread(&_thread);
     conns += QObject::connect(&_thread, &QThread::started, qobj(), [this]{
         Util::ThreadName::Set(qobj()->objectName()); // Set thread name for logger
+        ThreadTopology::placeCurrentThread(ThreadTopology::Group::IO);
         on_started();
     });
     conns += QObject::connect(&_thread, &QThread::finished, qobj(), [this]{on_finished();});
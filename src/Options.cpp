@@ -149,6 +149,7 @@ QVariantMap Options::toMap() const
     m["max_history"] = maxHistory;
     m["workqueue"] = workQueue;
     m["worker_threads"] = workerThreads;
+    m["workqueue_timeout"] = workQueueTimeout;
     m["max_pending_connections"] = maxPendingConnections;
     // tor related
     m["tor_hostname"] = torHostName.has_value() ? QVariant(*torHostName) : QVariant();
@@ -171,6 +172,19 @@ QVariantMap Options::toMap() const
     m["db_keep_log_file_num"] = qlonglong(db.keepLogFileNum);
     m["db_mem"] = double(db.maxMem / 1024.0 / 1024.0);
     m["db_use_fsync"] = db.useFsync;
+    m["db_verify_balance"] = db.verifyBalance;
+    m["db_compact_headers"] = db.compactHeaders;
+    m["db_flush_threads"] = db.flushThreads;
+    m["db_compaction_threads"] = db.compactionThreads;
+    m["db_block_cache_type"] = db.blockCacheTypeString();
+    m["db_block_cache_per_table"] = db.blockCachePerTable;
+    m["db_pin_index_filter"] = db.pinIndexFilter;
+    m["db_secondary_cache_mem"] = double(db.secondaryCacheMem / 1024.0 / 1024.0);
+    // thread placement
+    m["cpu_affinity_workers"] = cpuAffinity.workers;
+    m["cpu_affinity_db"] = cpuAffinity.db;
+    m["cpu_affinity_cotask"] = cpuAffinity.cotask;
+    m["cpu_affinity_io"] = cpuAffinity.io;
     // ts-format
     m["ts-format"] = logTimestampModeString();
     // tls-disallow-deprecated
@@ -181,14 +195,24 @@ QVariantMap Options::toMap() const
     m["bitcoind_timeout"] = bdTimeoutMS;
     // bitcoind_clients
     m["bitcoind_clients"] = bdNClients;
+    // bitcoind_batch
+    m["bitcoind_batch"] = bdBatchMax;
     // max_reorg
     m["max_reorg"] = maxReorg;
     // txhash_cache
     m["txhash_cache"] = txHashCacheBytes / 1e6; // this comes in as a MB value from config, so spit it back out in the same MB unit
+    // txhash_mem_index
+    m["txhash_mem_index"] = txHashMemIndex;
     // max_batch
     m["max_batch"] = maxBatch;
+    // binary_protocol
+    m["binary_protocol"] = binaryProtocol;
     // anon_logs
     m["anon_logs"] = anonLogs;
+    // log_async*
+    m["log_async"] = logAsync.enabled;
+    m["log_async_queue"] = logAsync.queueSize;
+    m["log_async_overflow"] = logAsync.blockOnOverflow ? "block" : "drop";
     // pidfile
     m["pidfile"] = pidFileAbsPath;
 
@@ -221,6 +245,15 @@ QString Options::logTimestampModeString() const
     return ""; // not reached; suppress compiler warnings
 }
 
+QString Options::DBOpts::blockCacheTypeString() const
+{
+    switch (blockCacheType) {
+    case BlockCacheType::LRU: return "lru";
+    case BlockCacheType::HyperClock: return "hyperclock";
+    }
+    return ""; // not reached; suppress compiler warnings
+}
+
 bool Options::BdReqThrottleParams::isValid() const noexcept
 {
     return hi >= lo && hi >= minBDReqHi && hi <= maxBDReqHi && lo >= minBDReqLo && lo <= maxBDReqLo
@@ -155,6 +155,9 @@ public:
     // necessarily the options used in practice (those can be determined by querying the Util::ThreadPool).
     int workQueue = -1;
     int workerThreads = -1;
+    /// 'workqueue_timeout': seconds after which a client request still waiting in the work queue is dropped. 0 = never.
+    static constexpr double defaultWorkQueueTimeout = 0., maxWorkQueueTimeout = 3600.;
+    double workQueueTimeout = defaultWorkQueueTimeout;
 
     static constexpr int defaultMaxPendingConnections = 60, minMaxPendingConnections = 10, maxMaxPendingConnections = 9999;
     int maxPendingConnections = defaultMaxPendingConnections; ///< comes from config 'max_pending_connections'.
@@ -204,9 +207,52 @@ public:
         /// db_use_fsync in conf file -- default false
         static constexpr bool defaultUseFsync = false;
         bool useFsync = defaultUseFsync;
+
+        /// db_verify_balance in conf file -- default false. If true, each getBalance also scans scripthash_unspent
+        /// and checks the per-scripthash balance aggregate against the scan (slow; for debugging only).
+        static constexpr bool defaultVerifyBalance = false;
+        bool verifyBalance = defaultVerifyBalance;
+
+        /// db_compact_headers in conf file -- default false. If true, a *new* datadir stores pre-RandomX headers as
+        /// 80-byte records rather than padding them to 112 bytes. Has no effect on an existing datadir.
+        static constexpr bool defaultCompactHeaders = false;
+        bool compactHeaders = defaultCompactHeaders;
+
+        /// db_flush_threads & db_compaction_threads in conf file -- the sizes of RocksDB's HIGH and LOW priority
+        /// background thread pools. 0 (default) = as sized by rocksdb::Options::IncreaseParallelism().
+        static constexpr unsigned maxBackgroundThreads = 256;
+        unsigned flushThreads = 0, compactionThreads = 0;
+
+        /// db_block_cache_type in conf file -- "lru" (default) or "hyperclock"
+        enum class BlockCacheType : uint8_t { LRU, HyperClock };
+        static constexpr BlockCacheType defaultBlockCacheType = BlockCacheType::LRU;
+        BlockCacheType blockCacheType = defaultBlockCacheType;
+        QString blockCacheTypeString() const;
+
+        /// db_block_cache_per_table in conf file -- default false. If true, each DB gets its own block cache, sized by
+        /// its share of db_mem, rather than all of them sharing one, so that e.g. history scans cannot evict the
+        /// UTXO set's blocks.
+        static constexpr bool defaultBlockCachePerTable = false;
+        bool blockCachePerTable = defaultBlockCachePerTable;
+
+        /// db_pin_index_filter in conf file -- default false. If true, index and filter blocks go into the block
+        /// cache's high-priority pool, and those of L0 files are pinned there.
+        static constexpr bool defaultPinIndexFilter = false;
+        bool pinIndexFilter = defaultPinIndexFilter;
+
+        /// db_secondary_cache_mem in conf file -- the size of the compressed secondary block cache, which holds the
+        /// blocks evicted from the (uncompressed) block cache(s). This is in addition to db_mem. 0 (default) = off.
+        size_t secondaryCacheMem = 0;
     };
     DBOpts db;
 
+    /// cpu_affinity_workers, cpu_affinity_db, cpu_affinity_cotask, cpu_affinity_io in conf file: the CPU lists the
+    /// ThreadTopology groups are pinned to, as configured. Empty = not pinned.
+    struct CpuAffinity {
+        QString workers, db, cotask, io;
+    };
+    CpuAffinity cpuAffinity;
+
     enum class LogTimestampMode {
         None = 0, Uptime, Local, UTC
     };
@@ -239,6 +285,14 @@ public:
     static constexpr bool isBdNClientsInRange(unsigned n) { return n >= bdNClientsMin && n <= bdNClientsMax; }
     unsigned bdNClients = defaultBdNClients;
 
+    // config: bitcoind_batch
+    /// If > 1, requests to bitcoind are coalesced per BitcoinD client into JSON-RPC batches of up to this many
+    /// requests, which saves an HTTP round trip per request when many are in flight (e.g. during mempool synch).
+    /// 0 (the default) or 1 disables this.
+    static constexpr unsigned defaultBdBatchMax = 0, bdBatchMaxMax = 100;
+    static constexpr bool isBdBatchMaxInRange(unsigned n) { return n <= bdBatchMaxMax; }
+    unsigned bdBatchMax = defaultBdBatchMax;
+
     // config: max_reorg
     /// Corresponds to the number of undo entries we keep in the DB. Older Fulcrum versions had this hard-coded
     /// as 100, and assumed 100 was the magic number.  As such, 100 is the minimum we support.  The maximum
@@ -257,6 +311,12 @@ public:
     static constexpr bool isTxHashCacheBytesInRange(unsigned n) { return n >= txHashCacheBytesMin && n <= txHashCacheBytesMax; }
     unsigned txHashCacheBytes = defaultTxHashCacheBytes;
 
+    // config: txhash_mem_index
+    /// If true, txhash -> txnum lookups are served from an in-memory index (built at startup from the txnum2txhash
+    /// file) rather than from the txhash2txnum db. Costs ~14 bytes of RAM per confirmed tx.
+    static constexpr bool defaultTxHashMemIndex = false;
+    bool txHashMemIndex = defaultTxHashMemIndex;
+
     // CLI: --compact-dbs
     /// If specified, we compact all of the databases on startup
     bool compactDBs = false;
@@ -273,6 +333,12 @@ public:
     static constexpr bool isMaxBatchInRange(unsigned n) { return n >= maxBatchMin && n <= maxBatchMax; }
     unsigned maxBatch = defaultMaxBatch;
 
+    // config: binary_protocol
+    /// If true, clients in subnetsExcludedFromPerIPLimits may switch their connection to the BinWire encoding by
+    /// passing "binary" as the 3rd argument to server.version (see BinWire.h).
+    static constexpr bool defaultBinaryProtocol = false;
+    bool binaryProtocol = defaultBinaryProtocol;
+
     // CLI: --utxo-cache (experimental)
     static constexpr size_t defaultUtxoCache = 0, minUtxoCache = 64ull * 1000ull * 1000ull; // 0 is off, otherwise 64 MB min
     size_t utxoCache = defaultUtxoCache;
@@ -281,6 +347,20 @@ public:
     static constexpr bool defaultAnonLogs = false;
     bool anonLogs = defaultAnonLogs; ///< if true, we hide IP addresses, Bitcoin addresses, and txid's from the Log()
 
+    // config: log_async, log_async_queue, log_async_overflow
+    struct LogAsync {
+        /// If true, log lines are queued to a dedicated writer thread rather than written by (or on behalf of) the thread doing the logging
+        static constexpr bool defaultEnabled = false;
+        bool enabled = defaultEnabled;
+        /// Capacity of the log queue, in lines (rounded up to the next power of 2)
+        static constexpr unsigned defaultQueueSize = 65'536, queueSizeMin = 1'024, queueSizeMax = 16'777'216;
+        static constexpr bool isQueueSizeInRange(unsigned n) { return n >= queueSizeMin && n <= queueSizeMax; }
+        unsigned queueSize = defaultQueueSize;
+        /// If true, logging threads block when the queue is full, otherwise the line is dropped (and counted)
+        static constexpr bool defaultBlockOnOverflow = false;
+        bool blockOnOverflow = defaultBlockOnOverflow;
+    } logAsync;
+
     // CLI: --pidfile
     // config: pidfile
     QString pidFileAbsPath; ///< If non-empty, app will write PID to this file and delete this file on shutdown
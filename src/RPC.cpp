@@ -17,6 +17,8 @@
 // <https://www.gnu.org/licenses/>.
 //
 #include "RPC.h"
+#include "BinWire.h"
+#include "Metrics.h"
 #include "Util.h"
 #include "WebSocket.h"
 
@@ -24,7 +26,10 @@
 #include <QHostAddress>
 #include <QSslSocket>
 
+#include <algorithm>
 #include <atomic>
+#include <cctype>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <type_traits>
@@ -54,6 +59,41 @@ namespace RPC {
      * `ParserBackend::FastestAvailable` which is set in App.cpp on startup. */
     static std::atomic<Json::ParserBackend> jsonParserBackend = Json::ParserBackend::Default;
 
+    namespace {
+        /// For v2 messages whose "jsonrpc" value `ver` is not "2.0" (`ver` is empty if the key is missing): returns the
+        /// value to keep for it, or throws InvalidError if `strict`.
+        QString checkedJsonRpcVersion(const QString &ver, bool strict)
+        {
+            if (ver.isEmpty()) {
+                // It turns out Electron Cash doesn't even send this key, even though JSON 2.0 spec specifies it. We
+                // accept requests without it if the key is missing entirely, and "fake" it so below code works (what
+                // follows is code that was originally written assuming the key is there).
+                return RPC::jsonRpcVersion;
+            }
+            constexpr auto errMsg = "Expected jsonrpc version \"%1\", instead got \"%2\"";
+            auto shortVer = ver; // shallow copy
+            if (ver.length() > 10)
+                // prevent log file spam DoS by only logging a partial string...
+                shortVer = ver.left(10);
+            if (strict)
+                throw InvalidError(QString(errMsg).arg(RPC::jsonRpcVersion, shortVer));
+            // Phoenix wallet on BTC actually sends the out-of-spec key: "jsonrpc": "1.0" here. It's not clear
+            // what to do here. We will just proceed along as if nothing happened, keeping the same string for
+            // "jsonrpc" that they gave us and hope for the best!  We won't parse the string at all and we won't
+            // even change the protocol version internally to `ret.v1 = true`.  Phoenix seems to work ok if we do
+            // things this way.  Previously Fulcrum used to throw an error here and refuse to proceed, but we
+            // decided to be more permissive. See issue: https://github.com/cculianu/Fulcrum/issues/91
+            DebugM(QString(errMsg).arg(RPC::jsonRpcVersion, shortVer));
+            if (shortVer.length() < ver.length()) {
+                // However, we *DO* prevent memory exhaustion DoS by not "remembering" a potentially huge version
+                // string that we can't even understand.. instead, we accept up to 10 characters of it.
+                DebugM("Got excessively long, out-of-spec \"jsonrpc\" value of length ", ver.length(),
+                       " (we truncated it to length ", shortVer.length(), ")");
+            }
+            return shortVer;
+        }
+    } // namespace
+
     /* static */
     Message Message::fromUtf8(const QByteArray &ba, Id *id_out, bool v1, bool strict)
     {
@@ -78,36 +118,9 @@ namespace RPC {
             throw InvalidError(QString("Error parsing JSON key \"%1\": %2").arg(s_id, e.what()));
         }
 
-        if (QString ver; !v1 && (ver=ret.jsonRpcVersion()) != RPC::jsonRpcVersion) {// we ignore this key in v1
-            if (!ver.isEmpty()) {
-                constexpr auto errMsg = "Expected jsonrpc version \"%1\", instead got \"%2\"";
-                auto shortVer = ver; // shallow copy
-                if (ver.length() > 10)
-                    // prevent log file spam DoS by only logging a partial string...
-                    shortVer = ver.left(10);
-                if (strict)
-                    throw InvalidError(QString(errMsg).arg(RPC::jsonRpcVersion, shortVer));
-                // Phoenix wallet on BTC actually sends the out-of-spec key: "jsonrpc": "1.0" here. It's not clear
-                // what to do here. We will just proceed along as if nothing happened, keeping the same string for
-                // "jsonrpc" that they gave us and hope for the best!  We won't parse the string at all and we won't
-                // even change the protocol version internally to `ret.v1 = true`.  Phoenix seems to work ok if we do
-                // things this way.  Previously Fulcrum used to throw an error here and refuse to proceed, but we
-                // decided to be more permissive. See issue: https://github.com/cculianu/Fulcrum/issues/91
-                DebugM(QString(errMsg).arg(RPC::jsonRpcVersion, shortVer));
-                if (shortVer.length() < ver.length()) {
-                    // However, we *DO* prevent memory exhaustion DoS by not "remembering" a potentially huge version
-                    // string that we can't even understand.. instead, we accept up to 10 characters of it.
-                    ret.data[s_jsonrpc] = shortVer;
-                    DebugM("Got excessively long, out-of-spec \"jsonrpc\" value of length ", ver.length(),
-                           " (we truncated it to length ", shortVer.length(), ")");
-                }
-            } else {
-                // It turns out Electron Cash doesn't even send this key, even though JSON 2.0 spec specifies it. We
-                // accept requests without it if the key is missing entirely, and "fake" it so below code works (what
-                // follows is code that was originally written assuming the key is there).
-                ret.data[s_jsonrpc] = RPC::jsonRpcVersion;
-            }
-        }
+        if (QString ver; !v1 && (ver=ret.jsonRpcVersion()) != RPC::jsonRpcVersion) // we ignore this key in v1
+            if (QString ver2 = checkedJsonRpcVersion(ver, strict); ver2 != ver) // may throw
+                ret.data[s_jsonrpc] = std::move(ver2);
 
         if (auto var = map.value(s_method);
                 map.contains(s_method) && (!Compat::IsMetaType(var, QMetaType::QString)
@@ -177,6 +190,53 @@ namespace RPC {
         return ret;
     }
 
+    /* static */
+    Message Message::fromRpcRequest(Json::RpcRequest &&req, Id *id_out, bool v1, bool strict)
+    {
+        // This does the same validation that fromJsonData() would on the equivalent map, but on the typed fields, and
+        // without building that map. parseRpcRequests() only decodes objects with no "result" or "error" keys, a
+        // string "method", and if present, a list "params", which leaves just the checks below.
+        using IdType = Json::RpcRequest::IdType;
+        Message ret;
+        ret.v1 = v1;
+        auto & t = ret.typed.emplace();
+        switch (req.idType) {
+        case IdType::Absent: case IdType::Null: break;
+        case IdType::Int: ret.id = int64_t(req.idInt); break;
+        case IdType::String: ret.id = std::move(req.idString); break;
+        }
+        if (id_out) *id_out = ret.id;
+        t.hasId = req.idType != IdType::Absent;
+        t.hasParams = req.hasParams;
+        t.params = std::move(req.params);
+        t.jsonrpc = std::move(req.jsonrpc);
+        if (!v1 && t.jsonrpc != RPC::jsonRpcVersion) // we ignore this key in v1
+            t.jsonrpc = checkedJsonRpcVersion(t.jsonrpc, strict); // may throw
+
+        ret.method = std::move(req.method);
+        if (ret.method.isEmpty() || ret.method.startsWith(rpcDot/*="rpc."*/))
+            throw InvalidError("Invalid method");
+
+        // For v2 the "jsonrpc" key is now always there, so with the keys we may have, the key counts that
+        // fromJsonData() checks always come out right, and any such object is a request or a notification. For v1,
+        // both need an "id" (which must be null for a notification).
+        if (v1 && !t.hasId)
+            throw InvalidError("Invalid JSON RPC object");
+
+        return ret;
+    }
+
+    QVariantMap Message::jsonData() const
+    {
+        if (!typed) return data;
+        QVariantMap ret;
+        if (typed->hasId) ret.insert(s_id, id.toVariant());
+        ret.insert(s_method, method);
+        if (!typed->jsonrpc.isEmpty()) ret.insert(s_jsonrpc, typed->jsonrpc);
+        if (typed->hasParams) ret.insert(s_params, typed->params);
+        return ret;
+    }
+
     /* static */
     Message Message::makeError(int code, const QString &message, const Id & id, bool v1)
     {
@@ -194,6 +254,12 @@ namespace RPC {
         return ret;
     }
 
+    QByteArray Message::resultHexDecoded() const
+    {
+        if (!binaryResult.isNull()) return binaryResult;
+        return Util::ParseHexFast(result().toByteArray());
+    }
+
     /// uses provided schema -- will not throw exception
     /*static*/
     Message Message::makeResponse(const Id & reqId, const QVariant & result, bool v1)
@@ -263,6 +329,43 @@ namespace RPC {
         return ret;
     }
 
+    const QByteArray & PreparedNotification::bytes(const bool v1, const Framing framing) const
+    {
+        const Form & f = forms[size_t(v1) * NumFramings + framing];
+        std::call_once(f.once, [&] {
+            if (framing == Raw) {
+                f.data = isMap
+                             ? Message::makeNotification(method, params.toMap(), v1).toJsonUtf8()
+                             : Message::makeNotification(method, params.toList(), v1).toJsonUtf8();
+                return;
+            }
+            if (framing == BinFramed) {
+                try {
+                    f.data = BinWire::serializeFramed(isMap ? Message::makeNotification(method, params.toMap(), v1).data
+                                                            : Message::makeNotification(method, params.toList(), v1).data);
+                } catch (const std::exception &e) {
+                    Error() << "PreparedNotification: failed to serialize " << method << ": " << e.what();
+                }
+                return;
+            }
+            const QByteArray & raw = bytes(v1, Raw);
+            if (raw.isEmpty()) return;
+            if (framing == Newline) {
+                f.data.reserve(raw.size() + 2);
+                f.data.append(raw).append(QByteArrayLiteral("\r\n"));
+                return;
+            }
+            try {
+                f.data = WebSocket::Ser::wrapPayload(raw, framing == WSBinary ? WebSocket::FrameType::Binary
+                                                                                : WebSocket::FrameType::Text,
+                                                     false /* server frames are never masked */);
+            } catch (const std::exception &e) {
+                Error() << "PreparedNotification: failed to frame " << method << ": " << e.what();
+            }
+        });
+        return f.data;
+    }
+
     ConnectionBase::ConnectionBase(const MethodMap * methods_, IdMixin::Id id_in, QObject *parent, qint64 maxBuffer_)
         : AbstractConnection(id_in, parent, maxBuffer_), methods(methods_ ? *methods_ : EmptyMethodMap)
     {
@@ -278,6 +381,8 @@ namespace RPC {
         // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendNotification, this, &ConnectionBase::_sendNotification));
         // connection will be auto-disconnected on socket disconnect
+        connectedConns.push_back(connect(this, &ConnectionBase::sendPreparedNotification, this, &ConnectionBase::_sendPreparedNotification));
+        // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendError, this, &ConnectionBase::_sendError));
         // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendResult, this, &ConnectionBase::_sendResult));
@@ -292,6 +397,23 @@ namespace RPC {
         AbstractConnection::on_disconnected(); // will auto-disconnect all QMetaObject::Connections appearing in connectedConns
         nUnansweredLifetime += quint64(idMethodMap.size());
         idMethodMap.clear();
+        pendingTimings.clear();
+    }
+
+    void ConnectionBase::beginRequestTiming(BatchId batchId, const Message::Id & reqid, Metrics::Histogram & h)
+    {
+        if (pendingTimings.size() >= MAX_UNANSWERED_REQUESTS)
+            return; // misbehaving peer; don't let this table grow without bound
+        pendingTimings.insert({batchId, reqid}, {&h, Util::getTimeNS()});
+    }
+
+    void ConnectionBase::endRequestTiming(BatchId batchId, const Message::Id & reqid)
+    {
+        if (pendingTimings.isEmpty()) return;
+        if (auto it = pendingTimings.find({batchId, reqid}); it != pendingTimings.end()) {
+            it->hist->recordNanos(Util::getTimeNS() - it->t0);
+            pendingTimings.erase(it);
+        }
     }
 
     auto ConnectionBase::stats() const -> Stats
@@ -339,6 +461,38 @@ namespace RPC {
         // below send() ends up calling do_write immediately (which is connected to send)
         emit send( wrapForSend(std::move(jsonData)) );
     }
+    void ConnectionBase::_sendRequestBatch(const std::vector<OutgoingRequest> & reqs)
+    {
+        if (reqs.empty()) return;
+        if (status != Connected || !socket) {
+            DebugM(__func__, " (", reqs.size(), " requests); Not connected! ", "(id: ", this->id, "), forcing on_disconnect ...");
+            // the below ensures socket cleanup code runs.  This guarantees a disconnect & cleanup on bad socket state.
+            do_disconnect();
+            return;
+        }
+        if (idMethodMap.size() + qsizetype(reqs.size()) > MAX_UNANSWERED_REQUESTS) {  // prevent memory leaks in case of misbehaving peer
+            Warning() << "Closing connection because too many unanswered requests for: " << prettyName();
+            do_disconnect();
+            return;
+        }
+        QVariantList batch;
+        batch.reserve(qsizetype(reqs.size()));
+        for (const auto & r : reqs)
+            batch.push_back(Message::makeRequest(r.id, r.method, r.params, v1).data);
+        QByteArray jsonData;
+        try { jsonData = Json::toUtf8(batch, true); } catch (...) {}
+        if (jsonData.isEmpty()) {
+            Error() << __func__ << " (" << reqs.size() << " requests); Unable to generate batch request JSON! FIXME!";
+            return;
+        }
+        for (const auto & r : reqs)
+            idMethodMap[r.id] = r.method; // remember method sent out to associate it back.
+
+        TraceM("Sending json: ", Util::Ellipsify(jsonData));
+        nRequestsSent += reqs.size();
+        // below send() ends up calling do_write immediately (which is connected to send)
+        emit send( wrapForSend(std::move(jsonData)) );
+    }
     void ConnectionBase::_sendNotification(const QString &method, const QVariant & params)
     {
         if (status != Connected || !socket) {
@@ -349,9 +503,9 @@ namespace RPC {
         }
         QByteArray json;
         if (params.canConvert<QVariantMap>()) {
-            json = Message::makeNotification(method, params.toMap(), v1).toJsonUtf8();
+            json = serializeForWire(Message::makeNotification(method, params.toMap(), v1).data);
         } else if (params.canConvert<QVariantList>()) {
-            json = Message::makeNotification(method, params.toList(), v1).toJsonUtf8();
+            json = serializeForWire(Message::makeNotification(method, params.toList(), v1).data);
         } else {
             Error() << __func__ << " method: " << method << "; Notification requires either a QVarantList or a QVariantMap as its argument! FIXME!";
             return;
@@ -365,8 +519,30 @@ namespace RPC {
         // below send() ends up calling do_write immediately (which is connected to send)
         emit send( wrapForSend(std::move(json)) );
     }
+    void ConnectionBase::_sendPreparedNotification(const PreparedNotificationPtr & n)
+    {
+        if (status != Connected || !socket) {
+            DebugM(__func__, " method: ", n ? n->method : QString(), "; Not connected! ", "(id: ", this->id, "), forcing on_disconnect ...");
+            // the below ensures socket cleanup code runs.  This guarantees a disconnect & cleanup on bad socket state.
+            do_disconnect();
+            return;
+        }
+        if (UNLIKELY(!n || n->bytes(v1, PreparedNotification::Raw).isEmpty())) {
+            Error() << __func__ << " method: " << (n ? n->method : QString()) << "; Unable to generate notification JSON! FIXME!";
+            return;
+        }
+        TraceM("Sending json: ", Util::Ellipsify(n->bytes(v1, PreparedNotification::Raw)));
+        ++nNotificationsSent;
+        writePrepared(*n);
+    }
+    void ConnectionBase::writePrepared(const PreparedNotification &n)
+    {
+        // below send() ends up calling do_write immediately (which is connected to send)
+        emit send( wrapForSend(QByteArray(n.bytes(v1, PreparedNotification::Raw))) );
+    }
     void ConnectionBase::_sendError(bool disc, int code, const QString &msg, BatchId batchId, const Message::Id & reqId)
     {
+        endRequestTiming(batchId, reqId);
         if (status != Connected || !socket) {
             DebugM(__func__, "; Not connected! ", "(id: ", this->id, "), forcing on_disconnect ...");
             // the below ensures socket cleanup code runs.  This guarantees a disconnect & cleanup on bad socket state.
@@ -385,7 +561,7 @@ namespace RPC {
                 return;
 
             // otherwise produce some Json right now and send it out to the client
-            json = m.toJsonUtf8();
+            json = serializeForWire(m.data);
         }
         TraceM("Sending json: ", Util::Ellipsify(json));
         ++nErrorsSent;
@@ -397,6 +573,7 @@ namespace RPC {
     }
     void ConnectionBase::_sendResult(BatchId batchId, const Message::Id & reqid, const QVariant & result)
     {
+        endRequestTiming(batchId, reqid);
         if (status != Connected || !socket) {
             DebugM(__func__, ":  Not connected! ", "(id: ", this->id, "), forcing on_disconnect ...");
             // the below ensures socket cleanup code runs.  This guarantees a disconnect & cleanup on bad socket state.
@@ -414,7 +591,7 @@ namespace RPC {
                 return;
 
             // otherwise produce some Json right now and send it out to the client
-            json = m.toJsonUtf8();
+            json = serializeForWire(m.data);
         }
         if (UNLIKELY(json.isEmpty())) {
             Error() << __func__ << ": Unable to generate result JSON! FIXME!";
@@ -426,6 +603,13 @@ namespace RPC {
         emit send( wrapForSend(std::move(json)) );
     }
 
+    QByteArray ConnectionBase::serializeForWire(const QVariant &v) const
+    {
+        QByteArray ret;
+        try { ret = wireFmt == WireFormat::Binary ? BinWire::serialize(v) : Json::toUtf8(v, true); } catch (...) {}
+        return ret;
+    }
+
     bool ConnectionBase::batchResponseFilter(BatchId batchId, const Message & msg)
     {
         if (batchId.isNull()) return false; // batchId.isNull() means to not filter.
@@ -444,58 +628,46 @@ namespace RPC {
         return true;
     }
 
-    void ConnectionBase::processJson(QByteArray &&json)
+    template <typename DecodeFunc>
+    void ConnectionBase::processIncoming(const qsizetype nBytes, DecodeFunc && decode, QByteArray &&binaryResult)
     {
         if (ignoreNewIncomingMessages) {
             // This is only ever latched to true in the "Client" subclass and it signifies that the client is being
             // dropped and so we have this short-circuit conditional to save on cycles in that situation and not
             // bother processing further messages.
-            DebugM("ignoring ", json.length(), " byte incoming message from ", id);
+            DebugM("ignoring ", nBytes, " byte incoming message from ", id);
             return;
         }
         Message::Id msgId;
         std::optional<ProcessObjectResult::Error> error;
         try {
-            const auto backend = jsonParserBackend.load(std::memory_order_relaxed);
-            const Json::ParseOption parseOpt = batchPermitted ? Json::ParseOption::AcceptAnyValue
-                                                              : Json::ParseOption::RequireObject;
-            QVariant var = Json::parseUtf8(json, parseOpt, backend); // may throw
-            json.clear(); // release memory right away (needed for ScaleNet)
-
-            if (var.canConvert<QVariantMap>()) {
-                // handle immediate request
-                const auto res = processObject(var.toMap()); // may throw
-                var.clear(); // release unused memory immediately
-                msgId = res.parsedMsgId; // copy parsed message id so possible error-sending code below has it (if not null)
-                if (res.error) {
-                    error = std::move(res.error);
-                } else if (res.message) {
-                    if (res.message->isError())
-                        emit gotErrorMessage(id, *res.message);
-                    else
-                        emit gotMessage(id, BatchId{} /* no batchId in immediate mode */, *res.message);
-                } else {
-                    // No error or no message means callee is telling us to do nothing with this.
-                    // This can happen if unexpected/unsupported notification, in which case peerError() was
-                    // already emitted by `processObject()`.
-                    return;
+            std::optional<ProcessObjectResult> res = decode(); // may throw
+            if (!res)
+                return; // a batch was enqueued
+            // handle immediate request
+            msgId = res->parsedMsgId; // copy parsed message id so possible error-sending code below has it (if not null)
+            if (res->error) {
+                error = std::move(res->error);
+            } else if (res->message) {
+                if (res->message->isError())
+                    emit gotErrorMessage(id, *res->message);
+                else {
+                    if (!binaryResult.isNull() && res->message->isResponse())
+                        res->message->binaryResult = std::move(binaryResult);
+                    emit gotMessage(id, BatchId{} /* no batchId in immediate mode */, *res->message);
                 }
-            } else if (var.canConvert<QVariantList>()) {
-                // Note: This branch can only be taken if batchPermitted == true
-                enqueueNewBatch(var.toList()); // This may throw InvalidRequest (if list is empty), or BatchLimitExceeded
-                return;
             } else {
-                // Note: This branch can only be taken if batchPermitted == true
-                // Handle error immediately. Note that older Fulcrum (or Fulcrum with batchPermitted == false)
-                // would throw Json::Error here, which technically isn't quite correct.  As per JSON-RPC 2.0 specs,
-                // the Invalid request error should happen when a request isn't properly formatted or is of the wrong
-                // JSON type.
-                throw InvalidRequest{};
+                // No error or no message means callee is telling us to do nothing with this.
+                // This can happen if unexpected/unsupported notification, in which case peerError() was
+                // already emitted by `processObject()`.
+                return;
             }
         } catch (const BatchLimitExceeded & e) {
             error.emplace(Code_App_LimitExceeded, "Batch limit exceeded");
         } catch (const Json::ParseError & e) {
             error.emplace(Code_ParseError, e.what());
+        } catch (const BinWire::ParseError & e) {
+            error.emplace(Code_ParseError, e.what());
         } catch (const InvalidRequest & e) {
             error.emplace(Code_InvalidRequest, "Invalid request");
         } catch (const Exception & e) {
@@ -507,6 +679,63 @@ namespace RPC {
             on_processJsonFailure(error->code, error->message, msgId);
     }
 
+    auto ConnectionBase::processVariant(QVariant &&var) -> std::optional<ProcessObjectResult>
+    {
+        if (var.canConvert<QVariantMap>()) {
+            std::optional<ProcessObjectResult> res{processObject(var.toMap())}; // may throw
+            var.clear(); // release unused memory immediately
+            return res;
+        } else if (var.canConvert<QVariantList>()) {
+            // Note: This branch can only be taken if batchPermitted == true
+            enqueueNewBatch(var.toList()); // This may throw InvalidRequest (if list is empty), or BatchLimitExceeded
+            return std::nullopt;
+        }
+        // Note: This branch can only be taken if batchPermitted == true
+        // Handle error immediately. Note that older Fulcrum (or Fulcrum with batchPermitted == false)
+        // would throw Json::Error here, which technically isn't quite correct.  As per JSON-RPC 2.0 specs,
+        // the Invalid request error should happen when a request isn't properly formatted or is of the wrong
+        // JSON type.
+        throw InvalidRequest{};
+    }
+
+    void ConnectionBase::processJson(QByteArray &&json, QByteArray &&binaryResult)
+    {
+        processIncoming(json.length(), [this, &json]() -> std::optional<ProcessObjectResult> {
+            const auto backend = jsonParserBackend.load(std::memory_order_relaxed);
+            std::optional<Json::RpcRequests> decoded;
+            if (backend != Json::ParserBackend::Default && Json::isParserAvailable(Json::ParserBackend::SimdJson))
+                // Fast path for the common case of a request (or a batch of requests) with simple positional params:
+                // decode straight into typed requests, skipping the intermediate QVariant tree. Anything unusual
+                // (including malformed JSON) yields an empty optional and takes the general path below.
+                decoded = Json::parseRpcRequests(json, batchPermitted);
+            if (decoded) {
+                json.clear(); // release memory right away
+                if (decoded->isBatch) {
+                    // Note: This branch can only be taken if batchPermitted == true
+                    enqueueNewBatch(std::move(decoded->requests)); // This may throw BatchLimitExceeded
+                    return std::nullopt;
+                }
+                return processObject(std::move(decoded->requests.front())); // may throw
+            }
+            const Json::ParseOption parseOpt = batchPermitted ? Json::ParseOption::AcceptAnyValue
+                                                              : Json::ParseOption::RequireObject;
+            QVariant var = Json::parseUtf8(json, parseOpt, backend); // may throw
+            json.clear(); // release memory right away (needed for ScaleNet)
+            return processVariant(std::move(var));
+        }, std::move(binaryResult));
+    }
+
+    void ConnectionBase::processBinary(QByteArray &&payload)
+    {
+        processIncoming(payload.length(), [this, &payload]() -> std::optional<ProcessObjectResult> {
+            QVariant var = BinWire::parse(payload); // may throw
+            payload.clear(); // release memory right away
+            if (!batchPermitted && !Compat::IsMetaType(var, QMetaType::QVariantMap))
+                throw InvalidRequest{};
+            return processVariant(std::move(var));
+        });
+    }
+
     void ConnectionBase::on_processJsonFailure(int code, const QString & message, const Message::Id &msgId)
     {
         bool doDisconnect = errorPolicy & ErrorPolicyDisconnect;
@@ -530,7 +759,17 @@ namespace RPC {
             // empty batch lists are a JSON-RPC error
             throw InvalidRequest();
 
-        auto batch_exception_guard = std::make_unique<RPC::BatchProcessor>(*this, std::move(varList));
+        enqueueNewBatch(std::make_unique<RPC::BatchProcessor>(*this, std::move(varList)));
+    }
+
+    void ConnectionBase::enqueueNewBatch(std::vector<Json::RpcRequest> && requests)
+    {
+        assert(!requests.empty()); // Json::parseRpcRequests() never returns an empty batch
+        enqueueNewBatch(std::make_unique<RPC::BatchProcessor>(*this, std::move(requests)));
+    }
+
+    void ConnectionBase::enqueueNewBatch(std::unique_ptr<BatchProcessor> batch_exception_guard)
+    {
         auto *batch = batch_exception_guard.get();
         const BatchId batchId{batch->batchId()};
         if ( ! canAcceptBatch(batch) ) {
@@ -560,12 +799,12 @@ namespace RPC {
         batch_exception_guard.release(); // owner is now `this`, as part of Qt QObject ownership model.
     }
 
-    auto ConnectionBase::processObject_internal(QVariantMap && vmap) -> ProcessObjectResult
+    template <typename MakeMessageFunc>
+    auto ConnectionBase::processMessage_internal(MakeMessageFunc && makeMessage) -> ProcessObjectResult
     {
         Message::Id msgId;
         try {
-            Message message = Message::fromJsonData(vmap, &msgId, v1, strict); // may throw
-            vmap.clear(); // release memory right away
+            Message message = makeMessage(&msgId); // may throw
 
             static const auto ValidateParams = [](const Message &msg, const Method &m) {
                 if (!msg.hasParams()) {
@@ -671,6 +910,22 @@ namespace RPC {
         } // end try/catch
     }
 
+    auto ConnectionBase::processObject_internal(QVariantMap && vmap) -> ProcessObjectResult
+    {
+        return processMessage_internal([&](Message::Id *msgId) {
+            Message message = Message::fromJsonData(vmap, msgId, v1, strict); // may throw
+            vmap.clear(); // release memory right away
+            return message;
+        });
+    }
+
+    auto ConnectionBase::processObject_internal(Json::RpcRequest && req) -> ProcessObjectResult
+    {
+        return processMessage_internal([&](Message::Id *msgId) {
+            return Message::fromRpcRequest(std::move(req), msgId, v1, strict); // may throw
+        });
+    }
+
     auto ConnectionBase::processObject(QVariantMap && vmap) -> ProcessObjectResult
     {
         auto ret = processObject_internal(std::move(vmap));
@@ -678,6 +933,13 @@ namespace RPC {
         return ret;
     }
 
+    auto ConnectionBase::processObject(Json::RpcRequest && req) -> ProcessObjectResult
+    {
+        auto ret = processObject_internal(std::move(req));
+        if (ret.message) lastGood = Util::getTime(); // update "lastGood" as this is used to determine if stale or not.
+        return ret;
+    }
+
     /* --- LinefeedConnection --- */
     ElectrumConnection::~ElectrumConnection() {} ///< for vtable
 
@@ -717,7 +979,7 @@ namespace RPC {
         // TODO: In the non-WebSocket case, scanning for '\n' may be slow for large loads.
         // Also TODO: This should have some upper bound on how many times it loops and come back later if too much data
         // is available.
-        while (!isBad() && socket && (ws ? ws->messagesAvailable() > 0 : socket->canReadLine())) {
+        while (!isBad() && socket && wireFmt == WireFormat::Json && (ws ? ws->messagesAvailable() > 0 : socket->canReadLine())) {
             // check if paused -- we may get paused inside processJson below
             if (readPaused) {
                 skippedOnReadyRead = true;
@@ -740,6 +1002,9 @@ namespace RPC {
             TraceM("Got: ", (!ws ? data.trimmed() : data));
             processJson(std::move(data));
         }
+        if (!isBad() && wireFmt == WireFormat::Binary)
+            // we are (or processJson() above just switched us to) reading length-prefixed binary frames
+            readBinaryFrames();
         if (isBad()) { // this may have been set again by processJson() above
             DebugM(prettyName(), " is now bad, ignoring read (buf: ",
                    QString::number((socket ? socket->bytesAvailable() : 0)/1024., 'f', 1), " KB)");
@@ -755,6 +1020,46 @@ namespace RPC {
         memoryWasteDoSProtection();
     }
 
+    void ElectrumConnection::readBinaryFrames()
+    {
+        assert(!checkSetGetWebSocket()); // WebSocket connections never switch to the binary wire format
+        while (!isBad() && socket && wireFmt == WireFormat::Binary) {
+            if (readPaused) {
+                skippedOnReadyRead = true;
+                DebugM(prettyName(), " reads paused, skipping readBinaryFrames",
+                       " (bufsz: ", QString::number(socket->bytesAvailable()/1024.0, 'f', 1), " KB) ...");
+                break;
+            }
+            const qint64 avail = socket->bytesAvailable();
+            char hdr[BinWire::kFrameHeaderSize];
+            if (avail < BinWire::kFrameHeaderSize || socket->peek(hdr, sizeof(hdr)) != qint64(sizeof(hdr)))
+                break;
+            const qint64 len = BinWire::frameLength(hdr);
+            if (MAX_BUFFER > 0 && len > MAX_BUFFER) {
+                Error() << prettyName() << " sent a " << len << " byte frame, which exceeds the max buffer size of "
+                        << MAX_BUFFER << ", aborting connection";
+                do_disconnect();
+                status = Bad;
+                break;
+            }
+            if (avail < BinWire::kFrameHeaderSize + len)
+                break; // wait for the rest of the frame
+            QByteArray payload;
+            try {
+                socket->read(hdr, sizeof(hdr)); // consume the header we peeked
+                payload = socket->read(len);
+            } catch (const std::exception &e) { // we anticipate only bad_alloc being thrown here in pathological cases
+                Error() << prettyName() << " exception copying data from socket: " << e.what() << ", aborting connection";
+                do_disconnect();
+                status = Bad;
+                break;
+            }
+            nReceived += BinWire::kFrameHeaderSize + payload.length();
+            TraceM("Got binary frame: ", payload.length(), " bytes");
+            processBinary(std::move(payload));
+        }
+    }
+
     void ElectrumConnection::setReadPaused(bool b)
     {
 #ifndef NDEBUG
@@ -831,6 +1136,8 @@ namespace RPC {
 
     QByteArray ElectrumConnection::wrapForSend(QByteArray && d)
     {
+        if (wireFmt == WireFormat::Binary)
+            return BinWire::frame(std::move(d));
         if (checkSetGetWebSocket()) {
             // in websocket mode we don't wrap anything -- it's already framed.
             return std::move(d);
@@ -840,6 +1147,31 @@ namespace RPC {
         return std::move(d);
     }
 
+    void ElectrumConnection::writePrepared(const PreparedNotification &n)
+    {
+        if (wireFmt == WireFormat::Binary) {
+            const QByteArray & frame = n.bytes(isV1(), PreparedNotification::BinFramed);
+            if (LIKELY(!frame.isEmpty())) emit send(frame); // else error already logged
+            return;
+        }
+        WebSocket::Wrapper * const ws = checkSetGetWebSocket();
+        if (!ws) {
+            // regular classic Electrum Cash socket -- send the shared newline-delimited bytes as-is.
+            emit send(n.bytes(isV1(), PreparedNotification::Newline));
+            return;
+        }
+        if (ws->mode() != WebSocket::Wrapper::ServerMode) {
+            // client-mode frames are masked with a random key, so they can't be shared; let the wrapper frame it.
+            emit send(n.bytes(isV1(), PreparedNotification::Raw));
+            return;
+        }
+        const QByteArray & frame = n.bytes(isV1(), ws->messageMode() == WebSocket::Wrapper::Binary
+                                                   ? PreparedNotification::WSBinary : PreparedNotification::WSText);
+        if (UNLIKELY(frame.isEmpty())) return; // error already logged
+        const qint64 payloadLen = n.bytes(isV1(), PreparedNotification::Raw).size();
+        do_write_custom(payloadLen, [ws, &frame, payloadLen]{ return ws->writeFrame(frame, payloadLen); });
+    }
+
     /* --- HttpConnection --- */
     HttpConnection::~HttpConnection() {} ///< for vtable
     void HttpConnection::setAuth(const QString &username, const QString &password)
@@ -1026,7 +1358,15 @@ namespace RPC {
                         Trace() << "cl: " << sm->contentLength << " inbound JSON: " << json.trimmed();
                     sm->clear(); // reset back to BEGIN state, empty buffers, clean slate.
 
-                    processJson(std::move(json));
+                    const auto firstChar = std::find_if_not(json.cbegin(), json.cend(), [](char c) { return std::isspace(uchar(c)); });
+                    if (firstChar != json.cend() && *firstChar == '[') {
+                        // reply to a batch we sent (bitcoind never sends us requests, so a JSON array can only be that)
+                        processBatchReply(std::move(json));
+                    } else {
+                        // Note: must be called after sm->clear() so that `json` is not shared (and thus not deep-copied)
+                        QByteArray binaryResult = json.size() >= kHexResultThresh ? takeHexResult(json) : QByteArray{};
+                        processJson(std::move(json), std::move(binaryResult));
+                    }
                     // `json` scope end to ensure not used after move.
                 }
                 // If bytesAvailable .. schedule a callback to this function again since we did a partial read just now,
@@ -1049,6 +1389,96 @@ namespace RPC {
             if (sm) sm->clear(); // ensure state machine is "fresh" if we get here
         }
     }
+    namespace {
+        /// Where the 'result' hex string of a bitcoind reply lives in the reply, see FindHexResult()
+        struct HexResultSpan {
+            QByteArray::size_type begin, end; ///< [begin, end) are the hex digits
+            QByteArray rest; ///< the reply with the hex string replaced by null
+            Message::Id id;
+        };
+
+        /// Locates the 'result' string of a bitcoind reply of the form {"result":"<hex>",...}. Returns an empty
+        /// optional if `json` doesn't look like that, or if the rest of it isn't a JSON object.
+        std::optional<HexResultSpan> FindHexResult(const QByteArray &json)
+        {
+            // bitcoind puts "result" first in its replies, or right after "jsonrpc":"2.0" for JSON-RPC 2.0 requests.
+            static const QByteArray s_key = "\"" + Message::s_result.toLatin1() + "\":\"";
+            constexpr QByteArray::size_type kMaxKeyPos = 32;
+            const auto keyPos = json.left(kMaxKeyPos + s_key.size()).indexOf(s_key);
+            if (keyPos <= 0 || (json[keyPos - 1] != '{' && json[keyPos - 1] != ','))
+                return std::nullopt;
+            const auto begin = keyPos + s_key.size();
+            const char * const quote = static_cast<const char *>(std::memchr(json.constData() + begin, '"',
+                                                                              size_t(json.size() - begin)));
+            if (!quote) return std::nullopt;
+            const auto end = QByteArray::size_type(quote - json.constData());
+            if (end == begin || (end - begin) % 2) return std::nullopt;
+            HexResultSpan ret{begin, end, json.left(begin - 1) + "null" + json.mid(end + 1), {}};
+            try {
+                ret.id = Message::Id::fromVariant(Json::parseUtf8(ret.rest, Json::ParseOption::RequireObject)
+                                                  .toMap().value(Message::s_id));
+            } catch (const std::exception &) {
+                return std::nullopt; // let processJson() deal with whatever this is
+            }
+            return ret;
+        }
+
+        /// Decodes the hex digits at `span` in place into the front of `json`, which must not be shared, and then
+        /// releases the rest of its buffer. Afterwards `json` holds the decoded bytes.
+        void DecodeHexResultInPlace(QByteArray &json, const HexResultSpan &span)
+        {
+            char * const d = json.data();
+            Util::ParseHexFastInPlace(d + span.begin, size_t(span.end - span.begin), d);
+            json.truncate((span.end - span.begin) / 2);
+            json.squeeze(); // give back the (now unused) second half of the buffer
+        }
+    } // namespace
+
+    QByteArray HttpConnection::takeHexResult(QByteArray &json)
+    {
+        auto span = FindHexResult(json);
+        if (!span || idMethodMap.value(span->id) != QStringLiteral("getblock"))
+            return {};
+        DecodeHexResultInPlace(json, *span);
+        QByteArray ret = std::move(json);
+        json = std::move(span->rest);
+        return ret;
+    }
+
+    void HttpConnection::processBatchReply(QByteArray &&json)
+    {
+        QVariantList items;
+        try {
+            items = Json::parseUtf8(json, Json::ParseOption::AcceptAnyValue,
+                                    jsonParserBackend.load(std::memory_order_relaxed)).toList(); // may throw
+        } catch (const std::exception & e) {
+            on_processJsonFailure(Code_ParseError, e.what());
+            return;
+        }
+        json.clear(); // release memory right away
+        if (items.isEmpty()) {
+            on_processJsonFailure(Code_InvalidRequest, "Empty or malformed batch reply");
+            return;
+        }
+        for (auto & item : items) {
+            if (!item.canConvert<QVariantMap>()) {
+                on_processJsonFailure(Code_InvalidRequest, "Batch reply item is not an object");
+                return;
+            }
+            auto res = processObject(item.toMap());
+            item.clear(); // release unused memory immediately
+            if (res.error) {
+                on_processJsonFailure(res.error->code, res.error->message, res.parsedMsgId);
+                if (isBad()) return; // on_processJsonFailure() disconnected us, so stop here
+            } else if (res.message) {
+                if (res.message->isError())
+                    emit gotErrorMessage(id, *res.message);
+                else
+                    emit gotMessage(id, BatchId{}, *res.message);
+            }
+        }
+    }
+
     QByteArray HttpConnection::wrapForSend(QByteArray && data)
     {
         static const QByteArray NL("\r\n"), SLASHN("\n"), EMPTY("");
@@ -1161,6 +1591,33 @@ namespace RPC {
         return ret;
     }
 
+    Json::RpcRequest Batch::takeNextAndIncrement()
+    {
+        Json::RpcRequest ret;
+        if (hasNext())
+            ret = std::move(requests[size_t(nextItem++)]); // consume array member right away to free up memory
+        return ret;
+    }
+
+    QString Batch::homogeneousMethod() const
+    {
+        QString ret;
+        if (size() < 2) return ret;
+        if (isNextTyped()) {
+            for (const auto & r : requests) {
+                if (r.method.isEmpty() || (!ret.isNull() && r.method != ret)) return QString{};
+                ret = r.method;
+            }
+        } else {
+            for (const auto & var : items) {
+                const QString method = var.toMap().value(QStringLiteral("method")).toString();
+                if (method.isEmpty() || (!ret.isNull() && method != ret)) return QString{};
+                ret = method;
+            }
+        }
+        return ret;
+    }
+
     BatchProcessor::BatchProcessor(ConnectionBase & parent, Batch && batch_)
         : QObject(&parent), IdMixin(newId()), conn(parent), batch(std::move(batch_))
     {
@@ -1168,11 +1625,15 @@ namespace RPC {
         assert(!batch.batchId.isNull());
         try {
             cumCost = Json::estimateMemoryFootprint(batch.items);
+            for (const auto & r : batch.requests)
+                cumCost += qsizetype(sizeof(r)) + Json::estimateMemoryFootprint(r.params)
+                           + (r.method.size() + r.idString.size() + r.jsonrpc.size()) * qsizetype(sizeof(QChar));
         } catch (const std::exception &e) {
             Error() << "Exception calculating base cost in " << __func__ << ": " << e.what();
         }
+        homogeneousMethod = batch.homogeneousMethod();
         setObjectName(parent.objectName() + " BatchProcessor." + QString::number(id)
-                      + " (" + QString::number(batch.items.size()) + ")");
+                      + " (" + QString::number(batch.size()) + ")");
         connect(&conn, &ConnectionBase::readPausedStateChanged, this, [this](bool readPaused){
             if (!readPaused && isProcessingPaused) {
                 // kick-start a paused state back to unpaused
@@ -1194,6 +1655,14 @@ namespace RPC {
         emit costDelta(cost);
     }
 
+    void BatchProcessor::endHomogeneousDispatch()
+    {
+        if (homogeneousAnnounced && !homogeneousDone) {
+            homogeneousDone = true;
+            emit conn.homogeneousBatchDispatched(conn.id, batch.batchId);
+        }
+    }
+
     void BatchProcessor::pushResponse(Message && response)
     {
         batch.responses.push_back(std::move(response));
@@ -1210,7 +1679,8 @@ namespace RPC {
             // This is only ever latched to true in the "Client" subclass and it signifies that the client is being
             // dropped and so we have this short-circuit conditional to save on cycles in that situation and not
             // bother processing further messages.
-            DebugM(objectName(), ": ignoring ", batch.items.size() - batch.nextItem, " batch message(s)");
+            DebugM(objectName(), ": ignoring ", batch.size() - batch.nextItem, " batch message(s)");
+            endHomogeneousDispatch();
             done = true;
             emit finished();
             return;
@@ -1218,6 +1688,7 @@ namespace RPC {
         if (killed) {
             // as the batch executed it exceeded a limit, so just return an error to the client
             done = true; // set this flag first so we don't stand a chance of filtering below error message
+            endHomogeneousDispatch();
             conn.on_processJsonFailure(Code_App_LimitExceeded, "Batch limit exceeded");
             emit finished();
         } else if (batch.hasNext()) {
@@ -1233,17 +1704,25 @@ namespace RPC {
                 isProcessingPaused = false;
             }
             if constexpr (debugBatchExtra) DebugM(objectName(), ": processing batch item ", batch.nextItem + 1);
-            auto var = batch.getNextAndIncrement();
+            if (!homogeneousMethod.isEmpty() && !homogeneousAnnounced) {
+                homogeneousAnnounced = true;
+                emit conn.gotHomogeneousBatch(conn.id, batch.batchId, homogeneousMethod);
+            }
             std::optional<QString> error;
-            if (!var.canConvert<QVariantMap>()) {
-                pushResponse(Message::makeError(Code_InvalidRequest, *(error="Invalid request"), {}, conn.isV1()));
+            std::optional<ConnectionBase::ProcessObjectResult> res;
+            if (batch.isNextTyped()) {
+                res.emplace(conn.processObject(batch.takeNextAndIncrement()));
+            } else if (auto var = batch.getNextAndIncrement(); var.canConvert<QVariantMap>()) {
+                res.emplace(conn.processObject(var.toMap()));
             } else {
-                auto res = conn.processObject(var.toMap());
-                if (res.error) {
-                    pushResponse(Message::makeError(res.error->code, (error=res.error->message)->left(120),
-                                                    res.parsedMsgId, conn.isV1()));
-                } else if (res.message) {
-                    const auto & m = *res.message;
+                pushResponse(Message::makeError(Code_InvalidRequest, *(error="Invalid request"), {}, conn.isV1()));
+            }
+            if (res) {
+                if (res->error) {
+                    pushResponse(Message::makeError(res->error->code, (error=res->error->message)->left(120),
+                                                    res->parsedMsgId, conn.isV1()));
+                } else if (res->message) {
+                    const auto & m = *res->message;
                     if (m.isRequest()) {
                         // Ok, proceed to pass the message along to the `conn` instance. We will be notified in
                         // our `acceptResponse()` method by `ConnectionBase::batchResponseFilter` when the result
@@ -1267,6 +1746,8 @@ namespace RPC {
                 if ( ! (conn.errorPolicy & conn.ErrorPolicyDisconnect))
                     emit conn.peerError(conn.id, conn.lastPeerError);
             }
+            if (!batch.hasNext())
+                endHomogeneousDispatch();
             if (LIKELY(conn.isGood()))
                 // keep sending requests to the conn, but only if we didn't go "Bad" (may happen in corner cases above,
                 // or if the connection went down asynchronously between calls)
@@ -1282,8 +1763,10 @@ namespace RPC {
             batch.responses.clear(); // clear memory right away
             if (!l.empty() && conn.isGood()) {
                 // only send if the response list is not empty and if the connection is still good.
-                auto json = Json::toUtf8(l, true);
+                auto json = conn.serializeForWire(l);
                 l.clear(); // clear memory right away
+                if (UNLIKELY(json.isEmpty()))
+                    throw InternalError("Unable to serialize batch response");
                 TraceM("Sending result json: ", Util::Ellipsify(json));
                 // below send() ends up calling do_write immediately (which is connected to send)
                 emit conn.send( conn.wrapForSend(std::move(json)) );
@@ -1334,7 +1817,7 @@ namespace RPC {
         ret["batch"] = [this]{
             QVariantMap bm;
             bm["cost"] = qlonglong(cost());
-            bm["size"] = qlonglong(batch.items.size());
+            bm["size"] = qlonglong(batch.size());
             bm["nextItem"] = qlonglong(batch.nextItem);
             bm["unansweredRequests"] = qlonglong(batch.unansweredRequests);
             bm["responses"] = qlonglong(batch.responses.size());
@@ -1412,3 +1895,228 @@ namespace RPC {
     }
 }
 #endif // if 0
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+namespace {
+    /// Returns a batch of `n` typical subscribe requests, as sent by a wallet syncing many addresses
+    QByteArray MakeSubscribeBatch(int n) {
+        QByteArray ret = "[";
+        for (int i = 0; i < n; ++i) {
+            if (i) ret += ',';
+            ret += R"({"jsonrpc":"2.0","method":"blockchain.scripthash.subscribe","id":)" + QByteArray::number(i)
+                   + R"(,"params":[")" + QByteArray::number(i * 7919).rightJustified(64, '0') + "\"]}";
+        }
+        return ret + "]";
+    }
+
+    void testRpcDecode() {
+        if (!Json::isParserAvailable(Json::ParserBackend::SimdJson)) {
+            Log() << "SimdJson not available, skipping test";
+            return;
+        }
+        using RPC::Message;
+        // Payloads the fast path must decode identically to the general path
+        const QList<QByteArray> common = {
+            R"({"jsonrpc":"2.0","method":"server.version","id":1,"params":["EC 4.3", "1.4"]})",
+            R"({"method":"server.ping","id":"abc"})",
+            R"({"jsonrpc":"2.0","method":"blockchain.block.header","id":null,"params":[123, 0, true, null]})",
+            R"({"jsonrpc":"1.0","method":"server.banner","id":-7,"params":[]})",
+            R"({"jsonrpc":"2.0","method":"blockchain.headers.subscribe"})",
+            R"({"jsonrpc":"2.0","method":"x","id":1,"params":[18446744073709551615]})",
+            R"({"jsonrpc":"2.0","method":"","id":1})",
+            R"({"jsonrpc":"2.0","method":"rpc.foo","id":1})",
+            MakeSubscribeBatch(3),
+        };
+        for (const auto & json : common) {
+            auto decoded = Json::parseRpcRequests(json, true);
+            if (!decoded) throw Exception("Fast path failed to decode: " + QString(json));
+            const auto general = Json::parseUtf8(json, Json::ParseOption::AcceptAnyValue, Json::ParserBackend::SimdJson);
+            const QVariantList items = decoded->isBatch ? general.toList() : QVariantList{general};
+            if (size_t(items.size()) != decoded->requests.size())
+                throw Exception("Request count mismatch for: " + QString(json));
+            for (size_t i = 0; i < decoded->requests.size(); ++i) {
+                QString err1, err2;
+                Message::Id id1, id2;
+                Message m1, m2;
+                try {
+                    m1 = Message::fromJsonData(items.at(int(i)).toMap(), &id1);
+                } catch (const Exception &e) { err1 = e.what(); }
+                try {
+                    m2 = Message::fromRpcRequest(std::move(decoded->requests[i]), &id2);
+                } catch (const Exception &e) { err2 = e.what(); }
+                if (err1 != err2 || id1 != id2 || m1.id != m2.id || m1.method != m2.method
+                        || m1.isRequest() != m2.isRequest() || m1.isNotif() != m2.isNotif()
+                        || m1.hasParams() != m2.hasParams() || m1.paramsList() != m2.paramsList()
+                        || m1.jsonRpcVersion() != m2.jsonRpcVersion() || m1.toJsonUtf8() != m2.toJsonUtf8())
+                    throw Exception(QString("Fast path and general path disagree for: %1 (errors: \"%2\" vs \"%3\")")
+                                    .arg(QString(json), err1, err2));
+            }
+        }
+        // Payloads the fast path must leave to the general path
+        const QList<QByteArray> unusual = {
+            R"({"jsonrpc":"2.0","method":"x","id":1,"params":{"a":1}})",
+            R"({"jsonrpc":"2.0","method":"x","id":1,"params":[[1]]})",
+            R"({"jsonrpc":"2.0","method":"x","id":1,"params":[1.5]})",
+            R"({"jsonrpc":"2.0","method":"x","id":1.0})",
+            R"({"jsonrpc":"2.0","method":"x","id":1,"id":2})",
+            R"({"jsonrpc":"2.0","result":"x","id":1})",
+            R"({"jsonrpc":"2.0","method":"x","id":1,"extra":1})",
+            R"({"jsonrpc":"2.0","id":1})",
+            R"({"jsonrpc":"2.0","method":5,"id":1})",
+            R"([])",
+            R"([{"jsonrpc":"2.0","method":"x","id":1}, 5])",
+            R"("str")",
+            R"({"jsonrpc":"2.0","method":"x","id":1)",
+        };
+        for (const auto & json : unusual)
+            if (Json::parseRpcRequests(json, true))
+                throw Exception("Fast path should have declined: " + QString(json));
+        if (Json::parseRpcRequests(MakeSubscribeBatch(2), false))
+            throw Exception("Fast path should have declined a batch when batching is not permitted");
+        // Homogeneous batch detection, for both kinds of Batch
+        {
+            const QByteArray mixed = R"([{"method":"server.ping","id":1},{"method":"blockchain.scripthash.subscribe","id":2}])";
+            const auto Check = [](const QByteArray &json, const QString &expected) {
+                auto decoded = Json::parseRpcRequests(json, true);
+                const RPC::Batch typed(std::move(decoded.value().requests)),
+                                 untyped(Json::parseUtf8(json, Json::ParseOption::AcceptAnyValue).toList());
+                if (typed.homogeneousMethod() != expected || untyped.homogeneousMethod() != expected)
+                    throw Exception(QString("Wrong homogeneous method for: %1").arg(QString(json)));
+            };
+            Check(MakeSubscribeBatch(3), "blockchain.scripthash.subscribe");
+            Check(MakeSubscribeBatch(1), QString{});
+            Check(mixed, QString{});
+        }
+        Log() << "RPC request decoding: ok";
+    }
+
+    void benchRpcDecode() {
+        if (!Json::isParserAvailable(Json::ParserBackend::SimdJson)) {
+            Log() << "SimdJson not available, skipping bench";
+            return;
+        }
+        using RPC::Message;
+        constexpr int batchSize = 500, iters = 400;
+        const QByteArray json = MakeSubscribeBatch(batchSize);
+        const auto Report = [](const char *what, qint64 nanos) {
+            const double secs = nanos / 1e9, n = double(batchSize) * iters;
+            Log() << what << ": " << QString::number(secs, 'f', 3) << " secs, "
+                  << QString::number(n / secs, 'f', 0) << " requests/sec on this thread";
+        };
+        Log() << "Decoding a " << batchSize << "-request batch (" << json.size() << " bytes) " << iters << " times ...";
+        auto t0 = Util::getTimeNS();
+        for (int i = 0; i < iters; ++i) {
+            const auto items = Json::parseUtf8(json, Json::ParseOption::AcceptAnyValue, Json::ParserBackend::SimdJson).toList();
+            for (const auto & item : items)
+                if (Message::fromJsonData(item.toMap()).method.isEmpty()) throw Exception("Unexpected empty method");
+        }
+        Report("General path (QVariant tree + fromJsonData)", Util::getTimeNS() - t0);
+        t0 = Util::getTimeNS();
+        for (int i = 0; i < iters; ++i) {
+            auto decoded = Json::parseRpcRequests(json, true);
+            if (!decoded) throw Exception("Fast path failed to decode");
+            for (auto & req : decoded->requests)
+                if (Message::fromRpcRequest(std::move(req)).method.isEmpty()) throw Exception("Unexpected empty method");
+        }
+        Report("Fast path (parseRpcRequests + fromRpcRequest)", Util::getTimeNS() - t0);
+    }
+
+    /// Returns a bitcoind-style "getblock" reply for `nBytes` of pseudo-random block data, and that data
+    std::pair<QByteArray, QByteArray> MakeHexReply(size_t nBytes, bool upper = false) {
+        QByteArray bin(QByteArray::size_type(nBytes), Qt::Uninitialized);
+        uint32_t x = 0x12345678u;
+        for (auto & c : bin) c = char((x = x * 1664525u + 1013904223u) >> 24);
+        const QByteArray hex = upper ? Util::ToHexFast(bin).toUpper() : Util::ToHexFast(bin);
+        return {R"({"result":")" + hex + R"(","error":null,"id":42})", bin};
+    }
+
+    void testHexResult() {
+        using namespace RPC;
+        for (const size_t n : {1u, 3u, 4u, 5u, 1000u, 1001u}) {
+            for (const bool upper : {false, true}) {
+                auto [json, bin] = MakeHexReply(n, upper);
+                const auto span = FindHexResult(json);
+                if (!span || span->id != Message::Id(int64_t(42)) || span->rest != R"({"result":null,"error":null,"id":42})")
+                    throw Exception(QString("Failed to find the hex result in a %1-byte reply").arg(n));
+                DecodeHexResultInPlace(json, *span);
+                if (json != bin) throw Exception(QString("In-place decode of %1 bytes (upper: %2) failed").arg(n).arg(upper));
+            }
+        }
+        for (const QByteArray json : {R"({"result":"abc","error":null,"id":1})", R"({"result":null,"error":{},"id":1})",
+                                      R"({"error":null,"id":1,"padding":"xxxxxxxx","result":"abcd"})", R"({"result":"abcd)",
+                                      R"({"result":"abcd","id":1,)", R"({"xresult":"abcd","id":1})"})
+            if (FindHexResult(json))
+                throw Exception("FindHexResult should have declined: " + QString(json));
+        if (const auto span = FindHexResult(R"({"jsonrpc":"2.0","result":"abcd","id":"x"})");
+                !span || span->id != Message::Id(QString("x")))
+            throw Exception("FindHexResult failed on a JSON-RPC 2.0 reply");
+        Log() << "Hex result extraction: ok";
+    }
+
+    void benchHexResult() {
+        using namespace RPC;
+        const size_t nBytes = size_t(std::max(1, std::getenv("BLOCKMB") ? std::atoi(std::getenv("BLOCKMB")) : 32)) << 20;
+        const auto Rss = []{ return qint64(Util::getProcessMemoryUsage().phys); };
+        const auto MB = [](qint64 b) { return QString::number(b / 1e6, 'f', 1) + " MB"; };
+        Log() << "Ingesting a " << MB(qint64(nBytes)) << " getblock reply ...";
+        {
+            QByteArray json = MakeHexReply(nBytes).first;
+            const auto rss0 = Rss();
+            const auto t0 = Util::getTimeNS();
+            // What we used to do: parse the whole reply as JSON, then hex-decode the result string
+            const QVariant var = Json::parseUtf8(json, Json::ParseOption::RequireObject);
+            json.clear();
+            const QByteArray bin = Util::ParseHexFast(var.toMap().value(Message::s_result).toByteArray());
+            const auto t1 = Util::getTimeNS();
+            Log() << "JSON parse + ParseHexFast: " << QString::number((t1 - t0) / 1e6, 'f', 2) << " msec, RSS grew by "
+                  << MB(Rss() - rss0) << " (decoded " << bin.size() << " bytes)";
+        }
+        {
+            QByteArray json = MakeHexReply(nBytes).first;
+            const auto rss0 = Rss();
+            const auto t0 = Util::getTimeNS();
+            const auto span = FindHexResult(json);
+            if (!span) throw Exception("Failed to find the hex result");
+            DecodeHexResultInPlace(json, *span);
+            const auto t1 = Util::getTimeNS();
+            Log() << "In-place decode in the receive buffer: " << QString::number((t1 - t0) / 1e6, 'f', 2)
+                  << " msec, RSS grew by " << MB(Rss() - rss0) << " (decoded " << json.size() << " bytes)";
+        }
+    }
+
+    void testPreparedNotification() {
+        using namespace RPC;
+        const QString method = "blockchain.scripthash.subscribe";
+        const QVariantList params{QByteArray(64, 'a'), QString(QByteArray(64, 'b'))};
+        const PreparedNotification n(method, params);
+        for (const bool v1 : {false, true}) {
+            const QByteArray & raw = n.bytes(v1, PreparedNotification::Raw);
+            if (raw != Message::makeNotification(method, params, v1).toJsonUtf8())
+                throw Exception(QString("Raw form mismatch (v1: %1): %2").arg(v1).arg(QString(raw)));
+            if (&raw != &n.bytes(v1, PreparedNotification::Raw) || raw.constData() != n.bytes(v1, PreparedNotification::Raw).constData())
+                throw Exception("Raw form was rebuilt on second use");
+            if (n.bytes(v1, PreparedNotification::Newline) != raw + "\r\n")
+                throw Exception("Newline form mismatch");
+            for (const auto framing : {PreparedNotification::WSText, PreparedNotification::WSBinary}) {
+                QByteArray buf = n.bytes(v1, framing);
+                const auto frames = WebSocket::Deser::parseBuffer(buf, WebSocket::Deser::RequireUnmasked);
+                const auto type = framing == PreparedNotification::WSText ? WebSocket::FrameType::Text : WebSocket::FrameType::Binary;
+                if (frames.size() != 1 || !buf.isEmpty() || frames.front().type != type || frames.front().payload != raw)
+                    throw Exception(QString("WebSocket form mismatch (framing: %1)").arg(int(framing)));
+            }
+        }
+        const PreparedNotification nm(method, QVariantMap{{"height", 1}});
+        if (nm.bytes(false, PreparedNotification::Raw) != Message::makeNotification(method, QVariantMap{{"height", 1}}, false).toJsonUtf8())
+            throw Exception("Map params form mismatch");
+        Log() << "Prepared notification: ok";
+    }
+
+    const auto t_rpcdecode = App::registerTest("rpcdecode", testRpcDecode);
+    const auto t_preparednotif = App::registerTest("preparednotif", testPreparedNotification);
+    const auto t_hexresult = App::registerTest("hexresult", testHexResult);
+    const auto b_hexresult = App::registerBench("hexresult", benchHexResult);
+    const auto b_rpcdecode = App::registerBench("rpcdecode", benchRpcDecode);
+} // namespace
+#endif
@@ -27,14 +27,20 @@
 #include <QtGlobal> // for qsizetype (and other typedefs)
 #include <QHash>
 #include <QMap>
+#include <QPair>
 #include <QSet>
 #include <QString>
 #include <QVariant>
 #include <QVector>
 
+#include <array>
 #include <memory>
+#include <mutex> // for std::once_flag
 #include <optional>
 #include <utility> // for std::pair, std::move
+#include <vector>
+
+namespace Metrics { class Histogram; }
 
 namespace WebSocket { class Wrapper; } ///< fwd decl
 
@@ -116,6 +122,18 @@ namespace RPC {
                              object where we matched the id to a method we knew about in Connection::idMethodMap. */
         QVariantMap data; ///< parsed json. 'method', 'jsonrpc', 'id', 'error', 'result', and/or 'params' get put here
         bool v1 = false; ///< iff true, we parse/validate/generate based on JSON-RPC 1.0 rules, otherwise we enforce 2.0.
+        /** If not null, this is a response whose hex string 'result' was already decoded by the transport, in which
+            case data['result'] is null. HttpConnection does this for "getblock" replies, decoding in place in its
+            receive buffer. Use resultHexDecoded() to read either kind of response. */
+        QByteArray binaryResult;
+        /** Set by fromRpcRequest() in lieu of `data`, which it leaves empty: what the decoded request had besides its
+            id and method. The accessors below consult this if set, and jsonData() builds the equivalent `data`. */
+        struct Typed {
+            bool hasId = false, hasParams = false;
+            QString jsonrpc; ///< empty if absent (and v1)
+            QVariantList params;
+        };
+        std::optional<Typed> typed;
         // -- METHODS --
 
         /// may throw Exception. This factory method should be the way one of the 6 ways one constructs this object
@@ -123,6 +141,10 @@ namespace RPC {
         /// may throw Exception. This factory method should be the way one of the 6 ways one constructs this object
         static Message fromJsonData(const QVariantMap &jsonData, Id *id_parsed_even_if_failed = nullptr,
                                     bool v1 = false, bool strict = false);
+        /// may throw Exception. Like fromJsonData, but takes a request already decoded by Json::parseRpcRequests(). The
+        /// returned message is `typed` (see above).
+        static Message fromRpcRequest(Json::RpcRequest &&req, Id *id_parsed_even_if_failed = nullptr,
+                                      bool v1 = false, bool strict = false);
         // 4 more factories below..
         /// will not throw exceptions
         static Message makeError(int code, const QString & message, const Id & id = Id(), bool v1 = false);
@@ -136,7 +158,9 @@ namespace RPC {
         static Message makeResponse(const Id & reqId, const QVariant & result, bool v1 = false);
 
         /// Note in pathological cases bad_alloc may be thrown here, so we just return an empty QString in that case and hope for the best.
-        QByteArray toJsonUtf8() const { QByteArray ret; try {ret = Json::toUtf8(data, true);} catch (...) {} return ret; }
+        QByteArray toJsonUtf8() const { QByteArray ret; try {ret = Json::toUtf8(jsonData(), true);} catch (...) {} return ret; }
+        /// Returns `data`, or for a `typed` message, the map that fromJsonData() would have left in `data`.
+        QVariantMap jsonData() const;
 
         // -- PERFORMANCE OPTIMIZATION --
         // It turns out QString::QString(const char *) is called a lot in typical usase of this class, so we pre-create
@@ -153,7 +177,9 @@ namespace RPC {
         // ./
 
         bool isError() const {
-            if (!v1)
+            if (typed)
+                return false;
+            else if (!v1)
                 return data.contains(s_error); // v2, error= key missing unless is an actual error result.
             else
                 return !data.value(s_error).isNull(); // v1, error=null may always be there. is error if it's not null
@@ -171,22 +197,24 @@ namespace RPC {
                 return !isError() && hasId() && id.isNull() && !hasResult() && hasMethod(); // v1 notifs..  ID present, but must be null.
         }
 
-        bool hasId() const { return data.contains(s_id); }
+        bool hasId() const { return typed ? typed->hasId : data.contains(s_id); }
 
-        bool hasParams() const { return data.contains(s_params); }
-        bool isParamsList() const { return Compat::IsMetaType(data.value(s_params), QMetaType::QVariantList); }
-        bool isParamsMap() const { return Compat::IsMetaType(data.value(s_params), QMetaType::QVariantMap); }
-        QVariant params() const { return data.value(s_params); }
-        QVariantList paramsList() const { return params().toList(); }
+        bool hasParams() const { return typed ? typed->hasParams : data.contains(s_params); }
+        bool isParamsList() const { return typed ? typed->hasParams : Compat::IsMetaType(data.value(s_params), QMetaType::QVariantList); }
+        bool isParamsMap() const { return !typed && Compat::IsMetaType(data.value(s_params), QMetaType::QVariantMap); }
+        QVariant params() const { return typed ? (typed->hasParams ? QVariant(typed->params) : QVariant()) : data.value(s_params); }
+        QVariantList paramsList() const { return typed ? typed->params : params().toList(); }
         QVariantMap paramsMap() const { return params().toMap(); }
 
 
-        bool hasResult() const { return data.contains(s_result); }
+        bool hasResult() const { return !typed && data.contains(s_result); }
         QVariant result() const { return data.value(s_result); }
+        /// Returns the hex-decoded 'result' of a response: binaryResult if set, otherwise ParseHexFast() of the string.
+        QByteArray resultHexDecoded() const;
 
-        bool hasMethod() const { return data.contains(s_method); }
+        bool hasMethod() const { return typed || data.contains(s_method); } // a typed message always has one
 
-        QString jsonRpcVersion() const { return data.value(s_jsonrpc).toString(); }
+        QString jsonRpcVersion() const { return typed ? typed->jsonrpc : data.value(s_jsonrpc).toString(); }
     };
 
     using MethodMap = QHash<QString, Method>;
@@ -223,6 +251,43 @@ namespace RPC {
     /// For QHash/QSet etc support
     inline Compat::qhuint qHash(const BatchId b, Compat::qhuint seed = 0) { return ::qHash(quint64(b.get()), seed); }
 
+    /// A notification that is serialized at most once no matter how many connections it is sent to. Notifications
+    /// carry no "id", so the bytes on the wire are identical for every recipient using the same JSON-RPC version and
+    /// framing. Each wire form is built the first time any connection asks for it, and is thereafter shared by all of
+    /// them via QByteArray's implicit sharing. Immutable once constructed, and thus safe to share across threads.
+    class PreparedNotification
+    {
+    public:
+        enum Framing : uint8_t {
+            Raw = 0,   ///< bare JSON (also what a WebSocket::Wrapper takes, since it does its own framing)
+            Newline,   ///< JSON + "\r\n", for classic newline-delimited Electrum connections
+            WSText,    ///< a complete, unmasked WebSocket text frame (server -> client frames are never masked)
+            WSBinary,  ///< ditto, binary frame
+            BinFramed, ///< a length-prefixed BinWire frame, for connections that negotiated the binary wire format
+            NumFramings
+        };
+
+        PreparedNotification(const QString &method, const QVariantList &params) : method(method), params(params), isMap(false) {}
+        PreparedNotification(const QString &method, const QVariantMap &params) : method(method), params(params), isMap(true) {}
+
+        const QString method;
+
+        /// Returns the wire bytes for the given JSON-RPC version and framing, building them on first use. The
+        /// returned reference remains valid for the lifetime of this object. Returns an empty QByteArray if the
+        /// params could not be serialized.
+        const QByteArray & bytes(bool v1, Framing framing) const;
+
+    private:
+        const QVariant params;
+        const bool isMap;
+        struct Form {
+            mutable std::once_flag once;
+            mutable QByteArray data;
+        };
+        std::array<Form, 2 * NumFramings> forms; ///< indexed by: v1 * NumFramings + framing
+    };
+    using PreparedNotificationPtr = std::shared_ptr<const PreparedNotification>;
+
     /// A semi-concrete derived class of AbstractConnection implementing a
     /// JSON-RPC based method<->result protocol.  This class is client/server
     /// agnostic and it just operates in terms of JSON RPC methods and results.
@@ -280,7 +345,11 @@ namespace RPC {
         /// Note the move semantics here. We take ownership of the passed-in QByteArray and clear it immediately
         /// once JSON processing is done, but before callbacks are dispatched -- this is to reduce peak memory usage
         /// if processing a huge JSON payload containing a big block (for networks like ScaleNet).
-        void processJson(QByteArray &&);
+        ///
+        /// If `binaryResult` is not null, it becomes the Message::binaryResult of the resulting response message.
+        void processJson(QByteArray &&, QByteArray &&binaryResult = {});
+        /// Like processJson(), but for the payload of a BinWire frame (WireFormat::Binary).
+        void processBinary(QByteArray &&);
 
         struct ProcessObjectResult {
             struct Error {
@@ -301,6 +370,8 @@ namespace RPC {
         /// Process an individual JSON object.
         /// May be called in either batch context or immediate context.
         [[nodiscard]] ProcessObjectResult processObject(QVariantMap &&);
+        /// Like the above, but for a request that was decoded by Json::parseRpcRequests().
+        [[nodiscard]] ProcessObjectResult processObject(Json::RpcRequest &&);
 
         /* --
          * -- Stuff subclasses must implement to make use of this class as base:
@@ -309,6 +380,9 @@ namespace RPC {
 
         /// subclasses must implement this to wrap outgoing data for sending.
         virtual QByteArray wrapForSend(QByteArray &&) = 0;
+        /// Sends `n` to the peer, framed appropriately. The default implementation sends wrapForSend() of its bare
+        /// JSON; subclasses may reimplement this to pick a ready-made framing instead.
+        virtual void writePrepared(const PreparedNotification &n);
 
         /* subclasses must also implement this pure virtual inherited from base:
              void on_readyRead() override; */
@@ -355,11 +429,28 @@ namespace RPC {
         bool isBatchPermitted() const { return batchPermitted; }
         void setBatchPermitted(bool b) { batchPermitted = b; }
 
+        /// How messages are encoded on the wire. Every connection starts out as Json; a trusted client may then
+        /// switch to Binary (see BinWire.h), which changes only the encoding: the same methods and handlers are used.
+        enum class WireFormat : uint8_t { Json, Binary };
+        WireFormat wireFormat() const { return wireFmt; }
+        /// Takes effect for the next message sent or read. Only call this from this object's thread, and only when
+        /// no batch is in progress (a batch reply must use the same encoding as its request).
+        void setWireFormat(WireFormat f) { wireFmt = f; }
+        /// Returns the number of batch requests from the peer that are still being processed
+        qsizetype numExtantBatches() const { return extantBatchProcessors.size(); }
+
+        /// Starts timing the peer's request `reqid` (part of `batchId`, which may be .isNull()). The elapsed time is
+        /// recorded into `h` once our result or error reply for it is sent. Must be called from this object's thread.
+        void beginRequestTiming(RPC::BatchId batchId, const RPC::Message::Id & reqid, Metrics::Histogram & h);
+
     signals:
         /// Call (emit) this to send a request to the peer. Note sending doesn't support batching.
         void sendRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params = {});
         /// Call (emit) this to send a notification to the peer
         void sendNotification(const QString &method, const QVariant & params);
+        /// Like sendNotification(), but for a notification that is sent to many peers: the JSON is built once and
+        /// shared by all of them.
+        void sendPreparedNotification(const RPC::PreparedNotificationPtr & notification);
         /// Call (emit) this to send an error message to the peer.
         /// @param `batchId` is the batch this error pertains to, if it is in response to a request from a batch,
         /// otherwise may be .isNull() (response will be sent immediately, and not collated to any batch in that case)
@@ -374,6 +465,13 @@ namespace RPC {
         /// a known method described in the 'methods' MethodMap. Unknown messages will eventually result
         /// in auto-disconnect.
         void gotMessage(IdMixin::Id thisId, RPC::BatchId batchId, const RPC::Message & m);
+        /// Emitted by the BatchProcessor for a batch of 2 or more items that all invoke the same `method`, just before
+        /// its first item is delivered via gotMessage(). Observers may use this to defer the work for the items they are
+        /// about to receive and then do it all at once when homogeneousBatchDispatched() is emitted.
+        void gotHomogeneousBatch(IdMixin::Id thisId, RPC::BatchId batchId, const QString &method);
+        /// Emitted once for every gotHomogeneousBatch(), after the last item of the batch has been delivered via
+        /// gotMessage(), or after the batch was abandoned (limit exceeded, connection going away, etc).
+        void homogeneousBatchDispatched(IdMixin::Id thisId, RPC::BatchId batchId);
         /// Same as a above, but for 'error' replies
         void gotErrorMessage(IdMixin::Id thisId, const RPC::Message &em);
         /// This is emitted when the peer sent malformed data to us and we didn't disconnect
@@ -391,6 +489,7 @@ namespace RPC {
         void _sendRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params = {});
         // ditto for notifications
         void _sendNotification(const QString &method, const QVariant & params);
+        void _sendPreparedNotification(const RPC::PreparedNotificationPtr & notification);
         /// Actual implementation of sendError, runs in our thread context.
         void _sendError(bool disconnect, int errorCode, const QString &message, RPC::BatchId batchId, const RPC::Message::Id &reqid = {});
         /// Actual implementation of sendResult, runs in our thread context.
@@ -429,6 +528,11 @@ namespace RPC {
         bool v1 = false; // if true, will generate v1 style messages and respond to v1 only
         bool strict = false; // if true, we will be more strict and reject some malformed JSON-RPC messages
         bool batchPermitted = false; // if true, we will accept JSON-RPC Batches
+        WireFormat wireFmt = WireFormat::Json;
+
+        /// Encodes a message (or a batch reply list) for sending in the current wireFormat(), not yet framed. Returns
+        /// an empty QByteArray on error.
+        QByteArray serializeForWire(const QVariant &) const;
 
         /// New in 1.0.1: This is latched to true in Client::on_disconnect to signal that the client is being
         /// disconnected and to just throw away any future messages from this client.
@@ -448,18 +552,49 @@ namespace RPC {
         /// This is called internally by either processJson() or by the BatchProcessor when it is killed.
         void on_processJsonFailure(int code, const QString & message, const Message::Id &msgId = {});
 
+        /// One request of an outgoing JSON-RPC batch, see _sendRequestBatch()
+        struct OutgoingRequest {
+            Message::Id id;
+            QString method;
+            QVariantList params;
+        };
+        /// Like _sendRequest(), but sends all of `reqs` to the peer as a single JSON-RPC batch (a JSON array). The
+        /// replies still arrive individually via gotMessage() / gotErrorMessage(), provided the subclass knows how to
+        /// split up a batch reply (HttpConnection does). Must be called from this object's thread.
+        void _sendRequestBatch(const std::vector<OutgoingRequest> & reqs);
+
     private:
         /// Table used to store the extant batch processors running.
         /// Keyed off of the BatchId (which has same id as the BackProcessor->id())
         QHash<BatchId, BatchProcessor *> extantBatchProcessors;
 
+        /// Requests being timed by beginRequestTiming(). Bounded by MAX_UNANSWERED_REQUESTS; cleared on disconnect.
+        struct PendingTiming { Metrics::Histogram *hist; qint64 t0; };
+        QHash<QPair<BatchId, Message::Id>, PendingTiming> pendingTimings;
+        // Internally called by _sendResult and _sendError
+        void endRequestTiming(BatchId batchId, const Message::Id & reqid);
+
+        // Common implementation of processJson() and processBinary(). `decode` returns the result of processing a
+        // single request, or nullopt if it enqueued a batch.
+        template <typename DecodeFunc>
+        void processIncoming(qsizetype nBytes, DecodeFunc && decode, QByteArray &&binaryResult = {});
+        // Processes a decoded message: an object is processed immediately, a list is enqueued as a batch
+        std::optional<ProcessObjectResult> processVariant(QVariant &&);
         // Internally called by processObject()
         [[nodiscard]] ProcessObjectResult processObject_internal(QVariantMap &&);
+        [[nodiscard]] ProcessObjectResult processObject_internal(Json::RpcRequest &&);
+        // Common implementation of the above two: validates the Message produced by `makeMessage` against `methods`
+        template <typename MakeMessageFunc>
+        [[nodiscard]] ProcessObjectResult processMessage_internal(MakeMessageFunc && makeMessage);
         // Internally called by _sendResult and _sendError
         // Precondition: Message must be either: isError() or isResponse() (this is not checked here for performance)
         [[nodiscard]] bool batchResponseFilter(RPC::BatchId batchId, const Message & msg);
         // Internally called to enqueue a new batch -- this may throw InvalidRequest if the QVariantList is empty
         void enqueueNewBatch(QVariantList &&);
+        // Internally called to enqueue a new batch of requests decoded by Json::parseRpcRequests() (never empty)
+        void enqueueNewBatch(std::vector<Json::RpcRequest> &&);
+        // Common code for the above two. Takes ownership of `batch`.
+        void enqueueNewBatch(std::unique_ptr<BatchProcessor> batch);
     };
 
     inline constexpr bool debugBatchExtra = false; ///< if true, Debug() log will print extra info for the batch processing feature
@@ -469,6 +604,9 @@ namespace RPC {
     {
         BatchId batchId; ///< the object id of the BatchProcessor instance that is handling this batch request.
         QVariantList items; ///< the contents of the original batch request list. Data items may be any JSON type.
+        /// Alternatively, if the batch was decoded by Json::parseRpcRequests(), its requests are here (and `items` is
+        /// empty). Each one is only turned into a Message once it is its turn to be processed.
+        std::vector<Json::RpcRequest> requests;
         QVariantList::size_type nextItem = 0; ///< index into above array
         /// The number of `items` that we have processed thus far that are notifications or that don't warrant a
         /// response in the batch response.
@@ -481,12 +619,19 @@ namespace RPC {
         /// Responses enqueued for sending back to the client, may also include error responses aside from results
         QVector<Message> responses;
 
-        bool hasNext() const { return nextItem < items.size(); }
-        QVariant getNextAndIncrement();
-        bool isComplete() const { return !hasNext() && skippedCt + responses.size() >= items.size(); }
+        QVariantList::size_type size() const { return requests.empty() ? items.size() : QVariantList::size_type(requests.size()); }
+        bool hasNext() const { return nextItem < size(); }
+        bool isNextTyped() const { return !requests.empty(); }
+        QVariant getNextAndIncrement(); ///< call if !isNextTyped()
+        Json::RpcRequest takeNextAndIncrement(); ///< call if isNextTyped()
+        bool isComplete() const { return !hasNext() && skippedCt + responses.size() >= size(); }
+        /// Returns the method name if there are at least 2 items and they are all requests or notifications for the
+        /// same method, otherwise returns a null QString. Call before processing has started.
+        QString homogeneousMethod() const;
 
         Batch() = default;
         Batch(QVariantList && items_) : items(std::move(items_)) {}
+        Batch(std::vector<Json::RpcRequest> && requests_) : requests(std::move(requests_)) {}
     };
 
     /// An individual batch request is managed by this object. Instances of this class are always children of
@@ -506,6 +651,10 @@ namespace RPC {
         bool done = false;
         bool isProcessingPaused = false;
         bool killed = false;
+        /// If not empty, the batch is homogeneous (see Batch::homogeneousMethod). We emit conn.gotHomogeneousBatch()
+        /// then conn.homogeneousBatchDispatched() for it, tracked by the 2 flags below.
+        QString homogeneousMethod;
+        bool homogeneousAnnounced = false, homogeneousDone = false;
         qsizetype cumCost = 0; ///< The cost of the JSON batch array itself initially, but it accumulates response costs too.
 
     public:
@@ -545,6 +694,7 @@ namespace RPC {
         void addCost(qsizetype cost);
         void pushResponse(Message && m);
         void pushResponse(const Message & m) { pushResponse(Message{m}); }
+        void endHomogeneousDispatch(); ///< emits conn.homogeneousBatchDispatched() if we announced and haven't yet
     };
 
 
@@ -572,6 +722,8 @@ namespace RPC {
         /// implements pure virtual from super to handle linefeed-based JSON. When a full line arrives, calls ConnectionBase::processJson
         void on_readyRead() override;
         QByteArray wrapForSend(QByteArray &&) override;
+        /// Reimplemented to send the shared newline-delimited or pre-framed WebSocket form of the notification.
+        void writePrepared(const PreparedNotification &n) override;
 
     private:
         qint64 memoryWasteThreshold = -1; ///< gets lazy-initialized in memoryWasteDoSProtection below
@@ -582,6 +734,8 @@ namespace RPC {
         bool skippedOnReadyRead = false;
         std::optional<WebSocket::Wrapper *> webSocket; ///< set once the first time on_readyRead() or wrapForSend() is called. If set and valid, affects the framing behavior of this class.
         WebSocket::Wrapper *checkSetGetWebSocket();
+        /// Called by on_readyRead() once wireFormat() is Binary: processes all complete length-prefixed frames.
+        void readBinaryFrames();
     };
 
     /// JSON RPC over HTTP.  Wraps the outgoing data in headers and can also parse incoming headers.
@@ -613,6 +767,18 @@ namespace RPC {
         void on_disconnected() override;
 
     private:
+        /// Responses at least this large are checked by takeHexResult()
+        static constexpr QByteArray::size_type kHexResultThresh = 256 * 1024;
+        /// If `json` is the reply to a "getblock" request we sent, hex-decodes its 'result' string in place into the
+        /// front of `json`'s own buffer and returns that buffer, leaving in `json` the (small) rest of the reply with
+        /// "result":null. Otherwise returns a null QByteArray and leaves `json` untouched. This saves the several
+        /// full-size copies of a big block that parsing the reply as JSON and then decoding the hex would make.
+        QByteArray takeHexResult(QByteArray &json);
+
+        /// Called by on_readyRead() for a reply that is a JSON array: the peer's reply to a batch we sent via
+        /// _sendRequestBatch(). Emits gotMessage() or gotErrorMessage() for each of the items, in order.
+        void processBatchReply(QByteArray &&json);
+
         /// These end up verbatim in the HTTP/1.1 POST header.
         struct {
             QByteArray authCookie; ///< "Authorization: Basic <cookie>"
@@ -635,3 +801,4 @@ namespace RPC {
 Q_DECLARE_METATYPE(RPC::Message);
 Q_DECLARE_METATYPE(RPC::Message::Id);
 Q_DECLARE_METATYPE(RPC::BatchId);
+Q_DECLARE_METATYPE(RPC::PreparedNotificationPtr);
@@ -24,6 +24,7 @@
 #include "BTC_Address.h"
 #include "Compat.h"
 #include "Merkle.h"
+#include "Metrics.h"
 #include "PeerMgr.h"
 #include "Rpa.h"
 #include "ServerMisc.h"
@@ -633,6 +634,8 @@ ServerBase::newClient(QTcpSocket *sock)
     connect(ret, &RPC::ConnectionBase::gotMessage, this, &ServerBase::onMessage);
     connect(ret, &RPC::ConnectionBase::gotErrorMessage, this, &ServerBase::onErrorMessage);
     connect(ret, &RPC::ConnectionBase::peerError, this, &ServerBase::onPeerError);
+    connect(ret, &RPC::ConnectionBase::gotHomogeneousBatch, this, &ServerBase::onHomogeneousBatch);
+    connect(ret, &RPC::ConnectionBase::homogeneousBatchDispatched, this, &ServerBase::onHomogeneousBatchDispatched);
 
     // tell SrvMgr about this client so it can keep track of clients-per-ip and other statistics, and potentially
     // kick the client if it exceeds its connection limit.
@@ -688,11 +691,31 @@ void ServerBase::onMessage(IdMixin::Id clientId, RPC::BatchId batchId, const RPC
     TraceM("onMessage: ", clientId, ", ", batchId.get(), " json: ", m.toJsonUtf8());
     if (Client *c = getClient(clientId); c) {
         const auto member = dispatchTable.value(m.method);
+        // while the db is still being checked (and we are catching up), only these may be served
+        static const QSet<QString> headersOnlyMethods{
+            "server.banner", "server.donation_address", "server.features", "server.peers.subscribe", "server.ping",
+            "server.version", "blockchain.block.header", "blockchain.block.headers", "blockchain.headers.get_tip",
+            "blockchain.headers.subscribe", "blockchain.headers.unsubscribe",
+        };
         if (!member)
             Error() << "Unknown method: \"" << m.method << "\". This shouldn't happen. FIXME! Json: " << m.toJsonUtf8();
-        else {
+        else if (UNLIKELY(srvmgr->isHeadersOnly()) && !isAdmin() && !headersOnlyMethods.contains(m.method)) {
+            ++c->info.nRequestsRcv;
+            if (m.isRequest())
+                emit c->sendError(false, RPC::Code_App_BadRequest,
+                                  "Server is still starting up; only server.* and header methods are available for now",
+                                  batchId, m.id);
+        } else {
             // indicate a good request, accepted request
             ++c->info.nRequestsRcv;
+            if (m.isRequest()) {
+                static const Metrics::HistogramFamily rpcLatency("fulcrum_rpc_latency_seconds",
+                                                                 "Time from receipt of a client RPC request to our reply",
+                                                                 "method");
+                c->beginRequestTiming(batchId, m.id, rpcLatency[m.method]);
+            }
+            dispatchingMethod = m.method;
+            Defer resetMethod([this]{ dispatchingMethod.clear(); });
             try {
                 // call ptr to member -- note member is free to throw if it wants to send an error immediately
                 (this->*member)(c, batchId, m);
@@ -721,6 +744,60 @@ void ServerBase::onErrorMessage(IdMixin::Id clientId, const RPC::Message &m)
         emit c->sendError(true, RPC::Code_InvalidRequest, "Not a valid request object", RPC::BatchId{});
     }
 }
+void ServerBase::onHomogeneousBatch(IdMixin::Id clientId, RPC::BatchId batchId, const QString &method)
+{
+    static const QSet<QString> balanceMethods{"blockchain.scripthash.get_balance", "blockchain.address.get_balance"},
+                               historyMethods{"blockchain.scripthash.get_history", "blockchain.address.get_history"};
+    const bool isBalance = balanceMethods.contains(method), isHistory = !isBalance && historyMethods.contains(method);
+    if (!isBalance && !isHistory) return;
+    if (Client *c = getClient(clientId); c && dispatchTable.contains(method)) {
+        // from now on, get_balance/get_history lookups for this batch are queued by deferCoalescedLookup()
+        c->coalescedBatches[batchId].isHistory = isHistory;
+    }
+}
+void ServerBase::onHomogeneousBatchDispatched(IdMixin::Id clientId, RPC::BatchId batchId)
+{
+    Client *c = getClient(clientId);
+    if (!c) return;
+    const auto cb = c->coalescedBatches.take(batchId);
+    if (cb.lookups.empty()) return;
+    DebugM(c->prettyName(), ": coalesced ", cb.lookups.size(), " ", cb.isHistory ? "get_history" : "get_balance",
+           " lookup(s) from batch ", batchId.get());
+    // Items that differ in their extra args (token filter or from/to heights) can't share a Storage call, so we
+    // partition by those. In practice a batch uses the same args for all of its items, so this is 1 partition.
+    std::vector<bool> taken(cb.lookups.size());
+    for (size_t first = 0; first < cb.lookups.size(); ++first) {
+        if (taken[first]) continue;
+        const auto & proto = cb.lookups[first];
+        std::vector<RPC::Message::Id> reqIds;
+        std::vector<HashX> scriptHashes;
+        for (size_t i = first; i < cb.lookups.size(); ++i) {
+            const auto & l = cb.lookups[i];
+            if (taken[i] || (cb.isHistory ? l.fromTo != proto.fromTo : l.tokenFilter != proto.tokenFilter))
+                continue;
+            taken[i] = true;
+            reqIds.push_back(l.reqId);
+            scriptHashes.push_back(l.scriptHash);
+        }
+        if (cb.isHistory)
+            generic_do_async_multi(c, batchId, reqIds, [scriptHashes = std::move(scriptHashes), fromTo = proto.fromTo, this] {
+                return getHistoriesCommon(scriptHashes, fromTo);
+            }, QStringLiteral("coalesced get_history"));
+        else
+            generic_do_async_multi(c, batchId, reqIds, [scriptHashes = std::move(scriptHashes), tf = proto.tokenFilter, this] {
+                return getBalancesCommon(scriptHashes, tf);
+            }, QStringLiteral("coalesced get_balance"));
+    }
+}
+bool ServerBase::deferCoalescedLookup(Client *c, RPC::BatchId batchId, const RPC::Message::Id &reqId, const HashX &scriptHash,
+                                      Storage::TokenFilterOption tokenFilter, const GetHistory_FromToBH &fromTo)
+{
+    if (batchId.isNull()) return false;
+    auto it = c->coalescedBatches.find(batchId);
+    if (it == c->coalescedBatches.end()) return false;
+    it->lookups.push_back(Client::CoalescedLookup{reqId, scriptHash, tokenFilter, fromTo});
+    return true;
+}
 void ServerBase::onPeerError(IdMixin::Id clientId, const QString &what)
 {
     if (Debug::isEnabled()) {
@@ -764,8 +841,17 @@ namespace {
 ServerBase::RPCError::~RPCError() {}
 ServerBase::RPCErrorWithDisconnect::~RPCErrorWithDisconnect() {}
 
+ThreadPool::SchedHints ServerBase::asyncSchedHints(const Client *c, const QString &costKey,
+                                                   const QByteArray &costSubKey) const
+{
+    ThreadPool::SchedHints ret{costKey, costSubKey, c->id};
+    if (const double timeout = options->workQueueTimeout; timeout > 0.)
+        ret.deadlineNS = Util::getTimeNS() + qint64(timeout * 1e9);
+    return ret;
+}
+
 void ServerBase::generic_do_async(Client *c, RPC::BatchId batchId, const RPC::Message::Id &reqId,
-                                  const std::function<QVariant ()> &work, int priority)
+                                  const std::function<QVariant ()> &work, const QByteArray &costSubKey)
 {
     if (LIKELY(work)) {
         struct ResErr {
@@ -802,13 +888,63 @@ void ServerBase::generic_do_async(Client *c, RPC::BatchId batchId, const RPC::Me
             },
             // default fail function just sends json rpc error "internal error: <message>"
             defaultTPFailFunc(c, batchId, reqId),
-            // lower is sooner, higher is later. Default 0.
-            priority
+            asyncSchedHints(c, dispatchingMethod, costSubKey)
         );
     } else
         Error() << "INTERNAL ERROR: work must be valid! FIXME!";
 }
 
+void ServerBase::generic_do_async_multi(Client *c, RPC::BatchId batchId, const std::vector<RPC::Message::Id> &reqIds,
+                                        const std::function<QVariantList ()> &work, const QString &costKey)
+{
+    if (UNLIKELY(!work)) {
+        Error() << "INTERNAL ERROR: work must be valid! FIXME!";
+        return;
+    }
+    struct ResErr {
+        QVariantList results;
+        bool error = false, doDisconnect = false;
+        QString errMsg;
+        int errCode = 0;
+    };
+
+    auto reserr = std::make_shared<ResErr>(); ///< shared with lambda for both work and completion. this is how they communicate.
+
+    (asyncThreadPool ? asyncThreadPool : ::AppThreadPool())->submitWork(
+        c, // <--- all work done in client context, so if client is deleted, completion not called
+        // runs in worker thread, must not access anything other than reserr and work
+        [reserr, work, n = reqIds.size()]{
+            try {
+                QVariantList results = work();
+                if (UNLIKELY(size_t(results.size()) != n))
+                    throw InternalError(QString("expected %1 results, got %2").arg(n).arg(results.size()));
+                reserr->results.swap( results ); // constant-time copy
+            } catch (const RPCError & e) {
+                reserr->error = true;
+                reserr->doDisconnect = e.disconnect;
+                reserr->errMsg = e.what();
+                reserr->errCode = e.code;
+            }
+        },
+        // completion: runs in client thread (only called if client not already deleted)
+        [c, batchId, reqIds, reserr] {
+            for (size_t i = 0; i < reqIds.size(); ++i) {
+                if (reserr->error)
+                    emit c->sendError(reserr->doDisconnect, reserr->errCode, reserr->errMsg, batchId, reqIds[i]);
+                else
+                    emit c->sendResult(batchId, reqIds[i], reserr->results[qsizetype(i)]);
+            }
+        },
+        // fail function just sends json rpc error "internal error: <message>" for each request
+        [c, batchId, reqIds](const QString &what) {
+            Warning() << "ThreadPool job for client " << c->id << " failed: " << what;
+            for (const auto & id : reqIds)
+                emit c->sendError(false, RPC::Code_InternalError, QString("internal error: %1").arg(what), batchId, id);
+        },
+        asyncSchedHints(c, costKey, {})
+    );
+}
+
 void ServerBase::generic_async_to_bitcoind(Client *c, const RPC::BatchId batchId, const RPC::Message::Id & reqId,
                                            const QString &method,
                                            const QVariantList & params,
@@ -894,6 +1030,15 @@ void ServerBase::generic_async_to_bitcoind(Client *c, const RPC::BatchId batchId
     );
 }
 
+// helper used by blockchain.headers.get_tip, blockchain.headers.subscribe, and blockchain.header.get
+static QVariantMap mkHeaderHexResponse(unsigned height, const QByteArray & header)
+{
+    QVariantMap m;
+    m.insert(QByteArrayLiteral("height"), height);
+    m.insert(QByteArrayLiteral("hex"), Util::ToHexFast(header));
+    return m;
+}
+
 Server::Server(SrvMgr *sm, const QHostAddress &a, quint16 p, const std::shared_ptr<const Options> & opts,
                const std::shared_ptr<Storage> &s, const std::shared_ptr<BitcoinDMgr> &bdm)
     : ServerBase(sm, StaticData::methodMap, StaticData::dispatchTable, a, p, opts, s, bdm)
@@ -910,6 +1055,13 @@ Server::Server(SrvMgr *sm, const QHostAddress &a, quint16 p, const std::shared_p
     resetName();
     setMaxPendingConnections(std::max(options->maxPendingConnections, options->minMaxPendingConnections)); // default in Options is 60 pending connections
     connect(this, &Server::newHeader, this, [this]{ logFilter->broadcast.onNewBlock(); }, Qt::QueuedConnection);
+    connect(this, &Server::newHeader, this, [this](unsigned height, const QByteArray &header) {
+        static const QMetaMethod sig = QMetaMethod::fromSignal(&Server::newHeaderNotification);
+        if (!isSignalConnected(sig)) return;
+        // the notification is a list of size 1, with a dict in it. :/
+        emit newHeaderNotification(std::make_shared<const RPC::PreparedNotification>(
+            QStringLiteral("blockchain.headers.subscribe"), QVariantList({mkHeaderHexResponse(height, header)})));
+    });
 }
 
 Server::~Server() { stop(); }
@@ -1180,11 +1332,26 @@ void Server::rpc_server_version(Client *c, const RPC::BatchId batchId, const RPC
     if (l.size() == 1)
         // missing second arg, protocolVersion, default to our minimal protocol version "1.4"
         l.push_back(ServerMisc::MinProtocolVersion.toString());
-    assert(l.size() == 2);
+    assert(l.size() == 2 || l.size() == 3);
 
     if (c->info.alreadySentVersion)
         throw RPCError(QString("%1 already sent").arg(m.method));
 
+    // Fulcrum extension: optional 3rd arg, the wire format to use after this reply ("json" or "binary")
+    bool switchToBinary = false;
+    if (l.size() == 3) {
+        if (const auto fmt = l[2].toString(); fmt == QStringLiteral("binary")) {
+            if (!options->binaryProtocol || !c->perIPData->isWhitelisted())
+                throw RPCError("The binary protocol is not available to this client");
+            if (!batchId.isNull() || c->numExtantBatches())
+                throw RPCError("The binary protocol cannot be negotiated while a batch request is in progress");
+            if (c->isWebSocket())
+                throw RPCError("The binary protocol is not available over WebSocket");
+            switchToBinary = true;
+        } else if (fmt != QStringLiteral("json"))
+            throw RPCError("Unsupported wire format");
+    }
+
     Version pver;
     if (const auto sl = l[1].toStringList(); sl.size() == 2) {
         // Ergh. EX also supports (protocolMin, protocolMax) tuples as the second arg! :/
@@ -1206,6 +1373,12 @@ void Server::rpc_server_version(Client *c, const RPC::BatchId batchId, const RPC
     c->info.protocolVersion = pver;
     c->info.alreadySentVersion = true;
     emit c->sendResult(batchId, m.id, QStringList({ServerMisc::AppSubVersion, pver.toString()}));
+    if (switchToBinary) {
+        // The reply above was already written as JSON (c lives in our thread, so sendResult is a direct call), and
+        // the client must wait for it before sending any binary frames.
+        c->setWireFormat(RPC::ConnectionBase::WireFormat::Binary);
+        DebugM(c->prettyName(false, false), " switched to the binary wire format");
+    }
 }
 
 /// returns the 'branch' and 'root' keys ready to be put in the results dictionary
@@ -1360,14 +1533,6 @@ void Server::rpc_blockchain_estimatefee(Client *c, const RPC::BatchId batchId, c
         return response.result();
     });
 }
-// helper used by blockchain.headers.get_tip, blockchain.headers.subscribe, and blockchain.header.get
-static QVariantMap mkHeaderHexResponse(unsigned height, const QByteArray & header)
-{
-    QVariantMap m;
-    m.insert(QByteArrayLiteral("height"), height);
-    m.insert(QByteArrayLiteral("hex"), Util::ToHexFast(header));
-    return m;
-}
 void Server::rpc_blockchain_headers_get_tip(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
     Storage::Header hdr;
@@ -1382,10 +1547,7 @@ void Server::rpc_blockchain_headers_subscribe(Client *c, const RPC::BatchId batc
     if (!c->headerSubConnection) {
         c->headerSubConnection =
             // connect to signal. Will be emitted directly to object until it dies, or until unsubscribed.
-            connect(this, &Server::newHeader, c, [c, meth=m.method](unsigned height, const QByteArray &header){
-                // the notification is a list of size 1, with a dict in it. :/
-                emit c->sendNotification(meth, QVariantList({mkHeaderHexResponse(height, header)}));
-            });
+            connect(this, &Server::newHeaderNotification, c, &Client::sendPreparedNotification);
         if (!c->headerSubConnection) {
             // This should never happen but it pays to be paranoid and always check return values
             Error() << "Failed to subscribe to headers for " << c->prettyName(false, false) << ". QObject::connect failed!";
@@ -1497,6 +1659,27 @@ HashX Server::parseFirstHashParamCommon(const RPC::Message &m, const char *const
         throw RPCError(!errMsg ? "Invalid scripthash" : errMsg);
     return sh;
 }
+std::vector<HashX> Server::parseFirstHashListParamCommon(const RPC::Message &m) const
+{
+    const QVariantList l(m.paramsList());
+    assert(!l.isEmpty());
+    if (!Compat::IsMetaType(l.front(), QMetaType::QVariantList))
+        throw RPCError("Expected a list of scripthashes", RPC::ErrorCodes::Code_InvalidParams);
+    const QVariantList shl = l.front().toList();
+    if (shl.isEmpty())
+        throw RPCError("Empty list of scripthashes", RPC::ErrorCodes::Code_InvalidParams);
+    if (size_t(shl.size()) > options->maxBatch)
+        throw RPCError(QString("Too many scripthashes (max: %1)").arg(options->maxBatch), RPC::ErrorCodes::Code_InvalidParams);
+    std::vector<HashX> ret;
+    ret.reserve(size_t(shl.size()));
+    for (const auto & var : shl) {
+        HashX sh = validateHashHex( var.toString() );
+        if (sh.length() != HashLen)
+            throw RPCError("Invalid scripthash");
+        ret.push_back(std::move(sh));
+    }
+    return ret;
+}
 Storage::TokenFilterOption Server::parseTokenFilterOptionCommon(Client *c, const RPC::Message &m, size_t argPos) const
 {
     const QVariantList l(m.paramsList());
@@ -1537,25 +1720,42 @@ void Server::rpc_blockchain_address_get_balance(Client *c, const RPC::BatchId ba
     impl_get_balance(c, batchId, m, sh, tf);
 }
 
+namespace {
+    QVariantMap BalanceToVariantMap(const std::pair<bitcoin::Amount, bitcoin::Amount> &bal) {
+        const auto & [amt, uamt] = bal;
+        /* Note: ElectrumX protocol docs are incorrect. They claim a string in coin units is returned here.
+         * It is not. Instead a number in satoshis is returned!
+         * Incorrect docs: https://electrumx.readthedocs.io/en/latest/protocol-methods.html#blockchain-scripthash-get-balance */
+        return QVariantMap{
+            { "confirmed" , qlonglong(amt / amt.satoshi()) },
+            { "unconfirmed" , qlonglong(uamt / uamt.satoshi()) },
+        };
+    }
+} // namespace
+
 QVariantMap ServerBase::getBalanceCommon(const HashX &sh, Storage::TokenFilterOption tokenFilter)
 {
-    const auto [amt, uamt] = storage->getBalance(sh, tokenFilter);
-    /* Note: ElectrumX protocol docs are incorrect. They claim a string in coin units is returned here.
-     * It is not. Instead a number in satoshis is returned!
-     * Incorrect docs: https://electrumx.readthedocs.io/en/latest/protocol-methods.html#blockchain-scripthash-get-balance */
-    QVariantMap resp{
-        { "confirmed" , qlonglong(amt / amt.satoshi()) },
-        { "unconfirmed" , qlonglong(uamt / uamt.satoshi()) },
-    };
+    return BalanceToVariantMap(storage->getBalance(sh, tokenFilter));
+}
+
+QVariantList ServerBase::getBalancesCommon(const std::vector<HashX> &shs, Storage::TokenFilterOption tokenFilter)
+{
+    QVariantList resp;
+    const auto bals = storage->getBalances(shs, tokenFilter);
+    resp.reserve(qsizetype(bals.size()));
+    for (const auto & bal : bals)
+        resp.push_back(BalanceToVariantMap(bal));
     return resp;
 }
 
 void Server::impl_get_balance(Client *c, const RPC::BatchId batchId, const RPC::Message &m, const HashX &sh,
                               const Storage::TokenFilterOption tokenFilter)
 {
+    if (deferCoalescedLookup(c, batchId, m.id, sh, tokenFilter))
+        return;
     generic_do_async(c, batchId, m.id, [sh, tokenFilter, this] {
         return getBalanceCommon(sh, tokenFilter);
-    });
+    }, sh);
 }
 
 // --- get_first_use --
@@ -1589,22 +1789,37 @@ void Server::impl_get_first_use(Client *c, const RPC::BatchId batchId, const RPC
 
 /// called from get_mempool and get_history to retrieve the mempool for a hashx synchronously.  Returns the
 /// QVariantMap suitable for placing into the resulting response.
+namespace {
+    QVariantList HistoryToVariantList(const Storage::History &items) {
+        QVariantList resp;
+        for (const auto & item : items) {
+            QVariantMap m{
+                { "tx_hash" , Util::ToHexFast(item.hash) },
+                { "height", int(item.height) },
+            };
+            if (item.fee.has_value())
+                m["fee"] = qlonglong(*item.fee / bitcoin::Amount::satoshi());
+            resp.push_back(m);
+        }
+        return resp;
+    }
+} // namespace
+
 QVariantList ServerBase::getHistoryCommon(const HashX &sh, bool mempoolOnly, const GetHistory_FromToBH &fromTo)
 {
-    QVariantList resp;
     const bool includeConfirmed = !mempoolOnly;
     const bool includeMempool = mempoolOnly || !fromTo.second.has_value();
     // the `items` result is already sorted
-    const auto items = storage->getHistory(sh, includeConfirmed, includeMempool, fromTo.first, fromTo.second);
-    for (const auto & item : items) {
-        QVariantMap m{
-            { "tx_hash" , Util::ToHexFast(item.hash) },
-            { "height", int(item.height) },
-        };
-        if (item.fee.has_value())
-            m["fee"] = qlonglong(*item.fee / bitcoin::Amount::satoshi());
-        resp.push_back(m);
-    }
+    return HistoryToVariantList(storage->getHistory(sh, includeConfirmed, includeMempool, fromTo.first, fromTo.second));
+}
+
+QVariantList ServerBase::getHistoriesCommon(const std::vector<HashX> &shs, const GetHistory_FromToBH &fromTo)
+{
+    QVariantList resp;
+    const auto histories = storage->getHistories(shs, true, !fromTo.second.has_value(), fromTo.first, fromTo.second);
+    resp.reserve(qsizetype(histories.size()));
+    for (const auto & items : histories)
+        resp.push_back(HistoryToVariantList(items));
     return resp;
 }
 
@@ -1645,8 +1860,67 @@ void Server::rpc_blockchain_address_get_history(Client *c, const RPC::BatchId ba
 void Server::impl_get_history(Client *c, const RPC::BatchId batchId, const RPC::Message &m, const HashX &sh,
                               const GetHistory_FromToBH &fromTo)
 {
+    if (deferCoalescedLookup(c, batchId, m.id, sh, {}, fromTo))
+        return;
     generic_do_async(c, batchId, m.id, [sh, fromTo, this] {
         return getHistoryCommon(sh, false, fromTo);
+    }, sh);
+}
+
+// --- get_history_page --
+// Args: scripthash_or_address, cursor (optional, default 0), limit (optional, default defaultHistoryPageLimit)
+// Returns: { "history": [ ...same items as get_history... ], "next_cursor": n }
+// "next_cursor" is null on the last page, which is also the only page that includes the mempool items. Unlike
+// get_history, this is not subject to max_history, so clients can sync arbitrarily large histories page by page.
+void Server::rpc_blockchain_scripthash_get_history_page(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
+{
+    impl_get_history_page(c, batchId, m, parseFirstHashParamCommon(m));
+}
+void Server::rpc_blockchain_address_get_history_page(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
+{
+    impl_get_history_page(c, batchId, m, parseFirstAddrParamToShCommon(m));
+}
+void Server::impl_get_history_page(Client *c, const RPC::BatchId batchId, const RPC::Message &m, const HashX &sh)
+{
+    const QVariantList l(m.paramsList());
+    TxNum cursor = 0;
+    int limit = std::min(defaultHistoryPageLimit, options->maxHistory);
+    if (l.size() > 1 && !l[1].isNull()) {
+        bool ok;
+        const qlonglong tmp = l[1].toLongLong(&ok);
+        if (!ok || tmp < 0) throw RPCError("Bad cursor argument", RPC::ErrorCodes::Code_InvalidParams);
+        cursor = TxNum(tmp);
+    }
+    if (l.size() > 2 && !l[2].isNull()) {
+        bool ok;
+        limit = l[2].toInt(&ok);
+        if (!ok || limit < 1 || limit > options->maxHistory)
+            throw RPCError(QString("Bad limit argument, expected an integer in the range [1, %1]").arg(options->maxHistory),
+                           RPC::ErrorCodes::Code_InvalidParams);
+    }
+    generic_do_async(c, batchId, m.id, [sh, cursor, limit, this] {
+        const auto page = storage->getHistoryPage(sh, cursor, size_t(limit), true);
+        return QVariantMap{
+            { "history", HistoryToVariantList(page.items) },
+            { "next_cursor", page.nextTxNum ? QVariant(qulonglong(*page.nextTxNum)) : QVariant() },
+        };
+    }, sh);
+}
+
+void Server::rpc_blockchain_scripthashes_get_balance(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
+{
+    auto shs = parseFirstHashListParamCommon(m);
+    const auto tf = parseTokenFilterOptionCommon(c, m, 1);
+    generic_do_async(c, batchId, m.id, [shs = std::move(shs), tf, this] {
+        return getBalancesCommon(shs, tf);
+    });
+}
+void Server::rpc_blockchain_scripthashes_get_history(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
+{
+    auto shs = parseFirstHashListParamCommon(m);
+    const auto fromTo = parseFromToBlockHeightCommon(m);
+    generic_do_async(c, batchId, m.id, [shs = std::move(shs), fromTo, this] {
+        return getHistoriesCommon(shs, fromTo);
     });
 }
 
@@ -1669,7 +1943,7 @@ void Server::impl_get_mempool(Client *c, const RPC::BatchId batchId, const RPC::
 {
     generic_do_async(c, batchId, m.id, [sh, this] {
         return getHistoryCommon(sh, true);
-    });
+    }, sh);
 }
 void Server::rpc_blockchain_scripthash_listunspent(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
@@ -1710,7 +1984,7 @@ void Server::impl_listunspent(Client *c, const RPC::BatchId batchId, const RPC::
 {
     generic_do_async(c, batchId, m.id, [sh, tokenFilter, this] {
         return listUnspentCommon(sh, tokenFilter);
-    });
+    }, sh);
 }
 void Server::rpc_blockchain_scripthash_subscribe(Client *c, const RPC::BatchId batchId, const RPC::Message &m)
 {
@@ -1724,6 +1998,36 @@ void Server::rpc_blockchain_address_subscribe(Client *c, const RPC::BatchId batc
     assert(!addrStr.isEmpty());
     impl_generic_subscribe(storage->subs(), c, batchId, m, sh, addrStr);
 }
+namespace {
+    /// Returns the status notification for `subject` (either a raw key, which is sent as hex, or an address alias,
+    /// which is sent verbatim). SubsMgr delivers a status change to all of a thread's subscribers of a key back to
+    /// back, so the previous notification built on this thread is reused if it was for the same thing. This way a
+    /// popular scripthash's notification gets serialized once per client thread, rather than once per client.
+    RPC::PreparedNotificationPtr StatusNotification(const QString &method, const QByteArray &subject, bool isAlias,
+                                                    const SubStatus &status)
+    {
+        thread_local struct {
+            QString method;
+            QByteArray subject;
+            bool isAlias = false;
+            SubStatus status;
+            RPC::PreparedNotificationPtr notification;
+        } last;
+        if (!last.notification || last.isAlias != isAlias || last.subject != subject || !(last.status == status)
+                || last.method != method) {
+            // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
+            const QVariant statusMaybeNull = status.toVariant();
+            last.notification = std::make_shared<const RPC::PreparedNotification>(
+                method, QVariantList{isAlias ? subject : Util::ToHexFast(subject), statusMaybeNull});
+            last.method = method;
+            last.subject = subject;
+            last.isAlias = isAlias;
+            last.status = status;
+        }
+        return last.notification;
+    }
+} // namespace
+
 void Server::impl_generic_subscribe(SubsMgr *subs, Client *c, const RPC::BatchId batchId, const RPC::Message &m,
                                     const HashX &key, const std::optional<QString> &optAlias)
 {
@@ -1780,18 +2084,13 @@ void Server::impl_generic_subscribe(SubsMgr *subs, Client *c, const RPC::BatchId
                 // regular blockchain.scripthash.subscribe callback does no aliasing/rewriting and simply echoes the sh back to client as hex.
                 ret =
                     [c, method=m.method](const HashX &key, const SubStatus &status) {
-                        // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
-                        const QVariant statusMaybeNull = status.toVariant();
-                        const QByteArray keyHex = Util::ToHexFast(key);
-                        emit c->sendNotification(method, QVariantList{keyHex, statusMaybeNull});
+                        emit c->sendPreparedNotification(StatusNotification(method, key, false, status));
                     };
             } else {
                 // When notifying, blockchain.address.subscribe callback must rewrite the sh arg -> the original address argument given by the client.
                 ret =
                     [c, method=m.method, alias=optAlias->toUtf8()](const HashX &, const SubStatus &status) {
-                        // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
-                        const QVariant statusMaybeNull = status.toVariant();
-                        emit c->sendNotification(method, QVariantList{alias, statusMaybeNull});
+                        emit c->sendPreparedNotification(StatusNotification(method, alias, true, status));
                     };
             }
             return ret;
@@ -2434,11 +2733,12 @@ HEY_COMPILER_PUT_STATIC_HERE(Server::StaticData::registry){
     { {"server.features",                   true,               false,    PR{0,0},                    },          MP(rpc_server_features) },
     { {"server.peers.subscribe",            true,               false,    PR{0,0},                    },          MP(rpc_server_peers_subscribe) },
     { {"server.ping",                       true,               false,    PR{0,0},                    },          MP(rpc_server_ping) },
-    { {"server.version",                    true,               false,    PR{0,2},                    },          MP(rpc_server_version) },
+    { {"server.version",                    true,               false,    PR{0,3},                    },          MP(rpc_server_version) },
 
     { {"blockchain.address.get_balance",    true,               false,    PR{1,2},                    },          MP(rpc_blockchain_address_get_balance) },
     { {"blockchain.address.get_first_use",  true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_get_first_use) },
     { {"blockchain.address.get_history",    true,               false,    PR{1,3},                    },          MP(rpc_blockchain_address_get_history) },
+    { {"blockchain.address.get_history_page", true,             false,    PR{1,3},                    },          MP(rpc_blockchain_address_get_history_page) },
     { {"blockchain.address.get_mempool",    true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_get_mempool) },
     { {"blockchain.address.get_scripthash", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_get_scripthash) },
     { {"blockchain.address.listunspent",    true,               false,    PR{1,2},                    },          MP(rpc_blockchain_address_listunspent) },
@@ -2457,11 +2757,15 @@ HEY_COMPILER_PUT_STATIC_HERE(Server::StaticData::registry){
     { {"blockchain.scripthash.get_balance", true,               false,    PR{1,2},                    },          MP(rpc_blockchain_scripthash_get_balance) },
     { {"blockchain.scripthash.get_first_use",  true,            false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_first_use) },
     { {"blockchain.scripthash.get_history", true,               false,    PR{1,3},                    },          MP(rpc_blockchain_scripthash_get_history) },
+    { {"blockchain.scripthash.get_history_page", true,          false,    PR{1,3},                    },          MP(rpc_blockchain_scripthash_get_history_page) },
     { {"blockchain.scripthash.get_mempool", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_mempool) },
     { {"blockchain.scripthash.listunspent", true,               false,    PR{1,2},                    },          MP(rpc_blockchain_scripthash_listunspent) },
     { {"blockchain.scripthash.subscribe",   true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_subscribe) },
     { {"blockchain.scripthash.unsubscribe", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_unsubscribe) },
 
+    { {"blockchain.scripthashes.get_balance", true,             false,    PR{1,2},                    },          MP(rpc_blockchain_scripthashes_get_balance) },
+    { {"blockchain.scripthashes.get_history", true,             false,    PR{1,3},                    },          MP(rpc_blockchain_scripthashes_get_history) },
+
     { {"blockchain.transaction.broadcast",  true,               false,    PR{1,1},                    },          MP(rpc_blockchain_transaction_broadcast) },
     { {"blockchain.transaction.get",        true,               false,    PR{1,2},                    },          MP(rpc_blockchain_transaction_get) },
     { {"blockchain.transaction.get_confirmed_blockhash", true,  false,    PR{1,2},                    },          MP(rpc_blockchain_transaction_get_confirmed_blockhash) },
@@ -25,6 +25,7 @@
 #include "RollingBloomFilter.h"
 #include "Rpa.h"
 #include "RPC.h"
+#include "ThreadPool.h"
 #include "Version.h"
 
 #include <QHash>
@@ -40,6 +41,7 @@
 #include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 struct TcpServerError : public Exception
 {
@@ -137,7 +139,6 @@ class Client;
 class QSslSocket;
 class Storage;
 class SubsMgr;
-class ThreadPool;
 
 /// Base class for the Electrum-server-style linefeed-based JSON-RPC service.
 ///
@@ -181,6 +182,8 @@ public:
 
     /// Default false.
     bool usesWebSockets() const { return usesWS; }
+    /// True for the AdminServer, which is exempt from the SrvMgr's header-only mode
+    virtual bool isAdmin() const { return false; }
     /// This should be called/set once before we begin listening for connections.  Called by SrvMgr depending on options from config.
     virtual void setUsesWebSockets(bool b) { usesWS = b; resetName(); }
 
@@ -215,6 +218,11 @@ protected slots:
     void onMessage(IdMixin::Id clientId, RPC::BatchId batchId, const RPC::Message &m);
     void onErrorMessage(IdMixin::Id clientId, const RPC::Message &m);
     void onPeerError(IdMixin::Id clientId, const QString &what);
+    /// Connected to RPC::ConnectionBase::gotHomogeneousBatch. If `method` is one of the scripthash/address get_balance
+    /// or get_history methods, the lookups for the batch's items are deferred (see deferCoalescedLookup) until
+    /// onHomogeneousBatchDispatched, which answers them all with one Storage::getBalances() or getHistories() call.
+    void onHomogeneousBatch(IdMixin::Id clientId, RPC::BatchId batchId, const QString &method);
+    void onHomogeneousBatchDispatched(IdMixin::Id clientId, RPC::BatchId batchId);
 
 protected:
     /// Overrides QTcpServer -- identical to default impl. from QTcpServer except it also attaches a child
@@ -280,7 +288,20 @@ protected:
     /// the work for later and handles sending the response (returned from work) to the client as well as sending
     /// any errors to the client. The `work` functor may throw RPCError, in which case code and message will be
     /// sent instead.  Note that all other exceptions also end up sent to the client as "internal error: MESSAGE".
-    void generic_do_async(Client *client, RPC::BatchId, const RPC::Message::Id &reqId,  const AsyncWorkFunc & work, int priority = 0);
+    ///
+    /// The work is scheduled by the cost of previous calls of the RPC method being dispatched (see
+    /// ThreadPool::SchedHints). Methods whose cost varies enormously by argument (e.g. get_history) should pass the
+    /// argument (e.g. the scripthash) as `costSubKey`.
+    void generic_do_async(Client *client, RPC::BatchId, const RPC::Message::Id &reqId,  const AsyncWorkFunc & work,
+                          const QByteArray &costSubKey = {});
+    /// Like the above, but a single `work` call answers several requests from the same batch. `work` must return
+    /// a list with one result per id in `reqIds`, in the same order. If it throws, each request gets the error.
+    /// `costKey` is the scheduling cost key, since this is not called while dispatching a single request.
+    void generic_do_async_multi(Client *client, RPC::BatchId, const std::vector<RPC::Message::Id> &reqIds,
+                                const std::function<QVariantList()> & work, const QString &costKey);
+    /// Returns the ThreadPool scheduling hints for work done on behalf of `client`: fair-shared per client, and with
+    /// a deadline if the 'workqueue_timeout' option is set.
+    ThreadPool::SchedHints asyncSchedHints(const Client *client, const QString &costKey, const QByteArray &costSubKey) const;
     void generic_async_to_bitcoind(Client *client,
                                    RPC::BatchId batchId, ///< if running in batch context, will be !batchId.isNull()
                                    const RPC::Message::Id & reqId,  ///< the original client request id
@@ -292,6 +313,9 @@ protected:
     /// Subclasses may set this pointer if they wish the generic_do_async function above to use a private/custom
     /// threadpool. Otherwise the app-global ::AppThreadPool()  will be used for generic_do_async().
     ThreadPool *asyncThreadPool = nullptr;
+    /// The method of the request being dispatched by onMessage(), if any. Used as the default scheduling cost key by
+    /// generic_do_async().
+    QString dispatchingMethod;
 
     /// pointer to the shared Options object -- app-wide configuration settings. Owned and controlled by the App instance.
     const std::shared_ptr<const Options> options;
@@ -328,6 +352,15 @@ protected:
     QVariantMap getBalanceCommon(const HashX & scriptHash, Storage::TokenFilterOption tokenFilter);
     /// Called for listunspent and also Admin server's query_address
     QVariantList listUnspentCommon(const HashX & scriptHash, Storage::TokenFilterOption tokenFilter);
+    /// Batched versions of getHistoryCommon and getBalanceCommon: one result per scripthash, in the same order.
+    QVariantList getHistoriesCommon(const std::vector<HashX> & scriptHashes, const GetHistory_FromToBH & = default_GetHistory_FromToBH);
+    QVariantList getBalancesCommon(const std::vector<HashX> & scriptHashes, Storage::TokenFilterOption tokenFilter);
+
+    /// Called by the get_balance and get_history impls. If `batchId` is for a batch that onHomogeneousBatch chose to
+    /// coalesce, queues the lookup on the client and returns true. Otherwise returns false, and the caller should do
+    /// the lookup itself.
+    bool deferCoalescedLookup(Client *, RPC::BatchId, const RPC::Message::Id &, const HashX &scriptHash,
+                              Storage::TokenFilterOption tokenFilter, const GetHistory_FromToBH & = default_GetHistory_FromToBH);
 
 public:
     /// Helper function called by blockchain.scripthash.listunspent RPC and by the Controller class for /debug/
@@ -361,6 +394,9 @@ signals:
     /// Connected to SrvMgr parent's "newHeader" signal (which itself is connected to Controller's newHeader).
     /// Used to notify clients that are subscribed to headers that a new header has arrived.
     void newHeader(unsigned height, const QByteArray &header);
+    /// Emitted (in this object's thread) for each newHeader(), with the blockchain.headers.subscribe notification for
+    /// it, serialized once for all clients. Subscribed clients are connected to this. Not emitted if nobody is.
+    void newHeaderNotification(const RPC::PreparedNotificationPtr &notification);
 
     /// Emitted for the SrvMgr to update its counters of the number of tx's successfully broadcast.  The argument
     /// is a size in bytes.
@@ -384,6 +420,7 @@ private:
     void rpc_blockchain_address_get_balance(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_address_get_first_use(Client *, RPC::BatchId, const RPC::Message &); // protocol v1.5.2
     void rpc_blockchain_address_get_history(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
+    void rpc_blockchain_address_get_history_page(Client *, RPC::BatchId, const RPC::Message &); // Fulcrum extension
     void rpc_blockchain_address_get_mempool(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_address_get_scripthash(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_address_listunspent(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
@@ -402,10 +439,14 @@ private:
     void rpc_blockchain_scripthash_get_balance(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_get_first_use(Client *, RPC::BatchId, const RPC::Message &); // protocol v1.5.2
     void rpc_blockchain_scripthash_get_history(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
+    void rpc_blockchain_scripthash_get_history_page(Client *, RPC::BatchId, const RPC::Message &); // Fulcrum extension
     void rpc_blockchain_scripthash_get_mempool(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_listunspent(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_subscribe(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_unsubscribe(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
+    // scripthashes (vectorized versions of the above, taking a list of scripthashes)
+    void rpc_blockchain_scripthashes_get_balance(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
+    void rpc_blockchain_scripthashes_get_history(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     // transaction
     void rpc_blockchain_transaction_broadcast(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
     void rpc_blockchain_transaction_get(Client *, RPC::BatchId, const RPC::Message &); // fully implemented
@@ -439,6 +480,7 @@ private:
     void impl_get_balance(Client *, RPC::BatchId, const RPC::Message &, const HashX &scriptHash, Storage::TokenFilterOption tokenFilter);
     void impl_get_first_use(Client *, RPC::BatchId, const RPC::Message &, const HashX &scriptHash);
     void impl_get_history(Client *, RPC::BatchId, const RPC::Message &, const HashX &scriptHash, const GetHistory_FromToBH &);
+    void impl_get_history_page(Client *, RPC::BatchId, const RPC::Message &, const HashX &scriptHash);
     void impl_get_mempool(Client *, RPC::BatchId, const RPC::Message &, const HashX &scriptHash);
     void impl_listunspent(Client *, RPC::BatchId, const RPC::Message &, const HashX &scriptHash, Storage::TokenFilterOption tokenFilter);
     void impl_generic_subscribe(SubsMgr *, Client *, RPC::BatchId, const RPC::Message &, const HashX &key,
@@ -459,12 +501,19 @@ private:
     /// it will throw RPCError in all parse/failure cases and only ever returns a valid hash on success.
     HashX parseFirstHashParamCommon(const RPC::Message &m, const char *const errMsg = nullptr) const;
 
+    /// Like the above, but for blockchain.scripthashes.*: the first argument must be a non-empty list of at most
+    /// max_batch scripthash hex strings. Throws RPCError on invalid argument.
+    std::vector<HashX> parseFirstHashListParamCommon(const RPC::Message &m) const;
+
     /// Helper used by blockchain.*.listunspent *.get_balance to parse optional 2nd arg
     Storage::TokenFilterOption parseTokenFilterOptionCommon(Client *c, const RPC::Message &m, size_t argPos) const;
 
     /// Helper used by blockchain.*.get_history to get the from_height and to_height optional params, if any
     GetHistory_FromToBH parseFromToBlockHeightCommon(const RPC::Message &m) const;
 
+    /// Default page size for blockchain.*.get_history_page. The maximum is max_history.
+    static constexpr int defaultHistoryPageLimit = 10'000;
+
     /// Helper used by blockchain.rpa.* to parse the prefix arg. Throws RPCError on invalid or unsupported arg.
     Rpa::Prefix parseRpaPrefixParamCommon(const QString &paramHex) const;
     /// Called from blockchain.rpa.get_mempool and blockchain.rpa.get_history
@@ -561,6 +610,7 @@ public:
     ~AdminServer() override;
 
     QString prettyName() const override;
+    bool isAdmin() const override { return true; }
 
 protected:
     /// From StatsMixin. This must be called in the thread context of this thread (use statsSafe() for the blocking, thread-safe version!)
@@ -677,6 +727,20 @@ public:
 
     double lastWarnedAboutSubsLimit = 0.; ///< used to throttle log messages when client hits subs limit
 
+    /// A get_balance or get_history lookup from a homogeneous batch, deferred until the whole batch has been
+    /// dispatched. See ServerBase::onHomogeneousBatch.
+    struct CoalescedLookup {
+        RPC::Message::Id reqId;
+        HashX scriptHash;
+        Storage::TokenFilterOption tokenFilter{}; ///< get_balance only
+        std::pair<BlockHeight, std::optional<BlockHeight>> fromTo; ///< get_history only
+    };
+    struct CoalescedBatch {
+        bool isHistory = false; ///< true: get_history, false: get_balance
+        std::vector<CoalescedLookup> lookups;
+    };
+    QHash<RPC::BatchId, CoalescedBatch> coalescedBatches; ///< batches currently being coalesced by ServerBase
+
     static std::atomic_size_t numClients, numClientsMax, numClientsCtr; // number of connected clients: current, max lifetime, accumulated counter
 
     /// Returns true iff the client is token aware (protocol version >= 1.4.6). Note that this only makese sense on BCH.
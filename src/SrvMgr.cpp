@@ -246,7 +246,19 @@ void SrvMgr::startServers()
         upnp->startSync(std::move(upnpPorts));
     }
 
-    emit allServersStarted();
+    if (isHeadersOnly())
+        Log() << "SrvMgr: serving header queries only, until the database is loaded and synched";
+    else
+        emit allServersStarted();
+}
+
+void SrvMgr::setHeadersOnly(bool b)
+{
+    if (headersOnly.exchange(b) == b) return;
+    if (!b && !servers.empty()) {
+        Log() << "SrvMgr: now serving all queries";
+        emit allServersStarted(); // deferred from startServers()
+    }
 }
 
 void SrvMgr::clientConnected(IdMixin::Id cid, const QHostAddress &addr)
@@ -431,6 +443,7 @@ auto SrvMgr::stats() const -> Stats
 {
     QVariantMap m;
     m["donationAddress"] = options->donationAddress;
+    m["headersOnly"] = isHeadersOnly();
     m["bannerFile"] = options->bannerFile.toUtf8(); // so we get a nice 'null' if not specified
     QVariantMap serversMap;
     const int timeout = kDefaultTimeout / qMax(int(servers.size()), 1);
@@ -82,6 +82,14 @@ public:
     /// Thread-Safe. Like the above but returns an invalid shared_ptr if the per-IP data for address does not exist.
     std::shared_ptr<Client::PerIPData> findExistingPerIPData(const QHostAddress &address) { return perIPData.getOrCreate(address, false); }
 
+    /// Header-only mode: used while the Controller is still checking the db and catching up with bitcoind. The servers
+    /// answer only the server.* and header methods (see ServerBase::onMessage), and PeerMgr is not told that the
+    /// servers are up (so we don't announce ourselves to peers) until this is turned off again. Call from this
+    /// object's thread.
+    void setHeadersOnly(bool);
+    /// Thread-safe.
+    bool isHeadersOnly() const noexcept { return headersOnly.load(std::memory_order_relaxed); }
+
     /// Thread-Safe. Returns whether bitcoind currently probes as having the dsproof RPC.
     /// This just forwards the call to BitcoinDMgr::hasDSProofRPC().
     bool hasDSProofRPC() const;
@@ -183,6 +191,7 @@ private:
     QMultiHash<QHostAddress, IdMixin::Id> addrIdMap;
 
     std::atomic_size_t numTxBroadcasts = 0, txBroadcastBytesTotal = 0;
+    std::atomic_bool headersOnly = false;
     BTC::Net _net = BTC::Invalid; ///< gets set in startServers by querying storage.
 
     // -- the below is shared with other threads and guarded by banMut.
@@ -23,11 +23,14 @@
 #include "CoTask.h"
 #include "Mempool.h"
 #include "Merkle.h"
+#include "Metrics.h"
 #include "RecordFile.h"
 #include "Rpa.h"
 #include "Span.h"
 #include "Storage.h"
 #include "SubsMgr.h"
+#include "ThreadTopology.h"
+#include "TxHashIndex.h"
 #include "VarInt.h"
 
 #include "bitcoin/crypto/endian.h"
@@ -40,31 +43,43 @@
 #include <rocksdb/advanced_cache.h>
 #endif
 #include <rocksdb/cache.h>
+#include <rocksdb/convenience.h>
 #include <rocksdb/db.h>
+#include <rocksdb/env.h>
 #include <rocksdb/iterator.h>
 #include <rocksdb/merge_operator.h>
 #include <rocksdb/options.h>
 #include <rocksdb/slice.h>
+#include <rocksdb/statistics.h>
 #include <rocksdb/table.h>
 #include <rocksdb/version.h>
 #include <rocksdb/write_buffer_manager.h>
 
 #include <QByteArray>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QSysInfo>
 #include <QVector> // we use this for the Height2Hash cache to save on memcopies since it's implicitly shared.
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstddef> // for std::byte, offsetof, ptrdiff_t
 #include <cstdlib>
 #include <cstring> // for memcpy
+#include <exception>
 #include <functional>
+#include <iterator>
 #include <limits>
 #include <list>
 #include <map>
+#include <memory_resource>
+#include <mutex>
+#include <numeric> // for std::iota
 #include <optional>
 #include <set>
 #include <shared_mutex>
@@ -150,6 +165,7 @@ namespace {
     // some database keys we use -- todo: if this grows large, move it elsewhere
     static const bool falseMem = false, trueMem = true;
     static const rocksdb::Slice kMeta{"meta"}, kDirty{"dirty"}, kUtxoCount{"utxo_count"}, kRpaNeedsFullCheck{"rpa_needs_full_check"},
+                                kShBalanceBuilt{"scripthash_balance_built"},
                                 kTrue(reinterpret_cast<const char *>(&trueMem), sizeof(trueMem)),
                                 kFalse(reinterpret_cast<const char *>(&falseMem), sizeof(falseMem));
 
@@ -243,6 +259,56 @@ namespace {
         bitcoin::token::OutputDataPtr tokenDataPtr;
     };
 
+    /// The value stored in the scripthash_balance db, keyed off HashX. It is the confirmed balance and UTXO count for
+    /// a HashX, split by whether the UTXOs carry token data. The db only ever receives *deltas* of this type (via
+    /// BalanceSumOperator below), which are summed, so removals are simply negative deltas.
+    struct BalanceAggregate {
+        int64_t amountNoTok = 0, countNoTok = 0, amountTok = 0, countTok = 0;
+
+        static constexpr size_t serSize() { return 4u * sizeof(int64_t); }
+
+        void apply(const bitcoin::Amount amount, const bool hasToken, const int64_t sign) {
+            auto [amt, ct] = hasToken ? std::tie(amountTok, countTok) : std::tie(amountNoTok, countNoTok);
+            amt += sign * (amount / bitcoin::Amount::satoshi());
+            ct += sign;
+        }
+        BalanceAggregate & operator+=(const BalanceAggregate &o) {
+            amountNoTok += o.amountNoTok; countNoTok += o.countNoTok;
+            amountTok += o.amountTok; countTok += o.countTok;
+            return *this;
+        }
+        bool operator==(const BalanceAggregate &) const = default;
+        bool isZero() const { return *this == BalanceAggregate{}; }
+        int64_t count() const { return countNoTok + countTok; }
+        bool isSane() const { return amountNoTok >= 0 && countNoTok >= 0 && amountTok >= 0 && countTok >= 0; }
+        /// Returns the balance in satoshis of the UTXOs that pass the given token filter
+        int64_t satsForFilter(const Storage::TokenFilterOption f) const {
+            switch (f) {
+            case Storage::TokenFilterOption::ExcludeTokens: return amountNoTok;
+            case Storage::TokenFilterOption::IncludeTokens: return amountNoTok + amountTok;
+            case Storage::TokenFilterOption::OnlyTokens: return amountTok;
+            }
+            throw InternalError(QString("Invalid TokenFilterOption encountered: %1. This shouldn't happen! FIXME!").arg(int(f)));
+        }
+
+        /// Serialized as 4 raw int64's in host byte order (as with SerializeScalar, this is not platform-neutral)
+        void toBytes(char *out) const {
+            const int64_t vals[4] = {amountNoTok, countNoTok, amountTok, countTok};
+            std::memcpy(out, vals, serSize());
+        }
+        static std::optional<BalanceAggregate> fromBytes(const char *data, size_t len) {
+            if (len != serSize()) return std::nullopt;
+            int64_t vals[4];
+            std::memcpy(vals, data, serSize());
+            return BalanceAggregate{vals[0], vals[1], vals[2], vals[3]};
+        }
+        QByteArray toByteArray() const { QByteArray ret(int(serSize()), Qt::Uninitialized); toBytes(ret.data()); return ret; }
+        QString toString() const {
+            return QString("(amountNoTok: %1, countNoTok: %2, amountTok: %3, countTok: %4)")
+                    .arg(amountNoTok).arg(countNoTok).arg(amountTok).arg(countTok);
+        }
+    };
+
     // Ensures we store RPA db keys in big endian for faster scans of adjacent heights
     struct RpaDBKey {
         uint32_t height;
@@ -287,6 +353,10 @@ namespace {
     using TxNumVec = std::vector<TxNum>;
     // this serializes a vector of TxNums to a compact representation (6 bytes, eg 48 bits per TxNum), in little endian byte order
     template <> QByteArray Serialize(const TxNumVec &);
+    // as above, for the arena-backed vectors in PreProcessedBlock::AggregatedOutsIns
+    using PmrTxNumVec = std::pmr::vector<TxNum>;
+    template <> QByteArray Serialize(const PmrTxNumVec &);
+    template <typename Vec> QByteArray SerializeTxNums(const Vec &); // implementation of the above two
     // this deserializes a vector of TxNums from a compact representation (6 bytes, eg 48 bits per TxNum), assuming little endian byte order
     template <> TxNumVec Deserialize(const QByteArray &, bool *);
 
@@ -329,6 +399,99 @@ namespace {
     /// Helper to just get the status error string as a QString
     QString StatusString(const rocksdb::Status & status) { return QString::fromStdString(status.ToString()); }
 
+#if ROCKSDB_MAJOR >= 9
+#define HAS_ROCKSDB_TIERED_CACHE 1 // HyperClockCache with automatic sizing, and the compressed secondary cache
+#else
+#define HAS_ROCKSDB_TIERED_CACHE 0
+#endif
+
+    /// Block cache helpers, as configured by the db_block_cache_type, db_pin_index_filter, and db_secondary_cache_mem
+    /// options. Used by Storage::startup() and by the "blockcache" bench.
+
+#if HAS_ROCKSDB_TIERED_CACHE
+    using SecondaryCachePtr = std::shared_ptr<rocksdb::SecondaryCache>;
+#else
+    using SecondaryCachePtr = std::shared_ptr<void>; // older rocksdb (e.g. 6.6.4) has no rocksdb::SecondaryCache; always null
+#endif
+
+    /// Returns a compressed secondary cache of `capacity` bytes, or nullptr if `capacity` is 0 or this rocksdb build
+    /// can't do it.
+    SecondaryCachePtr MakeSecondaryCache(size_t capacity) {
+        if (!capacity) return {};
+#if HAS_ROCKSDB_TIERED_CACHE
+        const auto supported = rocksdb::GetSupportedCompressions();
+        for (const auto ct : {rocksdb::kLZ4Compression, rocksdb::kSnappyCompression, rocksdb::kZSTD}) {
+            if (std::find(supported.begin(), supported.end(), ct) == supported.end()) continue;
+            rocksdb::CompressedSecondaryCacheOptions copts;
+            copts.capacity = capacity;
+            copts.compression_type = ct;
+            return rocksdb::NewCompressedSecondaryCache(copts);
+        }
+        Warning() << "db_secondary_cache_mem: this rocksdb build supports none of lz4, snappy, or zstd, secondary cache disabled";
+#else
+        Warning() << "db_secondary_cache_mem: requires rocksdb 9.0 or newer, secondary cache disabled";
+#endif
+        return {};
+    }
+
+    /// Returns a block cache of `capacity` bytes, of the configured type, that spills into `secondary` (if not null)
+    std::shared_ptr<rocksdb::Cache> MakeBlockCache(const Options::DBOpts &dbo, size_t capacity,
+                                                   const SecondaryCachePtr &secondary) {
+#if HAS_ROCKSDB_TIERED_CACHE
+        if (dbo.blockCacheType == Options::DBOpts::BlockCacheType::HyperClock) {
+            rocksdb::HyperClockCacheOptions hopts(capacity, 0 /* estimated_entry_charge: 0 = size the table automatically */);
+            hopts.secondary_cache = secondary;
+            return hopts.MakeSharedCache();
+        }
+        rocksdb::LRUCacheOptions lopts;
+        lopts.capacity = capacity;
+        lopts.strict_capacity_limit = false; // turning it on made db writes sometimes fail
+        lopts.secondary_cache = secondary;
+        return lopts.MakeSharedCache();
+#else
+        if (dbo.blockCacheType == Options::DBOpts::BlockCacheType::HyperClock)
+            Warning() << "db_block_cache_type: hyperclock requires rocksdb 9.0 or newer, using lru";
+        Q_UNUSED(secondary)
+        return rocksdb::NewLRUCache(capacity, -1, false /* strict capacity limit=off, turning it on made db writes sometimes fail */);
+#endif
+    }
+
+    /// Returns the table options all DBs share, save for (with db_block_cache_per_table) the block cache itself
+    rocksdb::BlockBasedTableOptions MakeTableOptions(const Options::DBOpts &dbo, std::shared_ptr<rocksdb::Cache> blockCache) {
+        rocksdb::BlockBasedTableOptions ret;
+        ret.block_cache = std::move(blockCache);
+        ret.cache_index_and_filter_blocks = true; // from the docs: this may be a large consumer of memory, cost & cap its memory usage to the cache
+        if (dbo.pinIndexFilter) {
+            // Index & filter blocks go into the LRU cache's high-priority pool (HyperClockCache ignores this), so that
+            // data blocks streaming through (e.g. from a large history read) evict each other first. Those of L0 files
+            // are pinned outright: every read consults all L0 files, and they are small and short-lived.
+            ret.cache_index_and_filter_blocks_with_high_priority = true;
+            ret.pin_l0_filter_and_index_blocks_in_cache = true;
+        }
+        return ret;
+    }
+
+    /// Block cache hit/miss counts and ratios from a DB's statistics, overall and by block type
+    QVariantMap BlockCacheStats(const rocksdb::Statistics &st) {
+        QVariantMap ret;
+        const auto put = [&ret, &st](const char *name, uint32_t hitTicker, uint32_t missTicker) {
+            const auto hits = st.getTickerCount(hitTicker), misses = st.getTickerCount(missTicker);
+            ret[name] = QVariantMap{
+                {"hits", qulonglong(hits)},
+                {"misses", qulonglong(misses)},
+                {"hit ratio", hits + misses ? QVariant(double(hits) / double(hits + misses)) : QVariant()},
+            };
+        };
+        put("all", rocksdb::BLOCK_CACHE_HIT, rocksdb::BLOCK_CACHE_MISS);
+        put("index", rocksdb::BLOCK_CACHE_INDEX_HIT, rocksdb::BLOCK_CACHE_INDEX_MISS);
+        put("filter", rocksdb::BLOCK_CACHE_FILTER_HIT, rocksdb::BLOCK_CACHE_FILTER_MISS);
+        put("data", rocksdb::BLOCK_CACHE_DATA_HIT, rocksdb::BLOCK_CACHE_DATA_MISS);
+#if HAS_ROCKSDB_TIERED_CACHE
+        ret["secondary cache hits"] = qulonglong(st.getTickerCount(rocksdb::SECONDARY_CACHE_HITS));
+#endif
+        return ret;
+    }
+
     /// DB read/write helpers
     /// NOTE: these may throw DatabaseError
     /// If missingOk=false, then the returned optional is guaranteed to have a value if this function returns without throwing.
@@ -505,13 +668,21 @@ namespace {
         std::vector<UTXODelUndo> delUndos;
 
         uint16_t deserVersion = 0u; ///< Only ever read-in from db, never written out (we write out the latest version always)
+        /// V4 undo records do not store txids; they reference outputs by TxNum. If this is true, the TXO::txHash of each
+        /// item in addUndos and delUndos is empty and resolveTxHashes() must be called before this object is used.
+        bool txHashesUnresolved = false;
 
         [[maybe_unused]] QString toDebugString() const;
 
         [[maybe_unused]] bool operator==(const UndoInfo &) const; // for debug ser/deser
 
+        /// Given a function that returns the TxHashes for a list of TxNums (in the same order), fill in the missing
+        /// TXO::txHash of all addUndos and delUndos. No-op if !txHashesUnresolved. Throws on error.
+        using GetTxHashesFunc = std::function<std::vector<TxHash>(const std::vector<uint64_t> &)>;
+        void resolveTxHashes(const GetTxHashesFunc &getTxHashes);
+
         bool isValid() const { return hash.size() == HashLen; } ///< cheap, imperfect check for validity
-        void clear() { height = 0; hash.clear(); blkInfo = BlkInfo(); scriptHashes.clear(); addUndos.clear(); delUndos.clear(); deserVersion = 0u; }
+        void clear() { height = 0; hash.clear(); blkInfo = BlkInfo(); scriptHashes.clear(); addUndos.clear(); delUndos.clear(); deserVersion = 0u; txHashesUnresolved = false; }
     };
 
     QString UndoInfo::toDebugString() const {
@@ -528,6 +699,30 @@ namespace {
                 && addUndos == o.addUndos && delUndos == o.delUndos;
     }
 
+    void UndoInfo::resolveTxHashes(const GetTxHashesFunc &getTxHashes) {
+        if (!txHashesUnresolved) return;
+        // gather the unique txNums referenced, so each hash is only read once
+        std::vector<uint64_t> txNums;
+        txNums.reserve(addUndos.size() + delUndos.size());
+        for (const auto & [txo, hashX, ctxo] : addUndos) txNums.push_back(ctxo.txNum());
+        for (const auto & [txo, info] : delUndos) txNums.push_back(info.txNum);
+        Util::sortAndUniqueify(txNums);
+        const std::vector<TxHash> hashes = getTxHashes(txNums);
+        if (UNLIKELY(hashes.size() != txNums.size()))
+            throw DatabaseError(QString("Unable to resolve txids for undo info at height %1: expected %2 hashes, got %3")
+                                .arg(height).arg(txNums.size()).arg(hashes.size()));
+        const auto HashFor = [&](const uint64_t txNum) -> const TxHash & {
+            const auto it = std::lower_bound(txNums.begin(), txNums.end(), txNum); // guaranteed to be found
+            const TxHash & h = hashes[size_t(it - txNums.begin())];
+            if (UNLIKELY(h.size() != HashLen))
+                throw DatabaseError(QString("Unable to resolve txid for txNum %1 in undo info at height %2").arg(txNum).arg(height));
+            return h;
+        };
+        for (auto & [txo, hashX, ctxo] : addUndos) txo.txHash = HashFor(ctxo.txNum());
+        for (auto & [txo, info] : delUndos) txo.txHash = HashFor(info.txNum);
+        txHashesUnresolved = false;
+    }
+
     // serialize as raw bytes mostly (no QDataStream)
     template <> QByteArray Serialize(const UndoInfo &);
     // serialize from raw bytes mostly (no QDataStream)
@@ -580,6 +775,85 @@ namespace {
         return true;
     }
 
+    /// Merge operator for the scripthash_balance db: the existing value and the operand are both serialized
+    /// BalanceAggregate records, and the result is their field-wise sum.
+    class BalanceSumOperator : public rocksdb::AssociativeMergeOperator {
+    public:
+        ~BalanceSumOperator() override;
+
+        mutable std::atomic_size_t merges = 0;
+
+        bool Merge(const rocksdb::Slice& key, const rocksdb::Slice* existing_value,
+                   const rocksdb::Slice& value, std::string* new_value,
+                   rocksdb::Logger* logger) const override;
+        const char* Name() const override { return "BalanceSumOperator"; /* NOTE: this must be the same for the same db each time it is opened! */ }
+    };
+
+    BalanceSumOperator::~BalanceSumOperator() {} // weak vtable warning prevention
+
+    bool BalanceSumOperator::Merge(const rocksdb::Slice &key [[maybe_unused]], const rocksdb::Slice *existing_value,
+                                   const rocksdb::Slice &value, std::string *new_value, rocksdb::Logger *) const
+    {
+        ++merges;
+        auto sum = BalanceAggregate::fromBytes(value.data(), value.size());
+        if (!sum) return false; // corrupt operand
+        if (existing_value) {
+            const auto ev = BalanceAggregate::fromBytes(existing_value->data(), existing_value->size());
+            if (!ev) return false; // corrupt existing value
+            *sum += *ev;
+        }
+        new_value->resize(BalanceAggregate::serSize());
+        sum->toBytes(new_value->data());
+        return true;
+    }
+
+    /// Reads the record for hashX from the scripthash_balance db. Returns an all-zero record if it is missing, and
+    /// throws DatabaseError on a read error or if the record has the wrong size.
+    BalanceAggregate ReadBalanceAggregate(rocksdb::DB *db, const HashX &hashX, const rocksdb::ReadOptions &ropts) {
+        static const QString errMsg("Error reading from the scripthash_balance db");
+        const auto optBa = GenericDBGet<QByteArray>(db, hashX, true, errMsg, false, ropts);
+        if (!optBa) return {};
+        auto ret = BalanceAggregate::fromBytes(optBa->constData(), size_t(optBa->size()));
+        if (UNLIKELY(!ret))
+            throw DatabaseSerializationError(QString("%1: record for %2 has the wrong size (%3)")
+                                             .arg(errMsg, QString(hashX.toHex())).arg(optBa->size()));
+        return *ret;
+    }
+
+    /// Net change to each HashX's BalanceAggregate, accumulated for a block (UTXOBatch) or many (UTXOCache)
+    using BalanceDeltas = std::unordered_map<HashX, BalanceAggregate, HashHasher>;
+
+    /// Writes `deltas` to the scripthash_balance db, committing a batch every `batchSize` records. Positive deltas become
+    /// merges. Rather than let the table fill up with all-zero records for every HashX that was ever funded, HashXs that
+    /// lost utxos are read back and deleted if nothing is left, so the caller must hold the blocksLock exclusively (so
+    /// that this is race-free). Throws DatabaseError on error.
+    void WriteBalanceDeltas(rocksdb::DB *db, const BalanceDeltas &deltas, const rocksdb::ReadOptions &ropts,
+                            const rocksdb::WriteOptions &wopts, const size_t batchSize = std::numeric_limits<size_t>::max()) {
+        static const QString errMsg("Error issuing batch write to scripthash_balance db for a utxo update");
+        rocksdb::WriteBatch batch;
+        size_t batchCount = 0u;
+        for (const auto & [hashX, delta] : deltas) {
+            if (delta.isZero()) continue; // e.g. a utxo created and spent in the same block
+            rocksdb::Status st;
+            if (delta.count() < 0) {
+                BalanceAggregate cur = ReadBalanceAggregate(db, hashX, ropts); // may throw
+                cur += delta;
+                if (cur.isZero()) st = batch.Delete(ToSlice(hashX));
+                else st = batch.Put(ToSlice(hashX), ToSlice(cur.toByteArray()));
+            } else {
+                st = batch.Merge(ToSlice(hashX), ToSlice(delta.toByteArray()));
+            }
+            if (!st.ok())
+                throw DatabaseError(QString("Failed to add a balance update to the scripthash_balance batch: %1").arg(StatusString(st)));
+            if (++batchCount >= batchSize) {
+                GenericBatchWrite(db, batch, errMsg, wopts); // may throw
+                batch.Clear();
+                batchCount = 0u;
+            }
+        }
+        if (batchCount) GenericBatchWrite(db, batch, errMsg, wopts); // may throw
+    }
+
     /// Thrown if user hits Ctrl-C / app gets a signal while we run the slow db checks
     struct UserInterrupted : public Exception { using Exception::Exception; ~UserInterrupted() override; };
     UserInterrupted::~UserInterrupted() {} // weak vtable warning suppression
@@ -591,6 +865,11 @@ namespace {
     ///
     /// This class is mainly a thin wrapper around the rocksdb and RecordFile facilities and they are both
     /// thread-safe and reentrant. It takes no locks itself.
+    ///
+    /// If loadMemIndex() was called (config: txhash_mem_index), lookups are instead served by an in-memory TxHashIndex
+    /// built from the RecordFile at startup, and the db is only written to (so that it stays valid should the option be
+    /// turned off later). The TxHashIndex is not thread-safe, so in that mode the calling code must not call find()
+    /// or findMany() concurrently with insertForBlock() or truncateForUndo(). Storage ensures this via blocksLock.
     class TxHash2TxNumMgr {
         rocksdb::DB * const db;
         const rocksdb::ReadOptions & rdOpts; // references into Storage::Pvt
@@ -600,6 +879,7 @@ namespace {
         ConcatOperator * concatOp;  // this is a "weak" pointer into above, dynamic casted down. always valid.
         Tic lastWarnTime; ///< this is not guarded by any locks. Assumption is calling code always holds an exclusive lock when calling truncateForUndo()
         int64_t largestTxNumSeen = -1;
+        std::unique_ptr<TxHashIndex> memIndex; ///< if not null, serves find() and findMany() instead of the db
     public:
         const size_t keyBytes;
 
@@ -632,7 +912,35 @@ namespace {
         /// Returns the largest tx num we have ever inserted into the db, or -1 if no txnums were inserted
         int64_t maxTxNumSeenInDB() const { return largestTxNumSeen; }
 
-        void insertForBlock(TxNum blockTxNum0, const std::vector<PreProcessedBlock::TxInfo> &txInfos) {
+        /// Builds the in-memory index from the RecordFile, after which lookups no longer touch the db. Call this only
+        /// once the db is known to be consistent with the RecordFile (i.e. after the startup checks). May throw.
+        void loadMemIndex() {
+            const Tic t0;
+            const auto nrec = rf->numRecords();
+            auto idx = std::make_unique<TxHashIndex>(nrec);
+            constexpr size_t batchSize = 50'000;
+            App *ourApp = app();
+            std::vector<uint64_t> keys;
+            for (size_t i = 0; i < nrec; i += keys.size()) {
+                if (UNLIKELY(ourApp && ourApp->signalsCaught()))
+                    throw UserInterrupted("User interrupted, aborting txhash index load");
+                QString err;
+                const auto recs = rf->readRecords(i, std::min<size_t>(batchSize, nrec - i), &err);
+                if (recs.empty() || !err.isEmpty()) throw DatabaseError(QString("Error reading txNums file: ") + err);
+                keys.clear();
+                for (const auto & rec : recs)
+                    keys.push_back(TxHashIndex::keyFor(rec));
+                idx->append(i, keys);
+            }
+            memIndex = std::move(idx);
+            Log() << "Loaded in-memory txhash index: " << nrec << Util::Pluralize(" entry", nrec) << ", "
+                  << QString::number(memIndex->memoryUsage() / 1e6, 'f', 1) << " MB, elapsed: " << t0.secsStr(2) << " sec";
+        }
+
+        /// Returns the in-memory index, or nullptr if loadMemIndex() was not called.
+        const TxHashIndex *getMemIndex() const { return memIndex.get(); }
+
+        void insertForBlock(TxNum blockTxNum0, const PreProcessedBlock::TxInfoVec &txInfos) {
             const Tic t0;
             rocksdb::WriteBatch batch;
             for (TxNum i = 0; i < txInfos.size(); ++i) {
@@ -650,6 +958,13 @@ namespace {
                 largestTxNumSeen = blockTxNum0 + txInfos.size() - 1;
                 saveLargestTxNumSeen();
             }
+            if (memIndex) {
+                std::vector<uint64_t> keys;
+                keys.reserve(txInfos.size());
+                for (const auto & txInfo : txInfos)
+                    keys.push_back(TxHashIndex::keyFor(txInfo.hash));
+                memIndex->append(blockTxNum0, keys);
+            }
             if (t0.msec() >= 50)
                 DebugM(__func__, ": inserted ", txInfos.size(), Util::Pluralize(" hash", txInfos.size()),
                        " in ", t0.msecStr(), " msec");
@@ -743,6 +1058,7 @@ namespace {
              // we always add at the end and truncare at the end; this invariant should always hold
             largestTxNumSeen = std::max(txNumI - 1, int64_t{-1});
             saveLargestTxNumSeen();
+            if (memIndex) memIndex->truncate(txNum);
 
             DebugM(__func__, ": txNum: ", txNum, ", nrecs: ", recs.size(), ", dels: ", dels, ", keeps: ", keeps, ", filts: ", filts,
                    ", elapsed: ", t0.msecStr(), " msec");
@@ -752,15 +1068,24 @@ namespace {
         /// May throw DatabaseError if there is a low-level deserialization error.
         std::optional<TxNum> find(const TxHash &txHash) const {
             std::optional<TxNum> ret;
-            const auto key = makeKeyFromHash(txHash);
-            auto optBytes = GenericDBGet<QByteArray>(db, key, true, dbName(), true, rdOpts);
-            if (!optBytes) return ret; // missing
-            auto span = Span<const char>{*optBytes};
             std::vector<uint64_t> txNums;
-            txNums.reserve(1 + span.size() / 5); // rough heuristic
+            std::optional<QByteArray> optBytes;
+            if (memIndex) {
+                const auto key = TxHashIndex::keyFor(txHash);
+                if (!memIndex->mayContain(key)) return ret; // definitely missing (the common case for unconfirmed txs)
+                memIndex->find(key, txNums);
+                if (txNums.empty()) return ret; // missing (Bloom filter false positive)
+            } else {
+                optBytes = GenericDBGet<QByteArray>(db, makeKeyFromHash(txHash), true, dbName(), true, rdOpts);
+                if (!optBytes) return ret; // missing
+            }
             try {
-                while (!span.empty())
-                    txNums.push_back(VarInt::deserialize(span).value<uint64_t>()); // this may throw
+                if (optBytes) {
+                    auto span = Span<const char>{*optBytes};
+                    txNums.reserve(1 + span.size() / 5); // rough heuristic
+                    while (!span.empty())
+                        txNums.push_back(VarInt::deserialize(span).value<uint64_t>()); // this may throw
+                }
                 if (UNLIKELY(txNums.empty())) throw DatabaseFormatError(QString("Missing data for txHash: ") + QString(txHash.toHex()));
                 QString errStr;
                 // we may get more than 1 txNum for a particular key, so examine them all
@@ -791,6 +1116,22 @@ namespace {
             if (hashes.empty()) return ret; // short-circuit return on no work to do
             const Tic t0;
             ret.resize(hashes.size());
+            std::vector<uint64_t> recNums;
+            std::vector<std::optional<std::pair<size_t, size_t>>> idx2RecNums;
+            idx2RecNums.resize(hashes.size());
+            recNums.reserve(hashes.size());
+            if (memIndex) {
+                for (size_t i = 0; i < hashes.size(); ++i) {
+                    if (UNLIKELY(size_t(hashes[i].size()) != HashLen)) continue; // can't be in the index
+                    const auto key = TxHashIndex::keyFor(hashes[i]);
+                    if (!memIndex->mayContain(key)) continue;
+                    const size_t first = recNums.size();
+                    memIndex->find(key, recNums);
+                    if (recNums.size() > first)
+                        idx2RecNums[i].emplace(first, recNums.size());
+                }
+                return resolveCandidates(hashes, recNums, idx2RecNums, std::move(ret), t0);
+            }
             std::vector<rocksdb::Slice> keySlices;
             std::vector<std::string> dbResults;
             keySlices.reserve(hashes.size());
@@ -801,10 +1142,6 @@ namespace {
             //DebugM(__func__, ": MultiGet of ", keySlices.size(), " items took ", t0.msecStr(), " msec");
             if (statuses.size() != hashes.size() || dbResults.size() != hashes.size())
                 throw DatabaseError(dbName() + ": db returned an unexpected number of results"); // should never happen
-            std::vector<uint64_t> recNums;
-            std::vector<std::optional<std::pair<size_t, size_t>>> idx2RecNums;
-            idx2RecNums.resize(hashes.size());
-            recNums.reserve(hashes.size());
             for (size_t i = 0; i < statuses.size(); ++i) {
                 auto & st = statuses[i];
                 if (st.IsNotFound()) continue; // skip NotFound
@@ -828,6 +1165,18 @@ namespace {
                 if (p.second > p.first)
                     idx2RecNums[i] = p;
             }
+            return resolveCandidates(hashes, recNums, idx2RecNums, std::move(ret), t0);
+        }
+
+        bool exists(const TxHash &txHash) const { return bool(find(txHash)); }
+
+    private:
+        /// Common tail of findMany(): reads the candidate records for each hash (hashes[i] may be at any of the TxNums
+        /// recNums[idx2RecNums[i]->first .. idx2RecNums[i]->second)) and fills in `ret` with the ones that match.
+        std::vector<std::optional<TxNum>> resolveCandidates(const std::vector<TxHash> &hashes,
+                                                            const std::vector<uint64_t> &recNums,
+                                                            const std::vector<std::optional<std::pair<size_t, size_t>>> &idx2RecNums,
+                                                            std::vector<std::optional<TxNum>> &&ret, const Tic &t0) const {
             QString errStr;
             const auto recs = rf->readRandomRecords(recNums, &errStr, true);
             if (!errStr.isEmpty()) DebugM(__func__, ": ", errStr); // DEBUG TODO: Remove me
@@ -844,13 +1193,10 @@ namespace {
                     }
                 }
             }
-            DebugM(__func__, ": ", ret.size(), " result(s), elapsed ", t0.msecStr(), " msec");
+            DebugM("findMany: ", ret.size(), " result(s), elapsed ", t0.msecStr(), " msec");
             return ret;
         }
 
-        bool exists(const TxHash &txHash) const { return bool(find(txHash)); }
-
-    private:
         ByteView makeKeyFromHash(const ByteView &bv) const {
             const auto len = bv.size();
             if (UNLIKELY(len != HashLen))
@@ -990,7 +1336,7 @@ namespace {
             const Tic t0;
             App *ourApp = app();
             const auto nrec = rf->numRecords();
-            std::vector<PreProcessedBlock::TxInfo> fakeInfos;
+            PreProcessedBlock::TxInfoVec fakeInfos;
             for (size_t i = 0; i < nrec; /*i += batchSize*/) {
                 if (UNLIKELY(0 == i % 100 && ourApp && ourApp->signalsCaught()))
                     throw UserInterrupted("User interrupted, aborting check"); // if the user hits Ctrl-C, stop the operation
@@ -1058,6 +1404,173 @@ namespace {
 
     /* static */ const QByteArray TxHash2TxNumMgr::kLargestTxNumSeenKeyPrefix = "+largestTxNumSeen";
 
+    /// The block hash (not reversed) for a header record as handed out by HeaderStore: sha256d of the first 80 bytes.
+    /// Pre-RandomX records are zero-padded to 112 bytes, so hashing the whole record would give the wrong answer.
+    QByteArray HeaderHashForRecord(const QByteArray &rec) {
+        return BTC::Hash(QByteArray::fromRawData(rec.constData(), std::min<QByteArray::size_type>(rec.size(), 80)));
+    }
+
+    /// The (reversed) hash that latestTip() returns, and that undo infos are stamped with, for the header record at
+    /// `height`: that of the header as serialized, i.e. all 112 bytes of a RandomX header. For pre-RandomX headers
+    /// this is HeaderHashForRecord() (reversed), so callers pass that in as `hash` if they have it, to save a re-hash.
+    QByteArray TipHashForRecord(BlockHeight height, const QByteArray &rec, const QByteArray &hash = {}) {
+        if (BTC::IsRandomXBlock(int(height))) return BTC::HashRev(rec);
+        return hash.size() == HashLen ? Util::reversedCopy(hash) : Util::reversedCopy(HeaderHashForRecord(rec));
+    }
+
+    /// The hash that addBlock() stamps an undo info with, and that undoLatestBlock() checks it against: the
+    /// TipHashForRecord() of the last header `verif` accepted. `hash` is as for TipHashForRecord().
+    QByteArray UndoHashForVerifierTip(const BTC::HeaderVerifier &verif, const QByteArray &hash = {}) {
+        const auto [height, rec] = verif.lastHeaderProcessed();
+        return TipHashForRecord(BlockHeight(std::max(height, 0)), rec, hash);
+    }
+
+    /// File-backed array of block headers, indexed by height. Regardless of the on-disk layout, every header is handed
+    /// out (and must be handed in) as a BTC::FIXED_HEADER_RECORD_SIZE record, zero-padded if it is a pre-RandomX
+    /// 80-byte header. The two layouts are:
+    ///  - Padded (the original): a single RecordFile "headers" of 112-byte records.
+    ///  - Compact (db_compact_headers = true): "headers_base" holds the 80-byte headers for heights below
+    ///    BTC::ALPHA_RANDOMX_ACTIVATION_HEIGHT, and "headers_rx" the 112-byte ones from that height onward. The file
+    ///    offset of height h is thus h*80 for h < A, and A*80 + (h-A)*112 for h >= A (plus the file headers).
+    /// The layout of an existing datadir always wins over the config option.
+    class HeaderStore
+    {
+        static constexpr uint64_t kActivation = uint64_t(BTC::ALPHA_RANDOMX_ACTIVATION_HEIGHT);
+        static constexpr size_t kBaseSize = 80u, kFullSize = size_t(BTC::FIXED_HEADER_RECORD_SIZE);
+        static constexpr uint32_t kPaddedMagic = 0x00f026a1, kBaseMagic = 0x00f026a3, kRxMagic = 0x00f026a4;
+
+        std::unique_ptr<RecordFile> padded; ///< valid iff using the padded layout
+        std::unique_ptr<RecordFile> base, rx; ///< valid iff using the compact layout
+
+        static QByteArray Pad(QByteArray rec) {
+            if (rec.size() == QByteArray::size_type(kBaseSize))
+                rec.append(QByteArray::size_type(kFullSize - kBaseSize), '\0');
+            return rec;
+        }
+
+    public:
+        /// May throw RecordFile::FileError
+        HeaderStore(const QString &datadir, bool compactIfNew) {
+            const QString paddedPath = datadir + QDir::separator() + "headers",
+                          basePath = datadir + QDir::separator() + "headers_base",
+                          rxPath = datadir + QDir::separator() + "headers_rx";
+            const bool havePadded = QFile::exists(paddedPath), haveCompact = QFile::exists(basePath);
+            if (havePadded && haveCompact)
+                throw DatabaseFormatError("Both the padded and the compact header files exist in the datadir. The datadir"
+                                          " is likely corrupted. Delete the datadir and resynch.");
+            const bool compact = haveCompact || (!havePadded && compactIfNew);
+            if (compact != compactIfNew)
+                Warning() << "db_compact_headers is " << (compactIfNew ? "true" : "false") << ", but this datadir uses the "
+                          << (compact ? "compact" : "padded") << " header layout; keeping the datadir's layout";
+            if (compact) {
+                base = std::make_unique<RecordFile>(basePath, kBaseSize, kBaseMagic);
+                rx = std::make_unique<RecordFile>(rxPath, kFullSize, kRxMagic);
+                if (rx->numRecords() && base->numRecords() != kActivation)
+                    throw DatabaseFormatError(QString("headers_rx has records but headers_base has %1 (expected %2)")
+                                              .arg(base->numRecords()).arg(kActivation));
+            } else
+                padded = std::make_unique<RecordFile>(paddedPath, kFullSize, kPaddedMagic);
+        }
+
+        bool isCompact() const { return !padded; }
+        size_t recordSize() const { return kFullSize; }
+        /// Total size in bytes of the records on disk (excluding file headers)
+        uint64_t bytesOnDisk() const {
+            if (padded) return padded->numRecords() * kFullSize;
+            return base->numRecords() * kBaseSize + rx->numRecords() * kFullSize;
+        }
+
+        uint64_t numRecords() const {
+            if (padded) return padded->numRecords();
+            // rx is appended to only once base is full, and truncated before base, so this sum never over-reports
+            return base->numRecords() + rx->numRecords();
+        }
+
+        /// Thread-safe. Returns an empty QByteArray on error.
+        QByteArray readRecord(uint64_t height, QString *errStr = nullptr) const {
+            if (padded) return padded->readRecord(height, errStr);
+            if (height < kActivation) {
+                auto ret = base->readRecord(height, errStr);
+                return ret.isEmpty() ? ret : Pad(std::move(ret));
+            }
+            return rx->readRecord(height - kActivation, errStr);
+        }
+
+        /// Thread-safe. Like RecordFile::readRecords, may return fewer than `count` records on error or short read.
+        std::vector<QByteArray> readRecords(uint64_t start, size_t count, QString *errStr = nullptr) const {
+            if (padded) return padded->readRecords(start, count, errStr);
+            std::vector<QByteArray> ret;
+            if (start < kActivation) {
+                const size_t nBase = size_t(std::min<uint64_t>(count, kActivation - start));
+                ret = base->readRecords(start, nBase, errStr);
+                for (auto & rec : ret)
+                    rec = Pad(std::move(rec));
+                if (ret.size() != nBase || nBase == count)
+                    return ret;
+            }
+            const uint64_t rxStart = start + ret.size() - kActivation;
+            auto more = rx->readRecords(rxStart, count - ret.size(), errStr);
+            if (ret.empty())
+                return more;
+            ret.reserve(ret.size() + more.size());
+            std::move(more.begin(), more.end(), std::back_inserter(ret));
+            return ret;
+        }
+
+        /// Appends `rec`, which must be recordSize() bytes, at height numRecords(). Returns that height, or nullopt on
+        /// error.
+        std::optional<uint64_t> appendRecord(const QByteArray &rec, bool updateHeader = true, QString *errStr = nullptr) {
+            if (padded) return padded->appendRecord(rec, updateHeader, errStr);
+            if (const uint64_t height = base->numRecords(); height < kActivation) {
+                if (UNLIKELY(rec.size() != QByteArray::size_type(kFullSize)
+                             || std::any_of(rec.begin() + kBaseSize, rec.end(), [](char c){ return c != 0; }))) {
+                    if (errStr) *errStr = QString("header at height %1 is not an 80-byte header").arg(height);
+                    return std::nullopt;
+                }
+                return base->appendRecord(rec.left(int(kBaseSize)), updateHeader, errStr);
+            }
+            if (auto res = rx->appendRecord(rec, updateHeader, errStr))
+                return *res + kActivation;
+            return std::nullopt;
+        }
+
+        /// Deletes every record at height >= newNumRecords. Returns the new numRecords().
+        uint64_t truncate(uint64_t newNumRecords, QString *errStr = nullptr) {
+            if (padded) return padded->truncate(newNumRecords, errStr);
+            QString err;
+            rx->truncate(newNumRecords > kActivation ? newNumRecords - kActivation : 0u, &err);
+            if (err.isEmpty())
+                base->truncate(std::min(newNumRecords, kActivation), &err);
+            if (errStr) *errStr = err;
+            return numRecords();
+        }
+    };
+
+    /// TipHashForRecord() of the stored header at `height`: from its header_hashes entry, plus for a RandomX height
+    /// (whose hash covers all 112 bytes) its header record. Returns an empty QByteArray and sets *err on error.
+    QByteArray TipHashAtHeight(const HeaderStore &headers, const RecordFile &hashes, BlockHeight height, QString *err) {
+        const auto hash = hashes.readRecord(height, err);
+        if (UNLIKELY(hash.size() != HashLen)) return {};
+        QByteArray rec;
+        if (BTC::IsRandomXBlock(int(height)) && (rec = headers.readRecord(height, err)).size() != BTC::FIXED_HEADER_RECORD_SIZE)
+            return {};
+        return TipHashForRecord(height, rec, hash);
+    }
+
+    /// Time spent waiting to acquire `lock` ("reader" or "addblock"), exported via /metrics. Callers should cache the
+    /// returned reference in a static.
+    Metrics::Histogram & LockWaitMetric(const QString &lock) {
+        return Metrics::Registry::instance().histogram("fulcrum_lock_wait_seconds",
+                                                       "Time spent waiting to acquire Storage locks", {{"lock", lock}});
+    }
+
+    /// Time spent in each phase of Storage::addBlock(), exported via /metrics. Callers should cache the result.
+    Metrics::Histogram & AddBlockPhaseMetric(const QString &phase) {
+        return Metrics::Registry::instance().histogram("fulcrum_addblock_phase_seconds",
+                                                       "Time spent in each phase of adding a block to the db",
+                                                       {{"phase", phase}});
+    }
+
 } // namespace
 
 struct Storage::Pvt
@@ -1102,14 +1615,17 @@ struct Storage::Pvt
         const rocksdb::ReadOptions defReadOpts; ///< avoid creating this each time
         const rocksdb::WriteOptions defWriteOpts; ///< avoid creating this each time
 
-        rocksdb::Options opts, shistOpts, txhash2txnumOpts;
+        rocksdb::Options opts, shistOpts, txhash2txnumOpts, shbalanceOpts;
         std::weak_ptr<rocksdb::Cache> blockCache; ///< shared across all dbs, caps total block cache size across all db instances
+        std::list<std::pair<QString, std::weak_ptr<rocksdb::Cache>>> tableBlockCaches; ///< instead of the above, if db_block_cache_per_table
         std::weak_ptr<rocksdb::WriteBufferManager> writeBufferManager; ///< shared across all dbs, caps total memtable buffer size across all db instances
 
         std::shared_ptr<ConcatOperator> concatOperator, concatOperatorTxHash2TxNum;
+        std::shared_ptr<BalanceSumOperator> balanceSumOperator;
 
         std::unique_ptr<rocksdb::DB> meta, blkinfo, utxoset,
                                      shist, shunspent, // scripthash_history and scripthash_unspent
+                                     shbalance, // scripthash_balance: per-HashX BalanceAggregate, maintained alongside shunspent
                                      undo, // undo (reorg rewind)
                                      txhash2txnum, // new: index of txhash -> txNumsFile
                                      rpa; // new: height -> Rpa::PrefixTable
@@ -1126,15 +1642,122 @@ struct Storage::Pvt
     RocksDBs db;
 
     std::unique_ptr<RecordFile> txNumsFile;
-    std::unique_ptr<RecordFile> headersFile;
-
-    /// Big lock used for block/history updates. Public methods that read the history such as getHistory and listUnspent
-    /// take this as read-only (shared), and addBlock and undoLatestBlock take this as read/write (exclusively).
-    /// This is intended to be a coarse lock.  Currently the update code takes this along with headerVerifierLock and
-    /// blkInfoLock at the same time, so it's (as of now) equivalent to either of those two locks.
-    /// TODO: See about removing all the other locks and keeping one general RWLock for all updates?
+    std::unique_ptr<HeaderStore> headersFile;
+    /// Companion to headersFile: the HeaderHashForRecord() of every header, kept the same length as headersFile by
+    /// appendHeader() and deleteHeadersPastHeight(), so that hash consumers need not re-hash headers.
+    std::unique_ptr<RecordFile> headerHashesFile;
+
+    /// Big lock used for block/history updates. addBlock and undoLatestBlock take this as read/write (exclusively).
+    /// Some public read methods take this as read-only (shared), however the hot ones (getHistory, listUnspent,
+    /// getBalance, getRpaHistory) instead read against a pinned ReadView (see withReadView() below), and only fall
+    /// back to taking this lock if they repeatedly lose the race against block commits.
+    /// undoLatestBlock takes this along with headerVerifierLock, blkInfoLock and mempoolLock for its whole duration.
+    /// addBlock holds this and headerVerifierLock for its whole duration, but takes blkInfoLock and mempoolLock only
+    /// for the brief sections that mutate those structures.
     mutable RWLock blocksLock;
 
+    /// An immutable, consistent view of the confirmed state, published by the writer (with blocksLock held
+    /// exclusively) at the end of every addBlock/undoLatestBlock. The rocksdb snapshots keep the tables readable at
+    /// this view's height, while the writer concurrently commits the next block to the live tables.
+    struct ReadView {
+        using SnapPtr = std::shared_ptr<const rocksdb::Snapshot>;
+        uint64_t generation = 0; ///< compared against Pvt::readViewGen to see if this view is still the latest
+        std::optional<BlockHeight> height; ///< chain tip height as of this view
+        TxNum txNumNext = 0; ///< all TxNums referenced by the snapshots below are < this value
+        SnapPtr shistSnap, shunspentSnap, shbalanceSnap, rpaSnap;
+        rocksdb::ReadOptions shistOpts, shunspentOpts, shbalanceOpts, rpaOpts; ///< copies of defReadOpts + .snapshot
+    };
+    std::shared_ptr<const ReadView> readView; ///< guarded by readViewMut; replaced wholesale by publishReadView()
+    mutable std::mutex readViewMut; ///< only held long enough to copy or swap the above shared_ptr
+    std::atomic<uint64_t> readViewGen{0}; ///< generation of the latest published ReadView
+    /// Taken shared by ReadView readers, and exclusively by undoLatestBlock only: undo truncates the txNumsFile and
+    /// blkInfos, which a reader pinned to an older view may still be resolving TxNums against.
+    mutable RWLock reorgLock;
+
+    /// Instrumentation for reader lock waits (reorgLock, plus blocksLock on fallback), reported in stats()
+    struct ReaderLockStats {
+        std::atomic_uint64_t nReads{0u}, nRetries{0u}, nFallbacks{0u}, waitNanosTotal{0u}, waitNanosMax{0u};
+        void recordWait(uint64_t nanos) {
+            static Metrics::Histogram & metric = LockWaitMetric("reader");
+            metric.recordNanos(int64_t(nanos));
+            waitNanosTotal.fetch_add(nanos, std::memory_order_relaxed);
+            for (uint64_t cur = waitNanosMax.load(std::memory_order_relaxed);
+                 nanos > cur && !waitNanosMax.compare_exchange_weak(cur, nanos, std::memory_order_relaxed); ) {}
+        }
+    } mutable readerLockStats;
+
+    /// Called by the writer with blocksLock held exclusively, once all of its db writes are done. If the writer also
+    /// changed the mempool, it must hold the mempool lock exclusively too (see isCurrent()).
+    void publishReadView() {
+        auto v = std::make_shared<ReadView>();
+        const auto Snap = [](const std::unique_ptr<rocksdb::DB> &dbp) -> ReadView::SnapPtr {
+            if (!dbp) return {};
+            rocksdb::DB *d = dbp.get();
+            return ReadView::SnapPtr(d->GetSnapshot(), [d](const rocksdb::Snapshot *snap){ d->ReleaseSnapshot(snap); });
+        };
+        const auto Opts = [this](const ReadView::SnapPtr &snap) {
+            rocksdb::ReadOptions ret = db.defReadOpts;
+            ret.snapshot = snap.get();
+            return ret;
+        };
+        v->shistSnap = Snap(db.shist);
+        v->shunspentSnap = Snap(db.shunspent);
+        v->shbalanceSnap = Snap(db.shbalance);
+        v->rpaSnap = Snap(db.rpa);
+        v->shistOpts = Opts(v->shistSnap);
+        v->shunspentOpts = Opts(v->shunspentSnap);
+        v->shbalanceOpts = Opts(v->shbalanceSnap);
+        v->rpaOpts = Opts(v->rpaSnap);
+        if (!blkInfos.empty()) v->height = BlockHeight(blkInfos.size() - 1u); // only we mutate blkInfos, so no lock needed
+        v->txNumNext = txNumNext.load();
+        std::unique_lock g(readViewMut);
+        v->generation = readViewGen.load() + 1u;
+        readView = std::move(v);
+        readViewGen = readView->generation; // published last, so isCurrent() never sees a generation with no view
+    }
+    /// Drops the latest view (and with it, the snapshots it holds). Must be called before the db's are closed.
+    void clearReadView() {
+        std::unique_lock g(readViewMut);
+        readView.reset();
+        ++readViewGen;
+    }
+
+    std::shared_ptr<const ReadView> currentReadView() const {
+        std::unique_lock g(readViewMut);
+        return readView;
+    }
+    /// True if `v` is still the latest view. Readers call this with the mempool lock held: since addBlock removes
+    /// newly-confirmed txs from the mempool and publishes the new view under the same exclusive mempool lock, a
+    /// reader that sees `true` here knows its mempool read is consistent with its (snapshot) confirmed read.
+    bool isCurrent(const ReadView &v) const { return v.generation == readViewGen.load(); }
+
+    /// Number of times a reader re-runs against a newer view before giving up and taking blocksLock (shared)
+    static constexpr unsigned kReadViewMaxRetries = 2;
+
+    /// Runs `func(const ReadView &)` against the latest view, without taking blocksLock. `func` should return false
+    /// if, once it holds the mempool lock, isCurrent() says the view went stale, in which case it is re-run against the
+    /// newer view. After kReadViewMaxRetries such retries, it is run one final time with blocksLock held (shared),
+    /// which guarantees the view stays current. May throw whatever `func` throws.
+    template <typename Func>
+    void withReadView(Func && func) const {
+        for (unsigned attempt = 0; ; ++attempt) {
+            const bool lastAttempt = attempt >= kReadViewMaxRetries;
+            const auto t0 = Util::getTimeNS();
+            SharedLockGuard rg(reorgLock); // only contended while undoLatestBlock runs
+            SharedLockGuard bg;
+            if (lastAttempt) {
+                bg = SharedLockGuard(blocksLock); // exclude the writer so that the view below stays current
+                readerLockStats.nFallbacks.fetch_add(1u, std::memory_order_relaxed);
+            }
+            readerLockStats.recordWait(uint64_t(Util::getTimeNS() - t0));
+            readerLockStats.nReads.fetch_add(1u, std::memory_order_relaxed);
+            const auto view = currentReadView();
+            if (UNLIKELY(!view)) throw InternalError("No ReadView has been published yet");
+            if (func(*view) || lastAttempt) return;
+            readerLockStats.nRetries.fetch_add(1u, std::memory_order_relaxed);
+        }
+    }
+
     BTC::HeaderVerifier headerVerifier;
     mutable RWLock headerVerifierLock;
 
@@ -1144,6 +1767,26 @@ struct Storage::Pvt
     std::map<TxNum, unsigned> blkInfosByTxNum; ///< ordered map of TxNum0 for a block -> index into above blkInfo array
     RWLock blkInfoLock; ///< locks blkInfos and blkInfosByTxNum
 
+    QVariantMap startupPhaseTimings; ///< phase name -> msec. Written once by startup(), read-only thereafter (see stats())
+    /// Lives from beginStartup() until completeStartup(): the timings of the startup phases, and the task running the
+    /// slow checks if they run in the background.
+    struct StartupState {
+        const Tic tAll;
+        std::mutex mut;
+        std::vector<std::pair<QString, qint64>> timings; ///< guarded by mut
+        std::unique_ptr<CoTask> slowChecksTask;
+        CoTask::Future slowChecksFut;
+
+        void timed(const QString &phase, const std::function<void()> &func) {
+            const Tic t0;
+            func();
+            std::unique_lock g(mut);
+            timings.emplace_back(phase, t0.msec());
+        }
+    };
+    std::unique_ptr<StartupState> startupState;
+    std::atomic_bool startupCompleted = false; ///< latched to true at the end of a successful startup(); gates saveBlkInfoSnapshot()
+
     std::atomic<int64_t> utxoCt = 0;
 
     static constexpr uint32_t InvalidUndoHeight = std::numeric_limits<uint32_t>::max();
@@ -1182,14 +1825,16 @@ struct Storage::Pvt
     std::unique_ptr<Merkle::Cache> merkleCache;
 
     HeaderHash genesisHash; // written-to once by either loadHeaders code or addBlock for block 0. Guarded by headerVerifierLock.
+    HeaderHash tipHash; // TipHashForRecord() of the latest header, as returned by latestTip(). Guarded by headerVerifierLock.
+    int tipHashHeight = -1; // the height tipHash is for. Guarded by headerVerifierLock.
 
     Mempool mempool; ///< app-wide mempool data -- does not get saved to db. Controller.cpp writes to this
-    Mempool::FeeHistogramVec mempoolFeeHistogram; ///< refreshed periodically by refreshMempoolHistogram()
     RWLock mempoolLock;
 
     Tic lastWarned; ///< to rate-limit potentially spammy warning messages (guarded by blocksLock)
 
     std::unique_ptr<CoTask> blocksWorker; ///< work to be done in parallel can be submitted to this co-task in addBlock and undoLatestBlock
+    std::vector<std::unique_ptr<CoTask>> undoWorkers; ///< created as needed by undoLatestBlock to split up the history truncation for large blocks (guarded by blocksLock)
 
     /// Info specific to the `rpa` index
     struct RpaInfo {
@@ -1258,12 +1903,14 @@ class Storage::UTXOCache
         size_t operator()(const NodeList::const_iterator &it) const noexcept { return std::hash<TXO>{}(it->first); }
     };
     using ItSet = robin_hood::unordered_flat_set<NodeList::const_iterator, ItSetHasher>;
-    using RmVec = std::vector<TXO>;
+    /// A set rather than a vector so that readers can tell a TXO that was spent but not yet deleted from the DB (see
+    /// peek()) from one that is still unspent there.
+    using RmSet = robin_hood::unordered_flat_set<TXO, TableHasherAndEq, TableHasherAndEq>;
 
     NodeList ordering;
     Table utxos; //< points to Nodes in `ordering`
     ItSet adds; ///< entries in above NodeList that are new and are not in the DB yet
-    RmVec rms; ///< queued deletions, not yet deleted from DB
+    RmSet rms; ///< queued deletions, not yet deleted from DB
 
     static_assert (std::is_same_v<decltype(std::declval<TXO>().txHash), QByteArray>
                    && std::is_same_v<decltype(std::declval<TXOInfo>().hashX), QByteArray>,
@@ -1272,7 +1919,7 @@ class Storage::UTXOCache
                                         + (HashLen + Util::qByteArrayPvtDataSize()) * size_t{2U} // account for txHash and hashX
                                         + sizeof(void *) * size_t{2U} /* account for list node next/prev ptrs */;
     static constexpr size_t ItSetItemSize = sizeof(ItSet::value_type);
-    static constexpr size_t RmVecItemSize = sizeof(RmVec::value_type) + HashLen + Util::qByteArrayPvtDataSize();
+    static constexpr size_t RmSetItemSize = sizeof(RmSet::value_type) + HashLen + Util::qByteArrayPvtDataSize();
 
     using ShunspentKey = QByteArray;
     using ShunspentValue = QByteArray;
@@ -1285,6 +1932,10 @@ class Storage::UTXOCache
     ShunspentTable shunspentAdds; ///< queued additions, not yet added to DB
     ShunspentRmVec shunspentRms; ///< queued deletions, not yet deleted from DB
 
+    BalanceDeltas balanceDeltas; ///< queued scripthash_balance changes, not yet written to DB (always written in full on flush)
+    static constexpr size_t BalanceDeltaNodeSize = sizeof(BalanceDeltas::value_type) + HashLen + Util::qByteArrayPvtDataSize()
+                                                   + sizeof(void *) * size_t{2U} /* node next ptr + bucket */;
+
     static constexpr size_t ShunspentTableNodeSize = sizeof(ShunspentTable::value_type) + HashLen + CompactTXO::minSize()
                                                      + Util::qByteArrayPvtDataSize()*size_t{2u} + sizeof(int64_t); // not guaranteed accurate: doesn't take possible tokenData serialization into account
     static constexpr size_t ShunspentRmVecNodeSize = sizeof(ShunspentRmVec::value_type) + HashLen + CompactTXO::minSize()
@@ -1292,7 +1943,7 @@ class Storage::UTXOCache
 
     static constexpr size_t memUsageForSizes(size_t utxosSize, size_t addsSize, size_t rmsSize,
                                              size_t shunspentAddsSize,size_t  shunspentRmsSize) noexcept {
-        return utxosSize * EntrySize + addsSize * ItSetItemSize + rmsSize * RmVecItemSize
+        return utxosSize * EntrySize + addsSize * ItSetItemSize + rmsSize * RmSetItemSize
                 + shunspentAddsSize * ShunspentTableNodeSize + shunspentRmsSize * ShunspentRmVecNodeSize;
     }
 
@@ -1310,9 +1961,12 @@ class Storage::UTXOCache
             prefetcherFut.future.wait();
         }
         const size_t us = utxos.size(), as = adds.size(), rs = rms.size(), sas = shunspentAdds.size(), srs = shunspentRms.size();
-        if (memUsageForSizes(us, as, rs, sas, srs) < memUsageTarget)
+        if (memUsageForSizes(us, as, rs, sas, srs) + balanceDeltas.size() * BalanceDeltaNodeSize < memUsageTarget)
              return;  // nothing to do!
         Log() << name <<  ": Flushing to DB ...";
+        // The balance deltas are small and cheap to write (mostly merges), so they always go out in full, with
+        // whatever utxo changes are flushed below.
+        do_balance_flush();
         if (as + rs == 0u || (memUsageTarget && memUsageForSizes(us, as, rs, 0, 0) <= memUsageTarget)) {
             // flush to the shunspents since we prefer to evict those over the utxos
             const bool doAdds = !memUsageTarget || memUsageForSizes(us, as, rs, sas, 0) > memUsageTarget; // we prefer rms over adds
@@ -1384,15 +2038,14 @@ class Storage::UTXOCache
             static const QString errMsgBatchWrite("Error issuing batch write to utxoset db for a utxo update");
             if (!db) throw InternalError("utxoset db is nullptr! FIXME!");
             size_t batchCount = 0u;
-            // rms first (loop in reverse to shrink vector as we loop)
-            for (size_t i = rms.size(); i-- > 0u; /**/) {
+            // rms first (erasing as we go)
+            for (auto it = rms.begin(); it != rms.end(); /**/) {
                 if (memUsageTarget && threadSafeMemUsage() <= memUsageTarget)
                     break; // abort loop early
                 // enqueue delete from utxoset db -- may throw.
                 static const QString errMsgPrefix("Failed to issue a batch delete for a utxo");
-                const auto & txo = rms[i];
-                GenericBatchDelete(batch, txo, errMsgPrefix); // may throw on failure
-                rms.resize(i);
+                GenericBatchDelete(batch, *it, errMsgPrefix); // may throw on failure
+                it = rms.erase(it);
                 --rmsSize;
                 ++rmCt;
                 if (++batchCount >= batchSize)
@@ -1452,6 +2105,17 @@ class Storage::UTXOCache
             DebugM(__func__, ": added ", addCt, " and deleted ", rmCt, Util::Pluralize(" utxo", addCt + rmCt),
                    " in ", t0.msecStr(3), " msec");
     }
+    void do_balance_flush() {
+        if (balanceDeltas.empty()) return;
+        const Tic t0;
+        if (!shbalancedb) throw InternalError("scripthash_balance db is nullptr! FIXME!");
+        // the caller (Storage::addBlock or setInitialSync) holds the blocksLock exclusively
+        WriteBalanceDeltas(shbalancedb.get(), balanceDeltas, readOpts, writeOpts, batchSize); // may throw
+        const size_t ct = balanceDeltas.size();
+        balanceDeltas.clear();
+        if (t0.msec<int>() >= 50)
+            DebugM(__func__, ": wrote ", ct, Util::Pluralize(" balance update", ct), " in ", t0.msecStr(3), " msec");
+    }
     template <typename Func>
     void do_shunspent_flush(bool doAdds, const size_t memUsageTarget, const Func &getMemUsage,
                             std::atomic_size_t * shunspentRmsSize = nullptr,
@@ -1643,7 +2307,7 @@ class Storage::UTXOCache
             ordering.erase(oit);
             ret = true;
         }
-        if (!wasInAdds) rms.push_back(txo);
+        if (!wasInAdds) rms.insert(txo);
         return ret;
     }
 
@@ -1669,7 +2333,7 @@ class Storage::UTXOCache
     CoTask prefetcher, flusherShunspent;
     CoTask::Future prefetcherFut, flusherShunspentFut;
 
-    const std::unique_ptr<rocksdb::DB> & db, & shunspentdb;
+    const std::unique_ptr<rocksdb::DB> & db, & shunspentdb, & shbalancedb;
     const rocksdb::ReadOptions & readOpts;
     const rocksdb::WriteOptions & writeOpts;
 
@@ -1744,10 +2408,10 @@ class Storage::UTXOCache
 
 public:
     UTXOCache(const QString &name, const std::unique_ptr<rocksdb::DB> & pdb,
-              const std::unique_ptr<rocksdb::DB> & pshunspentdb, const rocksdb::ReadOptions & readOpts,
-              const rocksdb::WriteOptions & writeOpts)
+              const std::unique_ptr<rocksdb::DB> & pshunspentdb, const std::unique_ptr<rocksdb::DB> & pshbalancedb,
+              const rocksdb::ReadOptions & readOpts, const rocksdb::WriteOptions & writeOpts)
         : name{name}, prefetcher{name + ".Prefetcher"}, flusherShunspent{name + ".ShunspentFlusher"},
-          db{pdb}, shunspentdb{pshunspentdb}, readOpts{readOpts}, writeOpts{writeOpts} {
+          db{pdb}, shunspentdb{pshunspentdb}, shbalancedb{pshbalancedb}, readOpts{readOpts}, writeOpts{writeOpts} {
         DebugM(name, ": created");
     }
 
@@ -1776,14 +2440,16 @@ public:
     void shrink_to_fit() {
         utxos.rehash(0);
         adds.rehash(0);
-        rms.shrink_to_fit();
+        rms.rehash(0);
         shunspentAdds.rehash(0);
         shunspentRms.shrink_to_fit();
+        balanceDeltas.rehash(0);
     }
 
     /// Returns the estimated dynamic memory usage, in bytes
     size_t memUsage() const {
-        return memUsageForSizes(utxos.size(), adds.size(), rms.size(), shunspentAdds.size(), shunspentRms.size());
+        return memUsageForSizes(utxos.size(), adds.size(), rms.size(), shunspentAdds.size(), shunspentRms.size())
+                + balanceDeltas.size() * BalanceDeltaNodeSize;
     }
 
     /// NB: no locks on ppb are used for now. While this is alive ppb->inputs must not be mutated
@@ -1803,6 +2469,26 @@ public:
 
     size_t cacheMisses = 0, cacheHits = 0, utxoDbOpsSaved = 0, shunspentDbOpsSaved = 0;
 
+    /// What peek() knows about a TXO
+    struct Peek {
+        enum Status : uint8_t {
+            Unknown, ///< not in the cache (or the prefetcher is active): the DB has the answer
+            Found, ///< unspent, and `info` is valid
+            Spent, ///< spent, but its deletion from the DB is still queued here: its DB row (if any) is stale
+        };
+        Status status = Unknown;
+        std::optional<TXOInfo> info;
+    };
+
+    /// Like get() below, but touches no counters and only looks at `utxos` while the prefetcher is inactive, so that
+    /// it is safe to call from any thread that holds the blocks lock (shared). Used by Storage::utxoGetManyFromDB().
+    Peek peek(const TXO & txo) const {
+        if (rms.contains(txo)) return {Peek::Spent, std::nullopt}; // the prefetcher never touches `rms`
+        if (prefetcherFut.future.valid()) return {};
+        if (auto info = get_from_cache(txo)) return {Peek::Found, std::move(info)};
+        return {};
+    }
+
     /// Get a UTXO from the cache. Will return a null optional if the requested TXO was not in the cache.
     /// Does not fall-back to looking in the DB. Caller should explicitly call utxoGetFromDB() themselves
     /// for that purpose. Note: this currently takes no locks. Assumption is calling code is locking
@@ -1833,6 +2519,11 @@ public:
     bool remove(const TXO & txo) { return rm(txo); }
 
     void putShunspent(const ShunspentKey &key, const ShunspentValue &val) { addShunspent(key, val); }
+    /// Accumulates a block's balance changes; they are written to the scripthash_balance db on the next flush.
+    void putBalanceDeltas(const BalanceDeltas &deltas) {
+        for (const auto & [hashX, delta] : deltas)
+            balanceDeltas[hashX] += delta;
+    }
     bool removeShunspent(const HashX & hashX, const CompactTXO & ctxo) { return rmShunspent(mkShunspentKey(hashX, ctxo)); }
 
     void flush() { do_flush(); }
@@ -1884,6 +2575,14 @@ QString Storage::rocksdbVersion()
 }
 
 void Storage::startup()
+{
+    beginStartup({});
+    completeStartup();
+}
+
+bool Storage::isStartupComplete() const { return p->startupCompleted; }
+
+void Storage::beginStartup(const std::function<void()> &slowChecksDone)
 {
     Log() << "Loading database ...";
 
@@ -1904,23 +2603,38 @@ void Storage::startup()
         p->db.utxoCache.reset(); // this should already be nullptr, but this reset() is just here to be defensive.
 
         // Optimize RocksDB. This is the easiest way to get RocksDB to perform well
-        rocksdb::Options & opts(p->db.opts), &shistOpts(p->db.shistOpts), &txhash2txnumOpts(p->db.txhash2txnumOpts);
+        rocksdb::Options & opts(p->db.opts), &shistOpts(p->db.shistOpts), &txhash2txnumOpts(p->db.txhash2txnumOpts),
+                           &shbalanceOpts(p->db.shbalanceOpts);
         opts.IncreaseParallelism(int(Util::getNPhysicalProcessors()));
         opts.OptimizeLevelStyleCompaction();
+        // IncreaseParallelism() gave the Env 1 compaction (LOW) thread per core but exactly 1 flush (HIGH) thread; the
+        // user may size these thread pools explicitly instead
+        if (const unsigned nFlush = options->db.flushThreads, nCompact = options->db.compactionThreads; nFlush || nCompact) {
+            rocksdb::Env * const env = opts.env;
+            if (nFlush) env->SetBackgroundThreads(int(nFlush), rocksdb::Env::Priority::HIGH);
+            if (nCompact) env->SetBackgroundThreads(int(nCompact), rocksdb::Env::Priority::LOW);
+            opts.max_background_jobs = env->GetBackgroundThreads(rocksdb::Env::Priority::HIGH)
+                                       + env->GetBackgroundThreads(rocksdb::Env::Priority::LOW);
+        }
 
-        // setup shared block cache
-        rocksdb::BlockBasedTableOptions tableOptions;
-        tableOptions.block_cache = rocksdb::NewLRUCache(options->db.maxMem /* capacity limit */, -1, false /* strict capacity limit=off, turning it on made db writes sometimes fail */);
+        // setup shared block cache, unless each db gets its own (in which case those are set up in OpenDB below)
+        const bool perTableCache = options->db.blockCachePerTable;
+        rocksdb::BlockBasedTableOptions tableOptions = MakeTableOptions(options->db, perTableCache ? nullptr
+                                                                        : MakeBlockCache(options->db, options->db.maxMem /* capacity limit */,
+                                                                                         MakeSecondaryCache(options->db.secondaryCacheMem)));
         p->db.blockCache = tableOptions.block_cache; // save shared_ptr to weak_ptr
-        tableOptions.cache_index_and_filter_blocks = true; // from the docs: this may be a large consumer of memory, cost & cap its memory usage to the cache
         std::shared_ptr<rocksdb::TableFactory> tableFactory{rocksdb::NewBlockBasedTableFactory(tableOptions)};
         // shared TableFactory for all db instances
         opts.table_factory = tableFactory;
 
         // setup shared write buffer manager (for memtables memory budgeting)
-        // - TODO cost this to the cache here? Or not? make sure both together don't exceed db.maxMem?!
         // - TODO right now we fix the cap of the write buffer manager's buffer size at db.maxMem / 2; tweak this.
-        auto writeBufferManager = std::make_shared<rocksdb::WriteBufferManager>(options->db.maxMem / 2, tableOptions.block_cache /* cost to block cache: hopefully this caps memory better? it appears to use locks though so many this will be slow?! TODO: experiment with and without this!! */);
+        // - its memory is costed to the shared block cache, so that memtables + cached blocks stay within db.maxMem.
+        // - with db_block_cache_per_table there is no shared cache to cost to (block_cache is null), so instead the
+        //   per-table caches split the remaining db.maxMem - writeBufferMem between them (see OpenDB below), for the
+        //   same bound.
+        const size_t writeBufferMem = options->db.maxMem / 2;
+        auto writeBufferManager = std::make_shared<rocksdb::WriteBufferManager>(writeBufferMem, tableOptions.block_cache /* cost to block cache: hopefully this caps memory better? it appears to use locks though so many this will be slow?! TODO: experiment with and without this!! */);
         p->db.writeBufferManager = writeBufferManager; // save shared_ptr to weak_ptr
         opts.write_buffer_manager = writeBufferManager; // will be shared across all DB instances
 
@@ -1938,26 +2652,43 @@ void Storage::startup()
         txhash2txnumOpts = opts;
         txhash2txnumOpts.merge_operator = p->db.concatOperatorTxHash2TxNum = std::make_shared<ConcatOperator>();
 
+        shbalanceOpts = opts;
+        shbalanceOpts.merge_operator = p->db.balanceSumOperator = std::make_shared<BalanceSumOperator>(); // sums BalanceAggregate deltas
+
 
         using DBInfoTup = std::tuple<QString, std::unique_ptr<rocksdb::DB> &, const rocksdb::Options &, double>;
         const std::list<DBInfoTup> dbs2open = {
             { "meta", p->db.meta, opts, 0.0005 },
             { "blkinfo" , p->db.blkinfo , opts, 0.02 },
             { "utxoset", p->db.utxoset, opts, 0.25 },
-            { "scripthash_history", p->db.shist, shistOpts, 0.30 },
+            { "scripthash_history", p->db.shist, shistOpts, 0.28 },
             { "scripthash_unspent", p->db.shunspent, opts, 0.25 },
+            { "scripthash_balance", p->db.shbalance, shbalanceOpts, 0.02 }, // small: 1 fixed-size record per funded HashX
             { "undo", p->db.undo, opts, 0.0395 },
             { "txhash2txnum", p->db.txhash2txnum, txhash2txnumOpts, 0.1 },
             // Future work: if on BTC or rpa disabled, give the rpa db's 0.04 back to scripthash_unspent and utxoset!!
             { "rpa", p->db.rpa, opts, 0.04 }, // this index appears to be < 1/2 the txhash2txnum one on average, so we give it less than half that mem ratio
         };
         std::size_t memTotal = 0;
-        const auto OpenDB = [this, &memTotal](const DBInfoTup &tup) {
+        const auto OpenDB = [this, &memTotal, &tableOptions, perTableCache, writeBufferMem](const DBInfoTup &tup) {
             auto & [name, uptr, opts_in, memFactor] = tup;
             rocksdb::Options opts = opts_in;
             const size_t mem = std::max(size_t(options->db.maxMem * memFactor), size_t(64*1024));
             Debug() << "DB \"" << name << "\" mem: " << QString::number(mem / 1024. / 1024., 'f', 2) << " MiB";
             opts.OptimizeLevelStyleCompaction(mem);
+            if (perTableCache) {
+                // this db's block cache (and its secondary cache) get its share of the memory budget not set aside for
+                // the (uncosted) memtables
+                const size_t cacheMem = std::max(size_t((options->db.maxMem - writeBufferMem) * memFactor), size_t(64*1024));
+                auto tOpts = tableOptions;
+                tOpts.block_cache = MakeBlockCache(options->db, cacheMem, MakeSecondaryCache(size_t(options->db.secondaryCacheMem * memFactor)));
+                p->db.tableBlockCaches.emplace_back(name, tOpts.block_cache);
+                opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(tOpts));
+            }
+            // Always on, for the block cache hit ratios in stats(). Tickers only: they are cheap per-core counters,
+            // whereas histograms and timers are too costly
+            opts.statistics = rocksdb::CreateDBStatistics();
+            opts.statistics->set_stats_level(rocksdb::StatsLevel::kExceptHistogramOrTimers);
             for (auto & comp : opts.compression_per_level)
                 comp = rocksdb::CompressionType::kNoCompression; // paranoia -- enforce no compression since our data compresses so poorly
             memTotal += mem;
@@ -1983,6 +2714,18 @@ void Storage::startup()
             OpenDB(tup);
 
         Log() << "DB memory: " << QString::number(memTotal / 1024. / 1024., 'f', 2) << " MiB";
+        if (options->db.blockCachePerTable || options->db.pinIndexFilter || options->db.secondaryCacheMem
+                || options->db.blockCacheType != Options::DBOpts::defaultBlockCacheType)
+            Log() << "DB block cache: " << options->db.blockCacheTypeString() << (perTableCache ? ", per table" : ", shared")
+                  << (options->db.pinIndexFilter ? ", index & filter blocks pinned" : "")
+                  << (options->db.secondaryCacheMem
+                      ? QString(", secondary cache: %1 MiB").arg(options->db.secondaryCacheMem / 1024. / 1024., 0, 'f', 2)
+                      : QString());
+
+        // the Env's background threads now all exist; they are named "rocksdb:low", "rocksdb:high", etc.
+        const unsigned nBgThreads = ThreadTopology::placeThreadsByName(ThreadTopology::Group::DB, "rocksdb:");
+        if (const auto cpus = ThreadTopology::groupCpus(ThreadTopology::Group::DB); !cpus.empty())
+            Log() << "DB background threads: pinned " << nBgThreads << " to CPUs " << ThreadTopology::toCpuList(cpus);
     }  // /open db's
 
     // load/check meta
@@ -2015,20 +2758,83 @@ void Storage::startup()
         }
     }
 
-    // load headers -- may throw.. this must come first
-    loadCheckHeadersInDB();
-    // check txnums
-    loadCheckTxNumsFileAndBlkInfo();
-    // construct the TxHash2TxNum manager -- depends on the above function having constructed the txNumFile
-    loadCheckTxHash2TxNumMgr();
-    // count utxos -- note this depends on "blkInfos" being filled in so it much be called after loadCheckTxNumsFileAndBlkInfo()
-    loadCheckUTXOsInDB();
-    // very slow check, only runs if -C -C (specified twice)
-    loadCheckShunspentInDB();
-    // load check earliest undo to populate earliestUndoHeight
-    loadCheckEarliestUndo();
-    // load rpa data
-    if (isRpaEnabled()) loadCheckRpaDB();
+    // Load & check the various tables. Checks that do not depend on one another run concurrently on short-lived
+    // CoTask threads. Only the header *count* is needed up-front (to size the blkinfo load), so header verification
+    // (which hashes every header and builds the merkle cache) proceeds in parallel with the txnum/blkinfo load.
+    auto & st = *(p->startupState = std::make_unique<Pvt::StartupState>());
+
+    // open headers file -- may throw.. this must come first
+    openHeadersFile();
+
+    // Phase 1: headers, undo, and (in this thread) txnums + blkinfo followed by the txhash2txnum index which
+    // depends on the txNumsFile having been opened
+    {
+        CoTask headersTask("Startup: Headers"), undoTask("Startup: Undo");
+        auto headersFut = headersTask.submitWork([&]{ st.timed("headers", [this]{ loadCheckHeadersInDB(); }); });
+        auto undoFut = undoTask.submitWork([&]{ st.timed("undo", [this]{ loadCheckEarliestUndo(); }); });
+        st.timed("blkinfo", [this]{ loadCheckTxNumsFileAndBlkInfo(); });
+        st.timed("txhash2txnum", [this]{ loadCheckTxHash2TxNumMgr(); });
+        headersFut.future.get(); // rethrows if the task threw
+        undoFut.future.get();
+    }
+    Log() << "Headers loaded in " << st.tAll.secsStr() << " sec";
+
+    // Phase 2: the slow checks, here or in the background (in which case the caller may serve header queries
+    // meanwhile -- nothing else touches the db until completeStartup()).
+    if (!slowChecksDone)
+        runSlowStartupChecks();
+    else {
+        st.slowChecksTask = std::make_unique<CoTask>("Startup: Checks");
+        st.slowChecksFut = st.slowChecksTask->submitWork([this, slowChecksDone]{
+            Defer notify(slowChecksDone); // called even if we throw; completeStartup() will rethrow
+            runSlowStartupChecks();
+        });
+        Log() << "Checking the rest of the database in the background ...";
+    }
+}
+
+void Storage::runSlowStartupChecks()
+{
+    // These need both the verified headers (latestTip) and blkInfos. The two utxo checks are only slow if -C was
+    // specified (or, once, for the scripthash_balance build); they and the RPA load don't write any table another one
+    // reads, so they may run concurrently.
+    auto & st = *p->startupState;
+    CoTask shunspentTask("Startup: Shunspent");
+    std::optional<CoTask> rpaTask;
+    auto shunspentFut = shunspentTask.submitWork([&]{ st.timed("scripthash_unspent", [this]{ loadCheckShunspentInDB(); }); });
+    CoTask::Future rpaFut;
+    if (isRpaEnabled())
+        rpaFut = rpaTask.emplace("Startup: RPA").submitWork([&]{ st.timed("rpa", [this]{ loadCheckRpaDB(); }); });
+    st.timed("utxoset", [this]{ loadCheckUTXOsInDB(); });
+    // Reads shunspent, as does the task above. It may also (re)build scripthash_balance and set its flag in meta, which
+    // nothing else touches here; the RPA task writes only the rpa db and its own meta key. See loadCheckBalanceDB().
+    st.timed("scripthash_balance", [this]{ loadCheckBalanceDB(); });
+    shunspentFut.future.get();
+    if (rpaFut.future.valid()) rpaFut.future.get();
+}
+
+void Storage::completeStartup()
+{
+    if (UNLIKELY(!p->startupState))
+        throw InternalError("completeStartup() called without a preceding beginStartup() -- FIXME!");
+    {
+        auto & st = *p->startupState;
+        if (st.slowChecksFut.future.valid())
+            st.slowChecksFut.future.get(); // waits; rethrows if the checks threw
+        st.slowChecksTask.reset();
+
+        QStringList parts;
+        QVariantMap m;
+        for (const auto & [phase, msec] : st.timings) {
+            parts.append(QString("%1: %2").arg(phase).arg(msec));
+            m[phase] = msec;
+        }
+        m["total"] = st.tAll.msec();
+        p->startupPhaseTimings = m;
+        Log() << "Database loaded in " << st.tAll.secsStr() << " sec (phase timings in msec: " << parts.join(", ") << ")";
+    }
+    p->startupState.reset();
+
     // if user specified --compact-dbs on CLI, run the compaction now before returning
     compactAllDBs();
 
@@ -2038,6 +2844,10 @@ void Storage::startup()
     // Detect old DB version and see if upgrade is permitted, and maybe do a DB upgrade...
     checkUpgradeDBVersion();
 
+    p->publishReadView(); // readers (getHistory, listUnspent, etc) need a view to read against
+
+    p->startupCompleted = true;
+
     start(); // starts our thread
 }
 
@@ -2123,6 +2933,7 @@ void Storage::compactAllDBs()
 void Storage::gentlyCloseAllDBs()
 {
     p->db.utxoCache.reset(); // if was valid, implicitly flushes UTXO Cache pending writes to DB...
+    p->clearReadView(); // release the snapshots it holds; they must not outlive the db's
 
     // do FlushWAL() and Close() to gently close the dbs
     for (auto & [db] : p->db.openDBs) {
@@ -2148,11 +2959,28 @@ void Storage::gentlyCloseAllDBs()
 
 void Storage::cleanup()
 {
+    if (p->startupState && p->startupState->slowChecksTask) {
+        // we are shutting down before the background startup checks finished; they read the dbs, so wait for them
+        Log() << "Waiting for the startup checks to finish ...";
+        try {
+            if (auto & fut = p->startupState->slowChecksFut.future; fut.valid()) fut.get();
+        } catch (const std::exception &e) {
+            DebugM("Startup checks: ", e.what());
+        }
+    }
+    p->startupState.reset();
     stop(); // joins our thread
     if (p->blocksWorker) p->blocksWorker.reset(); // stop the co-task
+    p->undoWorkers.clear(); // stop these co-tasks too
     if (txsubsmgr) txsubsmgr->cleanup();
     if (dspsubsmgr) dspsubsmgr->cleanup();
     if (subsmgr) subsmgr->cleanup();
+    try {
+        saveBlkInfoSnapshot();
+    } catch (const std::exception &e) {
+        Warning() << "Failed to save blkinfo snapshot: " << e.what();
+    }
+    p->startupCompleted = false; // cleanup() may be called more than once; only save once
     gentlyCloseAllDBs();
     // TODO: unsaved/"dirty state" detection here -- and forced save, if needed.
 }
@@ -2165,6 +2993,7 @@ auto Storage::stats() const -> Stats
     auto & c = p->db.concatOperator, & c2 = p->db.concatOperatorTxHash2TxNum;
     ret["merge calls"] = c ? static_cast<quint64>(c->merges.load()) : QVariant();
     ret["merge calls (txhash2txnum)"] = c2 ? static_cast<quint64>(c2->merges.load()) : QVariant();
+    ret["merge calls (scripthash_balance)"] = p->db.balanceSumOperator ? static_cast<quint64>(p->db.balanceSumOperator->merges.load()) : QVariant();
     QVariantMap caches;
     {
         QVariantMap m;
@@ -2193,11 +3022,40 @@ auto Storage::stats() const -> Stats
         caches["merkleHeaders_Size"] = qulonglong(nHashes);
         caches["merkleHeaders_SizeBytes"] = qulonglong(bytes);
     }
+    if (p->db.txhash2txnumMgr) {
+        SharedLockGuard g(p->blocksLock); // the index is mutated by addBlock/undo with this lock held exclusively
+        if (const auto *idx = p->db.txhash2txnumMgr->getMemIndex()) {
+            QVariantMap m;
+            m["Size bytes"] = qulonglong(idx->memoryUsage());
+            m["nItems"] = qulonglong(idx->nextTxNum());
+            m["nRuns"] = qulonglong(idx->numRuns());
+            caches["TxHash Memory Index"] = m;
+        }
+    }
     ret["caches"] = caches;
+    ret["startup phase timings (msec)"] = p->startupPhaseTimings;
+    {
+        // read-path stats: how long readers (getHistory, listUnspent, getBalance, getRpaHistory) waited on locks
+        QVariantMap m;
+        const auto & st = p->readerLockStats;
+        const auto nReads = st.nReads.load(std::memory_order_relaxed);
+        const auto waitNanos = st.waitNanosTotal.load(std::memory_order_relaxed);
+        m["nReads"] = qulonglong(nReads);
+        m["nRetries"] = qulonglong(st.nRetries.load(std::memory_order_relaxed));
+        m["nFallbacksToBlocksLock"] = qulonglong(st.nFallbacks.load(std::memory_order_relaxed));
+        m["lockWaitTotal (msec)"] = double(waitNanos) / 1e6;
+        m["lockWaitAvg (msec)"] = nReads ? double(waitNanos) / double(nReads) / 1e6 : 0.;
+        m["lockWaitMax (msec)"] = double(st.waitNanosMax.load(std::memory_order_relaxed)) / 1e6;
+        if (const auto view = p->currentReadView()) {
+            m["viewGeneration"] = qulonglong(view->generation);
+            m["viewHeight"] = view->height ? QVariant(qlonglong(*view->height)) : QVariant();
+        }
+        ret["Reader Lock Waits"] = m;
+    }
     {
         // db stats
         QVariantMap m;
-        for (const auto ptr : { &p->db.blkinfo, &p->db.meta, &p->db.shist, &p->db.shunspent, &p->db.undo, &p->db.utxoset, &p->db.txhash2txnum, &p->db.rpa, }) {
+        for (const auto ptr : { &p->db.blkinfo, &p->db.meta, &p->db.shist, &p->db.shunspent, &p->db.shbalance, &p->db.undo, &p->db.utxoset, &p->db.txhash2txnum, &p->db.rpa, }) {
             QVariantMap m2;
             const auto & db = *ptr;
             const QString name = QFileInfo(QString::fromStdString(db->GetName())).fileName();
@@ -2227,17 +3085,41 @@ auto Storage::stats() const -> Stats
                 m2["table factory options"] = m3;
             } else
                 m2["table factory options"] = QVariant(); // explicitly state it was null (this branch should not normally happen)
+            if (const auto st = db->GetOptions().statistics)
+                m2["block cache"] = BlockCacheStats(*st);
             m2["max_open_files"] = db->GetOptions().max_open_files;
             m2["keep_log_file_num"] = qulonglong(db->GetOptions().keep_log_file_num);
             m[name] = m2;
         }
         ret["DB Stats"] = m;
+        if (rocksdb::Env * const env = p->db.opts.env) {
+            ret["DB Background Threads"] = QVariantMap{
+                {"flush (high)", env->GetBackgroundThreads(rocksdb::Env::Priority::HIGH)},
+                {"compaction (low)", env->GetBackgroundThreads(rocksdb::Env::Priority::LOW)},
+                {"max_background_jobs", p->db.opts.max_background_jobs},
+            };
+        }
         if (const auto cache = p->db.blockCache.lock(); cache) {
             QVariantMap cmap;
             cmap["usage"] = qulonglong(cache->GetUsage());
             cmap["capacity"] = qulonglong(cache->GetCapacity());
+            cmap["type"] = options->db.blockCacheTypeString();
+            cmap["secondary cache capacity"] = qulonglong(options->db.secondaryCacheMem);
             ret["DB Shared Block Cache"] = cmap;
         }
+        if (!p->db.tableBlockCaches.empty()) {
+            QVariantMap cmap;
+            for (const auto & [name, wp] : p->db.tableBlockCaches) {
+                if (const auto cache = wp.lock())
+                    cmap[name] = QVariantMap{
+                        {"usage", qulonglong(cache->GetUsage())},
+                        {"capacity", qulonglong(cache->GetCapacity())},
+                    };
+            }
+            cmap["type"] = options->db.blockCacheTypeString();
+            cmap["secondary cache capacity (total)"] = qulonglong(options->db.secondaryCacheMem);
+            ret["DB Per-Table Block Caches"] = cmap;
+        }
         if (const auto wbm = p->db.writeBufferManager.lock(); wbm) {
             QVariantMap wmap;
             const bool en = wbm->enabled();
@@ -2349,15 +3231,19 @@ TxNum Storage::getTxNum() const { return p->txNumNext.load(); }
 
 auto Storage::latestTip(Header *hdrOut) const -> std::pair<int, HeaderHash> {
     static_assert(std::is_same_v<Header, HeaderHash> && std::is_same_v<Header, QByteArray>); // both must be QByteArray
-    std::pair<int, HeaderHash> ret = headerVerifier().first.lastHeaderProcessed(); // ok; lock stays locked until statement end.
+    auto [verif, lock] = headerVerifier();
+    std::pair<int, HeaderHash> ret = verif.lastHeaderProcessed();
     if (hdrOut) *hdrOut = ret.second; // this is not a hash but the actual block header
     if (ret.second.isEmpty() || ret.first < 0) {
         ret.first = -1;
         ret.second.clear();
         if (hdrOut) hdrOut->clear();
+    } else if (LIKELY(ret.first == p->tipHashHeight)) {
+        // .ret now has the actual header but we want the hash, which is maintained alongside the verifier state
+        ret.second = p->tipHash;
     } else {
-        // .ret now has the actual header but we want the hash
-        ret.second = BTC::HashRev(ret.second);
+        // can only happen if addBlock failed after appending the header; hash the header as a fallback
+        ret.second = TipHashForRecord(BlockHeight(ret.first), ret.second);
     }
     return ret;
 }
@@ -2406,7 +3292,7 @@ void Storage::saveMeta_impl()
     DebugM("Wrote new metadata to db");
 }
 
-void Storage::appendHeader(const Header &h, BlockHeight height)
+void Storage::appendHeader(const Header &h, BlockHeight height, const QByteArray &precomputedHash)
 {
     const auto targetHeight = p->headersFile->numRecords();
     if (UNLIKELY(height != targetHeight))
@@ -2444,6 +3330,17 @@ void Storage::appendHeader(const Header &h, BlockHeight height)
     }
     else if (UNLIKELY(!res.has_value() || *res != height))
         throw DatabaseError(QString("Failed to append header %1: returned count is bad").arg(height));
+
+    // Keep the hash column in step. If we crash between the above append and this one, loadCheckHeadersInDB() repairs
+    // the hash column on next startup.
+    const QByteArray hash = precomputedHash.size() == HashLen ? precomputedHash : HeaderHashForRecord(paddedHeader);
+    const auto res2 = p->headerHashesFile->appendRecord(hash, true, &err);
+    if (UNLIKELY(!err.isEmpty()))
+        throw DatabaseError(QString("Failed to append header hash %1: %2").arg(height).arg(err));
+    else if (UNLIKELY(!res2.has_value() || *res2 != height))
+        throw DatabaseError(QString("Failed to append header hash %1: returned count is bad").arg(height));
+    p->tipHash = TipHashForRecord(height, h, hash);
+    p->tipHashHeight = int(height);
 }
 
 void Storage::deleteHeadersPastHeight(BlockHeight height)
@@ -2454,6 +3351,16 @@ void Storage::deleteHeadersPastHeight(BlockHeight height)
         throw DatabaseError(QString("Failed to truncate headers past height %1: %2").arg(height).arg(err));
     else if (res != height + 1)
         throw InternalError("header truncate returned an unexepected value");
+    const auto res2 = p->headerHashesFile->truncate(height + 1, &err);
+    if (!err.isEmpty())
+        throw DatabaseError(QString("Failed to truncate header hashes past height %1: %2").arg(height).arg(err));
+    else if (res2 != height + 1)
+        throw InternalError("header hash truncate returned an unexepected value");
+    auto hash = TipHashAtHeight(*p->headersFile, *p->headerHashesFile, height, &err);
+    if (UNLIKELY(hash.isEmpty()))
+        throw DatabaseError(QString("Failed to read the hash of header %1: %2").arg(height).arg(err));
+    p->tipHash = std::move(hash);
+    p->tipHashHeight = int(height);
 }
 
 auto Storage::headerForHeight(BlockHeight height, QString *err) const -> std::optional<Header>
@@ -2507,16 +3414,22 @@ auto Storage::headersFromHeight(BlockHeight height, unsigned count, QString *err
 }
 
 
-void Storage::loadCheckHeadersInDB()
+void Storage::openHeadersFile()
 {
     assert(p->blockHeaderSize() > 0);
-    // Use the larger 112-byte header size for the file to handle both formats
-    // This ensures we can read all headers correctly regardless of format
-    p->headersFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "headers", 
-                                                 size_t(BTC::GetBlockHeaderSize(true)), // Always use 112-byte records
-                                                 0x00f026a1); // may throw
-    Debug() << "Initialized headers file with record size: " << p->headersFile->recordSize() << " bytes";
+    // Headers are always handed out as 112-byte records so we can read all headers correctly regardless of format,
+    // however on disk the pre-RandomX ones may be stored as 80 bytes (see HeaderStore).
+    p->headersFile = std::make_unique<HeaderStore>(options->datadir, options->db.compactHeaders); // may throw
+    Debug() << "Initialized headers file with record size: " << p->headersFile->recordSize() << " bytes, layout: "
+            << (p->headersFile->isCompact() ? "compact" : "padded");
+    p->headerHashesFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "header_hashes", HashLen,
+                                                       0x00f026a2); // may throw
+}
 
+// NOTE: this may run concurrently with loadCheckTxNumsFileAndBlkInfo(), loadCheckTxHash2TxNumMgr() and
+// loadCheckEarliestUndo(), so it must not touch any of the state those functions set up.
+void Storage::loadCheckHeadersInDB()
+{
     Log() << "Verifying headers ...";
     uint32_t num = unsigned(p->headersFile->numRecords());
     std::vector<QByteArray> hVec;
@@ -2545,46 +3458,52 @@ void Storage::loadCheckHeadersInDB()
             // set genesis hash - for all coins, only hash the first 80 bytes of the header
             p->genesisHash = BTC::HashRev(hVec.front().left(80));
 
-            err.clear();
-            // read db
-            for (uint32_t i = 0; i < num; ++i) {
-                auto & bytes = hVec[i];
-    
-                /*
-                // Add detailed logging for early blocks
-                if (i < 5) {
-                    Debug() << "Header " << i << " size: " << bytes.size() << " bytes";
-                    Debug() << "Header " << i << " raw data (hex): " << Util::ToHexFast(bytes);
-                    
-                    // Calculate the raw hash to see what's happening
-                    QByteArray rawHash = BTC::Hash(bytes.left(80)); // Standard header size
-                    Debug() << "  Raw 80-byte hash: " << Util::ToHexFast(rawHash);
-                    
-                    // Calculate hash with 112 bytes
-                    QByteArray fullHash = BTC::Hash(bytes);
-                    Debug() << "  Full 112-byte hash: " << Util::ToHexFast(fullHash);
-                    
-                    // Try to deserialize it to see what we're working with
-                    try {
-                        auto bHeader = BTC::Deserialize<bitcoin::CBlockHeader>(bytes, 0, false, false, true, false, true);
-                        Debug() << "  Version: " << bHeader.nVersion;
-                        Debug() << "  Time: " << bHeader.nTime;
-                        Debug() << "  hashPrevBlock: " << bHeader.hashPrevBlock.ToString().c_str();
-                        if (!bHeader.hashRandomX.IsNull()) {
-                            Debug() << "  hashRandomX: " << bHeader.hashRandomX.ToString().c_str();
-                        }
-                    } catch (const std::exception& e) {
-                        Debug() << "  Failed to deserialize header: " << e.what();
-                    }
+            // We have the hash of every header in the header_hashes file, so rather than have the verifier deserialize
+            // and re-hash every header, we do the same checks that it would against those: each pre-RandomX header's
+            // hashPrevBlock must match the stored hash of the header before it (RandomX headers are not linked by
+            // the verifier). The verifier then just needs the tip to carry on from.
+            const auto FirstBadLink = [&hVec, num](const std::vector<HeaderHash> &hashes) -> std::optional<uint32_t> {
+                for (uint32_t i = 0; i < num; ++i) {
+                    const auto & bytes = hVec[i];
+                    if (UNLIKELY(bytes.size() != BTC::FIXED_HEADER_RECORD_SIZE))
+                        throw DatabaseFormatError(QString("Header %1 has the wrong size (%2). Possible databaase corruption."
+                                                          " Delete the datadir and resynch.").arg(i).arg(bytes.size()));
+                    if (BTC::IsRandomXBlock(int(i)))
+                        continue; // the verifier bypasses these
+                    // offsets into the serialized header of nBits (0 means CBlockHeader::IsNull()) and hashPrevBlock
+                    constexpr int kNBitsOffset = 72, kHashPrevBlockOffset = 4;
+                    if (uint32_t nBits; std::memcpy(&nBits, bytes.constData() + kNBitsOffset, sizeof(nBits)), nBits == 0u)
+                        throw DatabaseFormatError(QString("Header verification failed for header at height %1: failed to"
+                                                          " deserialize. Possible databaase corruption. Delete the datadir"
+                                                          " and resynch.").arg(i));
+                    // the rest of the record is zero padding (hashRandomX.IsNull(), as the verifier requires)
+                    if (std::any_of(bytes.begin() + 80, bytes.end(), [](char c) { return c != 0; }))
+                        throw DatabaseFormatError(QString("Non-RandomX block at height %1 has unexpected hashRandomX field."
+                                                          " Possible databaase corruption. Delete the datadir and resynch.")
+                                                  .arg(i));
+                    if (i && std::memcmp(bytes.constData() + kHashPrevBlockOffset, hashes[i - 1u].constData(), HashLen) != 0)
+                        return i;
                 }
-                */
-                
-                if (!verif(bytes, &err))
-                    throw DatabaseFormatError(QString("%1. Possible databaase corruption. Delete the datadir and resynch.").arg(err));
-                
-                // Only hash the first 80 bytes for standard headers - consistent with other hash calculations
-                bytes = BTC::Hash(bytes.left(80)); // replace the header in the vector with its hash because it will be needed below...
+                return std::nullopt;
+            };
+            auto hashes = loadCheckHeaderHashes(hVec);
+            if (auto bad = FirstBadLink(hashes)) {
+                // either the header_hashes file or the headers are bad: rebuild the former from the latter and re-check
+                Warning() << "Header " << *bad << " does not link to the stored hash of its parent, rebuilding header hashes";
+                if (p->headerHashesFile->truncate(0, &err) != 0)
+                    throw DatabaseError(QString("Failed to truncate header hashes: %1").arg(err));
+                hashes = loadCheckHeaderHashes(hVec);
+                if ((bad = FirstBadLink(hashes)))
+                    throw DatabaseFormatError(QString("Header %1 'hashPrevBlock' does not match the contents of the previous"
+                                                      " block. Possible databaase corruption. Delete the datadir and"
+                                                      " resynch.").arg(*bad));
             }
+            verif.reset(num, hVec.back());
+            p->tipHash = TipHashForRecord(num - 1u, hVec.back(), hashes.back());
+            p->tipHashHeight = int(num - 1u);
+
+            // replace the headers in the vector with their hashes because they will be needed below...
+            hVec = std::move(hashes);
         }
     }
     if (num) {
@@ -2598,6 +3517,46 @@ void Storage::loadCheckHeadersInDB()
 
 }
 
+auto Storage::loadCheckHeaderHashes(const std::vector<Header> &headers) -> std::vector<HeaderHash>
+{
+    auto & hf = *p->headerHashesFile;
+    const uint64_t num = headers.size();
+    QString err;
+    if (hf.numRecords() > num) {
+        // we crashed in undoLatestBlock between truncating the headers and their hashes
+        Debug() << "Truncating header hashes from " << hf.numRecords() << " to " << num;
+        if (hf.truncate(num, &err) != num)
+            throw DatabaseError(QString("Failed to truncate header hashes: %1").arg(err));
+    }
+    // spot-check a few entries; this is cheap and catches a stale or foreign header_hashes file
+    if (const uint64_t have = hf.numRecords(); have) {
+        for (const uint64_t i : {uint64_t(0), have / 2u, have - 1u}) {
+            if (hf.readRecord(i, &err) != HeaderHashForRecord(headers[i])) {
+                Warning() << "Header hash for height " << i << " disagrees with the headers file, rebuilding header hashes";
+                if (hf.truncate(0, &err) != 0)
+                    throw DatabaseError(QString("Failed to truncate header hashes: %1").arg(err));
+                break;
+            }
+        }
+    }
+    if (const uint64_t have = hf.numRecords(); have < num) {
+        // first run with this file, or we crashed in addBlock between appending a header and its hash
+        const Tic t0;
+        auto batch = hf.beginBatchAppend(); // may throw if io error in c'tor here.
+        for (uint64_t i = have; i < num; ++i)
+            if (!batch.append(HeaderHashForRecord(headers[i]), &err)) // does not throw here, but we do.
+                throw DatabaseError(QString("Failed to append header hash %1: %2").arg(i).arg(err));
+        Debug() << "Computed " << (num - have) << " header " << Util::Pluralize("hash", num - have) << " in "
+                << t0.msecStr() << " msec";
+    }
+    auto ret = hf.readRecords(0, num, &err);
+    if (ret.size() != num)
+        throw DatabaseFormatError(QString("Could not read all header hashes: %1").arg(err));
+    return ret;
+}
+
+// NOTE: this runs concurrently with loadCheckHeadersInDB(), so it cannot use latestTip() (the header verifier may not
+// be populated yet). Instead the tip height is taken from the record count of the already-opened headers file.
 void Storage::loadCheckTxNumsFileAndBlkInfo()
 {
     // may throw.
@@ -2605,20 +3564,26 @@ void Storage::loadCheckTxNumsFileAndBlkInfo()
     p->txNumNext = p->txNumsFile->numRecords();
     Debug() << "Read TxNumNext from file: " << p->txNumNext.load();
     TxNum ct = 0;
-    if (const int height = latestTip().first; height >= 0)
+    if (const int height = int(p->headersFile->numRecords()) - 1; height >= 0)
     {
-        p->blkInfos.reserve(std::min(size_t(height+1), MAX_HEADERS));
-        Log() << "Checking tx counts ...";
-        for (int i = 0; i <= height; ++i) {
-            static const QString errMsg("Failed to read a blkInfo from db, the database may be corrupted");
-            const auto blkInfo = GenericDBGetFailIfMissing<BlkInfo>(p->db.blkinfo.get(), uint32_t(i), errMsg, false, p->db.defReadOpts);
-            if (blkInfo.txNum0 != ct)
-                throw DatabaseFormatError(QString("BlkInfo for height %1 does not match computed txNum of %2."
-                                                  "\n\nThe database may be corrupted. Delete the datadir and resynch it.\n")
-                                          .arg(i).arg(ct));
-            ct += blkInfo.nTx;
-            p->blkInfos.emplace_back(blkInfo);
-            p->blkInfosByTxNum[blkInfo.txNum0] = unsigned(p->blkInfos.size()-1);
+        if (loadBlkInfoSnapshot(height)) {
+            const auto & last = p->blkInfos.back();
+            ct = last.txNum0 + last.nTx;
+        } else {
+            p->blkInfos.reserve(std::min(size_t(height+1), MAX_HEADERS));
+            Log() << "Checking tx counts ...";
+            for (int i = 0; i <= height; ++i) {
+                static const QString errMsg("Failed to read a blkInfo from db, the database may be corrupted");
+                const auto blkInfo = GenericDBGetFailIfMissing<BlkInfo>(p->db.blkinfo.get(), uint32_t(i), errMsg, false, p->db.defReadOpts);
+                if (blkInfo.txNum0 != ct)
+                    throw DatabaseFormatError(QString("BlkInfo for height %1 does not match computed txNum of %2."
+                                                      "\n\nThe database may be corrupted. Delete the datadir and resynch it.\n")
+                                              .arg(i).arg(ct));
+                ct += blkInfo.nTx;
+                p->blkInfos.emplace_back(blkInfo);
+                // keys arrive in ascending order, so hinting at end() makes building this map linear rather than NlogN
+                p->blkInfosByTxNum.insert_or_assign(p->blkInfosByTxNum.end(), blkInfo.txNum0, unsigned(p->blkInfos.size()-1));
+            }
         }
         Log() << ct << " total transactions";
     }
@@ -2629,27 +3594,136 @@ void Storage::loadCheckTxNumsFileAndBlkInfo()
     }
 }
 
-// this depends on the above function having been run already
-void Storage::loadCheckTxHash2TxNumMgr()
+namespace {
+    /// The blkinfo snapshot file contains, in native byte order: magic, version, block count (uint32_t each), the
+    /// hash of the tip header it was taken at, `count` serialized BlkInfos, then a checksum (double-SHA256) of all
+    /// preceding bytes. It is bound to the chain tip it was taken at, so a snapshot left over from before blocks were
+    /// added or reorged is simply ignored.
+    constexpr uint32_t kBlkInfoSnapshotMagic = 0xb1c1f0a5, kBlkInfoSnapshotVersion = 1;
+    constexpr int kBlkInfoSnapshotHdrSize = 3 * sizeof(uint32_t) + HashLen;
+    QString blkInfoSnapshotPath(const QString &datadir) { return datadir + QDir::separator() + "blkinfo_snapshot"; }
+}
+
+bool Storage::loadBlkInfoSnapshot(const int tipHeight)
 {
-    // the below may throw
-    p->db.txhash2txnumMgr = std::make_unique<TxHash2TxNumMgr>(p->db.txhash2txnum.get(), p->db.defReadOpts, p->db.defWriteOpts,
-                                                              p->txNumsFile.get(), 6, TxHash2TxNumMgr::KeyPos::End);
-    try {
-        // basic sanity checks -- ensure we can read the first, middle, and last hash in the txNumsFile,
-        // and that those hashes exist in the txhash2txnum db
-        const QString errMsg = "The txhash index failed basic sanity checks -- it is missing some records.";
-        const auto nrecs = p->txNumsFile->numRecords();
-        if (nrecs) {
-            for (auto recNum : {uint64_t(0), uint64_t(nrecs/2), uint64_t(nrecs-1)}) {
-                if (!p->db.txhash2txnumMgr->exists(p->txNumsFile->readRecord(recNum)))
-                    throw DatabaseError(errMsg);
-            }
-        } else {
-            // sanity check on empty db: if no records, db should also have no rows
-            std::unique_ptr<rocksdb::Iterator> it(p->db.txhash2txnum->NewIterator(p->db.defReadOpts));
-            if (!it) throw DatabaseError("Unable to obtain an iterator to the txhash2txnum set db");
-            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    const QString path = blkInfoSnapshotPath(options->datadir);
+    if (!QFile::exists(path))
+        return false;
+    const auto Reject = [&path](const QString &why) {
+        Debug() << "Ignoring blkinfo snapshot \"" << path << "\": " << why;
+        return false;
+    };
+    if (options->doSlowDbChecks)
+        return Reject("-C specified, will do a full scan of the blkinfo table instead");
+
+    const Tic t0;
+    QByteArray data;
+    if (QFile f(path); !f.open(QIODevice::ReadOnly))
+        return Reject(f.errorString());
+    else
+        data = f.readAll();
+
+    const size_t nBlocks = size_t(tipHeight) + 1u;
+    if (size_t(data.size()) != kBlkInfoSnapshotHdrSize + nBlocks * sizeof(BlkInfo) + HashLen)
+        return Reject("size mismatch (stale snapshot?)");
+    if (BTC::Hash(QByteArray::fromRawData(data.constData(), data.size() - HashLen)) != data.right(HashLen))
+        return Reject("bad checksum");
+    int pos = 0;
+    if (DeserializeScalar<uint32_t>(data, nullptr, &pos) != kBlkInfoSnapshotMagic
+            || DeserializeScalar<uint32_t>(data, nullptr, &pos) != kBlkInfoSnapshotVersion
+            || DeserializeScalar<uint32_t>(data, nullptr, &pos) != nBlocks)
+        return Reject("bad header");
+    {
+        QString err;
+        const auto tipHdr = p->headersFile->readRecord(uint64_t(tipHeight), &err);
+        if (tipHdr.size() < 80)
+            return Reject(QString("unable to read tip header: %1").arg(err));
+        if (BTC::Hash(tipHdr.left(80)) != data.mid(pos, HashLen))
+            return Reject("tip hash mismatch (stale snapshot?)");
+        pos += HashLen;
+    }
+
+    std::vector<BlkInfo> blkInfos;
+    blkInfos.reserve(nBlocks);
+    TxNum ct = 0;
+    for (size_t i = 0; i < nBlocks; ++i, pos += int(sizeof(BlkInfo))) {
+        const auto & bi = blkInfos.emplace_back(Deserialize<BlkInfo>(QByteArray::fromRawData(data.constData() + pos, sizeof(BlkInfo))));
+        if (bi.txNum0 != ct)
+            return Reject(QString("txNum mismatch at height %1").arg(i));
+        ct += bi.nTx;
+    }
+    // spot-check a few entries against the db; this is cheap and catches a snapshot from a different datadir
+    for (const size_t height : {size_t(0), nBlocks / 2u, nBlocks - 1u}) {
+        static const QString errMsg("Failed to read a blkInfo from db, the database may be corrupted");
+        if (GenericDBGetFailIfMissing<BlkInfo>(p->db.blkinfo.get(), uint32_t(height), errMsg, false, p->db.defReadOpts) != blkInfos[height])
+            return Reject(QString("disagrees with the blkinfo table at height %1").arg(height));
+    }
+
+    p->blkInfos = std::move(blkInfos);
+    p->blkInfosByTxNum.clear();
+    for (unsigned i = 0; i < p->blkInfos.size(); ++i)
+        p->blkInfosByTxNum.insert_or_assign(p->blkInfosByTxNum.end(), p->blkInfos[i].txNum0, i);
+    Debug() << "Loaded " << nBlocks << " blkinfos from snapshot in " << t0.msecStr() << " msec";
+    return true;
+}
+
+void Storage::saveBlkInfoSnapshot() const
+{
+    if (!p->startupCompleted || !p->headersFile || !p->db.meta || isDirty())
+        return;
+    const QString path = blkInfoSnapshotPath(options->datadir);
+    const Tic t0;
+    QByteArray data;
+    {
+        SharedLockGuard g(p->blkInfoLock);
+        const size_t nBlocks = p->blkInfos.size();
+        if (!nBlocks || nBlocks != p->headersFile->numRecords() || nBlocks > std::numeric_limits<uint32_t>::max()) {
+            QFile::remove(path); // nothing sensible to save; make sure no stale snapshot lingers
+            return;
+        }
+        QString err;
+        const auto tipHdr = p->headersFile->readRecord(nBlocks - 1u, &err);
+        if (tipHdr.size() < 80) {
+            Warning() << "Not saving blkinfo snapshot, unable to read tip header: " << err;
+            return;
+        }
+        data.reserve(QByteArray::size_type(kBlkInfoSnapshotHdrSize + nBlocks * sizeof(BlkInfo) + HashLen));
+        data.append(SerializeScalar(kBlkInfoSnapshotMagic));
+        data.append(SerializeScalar(kBlkInfoSnapshotVersion));
+        data.append(SerializeScalar(uint32_t(nBlocks)));
+        data.append(BTC::Hash(tipHdr.left(80)));
+        for (const auto & bi : p->blkInfos)
+            data.append(Serialize(bi));
+    }
+    data.append(BTC::Hash(data)); // checksum
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(data) != data.size() || !f.commit())
+        Warning() << "Failed to write blkinfo snapshot \"" << path << "\": " << f.errorString();
+    else
+        Debug() << "Wrote blkinfo snapshot (" << data.size() << " bytes) in " << t0.msecStr() << " msec";
+}
+
+// this depends on the above function having been run already
+void Storage::loadCheckTxHash2TxNumMgr()
+{
+    // the below may throw
+    p->db.txhash2txnumMgr = std::make_unique<TxHash2TxNumMgr>(p->db.txhash2txnum.get(), p->db.defReadOpts, p->db.defWriteOpts,
+                                                              p->txNumsFile.get(), 6, TxHash2TxNumMgr::KeyPos::End);
+    try {
+        // basic sanity checks -- ensure we can read the first, middle, and last hash in the txNumsFile,
+        // and that those hashes exist in the txhash2txnum db
+        const QString errMsg = "The txhash index failed basic sanity checks -- it is missing some records.";
+        const auto nrecs = p->txNumsFile->numRecords();
+        if (nrecs) {
+            for (auto recNum : {uint64_t(0), uint64_t(nrecs/2), uint64_t(nrecs-1)}) {
+                if (!p->db.txhash2txnumMgr->exists(p->txNumsFile->readRecord(recNum)))
+                    throw DatabaseError(errMsg);
+            }
+        } else {
+            // sanity check on empty db: if no records, db should also have no rows
+            std::unique_ptr<rocksdb::Iterator> it(p->db.txhash2txnum->NewIterator(p->db.defReadOpts));
+            if (!it) throw DatabaseError("Unable to obtain an iterator to the txhash2txnum set db");
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
                 throw DatabaseFormatError(QString("Failed invariant: empty txNum file should mean empty db; ") + errMsg);
             }
         }
@@ -2673,6 +3747,8 @@ void Storage::loadCheckTxHash2TxNumMgr()
         }
         p->db.txhash2txnumMgr->rebuildDB();
     }
+    if (options->txHashMemIndex)
+        p->db.txhash2txnumMgr->loadMemIndex(); // may throw
 }
 
 // NOTE: this must be called *after* loadCheckTxNumsFileAndBlkInfo(), because it needs a valid p->txNumNext
@@ -2896,6 +3972,102 @@ void Storage::loadCheckShunspentInDB()
           << " in " << t0.secsStr() << " sec";
  }
 
+// NOTE: This reads scripthash_unspent and the kShBalanceBuilt flag from meta. When the flag is not set it also writes:
+// it DeleteRange()s all of scripthash_balance, rewrites it, and then sets the flag in meta. This is safe concurrently
+// with the other startup checks (see runSlowStartupChecks()): loadCheckShunspentInDB() only reads (shunspent, utxoset,
+// meta), and loadCheckRpaDB() writes only the rpa db and the distinct kRpaNeedsFullCheck meta key (RocksDB handles
+// concurrent writes to one db). Neither touches scripthash_balance, and header queries served meanwhile read none of
+// these tables.
+void Storage::loadCheckBalanceDB()
+{
+    FatalAssert(!!p->db.shbalance, __func__, ": scripthash_balance db is not open");
+
+    static const QString errRead("Error reading scripthash_balance_built flag from the meta db"),
+                         errWrite("Error issuing batch write to scripthash_balance db");
+    const bool built = GenericDBGet<bool>(p->db.meta.get(), kShBalanceBuilt, true, errRead, false, p->db.defReadOpts).value_or(false);
+    if (built && options->doSlowDbChecks < 2) // verifying is as slow as the shunspent check, so it requires -C -C
+        return;
+
+    if (!built)
+        Log() << "Building scripthash_balance from scripthash_unspent (one-time operation, this may take some time) ...";
+    else
+        Log() << "CheckDB: Verifying scripthash_balance (this may take some time) ...";
+
+    const Tic t0;
+
+    if (!built) {
+        // Start from scratch, in case a previous build was interrupted. All keys are HashLen bytes.
+        const QByteArray endKey(HashLen + 1, char(0xff));
+        if (auto st = p->db.shbalance->DeleteRange(p->db.defWriteOpts, p->db.shbalance->DefaultColumnFamily(),
+                                                   rocksdb::Slice(), ToSlice(endKey)); !st.ok())
+            throw DatabaseError(QString("Failed to clear the scripthash_balance db: %1").arg(StatusString(st)));
+    }
+
+    std::unique_ptr<rocksdb::Iterator> iter(p->db.shunspent->NewIterator(p->db.defReadOpts));
+    if (!iter) throw DatabaseError("Unable to obtain an iterator to the scripthash unspent db");
+
+    constexpr auto errMsg = "This may be due to either a database format mismatch or data corruption."
+                            "\n\nDelete the datadir and resynch to bitcoind.\n";
+    rocksdb::WriteBatch batch;
+    HashX curHashX;
+    BalanceAggregate cur;
+    size_t nHashX = 0, nUtxo = 0;
+    // Called for each completed run of adjacent scripthash_unspent keys sharing a HashX prefix
+    const auto FinishHashX = [&] {
+        if (curHashX.isEmpty()) return;
+        ++nHashX;
+        if (!built) {
+            GenericBatchPut(batch, curHashX, cur.toByteArray(), "Failed to add an entry to the scripthash_balance batch");
+            if (batch.Count() >= 100'000) {
+                GenericBatchWrite(p->db.shbalance.get(), batch, errWrite, p->db.defWriteOpts);
+                batch.Clear();
+            }
+        } else if (const auto dbVal = ReadBalanceAggregate(p->db.shbalance.get(), curHashX, p->db.defReadOpts); dbVal != cur) {
+            throw DatabaseError(QString("scripthash_balance mismatch for %1: db has %2, scripthash_unspent has %3. %4")
+                                .arg(QString(curHashX.toHex()), dbVal.toString(), cur.toString(), errMsg));
+        }
+    };
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        const rocksdb::Slice key = iter->key();
+        if (curHashX.isEmpty() || !key.starts_with(ToSlice(curHashX))) {
+            FinishHashX();
+            curHashX = extractShunspentKey(key).first; // throws if the key has the wrong size
+            cur = {};
+        }
+        const SHUnspentValue shuval = Deserialize<SHUnspentValue>(FromSlice(iter->value()));
+        if (UNLIKELY(!shuval.valid || !bitcoin::MoneyRange(shuval.amount)))
+            throw DatabaseError(QString("Read an invalid SHUnspentValue from the scripthash_unspent database for scripthash: %1. %2")
+                                .arg(QString(curHashX.toHex()), errMsg));
+        cur.apply(shuval.amount, bool(shuval.tokenDataPtr), +1);
+        if (0 == ++nUtxo % 100'000) {
+            *(0 == nUtxo % 2'500'000 ? std::make_unique<Log>() : std::make_unique<Debug>())
+                    << (built ? "CheckDB: Verified " : "Processed ") << nUtxo << " scripthash_unspent entries ...";
+            if (app() && app()->signalsCaught())
+                throw UserInterrupted("User interrupted, aborting");
+        }
+    }
+    FinishHashX();
+
+    if (!built) {
+        GenericBatchWrite(p->db.shbalance.get(), batch, errWrite, p->db.defWriteOpts);
+        GenericDBPut(p->db.meta.get(), kShBalanceBuilt, kTrue, "Error saving scripthash_balance_built flag to the meta db",
+                     p->db.defWriteOpts);
+    } else {
+        // every record in the table must have been accounted-for above (fully spent HashX's are deleted by issueUpdates)
+        std::unique_ptr<rocksdb::Iterator> it2(p->db.shbalance->NewIterator(p->db.defReadOpts));
+        if (!it2) throw DatabaseError("Unable to obtain an iterator to the scripthash balance db");
+        size_t nRecs = 0;
+        for (it2->SeekToFirst(); it2->Valid(); it2->Next())
+            ++nRecs;
+        if (nRecs != nHashX)
+            throw DatabaseError(QString("scripthash_balance has %1 records, but scripthash_unspent has %2 scripthashes. %3")
+                                .arg(nRecs).arg(nHashX).arg(errMsg));
+    }
+
+    Log() << (built ? "Verified " : "Built ") << nHashX << " scripthash_balance " << Util::Pluralize("record", nHashX)
+          << " from " << nUtxo << " scripthash_unspent " << Util::Pluralize("entry", nUtxo) << " in " << t0.secsStr() << " sec";
+}
+
 void Storage::loadCheckRpaDB()
 {
     FatalAssert(!!p->db.rpa, __func__, ": RPA db is not open");
@@ -3092,6 +4264,7 @@ void Storage::clampRpaEntries(BlockHeight from, BlockHeight to)
 {
     ExclusiveLockGuard g(p->blocksLock);
     clampRpaEntries_nolock(from, to);
+    p->publishReadView(); // so that getRpaHistory readers see the clamped rpa table
 }
 
 void Storage::clampRpaEntries_nolock(BlockHeight from, BlockHeight to)
@@ -3194,6 +4367,9 @@ bool Storage::hasUndo() const {
 struct Storage::UTXOBatch::P {
     rocksdb::WriteBatch utxosetBatch; ///< batch writes/deletes end up in the utxoset db (keyed off TXO)
     rocksdb::WriteBatch shunspentBatch; ///< batch writes/deletes end up in the shunspent db (keyed off HashX+CompactTXO)
+    /// Net change to each HashX's BalanceAggregate; written to the scripthash_balance db by issueUpdates(), or if there is
+    /// a UTXOCache active, handed to it to be written when it flushes the utxo changes.
+    BalanceDeltas balanceDeltas;
     int addCt = 0, rmCt = 0;
     bool defunct = false;
     UTXOCache *cache{}; ///< if not nullptr, there is a UTXOCache active and we should give it the batch writes.
@@ -3208,11 +4384,14 @@ void Storage::issueUpdates(UTXOBatch &b)
                          errMsg2("Error issuing batch write to scripthash_unspent db for a utxo update");
     if (UNLIKELY(b.p->defunct))
         throw InternalError("Misuse of Storage::issueUpdates. Cannot issue the same updates using the same context more than once. FIXME!");
-    assert(bool(p->db.utxoset) && bool(p->db.shunspent));
+    assert(bool(p->db.utxoset) && bool(p->db.shunspent) && bool(p->db.shbalance));
     if (!b.p->cache) {
         GenericBatchWrite(p->db.utxoset.get(), b.p->utxosetBatch, errMsg1, p->db.defWriteOpts); // may throw
         GenericBatchWrite(p->db.shunspent.get(), b.p->shunspentBatch, errMsg2, p->db.defWriteOpts); // may throw
-    }
+        // we hold the blocksLock exclusively here
+        WriteBalanceDeltas(p->db.shbalance.get(), b.p->balanceDeltas, p->db.defReadOpts, p->db.defWriteOpts); // may throw
+    } else
+        b.p->cache->putBalanceDeltas(b.p->balanceDeltas); // written to the db along with the utxos, on cache flush
     p->utxoCt += b.p->addCt - b.p->rmCt; // tally up adds and deletes
     b.p->defunct = true;
 }
@@ -3232,7 +4411,7 @@ void Storage::setInitialSync(bool b) {
                 bytes = limit;
             }
             Log() << "utxo-cache: Enabled; UTXO cache size set to " << bytes << " bytes (available physical RAM: " << limit << " bytes)";
-            p->db.utxoCache.reset(new UTXOCache("Storage UTXO Cache", p->db.utxoset, p->db.shunspent, p->db.defReadOpts, p->db.defWriteOpts));
+            p->db.utxoCache.reset(new UTXOCache("Storage UTXO Cache", p->db.utxoset, p->db.shunspent, p->db.shbalance, p->db.defReadOpts, p->db.defWriteOpts));
             // Reserve about 3.6 million entries per GB of utxoCache memory given to us
             // We need to do this, despite the extra memory bloat, because it turns out rehashing is very painful.
             p->db.utxoCache->autoReserve(bytes);
@@ -3265,11 +4444,13 @@ void Storage::UTXOBatch::add(const TXO &txo, const TXOInfo &info, const CompactT
         p->cache->put(txo, info);
         p->cache->putShunspent(shukey, shuval);
     }
+    p->balanceDeltas[info.hashX].apply(info.amount, bool(info.tokenDataPtr), +1);
 
     ++p->addCt;
 }
 
-void Storage::UTXOBatch::remove(const TXO &txo, const HashX &hashX, const CompactTXO &ctxo)
+void Storage::UTXOBatch::remove(const TXO &txo, const HashX &hashX, const CompactTXO &ctxo, const bitcoin::Amount amount,
+                                const bool hasToken)
 {
     if (!p->cache) {
         // enqueue delete from utxoset db -- may throw.
@@ -3284,6 +4465,7 @@ void Storage::UTXOBatch::remove(const TXO &txo, const HashX &hashX, const Compac
         p->cache->remove(txo);
         p->cache->removeShunspent(hashX, ctxo);
     }
+    p->balanceDeltas[hashX].apply(amount, hasToken, -1);
     ++p->rmCt;
 }
 
@@ -3296,6 +4478,64 @@ std::optional<TXOInfo> Storage::utxoGetFromDB(const TXO &txo, bool throwIfMissin
     return GenericDBGet<TXOInfo>(p->db.utxoset.get(), txo, !throwIfMissing, errMsgPrefix, false, p->db.defReadOpts);
 }
 
+std::vector<std::optional<TXOInfo>> Storage::utxoGetManyFromDB(const std::vector<TXO> &txos, size_t *nFromCache)
+{
+    assert(bool(p->db.utxoset));
+    std::vector<std::optional<TXOInfo>> ret(txos.size());
+    std::vector<size_t> todo; // indices into `txos` that still need a db lookup
+    todo.reserve(txos.size());
+    size_t cacheCt = 0u;
+    {
+        // The UTXO cache is only created, destroyed and mutated by the writer, with blocksLock held exclusively. It may
+        // hold adds that were not yet flushed to the db, and spends whose stale rows are still in the db, so it must be
+        // consulted first.
+        SharedLockGuard g(p->blocksLock);
+        for (size_t i = 0; i < txos.size(); ++i) {
+            auto pk = p->db.utxoCache ? p->db.utxoCache->peek(txos[i]) : UTXOCache::Peek{};
+            if (pk.status == UTXOCache::Peek::Unknown) {
+                todo.push_back(i);
+                continue;
+            }
+            ret[i] = std::move(pk.info); // nullopt if spent
+            ++cacheCt;
+        }
+    }
+    if (nFromCache) *nFromCache = cacheCt;
+    if (todo.empty()) return ret;
+
+    // Serialize the keys and issue them in sorted order. This lets RocksDB batch up lookups that land in the same
+    // data blocks, and skip the internal sort it would otherwise do.
+    std::vector<QByteArray> keyData;
+    keyData.reserve(todo.size());
+    for (const auto i : todo)
+        keyData.push_back(Serialize(txos[i]));
+    std::vector<size_t> order(todo.size());
+    std::iota(order.begin(), order.end(), size_t(0u));
+    std::sort(order.begin(), order.end(), [&keyData](size_t a, size_t b) { return keyData[a] < keyData[b]; });
+    std::vector<rocksdb::Slice> keys;
+    keys.reserve(order.size());
+    for (const auto k : order)
+        keys.emplace_back(keyData[k].constData(), size_t(keyData[k].size()));
+    std::vector<rocksdb::PinnableSlice> values(keys.size());
+    std::vector<rocksdb::Status> statuses(keys.size());
+    auto * const db = p->db.utxoset.get();
+    db->MultiGet(p->db.defReadOpts, db->DefaultColumnFamily(), keys.size(), keys.data(), values.data(), statuses.data(),
+                 true /* sorted_input */);
+    for (size_t j = 0; j < order.size(); ++j) {
+        const auto & st = statuses[j];
+        const TXO & txo = txos[todo[order[j]]];
+        if (st.IsNotFound()) continue;
+        if (!st.ok())
+            throw DatabaseError(QString("Failed to read a utxo from the utxo db: %1: %2").arg(txo.toString(), StatusString(st)));
+        bool ok;
+        TXOInfo info = Deserialize<TXOInfo>(FromSlice(values[j]), &ok);
+        if (!ok)
+            throw DatabaseSerializationError(QString("Failed to deserialize TXOInfo for TXO \"%1\"").arg(txo.toString()));
+        ret[todo[order[j]]].emplace(std::move(info));
+    }
+    return ret;
+}
+
 int64_t Storage::utxoSetSize() const { return p->utxoCt; }
 double Storage::utxoSetSizeMB() const {
     // TODO: the below is inaccurate because it does not account for any bitcoin::token::OutputDataPtr that may be in TXOInfo
@@ -3388,9 +4628,18 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
         notify = std::make_unique<NotifyData>(); // note we don't reserve here -- we will reserve at the end when we run through the hashXAggregated set one final time...
     }
 
+    static Metrics::Histogram & mLockWait = LockWaitMetric("addblock"), & mTxNums = AddBlockPhaseMetric("txnums"),
+                              & mUtxo = AddBlockPhaseMetric("utxo"), & mHistory = AddBlockPhaseMetric("history"),
+                              & mBlkInfo = AddBlockPhaseMetric("blkinfo"), & mUndo = AddBlockPhaseMetric("undo"),
+                              & mHeader = AddBlockPhaseMetric("header"), & mMempool = AddBlockPhaseMetric("mempool"),
+                              & mTotal = AddBlockPhaseMetric("total");
+    Metrics::Stopwatch swTotal, sw;
+
     {
-        // take all locks now.. since this is a Big Deal. TODO: add more locks here?
-        std::scoped_lock guard(p->blocksLock, p->headerVerifierLock, p->blkInfoLock, p->mempoolLock);
+        // Take the writer locks now. Note that blkInfoLock and mempoolLock are only taken further below, for the brief
+        // sections that mutate blkInfos and the mempool, so that readers (see Pvt::withReadView) don't stall on us.
+        std::scoped_lock guard(p->blocksLock, p->headerVerifierLock);
+        sw.lap(mLockWait);
 
         if (p->db.utxoCache && p->db.utxoCache->cacheMisses) {
             p->db.utxoCache->prefetch(ppb); // will prefetch inputs in a thread
@@ -3399,12 +4648,11 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
         const auto blockTxNum0 = p->txNumNext.load();
 
         p->recentBlockTxHashes.clear();
+        Mempool::TxHashNumMap txidMap; // populated if notify; used at the end to remove this block's txs from the mempool
         if (notify) {
-            // Txs in block can never be in mempool. Ensure they are gone from mempool right away so that notifications
-            // to clients are as accurate as possible (notifications may happen after this function returns).
             const auto sz = ppb->txInfos.size();
             const auto rsvsz = static_cast<Mempool::TxHashNumMap::size_type>(sz > 0 ? sz-1 : 0);
-            Mempool::TxHashNumMap txidMap(/* bucket_count: */ rsvsz);
+            txidMap.reserve(rsvsz);
             notify->txidsAffected.reserve(rsvsz);
             if (trackRecentBlockTxHashes) {
                 p->recentBlockTxHashes.reserve(sz);
@@ -3419,25 +4667,6 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                     // add to "recently seen" set for the hashtx zmq notifier spam suppressor
                     p->recentBlockTxHashes.insert(txHash);
             }
-            Mempool::ScriptHashesAffectedSet affected;
-            // Pre-reserve some capacity for the tmp affected set to avoid much rehashing.
-            // Use the heuristic 3 x numtxs capped at the SubsMgr::kRecommendedPendingNotificationsReserveSize (2048).
-            affected.reserve(std::min(txidMap.size()*3, SubsMgr::kRecommendedPendingNotificationsReserveSize));
-            auto res = p->mempool.confirmedInBlock(affected, txidMap, ppb->height,
-                                                   Trace::isEnabled(), 0.5f /* shrink to fit load_factor threshold */);
-            if (const auto diff = res.oldSize - res.newSize; (diff || res.elapsedMsec > 5.) && Debug::isEnabled()) {
-                Debug d;
-                d << "addBlock: removed " << diff << " txs from mempool involving "
-                  << affected.size() << " addresses";
-                if (res.dspRmCt || res.dspTxRmCt)
-                    d << " (also removed dsps: " << res.dspRmCt << ", dspTxs: " << res.dspTxRmCt << ")";
-                if (res.rpaRmCt)
-                    d << " (also removed rpa entries: " << res.rpaRmCt << ")";
-                d << " in " << QString::number(res.elapsedMsec, 'f', 3) << " msec";
-            }
-            notify->scriptHashesAffected.merge(std::move(affected));
-            notify->dspTxsAffected.merge(std::move(res.dspTxsAffected));
-            // ^^ notify->txidsAffected is updated in the above loop
         }
 
         const auto verifUndo = p->headerVerifier; // keep a copy of verifier state for undo purposes in case this fails
@@ -3448,16 +4677,19 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
         // code in the below block may throw -- exceptions are propagated out to caller.
         {
             // Verify header chain makes sense (by checking hashes, using the shared header verifier)
-            QByteArray rawHeader;
+            QByteArray rawHeader, headerHash; // headerHash is the sha256d of rawHeader in memory order, or empty if not known yet
             {
                 QString errMsg;
-                if (!p->headerVerifier(ppb->header, &errMsg) ) {
+                // If the download pipeline already did the heavy lifting, we need only check linkage to the tip.
+                if (!(ppb->preparedHeader ? p->headerVerifier.checkPrepared(ppb->header, *ppb->preparedHeader, &errMsg)
+                                          : p->headerVerifier(ppb->header, &errMsg))) {
                     // XXX possible reorg point. Caller will/should roll back the db state via issuing calls to undoLatestBlock()
                     throw HeaderVerificationFailure(errMsg);
                 }
                 // save raw header back to our buffer -- this will be used at the end of this function to add it to the db
                 // after everything completes successfully.
                 rawHeader = p->headerVerifier.lastHeaderProcessed().second;
+                if (ppb->preparedHeader) headerHash = ppb->preparedHeader->hash;
             }
 
             setDirty(true); // <--  no turning back. if the app crashes unexpectedly while this is set, on next restart it will refuse to run and insist on a clean resynch.
@@ -3477,6 +4709,7 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
 
             if (p->txNumNext != p->txNumsFile->numRecords())
                 throw InternalError("TxNum file and internal txNumNext counter disagree! FIXME!");
+            sw.lap(mTxNums);
 
             // Asynch task -- the future will automatically be awaited on scope end (even if we throw here!)
             // NOTE: The assumption here is that ppb->txInfos is ok to share amongst threads -- that is, the assumption
@@ -3575,7 +4808,7 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                                         << " HashX: " << info.hashX.toHex();
                             }
                             // delete from db
-                            utxoBatch.remove(txo, info.hashX, CompactTXO(info.txNum, txo.outN)); // delete from db
+                            utxoBatch.remove(txo, info.hashX, CompactTXO(info.txNum, txo.outN), info.amount, bool(info.tokenDataPtr)); // delete from db
                             if (undo) { // save undo info, if we are in saveUndo mode
                                 undo->delUndos.emplace_back(txo, info);
                             }
@@ -3596,20 +4829,19 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                     issueUpdates(utxoBatch);
                 }
 
-                // sort and shrink_to_fit new hashX inputs added
+                // sort new hashX inputs added (no shrink_to_fit: these live in the block's arena, see BlockProc.h)
                 for (const auto & hashX : newHashXInputsResolved) {
                     auto & ag = ppb->hashXAggregated[hashX];
                     std::sort(ag.ins.begin(), ag.ins.end()); // make sure they are sorted
                     std::sort(ag.txNumsInvolvingHashX.begin(), ag.txNumsInvolvingHashX.end());
                     auto last = std::unique(ag.txNumsInvolvingHashX.begin(), ag.txNumsInvolvingHashX.end());
                     ag.txNumsInvolvingHashX.erase(last, ag.txNumsInvolvingHashX.end());
-                    ag.ins.shrink_to_fit();
-                    ag.txNumsInvolvingHashX.shrink_to_fit();
                 }
 
                 if constexpr (debugPrt)
                     Debug() << "utxoset size: " << utxoSetSize() << " block: " << ppb->height;
             }
+            sw.lap(mUtxo);
 
             {
                 // now.. update the txNumsInvolvingHashX to be offset from txNum0 for this block, and save history to db table
@@ -3633,10 +4865,12 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                     throw DatabaseError(QString("batch merge fail for block height %1: %2")
                                         .arg(ppb->height).arg(StatusString(st)));
             }
+            sw.lap(mHistory);
 
 
             {
                 // update BlkInfo
+                ExclusiveLockGuard g(p->blkInfoLock); // readers may be resolving TxNums -> heights concurrently
                 if (nReserve) {
                     if (const auto size = p->blkInfos.size(); size + 1 > p->blkInfos.capacity())
                         p->blkInfos.reserve(size + nReserve); // reserve space for new blkinfos in 1 go to save on copying
@@ -3663,11 +4897,12 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
             if (ppb->serializedRpaPrefixTable) {
                 addRpaDataForHeight_nolock(ppb->height, *ppb->serializedRpaPrefixTable); // may throw theoretically if GenericDBPut threw
             }
+            sw.lap(mBlkInfo);
 
             // save the last of the undo info, if in saveUndo mode
             if (undo) {
                 const auto t0 = Util::getTimeNS();
-                undo->hash = BTC::HashRev(rawHeader);
+                undo->hash = UndoHashForVerifierTip(p->headerVerifier, headerHash);
                 undo->scriptHashes = Util::keySet<decltype (undo->scriptHashes)>(ppb->hashXAggregated);
                 static const QString errPrefix("Error saving undo info to undo db");
 
@@ -3691,7 +4926,7 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                 } else {
                     const auto elapsedms = (Util::getTimeNS() - t0)/1e6;
                     const size_t nTx = undo->blkInfo.nTx, nSH = undo->scriptHashes.size();
-                    Debug() << "Saved V3 undo for block " << undo->height << ", "
+                    Debug() << "Saved V4 undo for block " << undo->height << ", "
                             << nTx << " " << Util::Pluralize("transaction", nTx)
                             << " involving " << nSH << " " << Util::Pluralize("scripthash", nSH)
                             << ", in " << QString::number(elapsedms, 'f', 2) << " msec.";
@@ -3713,7 +4948,9 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
                 if constexpr (debugPrt) DebugM("Deleted undo for block ", expireUndoHeight, ", earliest now ", p->earliestUndoHeight.load());
             }
 
-            appendHeader(rawHeader, ppb->height);
+            sw.lap(mUndo);
+
+            appendHeader(rawHeader, ppb->height, headerHash);
 
             if (UNLIKELY(ppb->height == 0)) {
                 // update genesis hash now if block 0 -- this info is used by rpc method server.features
@@ -3726,7 +4963,36 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
             saveUtxoCt();
             setDirty(false);
 
+            sw.lap(mHeader); // includes the utxo cache trim and utxo count save above
             undoVerifierOnScopeEnd.disable(); // indicate to the "Defer" object declared at the top of this function that it shouldn't undo anything anymore as we are happy now with the db state now.
+
+            // Txs in block can never be in mempool. Ensure they are gone from mempool right away so that notifications
+            // to clients are as accurate as possible (notifications may happen after this function returns). This is
+            // done under the same exclusive mempool lock as the view publish, so readers see both changes or neither.
+            ExclusiveLockGuard mg(p->mempoolLock);
+            if (notify) {
+                Mempool::ScriptHashesAffectedSet affected;
+                // Pre-reserve some capacity for the tmp affected set to avoid much rehashing.
+                // Use the heuristic 3 x numtxs capped at the SubsMgr::kRecommendedPendingNotificationsReserveSize (2048).
+                affected.reserve(std::min(txidMap.size()*3, SubsMgr::kRecommendedPendingNotificationsReserveSize));
+                auto res = p->mempool.confirmedInBlock(affected, txidMap, ppb->height,
+                                                       Trace::isEnabled(), 0.5f /* shrink to fit load_factor threshold */);
+                if (const auto diff = res.oldSize - res.newSize; (diff || res.elapsedMsec > 5.) && Debug::isEnabled()) {
+                    Debug d;
+                    d << "addBlock: removed " << diff << " txs from mempool involving "
+                      << affected.size() << " addresses";
+                    if (res.dspRmCt || res.dspTxRmCt)
+                        d << " (also removed dsps: " << res.dspRmCt << ", dspTxs: " << res.dspTxRmCt << ")";
+                    if (res.rpaRmCt)
+                        d << " (also removed rpa entries: " << res.rpaRmCt << ")";
+                    d << " in " << QString::number(res.elapsedMsec, 'f', 3) << " msec";
+                }
+                notify->scriptHashesAffected.merge(std::move(affected));
+                notify->dspTxsAffected.merge(std::move(res.dspTxsAffected));
+                // ^^ notify->txidsAffected is updated at the top of this function
+            }
+            p->publishReadView();
+            sw.lap(mMempool); // includes the wait for the mempool lock
         }
     } /// release locks
 
@@ -3739,6 +5005,7 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
         if (txsubsmgr && !notify->txidsAffected.empty())
             txsubsmgr->enqueueNotifications(std::move(notify->txidsAffected));
     }
+    swTotal.lap(mTotal);
 }
 
 /// NB: Caller should probably hold some locks to avoid consistency issues... even though this function is inherently thread-safe.
@@ -3775,6 +5042,7 @@ void Storage::addRpaDataForHeight(BlockHeight height, const QByteArray &serializ
 {
     ExclusiveLockGuard g(p->blocksLock);
     addRpaDataForHeight_nolock(height, serializedRpaPrefixTable);
+    p->publishReadView(); // so that getRpaHistory readers see the new rpa row
 }
 
 BlockHeight Storage::undoLatestBlock(bool notifySubs)
@@ -3793,6 +5061,9 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
     }
 
     {
+        // Wait for any ReadView readers to finish first: we are about to truncate the txNumsFile and blkInfos, which
+        // they may still be resolving TxNums against. New readers will then block on this until we are done.
+        ExclusiveLockGuard reorgGuard(p->reorgLock);
         // take all locks now.. since this is a Big Deal. TODO: add more locks here?
         std::scoped_lock guard(p->blocksLock, p->headerVerifierLock, p->blkInfoLock, p->mempoolLock);
 
@@ -3843,9 +5114,16 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
         if (!undoOpt.has_value())
             throw UndoInfoMissing(errMsg1);
         auto & undo = *undoOpt; // non-const because we swap out its scripthashes potentially below if notifySubs == true
+        // V4 undo records reference outputs by TxNum; look up their txids now while the txNumsFile still has them
+        undo.resolveTxHashes([this](const std::vector<uint64_t> &txNums) {
+            QString err;
+            auto ret = p->txNumsFile->readRandomRecords(txNums, &err);
+            if (!err.isEmpty()) throw DatabaseError(QString("Failed to read txids for undo: %1").arg(err));
+            return ret;
+        });
 
         // ensure undo info sanity
-        if (!undo.isValid() || undo.height != unsigned(tip) || undo.hash != BTC::HashRev(header)
+        if (!undo.isValid() || undo.height != unsigned(tip) || undo.hash != UndoHashForVerifierTip(p->headerVerifier)
             || prevHeight+1 >= p->blkInfos.size() || p->blkInfos.empty() || p->blkInfos.back() != undo.blkInfo)
             throw DatabaseFormatError(QString("The undo information for height %1 was successfully retrieved from the "
                                               "database, but it failed an internal consistency check.").arg(tip));
@@ -3876,34 +5154,57 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
             // here is that the txNumsFile has all the hashes we want to delete until the below operation is done).
             CoTask::Future fut = p->blocksWorker->submitWork([&]{ p->db.txhash2txnumMgr->truncateForUndo(txNum0);});
 
-            // undo the scripthash histories
-            for (const auto & sh : undo.scriptHashes) {
-                const QString shHex = Util::ToHexFast(sh);
-                const auto vec = GenericDBGetFailIfMissing<TxNumVec>(p->db.shist.get(), sh, QStringLiteral("Undo failed because we failed to retrieve the scripthash history for %1").arg(shHex), false, p->db.defReadOpts);
-                TxNumVec newVec;
-                newVec.reserve(vec.size());
-                for (const auto txNum : vec) {
-                    if (txNum < txNum0) {
-                        // accept only stuff in history that's before txNum0 for this block, filter out everything else
-                        newVec.push_back(txNum);
+            // undo the scripthash histories. For large blocks the work is split across this thread and the undoWorkers:
+            // each reads and truncates the histories for its slice of the scripthashes into its own WriteBatch, and the
+            // batches are then written to the db from this thread.
+            {
+                const std::vector<HashX> shVec(undo.scriptHashes.begin(), undo.scriptHashes.end());
+                constexpr size_t minPerThread = 256;
+                const size_t nThreads = std::clamp<size_t>(shVec.size() / minPerThread, 1u,
+                                                           std::max(Util::getNVirtualProcessors(), 1u));
+                std::vector<rocksdb::WriteBatch> batches(nThreads);
+                std::vector<std::exception_ptr> excs(nThreads);
+                const auto TruncateHistories = [&](const size_t tnum) {
+                    try {
+                        const size_t begin = shVec.size() * tnum / nThreads, end = shVec.size() * (tnum + 1u) / nThreads;
+                        for (size_t i = begin; i < end; ++i) {
+                            const auto & sh = shVec[i];
+                            const auto vec = GenericDBGetFailIfMissing<TxNumVec>(p->db.shist.get(), sh, QStringLiteral("Undo failed because we failed to retrieve the scripthash history for %1").arg(QString(Util::ToHexFast(sh))), false, p->db.defReadOpts);
+                            TxNumVec newVec;
+                            newVec.reserve(vec.size());
+                            for (const auto txNum : vec) {
+                                if (txNum < txNum0) {
+                                    // accept only stuff in history that's before txNum0 for this block, filter out everything else
+                                    newVec.push_back(txNum);
+                                }
+                            }
+                            if (!newVec.empty()) {
+                                // The below is entirely unnecessary as the txnums should be already sorted and unique in the db data.
+                                // We are doing this here to illustrate that this invariant in the data is very important.
+                                Util::sortAndUniqueify(newVec, false);
+                                // the sh still has some history, write it to db
+                                GenericBatchPut(batches[tnum], sh, newVec, "Undo failed because we failed to write a new scripthash history to the batch");
+                            } else {
+                                // the sh in question lost all its history as a result of undo, just delete it from db to save space
+                                GenericBatchDelete(batches[tnum], sh, "Undo failed because we failed to add a scripthash history delete to the batch");
+                            }
+                        }
+                    } catch (...) {
+                        excs[tnum] = std::current_exception();
                     }
+                };
+                while (p->undoWorkers.size() < nThreads - 1u)
+                    p->undoWorkers.push_back(std::make_unique<CoTask>(QString("Storage Undo %1").arg(p->undoWorkers.size() + 1u)));
+                {
+                    std::vector<CoTask::Future> futs; // auto-awaited on scope end, even if we throw
+                    futs.reserve(nThreads - 1u);
+                    for (size_t t = 1; t < nThreads; ++t)
+                        futs.push_back(p->undoWorkers[t - 1u]->submitWork([&TruncateHistories, t]{ TruncateHistories(t); }));
+                    TruncateHistories(0); // this thread does slice 0
                 }
-                const QString errMsg = QStringLiteral("Undo failed because we failed to write the new scripthash history for %1").arg(shHex);
-                if (!newVec.empty()) {
-                    // The below is entirely unnecessary as the txnums should be already sorted and unique in the db data.
-                    // We are doing this here to illustrate that this invariant in the data is very important.
-                    // Block undo is intended to be an infrequent process (and thus not especially performance-critical),
-                    // so this does no harm.
-                    std::sort(newVec.begin(), newVec.end());
-                    auto last = std::unique(newVec.begin(), newVec.end());
-                    newVec.erase(last, newVec.end());
-                }
-                if (!newVec.empty()) {
-                    // the sh still has some history, write it to db
-                    GenericDBPut(p->db.shist.get(), sh, newVec, errMsg, p->db.defWriteOpts);
-                } else {
-                    // the sh in question lost all its history as a result of undo, just delete it from db to save space
-                    GenericDBDelete(p->db.shist.get(), sh, errMsg, p->db.defWriteOpts);
+                for (size_t t = 0; t < nThreads; ++t) {
+                    if (excs[t]) std::rethrow_exception(excs[t]);
+                    GenericBatchWrite(p->db.shist.get(), batches[t], "Undo failed because we failed to write the new scripthash histories", p->db.defWriteOpts);
                 }
             }
 
@@ -3917,10 +5218,30 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
                     utxoBatch.add(txo, info, CompactTXO(info.txNum, txo.outN)); // may throw
                 }
 
-                // now, undo the utxo additions by deleting them
+                // now, undo the utxo additions by deleting them. The undo info lacks the amounts, which we need for the
+                // balance aggregate, so we get them from scripthash_unspent -- or from delUndos above, for utxos that
+                // were created and spent in this same block (and thus are not in scripthash_unspent).
+                std::unordered_map<TXO, const TXOInfo *> spentInBlock;
+                for (const auto & [txo, info] : undo.delUndos)
+                    if (info.txNum >= txNum0) spentInBlock.emplace(txo, &info);
                 for (const auto & [txo, hashx, ctxo] : undo.addUndos) {
                     assert(ctxo.txNum() >= txNum0); // all of the additions must have been in this block or newer
-                    utxoBatch.remove(txo, hashx, ctxo); // may throw
+                    bitcoin::Amount amount;
+                    bool hasToken;
+                    if (auto it = spentInBlock.find(txo); it != spentInBlock.end()) {
+                        amount = it->second->amount;
+                        hasToken = bool(it->second->tokenDataPtr);
+                    } else {
+                        static const QString errPrefix("Undo failed because we failed to read a utxo from the scripthash_unspent db");
+                        const auto shuval = Deserialize<SHUnspentValue>(
+                            GenericDBGetFailIfMissing<QByteArray>(p->db.shunspent.get(), mkShunspentKey(hashx, ctxo), errPrefix,
+                                                                  false, p->db.defReadOpts));
+                        if (UNLIKELY(!shuval.valid))
+                            throw DatabaseError(QString("%1: bad value for %2").arg(errPrefix, ctxo.toString()));
+                        amount = shuval.amount;
+                        hasToken = bool(shuval.tokenDataPtr);
+                    }
+                    utxoBatch.remove(txo, hashx, ctxo, amount, hasToken); // may throw
                 }
 
                 issueUpdates(utxoBatch); // may throw, updates p->utxoCt and issues write to db.
@@ -3951,6 +5272,7 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
 
             saveUtxoCt();
             setDirty(false); // phew. done.
+            p->publishReadView();
 
             nSH = undo.scriptHashes.size();
 
@@ -4117,10 +5439,7 @@ std::optional<TxHash> Storage::hashForHeightAndPos(BlockHeight height, uint32_t
 std::vector<std::optional<TxHash>> Storage::hashesForHeightAndPosVec(BlockHeight height, Span<const uint32_t> positionsInBlock,
                                                                      const SharedLockGuard *existingBlocksLock) const
 {
-    std::vector<std::optional<TxHash>> ret;
-    if (positionsInBlock.empty()) return ret; // unlikely fast path
-    ret.reserve(positionsInBlock.size());
-    BlkInfo bi;
+    if (positionsInBlock.empty()) return {}; // unlikely fast path
 
     // Below is to implement optionally locking with: SharedLockGuard(p->blocksLock), if existingBlocksLock is nullptr
     SharedLockGuard maybeLockedByUs;
@@ -4129,12 +5448,20 @@ std::vector<std::optional<TxHash>> Storage::hashesForHeightAndPosVec(BlockHeight
     } else if (UNLIKELY(existingBlocksLock->mutex() != &p->blocksLock)) {
         Error() << "Internal Error: expected the `existingBlocksLock` to be holding `p->blocksLock` (but it is not) in "
                 << __func__ << ". FIXME!";
-        return ret;
+        return {};
     }
 
     // At this point p->blocksLock is held for the rest of the function (either by caller or by us).
     // We need to hold p->blocksLock here to get a consistent view (so that data doesn't mutate from beneath us).
+    return hashesForHeightAndPosVec_nolock(height, positionsInBlock);
+}
 
+std::vector<std::optional<TxHash>> Storage::hashesForHeightAndPosVec_nolock(BlockHeight height, Span<const uint32_t> positionsInBlock) const
+{
+    std::vector<std::optional<TxHash>> ret;
+    if (positionsInBlock.empty()) return ret; // unlikely fast path
+    ret.reserve(positionsInBlock.size());
+    BlkInfo bi;
     {
         SharedLockGuard g(p->blkInfoLock);
         if (height >= p->blkInfos.size())
@@ -4215,54 +5542,189 @@ static auto GetMaxHistoryCtrFunc(const QString &name, const QString &itemName, s
     };
 }
 
+/// Looks up every valid (HashLen-sized) hashX in `hashXs` from `db` with a single MultiGet against `ropts`. The keys
+/// are handed to RocksDB in sorted order, which lets it coalesce the lookups that land in the same data blocks. Calls
+/// `func(index, value)` for each valid hashX in key order, where `index` is the position in `hashXs` and `value` is
+/// nullptr if the key is missing. Throws DatabaseError on a read error. Used below by getHistories() and getBalances().
+template <typename Func>
+static void SortedMultiGet(rocksdb::DB *db, const rocksdb::ReadOptions &ropts, const std::vector<HashX> &hashXs,
+                           const QString &errMsg, Func && func)
+{
+    std::vector<size_t> order;
+    order.reserve(hashXs.size());
+    for (size_t i = 0; i < hashXs.size(); ++i)
+        if (hashXs[i].length() == HashLen) order.push_back(i);
+    if (order.empty()) return;
+    std::sort(order.begin(), order.end(), [&hashXs](size_t a, size_t b) {
+        return std::memcmp(hashXs[a].constData(), hashXs[b].constData(), HashLen) < 0; // same order as rocksdb's BytewiseComparator
+    });
+    const size_t n = order.size();
+    std::vector<rocksdb::Slice> keys;
+    keys.reserve(n);
+    for (const auto i : order)
+        keys.push_back(ToSlice(hashXs[i]));
+    std::vector<rocksdb::PinnableSlice> values(n);
+    std::vector<rocksdb::Status> statuses(n);
+    db->MultiGet(ropts, db->DefaultColumnFamily(), n, keys.data(), values.data(), statuses.data(), /* sorted_input = */ true);
+    for (size_t k = 0; k < n; ++k) {
+        const auto & status = statuses[k];
+        if (status.IsNotFound())
+            func(order[k], static_cast<const rocksdb::Slice *>(nullptr));
+        else if (UNLIKELY(!status.ok()))
+            throw DatabaseError(QString("%1: %2").arg(errMsg, StatusString(status)));
+        else
+            func(order[k], static_cast<const rocksdb::Slice *>(&values[k]));
+    }
+}
+
 auto Storage::getHistory(const HashX & hashX, bool conf, bool unconf, BlockHeight fromHeight,
                          std::optional<BlockHeight> optToHeight) const -> History
 {
-    History ret;
-    if (hashX.length() != HashLen)
-        return ret;
-    auto IncrementCtrAndThrowIfExceedsMaxHistory = GetMaxHistoryCtrFunc("History", QString("scripthash %1").arg(QString(hashX.toHex())),
-                                                                        options->maxHistory);
+    return std::move(getHistories({hashX}, conf, unconf, fromHeight, optToHeight).front());
+}
+
+auto Storage::getHistories(const std::vector<HashX> & hashXs, bool conf, bool unconf, BlockHeight fromHeight,
+                           std::optional<BlockHeight> optToHeight) const -> std::vector<History>
+{
+    std::vector<History> ret(hashXs.size());
+    using CtrFunc = decltype(GetMaxHistoryCtrFunc(QString(), QString(), 0u));
+    std::vector<std::optional<CtrFunc>> ctrs(hashXs.size()); // nullopt for invalid hashXs and for items that failed
     try {
-        SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
-        if (conf) {
-            static const QString err("Error retrieving history for a script hash");
-            auto nums_opt = GenericDBGet<TxNumVec>(p->db.shist.get(), hashX, true, err, false, p->db.defReadOpts);
-            if (nums_opt.has_value()) {
-                const auto & nums = *nums_opt;
-                IncrementCtrAndThrowIfExceedsMaxHistory(nums.size());
-                ret.reserve(nums.size());
-                // TODO: The below could use some optimization.  A batched version of both hashForTxNum and
-                // heightForTxNum are low-hanging fruit for optimization.  Each call to the below takes a shared lock
-                // then releases it, for each item.  I imagine batched versions would have significantly less overhead
-                // per item, which could add up to huge performance savings on large histories.  This is a very
-                // low hanging fruit for optimization -- thus I am leaving this comment here so I can remember to come
-                // back and optmize the below.  /TODO
-                for (auto num : nums) {
-                    const BlockHeight height = heightForTxNum(num).value(); // may throw, same deal
-
-                    // Assumption for this loop: the nums are in order!
-                    if (optToHeight && height >= *optToHeight) break; // threshold of "to height" reached
-                    else if (height < fromHeight) continue; // keep looping until we hit a height that at least "from height"
-
-                    const auto hash = hashForTxNum(num).value(); // may throw, but that indicates some database inconsistency. we catch below
-                    ret.emplace_back(/* HistoryItem: */ hash, int(height));
+        // history doesn't mutate from underneath our feet in the pinned view, and we don't block addBlock (or vice-versa)
+        p->withReadView([&](const Pvt::ReadView &view) {
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                ret[i].clear(); // in case we are being re-run against a newer view
+                ctrs[i].reset();
+                if (hashXs[i].length() == HashLen)
+                    ctrs[i].emplace(GetMaxHistoryCtrFunc("History", QString("scripthash %1").arg(QString(hashXs[i].toHex())),
+                                                         options->maxHistory));
+            }
+            if (conf) {
+                static const QString err("Error retrieving history for a script hash");
+                SortedMultiGet(p->db.shist.get(), view.shistOpts, hashXs, err, [&](size_t i, const rocksdb::Slice *val) {
+                    if (!val) return; // no confirmed history
+                    auto & hist = ret[i];
+                    try {
+                        bool ok;
+                        const auto nums = Deserialize<TxNumVec>(FromSlice(*val), &ok);
+                        if (UNLIKELY(!ok))
+                            throw DatabaseSerializationError(QString("%1: Key was retrieved ok, but data could not be deserialized")
+                                                             .arg(err));
+                        (*ctrs[i])(nums.size());
+                        hist.reserve(nums.size());
+                        // TODO: The below could use some optimization.  A batched version of both hashForTxNum and
+                        // heightForTxNum are low-hanging fruit for optimization.  Each call to the below takes a shared lock
+                        // then releases it, for each item.  I imagine batched versions would have significantly less overhead
+                        // per item, which could add up to huge performance savings on large histories.  This is a very
+                        // low hanging fruit for optimization -- thus I am leaving this comment here so I can remember to come
+                        // back and optmize the below.  /TODO
+                        for (auto num : nums) {
+                            const BlockHeight height = heightForTxNum(num).value(); // may throw, same deal
+
+                            // Assumption for this loop: the nums are in order!
+                            if (optToHeight && height >= *optToHeight) break; // threshold of "to height" reached
+                            else if (height < fromHeight) continue; // keep looping until we hit a height that at least "from height"
+
+                            const auto hash = hashForTxNum(num).value(); // may throw, but that indicates some database inconsistency. we catch below
+                            hist.emplace_back(/* HistoryItem: */ hash, int(height));
+                        }
+                    } catch (const std::exception &e) {
+                        // this item is left as-is (possibly truncated), and is skipped for the mempool below
+                        Warning(Log::Magenta) << "getHistory: " << e.what();
+                        ctrs[i].reset();
+                    }
+                });
+            }
+            if (unconf) {
+                auto [mempool, lock] = this->mempool();
+                if (!p->isCurrent(view)) return false; // a block was committed since we read the db; retry
+                for (size_t i = 0; i < hashXs.size(); ++i) {
+                    if (!ctrs[i]) continue;
+                    if (auto it = mempool.hashXTxs.find(hashXs[i]); it != mempool.hashXTxs.end()) {
+                        const auto & txvec = it->second;
+                        try {
+                            (*ctrs[i])(txvec.size());
+                        } catch (const HistoryTooLarge &e) {
+                            Warning(Log::Magenta) << "getHistory: " << e.what();
+                            continue;
+                        }
+                        auto & hist = ret[i];
+                        hist.reserve(hist.size() + txvec.size());
+                        for (const auto & tx : txvec)
+                            hist.emplace_back(/* HistoryItem: */ tx->hash, tx->hasUnconfirmedParents() ? -1 : 0, tx->fee);
+                    }
                 }
             }
+            return true;
+        });
+    } catch (const std::exception &e) {
+        Warning(Log::Magenta) << __func__ << ": " << e.what();
+    }
+    return ret;
+}
+
+namespace {
+    /// The part of a scripthash_history record that getHistoryPage() returns: up to `limit` of its TxNums that are
+    /// >= startTxNum, plus the TxNum that starts the next page, if any.
+    struct HistoryRecordSlice {
+        TxNumVec nums;
+        std::optional<TxNum> nextTxNum;
+    };
+
+    /// The record is a series of 6-byte TxNums in ascending order (see Serialize(TxNumVec)), so we binary search it in
+    /// place and decode just the slice we need. Throws DatabaseSerializationError if the record has a bad length.
+    HistoryRecordSlice SliceHistoryRecord(const rocksdb::Slice &val, TxNum startTxNum, size_t limit, const QString &err) {
+        HistoryRecordSlice ret;
+        constexpr size_t compactSize = CompactTXO::compactTxNumSize();
+        if (UNLIKELY(val.size() % compactSize != 0u))
+            throw DatabaseSerializationError(QString("%1: Key was retrieved ok, but data has an unexpected length").arg(err));
+        const auto * const base = reinterpret_cast<const std::byte *>(val.data());
+        const auto numAt = [base](size_t i) { return CompactTXO::txNumFromCompactBytes(base + i * compactSize); };
+        const size_t n = val.size() / compactSize;
+        size_t begin = 0;
+        for (size_t hi = n; begin < hi; ) {
+            const size_t mid = begin + (hi - begin) / 2u;
+            if (numAt(mid) < startTxNum) begin = mid + 1u;
+            else hi = mid;
         }
-        if (unconf) {
+        const size_t end = begin + std::min(limit, n - begin);
+        ret.nums.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i)
+            ret.nums.push_back(numAt(i));
+        if (end < n) ret.nextTxNum = numAt(end);
+        return ret;
+    }
+} // namespace
+
+auto Storage::getHistoryPage(const HashX &hashX, TxNum startTxNum, size_t limit, bool includeMempool) const -> HistoryPage
+{
+    HistoryPage ret;
+    if (hashX.length() != HashLen || !limit) return ret;
+    p->withReadView([&](const Pvt::ReadView &view) {
+        ret = HistoryPage{}; // in case we are being re-run against a newer view
+        static const QString err("Error retrieving a history page for a script hash");
+        SortedMultiGet(p->db.shist.get(), view.shistOpts, {hashX}, err, [&](size_t, const rocksdb::Slice *val) {
+            if (!val) return; // no confirmed history
+            const auto slice = SliceHistoryRecord(*val, startTxNum, limit, err);
+            ret.items.reserve(slice.nums.size());
+            for (const TxNum num : slice.nums) {
+                // these may throw, but that indicates some database inconsistency
+                const BlockHeight height = heightForTxNum(num).value();
+                ret.items.emplace_back(/* HistoryItem: */ hashForTxNum(num).value(), int(height));
+            }
+            ret.nextTxNum = slice.nextTxNum;
+        });
+        if (includeMempool && !ret.nextTxNum) {
             auto [mempool, lock] = this->mempool();
+            if (!p->isCurrent(view)) return false; // a block was committed since we read the db; retry
             if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
-                const auto & txvec = it->second;
-                IncrementCtrAndThrowIfExceedsMaxHistory(txvec.size());
-                ret.reserve(ret.size() + txvec.size());
-                for (const auto & tx : txvec)
-                    ret.emplace_back(/* HistoryItem: */ tx->hash, tx->hasUnconfirmedParents() ? -1 : 0, tx->fee);
+                ret.items.reserve(ret.items.size() + it->second.size());
+                for (const auto & tx : it->second)
+                    ret.items.emplace_back(/* HistoryItem: */ tx->hash, tx->hasUnconfirmedParents() ? -1 : 0, tx->fee);
             }
         }
-    } catch (const std::exception &e) {
-        Warning(Log::Magenta) << __func__ << ": " << e.what();
-    }
+        return true;
+    });
     return ret;
 }
 
@@ -4270,13 +5732,9 @@ auto Storage::getRpaHistory(const Rpa::Prefix &prefix, bool includeConfirmed, bo
                             BlockHeight fromHeight, std::optional<BlockHeight> endHeight) const-> History
 {
     History ret;
-    auto IncrementCtrAndThrowIfExceedsMaxHistory = GetMaxHistoryCtrFunc("RPA History", QString("prefix '%1'").arg(QString(prefix.toHex())),
-                                                                        options->rpa.maxHistory);
     double tReadDb = 0., tPfxSearch = 0., tResolveTxIdx = 0., tWaitForLock = 0., tBuildRes = 0.;
 
     Tic t0;
-    SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
-    tWaitForLock += t0.msec<double>();
 
     const int rpaStartHeight = getConfiguredRpaStartHeight();
     if (UNLIKELY(rpaStartHeight < 0)) {
@@ -4286,117 +5744,131 @@ auto Storage::getRpaHistory(const Rpa::Prefix &prefix, bool includeConfirmed, bo
         throw InternalError("RPA is disabled");
     }
 
-    const auto tipHeight = latestHeight();
-    if (UNLIKELY( ! tipHeight)) throw InternalError("No blockchain");
-    if (unsigned(rpaStartHeight) > *tipHeight) {
-        // Nothing to do! Index not yet enabled! Warn here since likely the admin has misconfigured his server.
-        Warning() << "getRpaHistory called but rpa_start_height is " << rpaStartHeight << ", which is greater than the"
-                  << " block chain height of " << *tipHeight << ".\n\nIf you wish to enable RPA indexing, set the RPA"
-                  << " start height to below the blockchain height using the `rpa_start_height` configuration"
-                  << " variable. If, on the other hand, you wish to disable RPA indexing, set `rpa = false` in the"
-                  << " configuration file.\n\n";
-        return ret;
-    }
+    Tic tPin;
+    // the rpa table and tip height don't mutate from underneath our feet in the pinned view
+    p->withReadView([&](const Pvt::ReadView &view) {
+        tWaitForLock += tPin.msec<double>();
+        ret.clear(); // in case we are being re-run against a newer view
+        auto IncrementCtrAndThrowIfExceedsMaxHistory = GetMaxHistoryCtrFunc("RPA History", QString("prefix '%1'").arg(QString(prefix.toHex())),
+                                                                            options->rpa.maxHistory);
+        const auto tipHeight = view.height;
+        if (UNLIKELY( ! tipHeight)) throw InternalError("No blockchain");
+        if (unsigned(rpaStartHeight) > *tipHeight) {
+            // Nothing to do! Index not yet enabled! Warn here since likely the admin has misconfigured his server.
+            Warning() << "getRpaHistory called but rpa_start_height is " << rpaStartHeight << ", which is greater than the"
+                      << " block chain height of " << *tipHeight << ".\n\nIf you wish to enable RPA indexing, set the RPA"
+                      << " start height to below the blockchain height using the `rpa_start_height` configuration"
+                      << " variable. If, on the other hand, you wish to disable RPA indexing, set `rpa = false` in the"
+                      << " configuration file.\n\n";
+            return true;
+        }
 
-    try {
-        if (includeConfirmed) {
-            // sanitize `fromHeight` and `endHeight`; restrict to range: [rpaStartHeight, tipHeight + 1)
-            fromHeight = std::max<unsigned>(rpaStartHeight, fromHeight); // restrict `from` to be >= configured height
-            endHeight = std::min(endHeight.value_or(*tipHeight + 1u), *tipHeight + 1u); // define and restrict `end` to be <= tip height + 1
-
-            // We use an iterator and seek forward each time because this is far faster since our table rows are in order
-            // of height (serialized as big endian). Note that the assumption here is that the rpa table contains
-            // *only* records of the form: Key = 4-byte big endian height, Value = serialized Rpa::PrefixTable.
-            // If this assumption changes, update this code to not use this assumption as an optimization.
-            std::unique_ptr<rocksdb::Iterator> iter{p->db.rpa->NewIterator(p->db.defReadOpts)};
-            if (UNLIKELY(!iter)) throw DatabaseError("Unable to obtain an iterator to the rpa db");
-
-            BlockHeight height = fromHeight;
-            size_t blockScansRemaining = std::max(options->rpa.historyBlockLimit, 1u); // use configured limit (default: 60)
-            for ( /* */; blockScansRemaining && height < *endHeight; ++height, --blockScansRemaining) {
-                Tic t1;
-                const RpaDBKey dbKey(height);
-                if (height == fromHeight)
-                    iter->Seek(ToSlice(dbKey));
-                else
-                    iter->Next(); // bump iterator one item... this is the secret sauce to make this fast.
-                bool ok{};
-                if (UNLIKELY(!iter->Valid() || RpaDBKey::fromBytes(FromSlice(iter->key()), &ok, true) != dbKey || !ok)) {
-                    // This should never happen -- error to console just in case we have bugs and/or missing data.
-                    Error() << "Missing RPA PrefixTable for height: " << height << ". This should never happen."
-                            << " Report this to situation to the developers.";
-                    break;
-                }
-                // Note: This read-only Rpa::PrefixTable is "lazy loaded" and populated only for records we access on-demand
-                const auto valueSlice = iter->value(); // NB: slice is invalidated when iter is modified
-                const auto prefixTable = Deserialize<Rpa::PrefixTable>(FromSlice(valueSlice)); // Throws on failure to deserialize.
-                tReadDb += t1.msec<double>();
-                // Update RpaInfo stats
-                p->rpaInfo.nReads.fetch_add(1, std::memory_order_relaxed);
-                p->rpaInfo.nBytesRead.fetch_add(sizeof(uint32_t) + valueSlice.size(), std::memory_order_relaxed);
-
-                t1 = Tic();
-                const bool needSort = prefix.range().size() > 1u; // if prefix spans multiple rows of table, sort and uniqueify
-                auto txIdxVec = prefixTable.searchPrefix(prefix, needSort);
-                tPfxSearch += t1.msec<double>();
-                if (txIdxVec.empty()) continue; // no match for this prefix at this height, keep going
-
-                IncrementCtrAndThrowIfExceedsMaxHistory(txIdxVec.size());
-
-                t1 = Tic();
-                const auto vecOfOptHashes = hashesForHeightAndPosVec(height, txIdxVec, &g /* <-- tell callee not to re-lock blocksLock */);
-                tResolveTxIdx += t1.msec<double>();
-                t1 = Tic();
-                for (const auto & optHash : vecOfOptHashes) {
-                    if (LIKELY(optHash)) ret.emplace_back(*optHash, int(height));
+        bool inclMempool = includeMempool; // may be modified below, so we copy it in case we are re-run
+        try {
+            if (includeConfirmed) {
+                // sanitize `fromHeight` and `endHeight`; restrict to range: [rpaStartHeight, tipHeight + 1)
+                const BlockHeight from = std::max<unsigned>(rpaStartHeight, fromHeight); // restrict `from` to be >= configured height
+                const BlockHeight end = std::min(endHeight.value_or(*tipHeight + 1u), *tipHeight + 1u); // define and restrict `end` to be <= tip height + 1
+
+                // We use an iterator and seek forward each time because this is far faster since our table rows are in order
+                // of height (serialized as big endian). Note that the assumption here is that the rpa table contains
+                // *only* records of the form: Key = 4-byte big endian height, Value = serialized Rpa::PrefixTable.
+                // If this assumption changes, update this code to not use this assumption as an optimization.
+                std::unique_ptr<rocksdb::Iterator> iter{p->db.rpa->NewIterator(view.rpaOpts)};
+                if (UNLIKELY(!iter)) throw DatabaseError("Unable to obtain an iterator to the rpa db");
+
+                BlockHeight height = from;
+                size_t blockScansRemaining = std::max(options->rpa.historyBlockLimit, 1u); // use configured limit (default: 60)
+                for ( /* */; blockScansRemaining && height < end; ++height, --blockScansRemaining) {
+                    Tic t1;
+                    const RpaDBKey dbKey(height);
+                    if (height == from)
+                        iter->Seek(ToSlice(dbKey));
+                    else
+                        iter->Next(); // bump iterator one item... this is the secret sauce to make this fast.
+                    bool ok{};
+                    if (UNLIKELY(!iter->Valid() || RpaDBKey::fromBytes(FromSlice(iter->key()), &ok, true) != dbKey || !ok)) {
+                        // This should never happen -- error to console just in case we have bugs and/or missing data.
+                        Error() << "Missing RPA PrefixTable for height: " << height << ". This should never happen."
+                                << " Report this to situation to the developers.";
+                        break;
+                    }
+                    // Note: This read-only Rpa::PrefixTable is "lazy loaded" and populated only for records we access on-demand
+                    const auto valueSlice = iter->value(); // NB: slice is invalidated when iter is modified
+                    const auto prefixTable = Deserialize<Rpa::PrefixTable>(FromSlice(valueSlice)); // Throws on failure to deserialize.
+                    tReadDb += t1.msec<double>();
+                    // Update RpaInfo stats
+                    p->rpaInfo.nReads.fetch_add(1, std::memory_order_relaxed);
+                    p->rpaInfo.nBytesRead.fetch_add(sizeof(uint32_t) + valueSlice.size(), std::memory_order_relaxed);
+
+                    t1 = Tic();
+                    const bool needSort = prefix.range().size() > 1u; // if prefix spans multiple rows of table, sort and uniqueify
+                    auto txIdxVec = prefixTable.searchPrefix(prefix, needSort);
+                    tPfxSearch += t1.msec<double>();
+                    if (txIdxVec.empty()) continue; // no match for this prefix at this height, keep going
+
+                    IncrementCtrAndThrowIfExceedsMaxHistory(txIdxVec.size());
+
+                    t1 = Tic();
+                    const auto vecOfOptHashes = hashesForHeightAndPosVec_nolock(height, txIdxVec); // height <= view tip, so stable
+                    tResolveTxIdx += t1.msec<double>();
+                    t1 = Tic();
+                    for (const auto & optHash : vecOfOptHashes) {
+                        if (LIKELY(optHash)) ret.emplace_back(*optHash, int(height));
+                    }
+                    tBuildRes += t1.msec<double>();
                 }
-                tBuildRes += t1.msec<double>();
-            }
 
-            // Special behavior: disable mempool append if we didn't reach past tipHeight
-            if (includeMempool && height <= *tipHeight)
-                includeMempool = false;
-        }
-        if (includeMempool) {
-            auto [mempool, lock] = this->mempool();
-            if (LIKELY(mempool.optPrefixTable)) {
-                const auto origSize = ret.size();
-                const bool needSort = prefix.range().size() > 1u; // if prefix spans multiple rows of mempool table, sort and uniqueify
-                Tic t1;
-                const auto txHashes = mempool.optPrefixTable->searchPrefix(prefix, needSort /* to get unique hashes */);
-                tPfxSearch += t1.msec<double>();
-
-                IncrementCtrAndThrowIfExceedsMaxHistory(txHashes.size());
-
-                t1 = Tic();
-                for (const auto & txHash : txHashes) {
-                    if (auto it = mempool.txs.find(txHash); LIKELY(it != mempool.txs.end())) {
-                        const int height = it->second->hasUnconfirmedParents() ? -1 : 0;
-                        ret.emplace_back(txHash, height, it->second->fee);
-                    } else {
-                        Error() << "Tx: " << Util::ToHexFast(txHash) << " for prefix '" << prefix.toHex() << "'"
-                                << " exists in Mempool prefix table but not in Mempool txs! FIXME!";
+                // Special behavior: disable mempool append if we didn't reach past tipHeight
+                if (inclMempool && height <= *tipHeight)
+                    inclMempool = false;
+            }
+            if (inclMempool) {
+                auto [mempool, lock] = this->mempool();
+                if (!p->isCurrent(view)) { // a block was committed since we read the db; retry
+                    tPin = Tic();
+                    return false;
+                }
+                if (LIKELY(mempool.optPrefixTable)) {
+                    const auto origSize = ret.size();
+                    const bool needSort = prefix.range().size() > 1u; // if prefix spans multiple rows of mempool table, sort and uniqueify
+                    Tic t1;
+                    const auto txHashes = mempool.optPrefixTable->searchPrefix(prefix, needSort /* to get unique hashes */);
+                    tPfxSearch += t1.msec<double>();
+
+                    IncrementCtrAndThrowIfExceedsMaxHistory(txHashes.size());
+
+                    t1 = Tic();
+                    for (const auto & txHash : txHashes) {
+                        if (auto it = mempool.txs.find(txHash); LIKELY(it != mempool.txs.end())) {
+                            const int height = it->second->hasUnconfirmedParents() ? -1 : 0;
+                            ret.emplace_back(txHash, height, it->second->fee);
+                        } else {
+                            Error() << "Tx: " << Util::ToHexFast(txHash) << " for prefix '" << prefix.toHex() << "'"
+                                    << " exists in Mempool prefix table but not in Mempool txs! FIXME!";
+                        }
                     }
+                    // force unconf parent to sort after conf parent txns
+                    std::sort(ret.begin() + origSize, ret.end(), [](const HistoryItem &a, const HistoryItem &b){
+                        int ha = std::max(a.height, -1), hb = std::max(b.height, -1);
+                        if (ha <= 0) ha = 0x7f'ff'ff'fe - ha;  // -1 becomes -> 0x7f'ff'ff'ff, 0 becomes -> 0x7f'ff'ff'fe
+                        if (hb <= 0) hb = 0x7f'ff'ff'fe - hb;
+                        return std::tie(ha, a.hash) < std::tie(hb, b.hash);
+                    });
+                    // uniqueify
+                    auto last = std::unique(ret.begin() + origSize, ret.end());
+                    ret.erase(last, ret.end());
+                    tBuildRes += t1.msec<double>();
+                } else {
+                    // This should never happen for mempool.
+                    Warning() << "Missing RPA PrefixTable for mempool. This should never happen. Contact the developers to report this.";
                 }
-                // force unconf parent to sort after conf parent txns
-                std::sort(ret.begin() + origSize, ret.end(), [](const HistoryItem &a, const HistoryItem &b){
-                    int ha = std::max(a.height, -1), hb = std::max(b.height, -1);
-                    if (ha <= 0) ha = 0x7f'ff'ff'fe - ha;  // -1 becomes -> 0x7f'ff'ff'ff, 0 becomes -> 0x7f'ff'ff'fe
-                    if (hb <= 0) hb = 0x7f'ff'ff'fe - hb;
-                    return std::tie(ha, a.hash) < std::tie(hb, b.hash);
-                });
-                // uniqueify
-                auto last = std::unique(ret.begin() + origSize, ret.end());
-                ret.erase(last, ret.end());
-                tBuildRes += t1.msec<double>();
-            } else {
-                // This should never happen for mempool.
-                Warning() << "Missing RPA PrefixTable for mempool. This should never happen. Contact the developers to report this.";
             }
+        } catch (const std::exception &e) {
+            Warning(Log::Magenta) << __func__ << ": " << e.what();
         }
-    } catch (const std::exception &e) {
-        Warning(Log::Magenta) << __func__ << ": " << e.what();
-    }
+        return true;
+    });
     Debug() << "getRpaHistory returned " << ret.size() << " items"
             << ", readDb: " << QString::number(tReadDb, 'f', 3) << " msec"
             << ", pfxSearch: " << QString::number(tPfxSearch, 'f', 3) << " msec"
@@ -4429,20 +5901,23 @@ auto Storage::listUnspent(const HashX & hashX, const TokenFilterOption tokenFilt
         return ret;
     try {
         auto ShouldFilter = [tokenFilter](const bitcoin::token::OutputDataPtr & p) { return ShouldTokenFilter(tokenFilter, p); };
-        auto IncrementCtrAndThrowIfExceedsMaxHistory = GetMaxHistoryCtrFunc("Unspent UTXOs",
-                                                                            QString("scripthash %1").arg(QString(hashX.toHex())),
-                                                                            options->maxHistory);
         constexpr size_t iota = 10; // we initially reserve this many items in the returned array in order to prevent redundant allocations in the common case.
         std::unordered_set<TXO> mempoolConfirmedSpends;
-        mempoolConfirmedSpends.reserve(iota);
-        ret.reserve(iota);
-        {
-            // take shared lock (ensure history doesn't mutate from underneath our feet)
-            SharedLockGuard g(p->blocksLock);
-            const TxNum veryHighTxNum = getTxNum() + 100000000;  // pick an absurdly high TxNum that is 100 million past current. This is a fudge so sorting works ok for unconfirmed tx's so that they appear at the end.
+        // history doesn't mutate from underneath our feet in the pinned view, and we don't block addBlock (or vice-versa)
+        p->withReadView([&](const Pvt::ReadView &view) {
+            // in case we are being re-run against a newer view
+            ret.clear();
+            mempoolConfirmedSpends.clear();
+            auto IncrementCtrAndThrowIfExceedsMaxHistory = GetMaxHistoryCtrFunc("Unspent UTXOs",
+                                                                                QString("scripthash %1").arg(QString(hashX.toHex())),
+                                                                                options->maxHistory);
+            mempoolConfirmedSpends.reserve(iota);
+            ret.reserve(iota);
+            const TxNum veryHighTxNum = view.txNumNext + 100000000;  // pick an absurdly high TxNum that is 100 million past current. This is a fudge so sorting works ok for unconfirmed tx's so that they appear at the end.
             {
                 // grab mempool utxos for scripthash -- we do mempool first so as to build the "mempoolConfirmedSpends" set as we iterate.
                 auto [mempool, lock] = this->mempool(); // shared lock
+                if (!p->isCurrent(view)) return false; // a block was committed since we pinned the view; retry
                 if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
                     const auto & txvec = it->second;
                     for (const auto & tx : txvec) {
@@ -4489,7 +5964,7 @@ auto Storage::listUnspent(const HashX & hashX, const TokenFilterOption tokenFilt
                 }
             } // release mempool lock
             { // begin confirmed/db search
-                std::unique_ptr<rocksdb::Iterator> iter(p->db.shunspent->NewIterator(p->db.defReadOpts));
+                std::unique_ptr<rocksdb::Iterator> iter(p->db.shunspent->NewIterator(view.shunspentOpts));
                 if (UNLIKELY(!iter)) throw DatabaseError("Unable to obtain an iterator to the shunspent db"); // should never happen
                 const rocksdb::Slice prefix = ToSlice(hashX); // points to data in hashX
 
@@ -4539,7 +6014,8 @@ auto Storage::listUnspent(const HashX & hashX, const TokenFilterOption tokenFilt
                     });
                 }
             } // end confirmed/db search
-        } // release blocks lock
+            return true;
+        });
         std::sort(ret.begin(), ret.end());
         if (const auto sz = ret.size(), cap = ret.capacity(); cap - sz > iota && sz > 0 && double(cap)/double(sz) > 1.20)
             // we only do this if we're wasting enough space (at least iota, and at least 20% space wasted),
@@ -4554,76 +6030,130 @@ auto Storage::listUnspent(const HashX & hashX, const TokenFilterOption tokenFilt
 
 auto Storage::getBalance(const HashX &hashX, TokenFilterOption tokenFilter) const -> std::pair<bitcoin::Amount, bitcoin::Amount>
 {
-    std::pair<bitcoin::Amount, bitcoin::Amount> ret;
-    if (hashX.length() != HashLen)
-        return ret;
+    return getBalances({hashX}, tokenFilter).front();
+}
+
+auto Storage::getBalances(const std::vector<HashX> &hashXs, TokenFilterOption tokenFilter) const
+    -> std::vector<std::pair<bitcoin::Amount, bitcoin::Amount>>
+{
+    std::vector<std::pair<bitcoin::Amount, bitcoin::Amount>> ret(hashXs.size());
     auto ShouldFilter = [tokenFilter](const bitcoin::token::OutputDataPtr & p) { return ShouldTokenFilter(tokenFilter, p); };
-    auto IncrementCtrAndThrowIfExceedsMaxHistory = GetMaxHistoryCtrFunc("GetBalance UTXOs",
-                                                                        QString("scripthash %1").arg(QString(hashX.toHex())),
-                                                                        options->maxHistory);
+    using CtrFunc = decltype(GetMaxHistoryCtrFunc(QString(), QString(), 0u));
+    std::vector<std::optional<CtrFunc>> ctrs(hashXs.size()); // nullopt for invalid hashXs and for items that failed
     try {
-        // take shared lock (ensure history doesn't mutate from underneath our feet)
-        SharedLockGuard g(p->blocksLock);
-        {
-            // confirmed -- read from db using an iterator
-            std::unique_ptr<rocksdb::Iterator> iter(p->db.shunspent->NewIterator(p->db.defReadOpts));
-            if (UNLIKELY(!iter)) throw DatabaseError("Unable to obtain an iterator to the shunspent db"); // should never happen
-            const rocksdb::Slice prefix = ToSlice(hashX); // points to data in hashX
-
-            // Search table for all keys that start with hashx's bytes. Note: the loop end-condition is strange.
-            // See: https://github.com/facebook/rocksdb/wiki/Prefix-Seek-API-Changes#transition-to-the-new-usage
-            rocksdb::Slice key;
-            for (iter->Seek(prefix); iter->Valid() && (key = iter->key()).starts_with(prefix); iter->Next()) {
-                IncrementCtrAndThrowIfExceedsMaxHistory(); // throw if we are iterating too much
-                const CompactTXO ctxo = extractCompactTXOFromShunspentKey(key); // may throw if key has the wrong size, etc
-                bool ok;
-                const auto & [valid, amount, tokenDataPtr] = Deserialize<SHUnspentValue>(FromSlice(iter->value()), &ok);
-                if (UNLIKELY(!ok || !valid))
-                    throw InternalError(QString("Bad SHUnspentValue in db for ctxo %1 (%2)").arg(ctxo.toString(), QString(hashX.toHex())));
-                if (UNLIKELY(!bitcoin::MoneyRange(amount)))
-                    throw InternalError(QString("Out-of-range amount in db for ctxo %1: %2").arg(ctxo.toString()).arg(amount / amount.satoshi()));
-                if ( ! ShouldFilter(tokenDataPtr)) {
-                    ret.first += amount; // tally the result
-                }
-            }
-            if (UNLIKELY(!bitcoin::MoneyRange(ret.first))) {
-                ret.first = bitcoin::Amount::zero();
-                throw InternalError(QString("Out-of-range total in db for getBalance on scripthash: %1").arg(QString(hashX.toHex())));
+        // the balance aggregate doesn't mutate from underneath our feet in the pinned view, and we don't block addBlock
+        p->withReadView([&](const Pvt::ReadView &view) {
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                ret[i] = {}; // in case we are being re-run against a newer view
+                ctrs[i].reset();
+                if (hashXs[i].length() == HashLen)
+                    ctrs[i].emplace(GetMaxHistoryCtrFunc("GetBalance UTXOs", QString("scripthash %1").arg(QString(hashXs[i].toHex())),
+                                                         options->maxHistory));
             }
-        }
-        {
-            // unconfirmed -- check mempool
-            auto [mempool, lock] = this->mempool(); // shared (read only) lock is held until scope end
-            if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
-                // for all tx's involving scripthash
-                bitcoin::Amount utxos, spends;
-                for (const auto & tx : it->second) {
-                    assert(bool(tx));
-                    auto it2 = tx->hashXs.find(hashX);
-                    if (UNLIKELY(it2 == tx->hashXs.end())) {
-                        throw InternalError(QString("scripthash %1 lists tx %2, which then lacks the IOInfo for said hashX! FIXME!")
-                                            .arg(QString(hashX.toHex()), QString(tx->hash.toHex())));
-                    }
-                    auto & info = it2->second;
-                    IncrementCtrAndThrowIfExceedsMaxHistory(info.confirmedSpends.size() + info.utxo.size()); // throw if >maxHistory
-                    for (const auto & [txo, txoinfo] : info.confirmedSpends) {
-                        if ( ! ShouldFilter(txoinfo.tokenDataPtr))
-                            spends += txoinfo.amount;
+            {
+                // confirmed -- a point lookup per hashX of the aggregate maintained by UTXOBatch::add/remove, all in 1 MultiGet
+                static const QString errMsg("Error reading from the scripthash_balance db");
+                std::unique_ptr<rocksdb::Iterator> iter; // only used if options->db.verifyBalance
+                if (UNLIKELY(options->db.verifyBalance)) {
+                    iter.reset(p->db.shunspent->NewIterator(view.shunspentOpts));
+                    if (UNLIKELY(!iter)) throw DatabaseError("Unable to obtain an iterator to the shunspent db"); // should never happen
+                }
+                SortedMultiGet(p->db.shbalance.get(), view.shbalanceOpts, hashXs, errMsg, [&](size_t i, const rocksdb::Slice *val) {
+                    const HashX & hashX = hashXs[i];
+                    auto & confirmed = ret[i].first;
+                    try {
+                        BalanceAggregate agg; // an all-zero record if missing
+                        if (val) {
+                            auto optAgg = BalanceAggregate::fromBytes(val->data(), val->size());
+                            if (UNLIKELY(!optAgg))
+                                throw DatabaseSerializationError(QString("%1: record for %2 has the wrong size (%3)")
+                                                                 .arg(errMsg, QString(hashX.toHex())).arg(val->size()));
+                            agg = *optAgg;
+                        }
+                        (*ctrs[i])(size_t(std::max<int64_t>(agg.count(), 0))); // same limit as when this was a scan
+                        if (UNLIKELY(!agg.isSane()))
+                            throw InternalError(QString("Bad balance aggregate in db for %1: %2").arg(QString(hashX.toHex()), agg.toString()));
+                        confirmed = agg.satsForFilter(tokenFilter) * bitcoin::Amount::satoshi();
+                        if (UNLIKELY(iter)) {
+                            // debug mode: check the aggregate against a scan of scripthash_unspent, and prefer the scan on
+                            // mismatch. We are called in key order, so the seeks below only ever move the iterator forward.
+                            BalanceAggregate scanned;
+                            const rocksdb::Slice prefix = ToSlice(hashX); // points to data in hashX
+
+                            // Search table for all keys that start with hashx's bytes. Note: the loop end-condition is strange.
+                            // See: https://github.com/facebook/rocksdb/wiki/Prefix-Seek-API-Changes#transition-to-the-new-usage
+                            rocksdb::Slice key;
+                            for (iter->Seek(prefix); iter->Valid() && (key = iter->key()).starts_with(prefix); iter->Next()) {
+                                const CompactTXO ctxo = extractCompactTXOFromShunspentKey(key); // may throw if key has the wrong size, etc
+                                bool ok;
+                                const auto & [valid, amount, tokenDataPtr] = Deserialize<SHUnspentValue>(FromSlice(iter->value()), &ok);
+                                if (UNLIKELY(!ok || !valid))
+                                    throw InternalError(QString("Bad SHUnspentValue in db for ctxo %1 (%2)").arg(ctxo.toString(), QString(hashX.toHex())));
+                                if (UNLIKELY(!bitcoin::MoneyRange(amount)))
+                                    throw InternalError(QString("Out-of-range amount in db for ctxo %1: %2").arg(ctxo.toString()).arg(amount / amount.satoshi()));
+                                scanned.apply(amount, bool(tokenDataPtr), +1);
+                            }
+                            if (scanned != agg) {
+                                Warning() << "db_verify_balance: balance aggregate mismatch for " << hashX.toHex() << ", db: "
+                                          << agg.toString() << ", scan: " << scanned.toString();
+                                confirmed = scanned.satsForFilter(tokenFilter) * bitcoin::Amount::satoshi();
+                            }
+                        }
+                        if (UNLIKELY(!bitcoin::MoneyRange(confirmed))) {
+                            confirmed = bitcoin::Amount::zero();
+                            throw InternalError(QString("Out-of-range total in db for getBalance on scripthash: %1").arg(QString(hashX.toHex())));
+                        }
+                    } catch (const std::exception &e) {
+                        // this item is left as-is, and is skipped for the mempool below
+                        Warning(Log::Magenta) << "getBalance: " << e.what();
+                        ctrs[i].reset();
                     }
-                    for (const auto ionum : info.utxo) {
-                        if (decltype(tx->txos.cbegin()) it3; UNLIKELY( ionum >= tx->txos.size()
-                                                                       || !(it3 = tx->txos.cbegin() + ionum)->isValid()) )
-                        {
-                            throw InternalError(QString("scripthash %1 lists tx %2, which then lacks a valid TXO IONum %3 for said hashX! FIXME!")
-                                                .arg(QString(hashX.toHex()), QString(tx->hash.toHex())).arg(ionum));
-                        } else if ( ! ShouldFilter(it3->tokenDataPtr)) {
-                            utxos += it3->amount;
+                });
+            }
+            {
+                // unconfirmed -- check mempool
+                auto [mempool, lock] = this->mempool(); // shared (read only) lock is held until scope end
+                if (!p->isCurrent(view)) return false; // a block was committed since we read the db; retry
+                for (size_t i = 0; i < hashXs.size(); ++i) {
+                    if (!ctrs[i]) continue;
+                    const HashX & hashX = hashXs[i];
+                    auto it = mempool.hashXTxs.find(hashX);
+                    if (it == mempool.hashXTxs.end()) continue;
+                    try {
+                        // for all tx's involving scripthash
+                        bitcoin::Amount utxos, spends;
+                        for (const auto & tx : it->second) {
+                            assert(bool(tx));
+                            auto it2 = tx->hashXs.find(hashX);
+                            if (UNLIKELY(it2 == tx->hashXs.end())) {
+                                throw InternalError(QString("scripthash %1 lists tx %2, which then lacks the IOInfo for said hashX! FIXME!")
+                                                    .arg(QString(hashX.toHex()), QString(tx->hash.toHex())));
+                            }
+                            auto & info = it2->second;
+                            (*ctrs[i])(info.confirmedSpends.size() + info.utxo.size()); // throw if >maxHistory
+                            for (const auto & [txo, txoinfo] : info.confirmedSpends) {
+                                if ( ! ShouldFilter(txoinfo.tokenDataPtr))
+                                    spends += txoinfo.amount;
+                            }
+                            for (const auto ionum : info.utxo) {
+                                if (decltype(tx->txos.cbegin()) it3; UNLIKELY( ionum >= tx->txos.size()
+                                                                               || !(it3 = tx->txos.cbegin() + ionum)->isValid()) )
+                                {
+                                    throw InternalError(QString("scripthash %1 lists tx %2, which then lacks a valid TXO IONum %3 for said hashX! FIXME!")
+                                                        .arg(QString(hashX.toHex()), QString(tx->hash.toHex())).arg(ionum));
+                                } else if ( ! ShouldFilter(it3->tokenDataPtr)) {
+                                    utxos += it3->amount;
+                                }
+                            }
                         }
+                        ret[i].second = utxos - spends; // note this may not be MoneyRange (may be negative), which is ok.
+                    } catch (const std::exception &e) {
+                        Warning(Log::Magenta) << "getBalance: " << e.what();
                     }
                 }
-                ret.second = utxos - spends; // note this may not be MoneyRange (may be negative), which is ok.
             }
-        }
+            return true;
+        });
     } catch (const std::exception &e) {
         Warning(Log::Magenta) << __func__ << ": " << e.what();
     }
@@ -4646,9 +6176,14 @@ auto Storage::getFirstUse(const HashX & hashX) const -> std::optional<FirstUse>
             const TxNum txNum = CompactTXO::txNumFromCompactBytes(reinterpret_cast<const std::byte *>(optba->constData()));
             // NB: Below opt.value() calls may throw, which is what we want.
             const BlockHeight blockHeight = heightForTxNum(txNum).value(); // may throw
+            QString err2;
+            // the same hash as latestTip() reports, i.e. of all 112 bytes of a RandomX header (blocksLock keeps this in range)
+            auto blockHash = TipHashAtHeight(*p->headersFile, *p->headerHashesFile, blockHeight, &err2);
+            if (blockHash.isEmpty())
+                throw DatabaseError(QString("Failed to read the hash of header %1: %2").arg(blockHeight).arg(err2));
             return FirstUse(hashForTxNum(txNum).value(), /* .txHash */
                             blockHeight, /* .height */
-                            BTC::HashRev(headerForHeight(blockHeight).value()) /* .blockHash */);
+                            std::move(blockHash) /* .blockHash */);
         } else {
             // try unconfirmed (mempool)
             auto [mempool, lock] = this->mempool();
@@ -4672,9 +6207,12 @@ auto Storage::getFirstUse(const HashX & hashX) const -> std::optional<FirstUse>
 
 std::vector<QByteArray> Storage::merkleCacheHelperFunc(unsigned int start, unsigned int count, QString *err)
 {
-    auto vec = headersFromHeight_nolock_nocheck(start, count, err); // despite the name of this function, it does take a small lock internally and is thread-safe. we cannot use the public one as that would potentially cause a deadlock here
-    for (auto & ba : vec)
-        ba = BTC::Hash(ba);
+    // Read the precomputed hashes. RecordFile takes a small lock internally and is thread-safe. We cannot use any of the
+    // public header functions as that would potentially cause a deadlock here.
+    if (err) err->clear();
+    auto vec = p->headerHashesFile->readRecords(start, count, err);
+    if (vec.size() != count && err && err->isEmpty())
+        *err = "short header hash count returned from header hashes file";
     return vec;
 }
 
@@ -4737,27 +6275,11 @@ bool Storage::isMaybeRecentlySeenTx(const TxHash &txhash) const
     return p->recentBlockTxHashes.contains(txhash);
 }
 
-void Storage::refreshMempoolHistogram()
-{
-    Tic t0;
-    Mempool::FeeHistogramVec hist;
-    // shared lock
-    {
-        auto [mempool, lock] = this->mempool();
-        hist = mempool.calcCompactFeeHistogram();
-    }
-    // lock exclusively to do the final swap
-    {
-        ExclusiveLockGuard g(p->mempoolLock);
-        p->mempoolFeeHistogram.swap(hist);
-    }
-    if (t0.msec() >= 10) DebugM("Storage::refreshMempoolHistogram took ", t0.msecStr(), " msec");
-}
-
 auto Storage::mempoolHistogram() const -> Mempool::FeeHistogramVec
 {
-    SharedLockGuard g(p->mempoolLock);
-    return p->mempoolFeeHistogram;
+    // cheap: the per-fee-rate sizes are maintained incrementally by the mempool, so this is O(distinct fee rates)
+    auto [mempool, lock] = this->mempool();
+    return mempool.calcCompactFeeHistogram();
 }
 
 
@@ -5063,8 +6585,8 @@ namespace {
     }
 
     struct UndoInfoSerHeader {
-        static constexpr uint16_t defMagic = 0xf12cu, v1Ver = 0x1u, v2Ver = 0x2u, v3Ver = 0x3u;
-        static constexpr auto defVer = v3Ver;
+        static constexpr uint16_t defMagic = 0xf12cu, v1Ver = 0x1u, v2Ver = 0x2u, v3Ver = 0x3u, v4Ver = 0x4u;
+        static constexpr auto defVer = v4Ver;
         uint16_t magic = defMagic; ///< sanity check
         uint16_t ver = defVer; ///< sanity check
         uint32_t len = 0; ///< the length of the entire buffer, including this struct and all data to follow. A sanity check.
@@ -5102,6 +6624,15 @@ namespace {
         /// computes the minimum size given the ser size of the blkInfo struct. Requires that nScriptHashes, nAddUndos, and nDelUndos be already filled-in.
         size_t computeMinimumSize_V3() const { return computeTotalSize_V2(); }
         bool isLenMinimallySane_V3() const { return size_t(len) >= computeMinimumSize_V3(); }
+
+        /* ----------- V4 format (compact: TxNum-relative VarInts instead of txids, hashXs deduped into a table) */
+        /// Each addUndo is >= 3 bytes, each delUndo is >= 6 bytes. The scripthash table holds at least nScriptHashes entries.
+        static constexpr size_t addUndoItemMinSerSize_V4 = 3, delUndoItemMinSerSize_V4 = 6;
+        size_t computeMinimumSize_V4() const {
+            return sizeof(*this) + sizeof(UndoInfo::height) + HashLen + sizeof(BlkInfo) + 1 /* nExtraHashXs VarInt */
+                   + nScriptHashes * HashLen + nAddUndos * addUndoItemMinSerSize_V4 + nDelUndos * delUndoItemMinSerSize_V4;
+        }
+        bool isLenMinimallySane_V4() const { return size_t(len) >= computeMinimumSize_V4(); }
     };
 
     static_assert(std::has_unique_object_representations_v<UndoInfoSerHeader>, "This type is serialized as bytes to db");
@@ -5118,67 +6649,156 @@ namespace {
         return ret;
     }
 
-    // UndoInfo -- serialize to V3 format (fixed 3-byte IONums, dynamically-sized TXOInfo objects)
+    // UndoInfo -- serialize to V4 format. After the fixed part (header, height, hash, blkInfo) comes:
+    //   - VarInt nExtraHashXs, then a table of (nScriptHashes + nExtraHashXs) 32-byte hashXs. The first nScriptHashes
+    //     entries are the .scriptHashes set; the extras are any add/del hashXs not in that set (normally there are none).
+    //   - addUndos: VarInt (txNum - blkInfo.txNum0), VarInt outN, VarInt hashX table index
+    //   - delUndos: VarInt (blkInfo.txNum0 + blkInfo.nTx - txNum), VarInt outN, VarInt hashX table index,
+    //               VarInt amount (sats), VarInt (height - confirmedHeight + 1, or 0 if no height),
+    //               VarInt token data size, followed by that many bytes of token data (with prefix)
+    // TXO txids are not stored; they are recovered from the txNumsFile on load (see UndoInfo::resolveTxHashes).
     template <> QByteArray Serialize(const UndoInfo &u) {
         UndoInfoSerHeader hdr;
-        // fill these in now so that hdr.computeTotalSize works
         hdr.nScriptHashes = uint32_t(u.scriptHashes.size());
         hdr.nAddUndos = uint32_t(u.addUndos.size());
         hdr.nDelUndos = uint32_t(u.delUndos.size());
-        hdr.len = uint32_t(hdr.computeMinimumSize_V3());
         const size_t offset_of_len = offsetof(UndoInfoSerHeader, len);
         QByteArray ret;
-        ret.reserve(int(hdr.len));
-        // 1. header
+        const auto Fail = [&ret](const QString &why) {
+            Warning() << "Serialize UndoInfo fail: " << why << ". FIXME!";
+            ret.clear();
+            return ret;
+        };
+        if (u.txHashesUnresolved) return Fail("txHashes are unresolved");
+        if (u.hash.length() != HashLen) return Fail(QString("hash is not %1 bytes").arg(HashLen));
+
+        // build the hashX -> table index map
+        std::unordered_map<HashX, uint32_t, HashHasher> shIndex;
+        std::vector<const HashX *> extras;
+        shIndex.reserve(u.scriptHashes.size());
+        for (const auto & sh : u.scriptHashes) {
+            if (UNLIKELY(sh.length() != HashLen)) return Fail(QString("scripthash is not %1 bytes").arg(HashLen));
+            shIndex.emplace(sh, uint32_t(shIndex.size()));
+        }
+        const auto IndexOf = [&](const HashX &hashX) -> std::optional<uint32_t> {
+            if (UNLIKELY(hashX.length() != HashLen)) return std::nullopt;
+            auto [it, inserted] = shIndex.try_emplace(hashX, uint32_t(shIndex.size()));
+            if (inserted) extras.push_back(&it->first);
+            return it->second;
+        };
+        const TxNum txNum0 = u.blkInfo.txNum0, txNumEnd = u.blkInfo.txNum0 + u.blkInfo.nTx;
+        // encode the adds and dels first into a separate buffer, since doing so may grow the extras table
+        QByteArray body;
+        body.reserve(QByteArray::size_type(u.addUndos.size() * 6u + u.delUndos.size() * 14u));
+        const auto AppendVarInt = [&body](const uint64_t val) { body.append(VarInt(val).byteArray(false)); };
+        for (const auto & [txo, hashX, ctxo] : u.addUndos) {
+            const auto idx = IndexOf(hashX);
+            if (UNLIKELY(!idx)) return Fail("bad hashX in addUndos");
+            if (UNLIKELY(ctxo.txNum() < txNum0 || ctxo.txNum() >= txNumEnd || ctxo.N() != txo.outN))
+                return Fail(QString("addUndo %1 is not from this block").arg(txo.toString()));
+            AppendVarInt(ctxo.txNum() - txNum0);
+            AppendVarInt(txo.outN);
+            AppendVarInt(*idx);
+        }
+        for (const auto & [txo, info] : u.delUndos) {
+            const auto idx = IndexOf(info.hashX);
+            if (UNLIKELY(!idx || !info.isValid())) return Fail("bad TXOInfo in delUndos");
+            if (UNLIKELY(info.txNum >= txNumEnd || (info.confirmedHeight && *info.confirmedHeight > u.height)))
+                return Fail(QString("delUndo %1 is from the future").arg(txo.toString()));
+            AppendVarInt(txNumEnd - info.txNum);
+            AppendVarInt(txo.outN);
+            AppendVarInt(*idx);
+            AppendVarInt(uint64_t(info.amount / bitcoin::Amount::satoshi()));
+            AppendVarInt(info.confirmedHeight ? uint64_t(u.height - *info.confirmedHeight) + 1u : uint64_t(0));
+            QByteArray tok;
+            BTC::SerializeTokenDataWithPrefix(tok, info.tokenDataPtr.get());
+            AppendVarInt(uint64_t(tok.size()));
+            body.append(tok);
+        }
+
+        ret.reserve(QByteArray::size_type(hdr.computeMinimumSize_V4() + extras.size() * HashLen + body.size()));
+        // 1. header (len is filled-in at the end)
         ret.append(ShallowTmp(&hdr));
         // 2. .height
         ret.append(SerializeScalarNoCopy(u.height));
         // 3. .hash
-        const auto chkHashLen = [&ret](const QByteArray & hash) -> bool {
-            if (hash.length() != HashLen) {
-                Warning() << "hash is not " << HashLen << " bytes. Serialize UndoInfo fail. FIXME!";
-                ret.clear();
-                return false;
-            }
-            return true;
-        };
-        if (!chkHashLen(u.hash)) return ret;
         ret.append(u.hash);
         // 4. .blkInfo
-        const QByteArray blkInfoBytes = Serialize(u.blkInfo);
-        ret.append(blkInfoBytes);
-        // 5. .scriptHashes, 32 bytes each, for all in set
-        for (const auto & sh : u.scriptHashes) {
-            if (UNLIKELY(!chkHashLen(sh))) return ret;
-            ret.append(sh);
-        }
-        // 6. .addUndos, 76 bytes each * nAddUndos
-        for (const auto & [txo, hashX, ctxo] : u.addUndos) {
-            if (UNLIKELY(!chkHashLen(hashX))) return ret;
-            ret.append(txo.toBytes(true  /* force wide (3 byte IONum) */));
-            ret.append(hashX);
-            ret.append(ctxo.toBytes(true /* force wide (3 byte IONum) */));
-        }
-        // 7. .delUndos, >=85 bytes each * nDelUndos
-        for (const auto & [txo, txoInfo] : u.delUndos) {
-            ret.append(txo.toBytes(true));
-            if (UNLIKELY(!chkHashLen(txoInfo.hashX))) return ret;
-            const QByteArray serinfo = Serialize(txoInfo);
-            ret.append(VarInt(uint32_t(serinfo.size())).byteArray(false)); // append size as VarInt (our own internal compact int)
-            ret.append(serinfo);
-        }
-        if (UNLIKELY(ret.length() < QByteArray::size_type(hdr.len))) {
-            Warning() << "unexpected length when serializing an UndoInfo object: " << ret.length() << ". FIXME!";
-            ret.clear();
-            return ret;
-        }
-        // 8. update length since serializing potential token data for each TXOInfo has variable size
+        ret.append(Serialize(u.blkInfo));
+        // 5. hashX table: .scriptHashes, then extras
+        ret.append(VarInt(uint64_t(extras.size())).byteArray(false));
+        for (const auto & sh : u.scriptHashes) ret.append(sh); // same iteration order as when we built shIndex above
+        for (const auto *sh : extras) ret.append(*sh);
+        // 6. & 7. adds & dels
+        ret.append(body);
+        if (UNLIKELY(ret.length() < QByteArray::size_type(hdr.computeMinimumSize_V4()) || size_t(ret.length()) > std::numeric_limits<uint32_t>::max()))
+            return Fail(QString("unexpected length: %1").arg(ret.length()));
+        // 8. update length
         hdr.len = uint32_t(ret.length());
         std::memcpy(ret.data() + offset_of_len, &hdr.len, sizeof(hdr.len));
 
         return ret;
     }
 
+    /// Helper for Deserialize<UndoInfo> below: reads the V4 body (everything after .blkInfo). Throws on error.
+    void DeserializeUndoInfoV4Body(const char *cur, const char *const end, const UndoInfoSerHeader &hdr, UndoInfo &ret) {
+        const auto ReadVarInt = [&cur, end]() -> uint64_t {
+            Span sp{cur, size_t(end - cur)};
+            const VarInt vi = VarInt::deserialize(sp); // this may throw
+            cur = sp.data(); // span was updated to point past the varint
+            return vi.value<uint64_t>(); // this may throw
+        };
+        const auto Check = [](bool assertion, const char *what) {
+            if (UNLIKELY(!assertion)) throw DatabaseSerializationError(what);
+        };
+        // 5. hashX table
+        const uint64_t nExtra = ReadVarInt();
+        const uint64_t nTable = uint64_t(hdr.nScriptHashes) + nExtra;
+        Check(nExtra <= hdr.nAddUndos + uint64_t(hdr.nDelUndos) && uint64_t(end - cur) >= nTable * HashLen, "bad hashX table size");
+        std::vector<HashX> table;
+        table.reserve(nTable);
+        ret.scriptHashes.reserve(hdr.nScriptHashes);
+        for (uint64_t i = 0; i < nTable; ++i, cur += HashLen) {
+            const HashX & sh = table.emplace_back(DeepCpy(cur, HashLen)); // deep copy
+            if (i < hdr.nScriptHashes) ret.scriptHashes.insert(sh); // shallow copy of above
+        }
+        const auto HashXAt = [&](const uint64_t idx) -> const HashX & {
+            Check(idx < table.size(), "hashX index out of range");
+            return table[idx];
+        };
+        const TxNum txNum0 = ret.blkInfo.txNum0, txNumEnd = ret.blkInfo.txNum0 + ret.blkInfo.nTx;
+        // 6. .addUndos
+        ret.addUndos.reserve(hdr.nAddUndos);
+        for (unsigned i = 0; i < hdr.nAddUndos; ++i) {
+            const uint64_t txNumOff = ReadVarInt(), outN = ReadVarInt();
+            const HashX & hashX = HashXAt(ReadVarInt());
+            Check(txNumOff < ret.blkInfo.nTx && outN <= std::numeric_limits<IONum>::max(), "bad addUndo");
+            const CompactTXO ctxo(txNum0 + txNumOff, IONum(outN));
+            ret.addUndos.emplace_back(TXO{{}, IONum(outN)}, hashX, ctxo);
+        }
+        // 7. .delUndos
+        ret.delUndos.reserve(hdr.nDelUndos);
+        for (unsigned i = 0; i < hdr.nDelUndos; ++i) {
+            const uint64_t txNumBack = ReadVarInt(), outN = ReadVarInt();
+            TXOInfo info;
+            info.hashX = HashXAt(ReadVarInt());
+            const uint64_t amount = ReadVarInt(), heightCode = ReadVarInt(), tokLen = ReadVarInt();
+            Check(txNumBack >= 1u && txNumBack <= txNumEnd && outN <= std::numeric_limits<IONum>::max()
+                  && amount <= uint64_t(std::numeric_limits<int64_t>::max()) && heightCode <= uint64_t(ret.height) + 1u
+                  && tokLen <= uint64_t(end - cur), "bad delUndo");
+            info.txNum = txNumEnd - txNumBack;
+            info.amount = int64_t(amount) * bitcoin::Amount::satoshi();
+            if (heightCode) info.confirmedHeight = BlockHeight(ret.height - (heightCode - 1u));
+            if (tokLen) {
+                info.tokenDataPtr = BTC::DeserializeTokenDataWithPrefix(QByteArray::fromRawData(cur, int(tokLen)), 0); // may throw
+                cur += tokLen;
+            }
+            ret.delUndos.emplace_back(TXO{{}, IONum(outN)}, std::move(info));
+        }
+        Check(cur == end, "cur != end");
+        ret.txHashesUnresolved = hdr.nAddUndos || hdr.nDelUndos;
+    }
+
     // UndoInfo -- note this will fail if the byte array has extra bytes at the end
     template <> UndoInfo Deserialize(const QByteArray &ba, bool *ok) {
         UndoInfo ret;
@@ -5197,7 +6817,8 @@ namespace {
         // 1. .header
         const UndoInfoSerHeader hdr = Deserialize<UndoInfoSerHeader>(ba, &myok);;
         if (!chkAssertion(myok && int(hdr.len) == ba.size() && hdr.magic == hdr.defMagic
-                          && ( (hdr.ver == hdr.v3Ver && hdr.isLenMinimallySane_V3())
+                          && ( (hdr.ver == hdr.v4Ver && hdr.isLenMinimallySane_V4())
+                               || (hdr.ver == hdr.v3Ver && hdr.isLenMinimallySane_V3())
                                || (hdr.ver == hdr.v2Ver && hdr.isLenSane_V2())
                                || (hdr.ver == hdr.v1Ver && hdr.isLenSane_V1()) ),
                           "Header sanity check fail"))
@@ -5210,8 +6831,10 @@ namespace {
         // as a flat array without any VarInt info as to the size of each
         const bool isV2 = hdr.ver == hdr.v2Ver;
 
+        const bool isV4 = hdr.ver == hdr.v4Ver;
+
         // print to debug if encountering V1 vs V2
-        DebugM("Deserializing ", isV1 ? "V1" : (isV2 ? "V2" : "V3"), " undo info of length ", hdr.len);
+        DebugM("Deserializing V", hdr.ver, " undo info of length ", hdr.len);
 
         const size_t TXOSerSize = isV1 ? TXO::minSize() : TXO::maxSize();
         const size_t CompactTXOSerSize = isV1 ? CompactTXO::minSize() : CompactTXO::maxSize();
@@ -5235,6 +6858,17 @@ namespace {
         if (!chkAssertion(myok && cur <= end))
             return ret;
         cur += sizeof(BlkInfo);
+        if (isV4) {
+            // V4 has a different, compact, layout from here on
+            try {
+                DeserializeUndoInfoV4Body(cur, end, hdr, ret);
+            } catch (const std::exception &e) {
+                chkAssertion(false, e.what());
+                return ret;
+            }
+            setOk(true);
+            return ret;
+        }
         // 5. .scriptHashes, 32 bytes each * hdr->nScriptHashes
         ret.scriptHashes.reserve(hdr.nScriptHashes);
         for (unsigned i = 0; i < hdr.nScriptHashes; ++i) {
@@ -5292,7 +6926,11 @@ namespace {
         return ret;
     }
 
-    template <> QByteArray Serialize(const TxNumVec &v)
+    template <> QByteArray Serialize(const TxNumVec &v) { return SerializeTxNums(v); }
+    template <> QByteArray Serialize(const PmrTxNumVec &v) { return SerializeTxNums(v); }
+
+    template <typename Vec>
+    QByteArray SerializeTxNums(const Vec &v)
     {
         // this serializes a vector of TxNums to a compact representation (6 bytes, eg 48 bits per TxNum), in little endian byte order
         constexpr auto compactSize = CompactTXO::compactTxNumSize(); /* 6 */
@@ -5367,6 +7005,9 @@ namespace {
 
 #ifdef ENABLE_TESTS
 #include "robin_hood/robin_hood.h"
+
+#include <QRandomGenerator>
+#include <QTemporaryDir>
 namespace {
 
     template<size_t NB>
@@ -5450,5 +7091,693 @@ namespace {
               << " elapsed: " << t0.secsStr(2) << " sec";
     }
     const auto b1 = App::registerBench("txcol", findCollisions);
+
+    /// Generates undo info for a synthetic block shaped roughly like a typical mainnet block: each tx creates a couple
+    /// of outputs and spends a couple of earlier outputs, with scripthashes drawn from a pool so some repeat.
+    struct UndoGen {
+        QRandomGenerator rgen{0x5eed};
+        std::map<TxNum, TxHash> txHashes; // the "txNumsFile"
+        TxNum txNumNext = 1'000'000;
+        BlockHeight height = 500'000;
+
+        QByteArray randHash() {
+            QByteArray ret(HashLen, Qt::Uninitialized);
+            rgen.fillRange(reinterpret_cast<quint32 *>(ret.data()), HashLen / int(sizeof(quint32)));
+            return ret;
+        }
+        const TxHash & hashFor(TxNum n) {
+            auto & h = txHashes[n];
+            if (h.isEmpty()) h = randHash();
+            return h;
+        }
+        std::vector<TxHash> getTxHashes(const std::vector<uint64_t> &nums) {
+            std::vector<TxHash> ret;
+            for (const auto n : nums) ret.push_back(hashFor(n));
+            return ret;
+        }
+        UndoInfo next(unsigned nTx) {
+            UndoInfo u;
+            u.height = ++height;
+            u.hash = randHash();
+            u.blkInfo = BlkInfo(txNumNext, nTx);
+            txNumNext += nTx;
+            std::vector<HashX> pool;
+            for (unsigned i = 0; i < std::max(nTx, 2u); ++i) pool.push_back(randHash());
+            for (TxNum n = u.blkInfo.txNum0; n < txNumNext; ++n) {
+                for (IONum outN = 0, nOut = 1 + rgen.bounded(3); outN < nOut; ++outN) {
+                    const auto & sh = pool[rgen.bounded(quint32(pool.size()))];
+                    u.addUndos.emplace_back(TXO{hashFor(n), outN}, sh, CompactTXO(n, outN));
+                    u.scriptHashes.insert(sh);
+                }
+                if (n == u.blkInfo.txNum0) continue; // coinbase spends nothing
+                for (unsigned j = 0, nIn = 1 + rgen.bounded(3); j < nIn; ++j) {
+                    TXOInfo info;
+                    info.txNum = u.blkInfo.txNum0 - 1 - rgen.bounded(quint32(500'000));
+                    info.hashX = pool[rgen.bounded(quint32(pool.size()))];
+                    info.amount = int64_t(rgen.bounded(quint32(2'000'000'000))) * bitcoin::Amount::satoshi();
+                    info.confirmedHeight = u.height - 1 - rgen.bounded(quint32(10'000));
+                    u.delUndos.emplace_back(TXO{hashFor(info.txNum), IONum(rgen.bounded(4))}, info);
+                    u.scriptHashes.insert(info.hashX);
+                }
+            }
+            return u;
+        }
+    };
+
+    /// The size a V3 undo record would have had (no token data): fixed-size items plus a 1-byte VarInt per delUndo
+    size_t undoV3SerSize(const UndoInfo &u) {
+        UndoInfoSerHeader hdr;
+        hdr.nScriptHashes = uint32_t(u.scriptHashes.size());
+        hdr.nAddUndos = uint32_t(u.addUndos.size());
+        hdr.nDelUndos = uint32_t(u.delUndos.size());
+        return hdr.computeMinimumSize_V3() + u.delUndos.size();
+    }
+
+    void testUndo() {
+        UndoGen gen;
+        const auto Get = [&gen](const std::vector<uint64_t> &nums) { return gen.getTxHashes(nums); };
+        size_t v3Total = 0, v4Total = 0;
+        for (const unsigned nTx : {1u, 2u, 10u, 500u, 3000u}) {
+            const UndoInfo u = gen.next(nTx);
+            QByteArray ba = Serialize(u);
+            if (ba.isEmpty()) throw Exception(QString("Serialize failed for nTx = %1").arg(nTx));
+            bool ok{};
+            UndoInfo u2 = Deserialize<UndoInfo>(ba, &ok);
+            ba.fill('z'); // ensure no shallow copies of buffer exist in deserialized object
+            if (!ok || u2.deserVersion != UndoInfoSerHeader::v4Ver || u2.txHashesUnresolved != (nTx > 0))
+                throw Exception(QString("Deserialize failed for nTx = %1").arg(nTx));
+            u2.resolveTxHashes(Get);
+            if (!(u == u2)) throw Exception(QString("Roundtrip mismatch for nTx = %1: %2 != %3").arg(nTx).arg(u.toDebugString(), u2.toDebugString()));
+            // truncated data must be rejected
+            QByteArray ba2 = Serialize(u);
+            ba2.chop(1);
+            if (Deserialize<UndoInfo>(ba2, &ok); ok) throw Exception("Truncated undo info was not rejected");
+            const size_t v3 = undoV3SerSize(u), v4 = size_t(Serialize(u).size());
+            v3Total += v3; v4Total += v4;
+            Log() << "nTx: " << nTx << ", adds: " << u.addUndos.size() << ", dels: " << u.delUndos.size()
+                  << ", scripthashes: " << u.scriptHashes.size() << " -- V3: " << v3 << " bytes, V4: " << v4 << " bytes";
+        }
+        Log() << "V4 undo is " << QString::number(100.0 * (1.0 - double(v4Total) / double(v3Total)), 'f', 1) << "% smaller than V3";
+        Log() << "Undo ser/deser: ok";
+    }
+
+    void benchUndo() {
+        const unsigned nBlocks = std::getenv("UNDO_BENCH_BLOCKS") ? std::atoi(std::getenv("UNDO_BENCH_BLOCKS")) : 100;
+        const unsigned nTx = std::getenv("UNDO_BENCH_TXS") ? std::atoi(std::getenv("UNDO_BENCH_TXS")) : 2000;
+        Log() << "Generating " << nBlocks << " blocks of " << nTx << " txs (set UNDO_BENCH_BLOCKS / UNDO_BENCH_TXS to change) ...";
+        UndoGen gen;
+        std::vector<UndoInfo> undos;
+        for (unsigned i = 0; i < nBlocks; ++i) undos.push_back(gen.next(nTx));
+        const auto Get = [&gen](const std::vector<uint64_t> &nums) { return gen.getTxHashes(nums); };
+
+        std::vector<QByteArray> sers;
+        size_t v3Bytes = 0, v4Bytes = 0;
+        Tic t0;
+        for (const auto & u : undos) sers.push_back(Serialize(u));
+        t0.fin();
+        for (size_t i = 0; i < undos.size(); ++i) { v3Bytes += undoV3SerSize(undos[i]); v4Bytes += size_t(sers[i].size()); }
+        Log() << "Serialized " << nBlocks << " undos in " << t0.msecStr() << " msec";
+        Log() << "Undo db size for a reorg depth of " << nBlocks << ": V3: " << QString::number(v3Bytes / 1e6, 'f', 2)
+              << " MB, V4: " << QString::number(v4Bytes / 1e6, 'f', 2) << " MB ("
+              << QString::number(100.0 * (1.0 - double(v4Bytes) / double(v3Bytes)), 'f', 1) << "% smaller)";
+        // Load + resolve in reverse order, as a reorg of nBlocks would
+        Tic t1;
+        for (auto it = sers.rbegin(); it != sers.rend(); ++it) {
+            bool ok{};
+            UndoInfo u = Deserialize<UndoInfo>(*it, &ok);
+            if (!ok) throw Exception("Deserialize failed");
+            u.resolveTxHashes(Get);
+        }
+        t1.fin();
+        Log() << "Loaded & resolved undo info for a reorg of " << nBlocks << " blocks in " << t1.msecStr() << " msec ("
+              << QString::number(t1.msec<double>() / nBlocks, 'f', 3) << " msec/block)";
+    }
+
+    const auto t_undo = App::registerTest("undo", testUndo);
+    const auto b_undo = App::registerBench("undo", benchUndo);
+
+    void testBalanceAgg() {
+        using TFO = Storage::TokenFilterOption;
+        const auto sats = bitcoin::Amount::satoshi();
+        BalanceAggregate a, b, c;
+        a.apply(1000 * sats, false, +1);
+        a.apply(7 * sats, true, +1);
+        b.apply(250 * sats, false, +1);
+        c.apply(1000 * sats, false, -1); // spend of the first utxo above
+        if (a.satsForFilter(TFO::IncludeTokens) != 1007 || a.satsForFilter(TFO::ExcludeTokens) != 1000
+                || a.satsForFilter(TFO::OnlyTokens) != 7 || a.count() != 2)
+            throw Exception(QString("Unexpected aggregate: %1").arg(a.toString()));
+        // fold the operands through the merge operator as rocksdb would
+        BalanceSumOperator op;
+        std::string acc;
+        for (const auto & delta : {a, b, c}) {
+            const QByteArray d = delta.toByteArray();
+            const rocksdb::Slice existing(acc);
+            std::string out;
+            if (!op.Merge(rocksdb::Slice(), acc.empty() ? nullptr : &existing, ToSlice(d), &out, nullptr))
+                throw Exception("Merge failed");
+            acc = std::move(out);
+        }
+        const auto res = BalanceAggregate::fromBytes(acc.data(), acc.size());
+        if (!res || *res != BalanceAggregate{250, 1, 7, 1} || !res->isSane())
+            throw Exception(QString("Unexpected merge result: %1").arg(res ? res->toString() : "(bad size)"));
+        // malformed operands must be rejected
+        std::string out;
+        if (op.Merge(rocksdb::Slice(), nullptr, rocksdb::Slice("short"), &out, nullptr))
+            throw Exception("Merge accepted a malformed operand");
+        Log() << "Balance aggregate: ok";
+    }
+
+    const auto t_balanceagg = App::registerTest("balanceagg", testBalanceAgg);
+
+    void testHeaderStore() {
+        QTemporaryDir dir;
+        if (!dir.isValid()) throw Exception("Failed to create a temporary directory");
+        constexpr uint64_t A = BTC::ALPHA_RANDOMX_ACTIVATION_HEIGHT, N = A + 100;
+        const auto RandHeader = [](uint64_t height) {
+            QByteArray ret(BTC::FIXED_HEADER_RECORD_SIZE, '\0');
+            Util::getRandomBytes(ret.data(), height < A ? 80 : ret.size()); // pre-RandomX headers are zero-padded
+            return ret;
+        };
+        std::vector<QByteArray> hdrs;
+        hdrs.reserve(N);
+        for (uint64_t i = 0; i < N; ++i)
+            hdrs.push_back(RandHeader(i));
+        Tic t0;
+        {
+            HeaderStore hs(dir.path(), true);
+            if (!hs.isCompact()) throw Exception("Expected a new datadir to get the compact layout");
+            QString err;
+            for (uint64_t i = 0; i < N; ++i)
+                if (const auto res = hs.appendRecord(hdrs[i], i + 1 == N, &err); !res || *res != i)
+                    throw Exception(QString("Failed to append header %1: %2").arg(i).arg(err));
+            if (hs.appendRecord(QByteArray(BTC::FIXED_HEADER_RECORD_SIZE, '\0'), true, &err) != N)
+                throw Exception("Append past activation height returned the wrong height");
+            hs.truncate(N, &err);
+            if (hs.bytesOnDisk() != A * 80u + (N - A) * BTC::FIXED_HEADER_RECORD_SIZE)
+                throw Exception(QString("Unexpected on-disk size: %1").arg(hs.bytesOnDisk()));
+        }
+        Log() << "Wrote " << N << " headers in compact layout in " << t0.msecStr() << " msec";
+        {
+            // the datadir's layout wins over the option
+            HeaderStore hs(dir.path(), false);
+            if (!hs.isCompact() || hs.numRecords() != N) throw Exception("Reopened store has the wrong layout or size");
+            QString err;
+            for (const uint64_t i : {uint64_t(0), A - 1u, A, N - 1u})
+                if (hs.readRecord(i, &err) != hdrs[i])
+                    throw Exception(QString("Header %1 did not round-trip: %2").arg(i).arg(err));
+            // range read spanning both files
+            const auto recs = hs.readRecords(A - 10u, 20u, &err);
+            if (recs.size() != 20u || !std::equal(recs.begin(), recs.end(), hdrs.begin() + (A - 10u)))
+                throw Exception(QString("Range read across the activation height failed: %1").arg(err));
+            // a pre-RandomX header that isn't zero-padded would be truncated by the compact layout; must be refused
+            if (hs.truncate(A - 5u, &err) != A - 5u || !err.isEmpty())
+                throw Exception(QString("Truncate failed: %1").arg(err));
+            if (hs.appendRecord(RandHeader(A), true, &err))
+                throw Exception("Compact layout accepted a 112-byte header below the activation height");
+            if (hs.readRecords(0, N, &err).size() != A - 5u)
+                throw Exception("Short read after truncate returned the wrong count");
+        }
+        {
+            // TipHashAtHeight(), as used by getFirstUse(): all 112 bytes for a RandomX height, the first 80 otherwise
+            HeaderStore hs(dir.path(), true);
+            RecordFile hashes(dir.path() + QDir::separator() + "header_hashes", HashLen);
+            QString err;
+            for (uint64_t i = hs.numRecords(); i < A + 2u; ++i) // re-append some of what the truncate above removed
+                if (!hs.appendRecord(hdrs[i], i + 1u == A + 2u, &err))
+                    throw Exception(QString("Failed to re-append header %1: %2").arg(i).arg(err));
+            {
+                auto batch = hashes.beginBatchAppend();
+                for (uint64_t i = 0; i < A + 2u; ++i)
+                    if (!batch.append(HeaderHashForRecord(hdrs[i]), &err))
+                        throw Exception(QString("Failed to append header hash %1: %2").arg(i).arg(err));
+            }
+            for (const uint64_t i : {A - 1u, A, A + 1u}) {
+                const bool rx = BTC::IsRandomXBlock(int(i));
+                const auto hash = TipHashAtHeight(hs, hashes, BlockHeight(i), &err);
+                if (hash != (rx ? BTC::HashRev(hdrs[i]) : Util::reversedCopy(HeaderHashForRecord(hdrs[i])))
+                        || (rx && hash == Util::reversedCopy(HeaderHashForRecord(hdrs[i]))))
+                    throw Exception(QString("Unexpected hash for header %1: %2").arg(i).arg(err));
+            }
+            if (!TipHashAtHeight(hs, hashes, BlockHeight(A + 2u), &err).isEmpty())
+                throw Exception("Expected no hash for a header past the end");
+        }
+        Log() << "HeaderStore: ok";
+    }
+
+    const auto t_headerstore = App::registerTest("headerstore", testHeaderStore);
+
+    /// addBlock() with a header prepared by the download pipeline, then undoLatestBlock() of it, both in the same
+    /// session and after a restart (verifier reset to the stored record), must agree on the undo info's hash.
+    void testUndoHash() {
+        constexpr unsigned A = BTC::ALPHA_RANDOMX_ACTIVATION_HEIGHT;
+        const auto RandHash = [] {
+            bitcoin::uint256 ret;
+            Util::getRandomBytes(ret.begin(), ret.size());
+            return ret;
+        };
+        const auto MakeHeader = [&RandHash](unsigned height, const bitcoin::uint256 &hashPrevBlock) {
+            bitcoin::CBlockHeader h;
+            const bool rx = BTC::IsRandomXBlock(int(height));
+            h.nVersion = rx ? 0x20000000 : 1;
+            h.hashPrevBlock = hashPrevBlock;
+            h.hashMerkleRoot = RandHash();
+            h.nTime = 1'700'000'000u + height;
+            h.nBits = 0x1d00ffffu;
+            h.nNonce = height;
+            if (rx) h.hashRandomX = RandHash();
+            return h;
+        };
+        const auto Record = [](const QByteArray &raw) { // as HeaderStore hands it out: zero-padded to 112 bytes
+            QByteArray ret(BTC::FIXED_HEADER_RECORD_SIZE, '\0');
+            std::memcpy(ret.data(), raw.constData(), size_t(raw.size()));
+            return ret;
+        };
+        for (const unsigned height : {A - 1u, A, A + 1u}) {
+            const QByteArray prevRaw = BTC::Serialize(MakeHeader(height - 1u, RandHash()));
+            bitcoin::uint256 link;
+            std::memcpy(link.begin(), BTC::Hash(prevRaw.left(80)).constData(), link.size());
+            const auto hdr = MakeHeader(height, link);
+            QString err;
+            const auto prepared = BTC::HeaderVerifier::prepare(height, hdr, &err);
+            if (!prepared) throw Exception(QString("prepare failed for height %1: %2").arg(height).arg(err));
+            if (BTC::IsRandomXBlock(int(height)) && prepared->raw.size() != BTC::FIXED_HEADER_RECORD_SIZE)
+                throw Exception(QString("Expected a 112-byte header at height %1").arg(height));
+            BTC::HeaderVerifier verif;
+            verif.reset(height, Record(prevRaw));
+            if (!verif.checkPrepared(hdr, *prepared, &err))
+                throw Exception(QString("checkPrepared failed for height %1: %2").arg(height).arg(err));
+            const QByteArray added = UndoHashForVerifierTip(verif, prepared->hash); // as addBlock() stamps it
+            BTC::HeaderVerifier restarted;
+            restarted.reset(height + 1u, Record(prepared->raw));
+            const QByteArray expected = BTC::IsRandomXBlock(int(height)) ? BTC::HashRev(prepared->raw)
+                                                                          : Util::reversedCopy(prepared->hash);
+            if (added != expected || UndoHashForVerifierTip(verif) != added || UndoHashForVerifierTip(restarted) != added
+                    || TipHashForRecord(height, Record(prepared->raw)) != added)
+                throw Exception(QString("Undo hash mismatch for the header at height %1").arg(height));
+        }
+        Log() << "Undo hash: ok";
+    }
+
+    const auto t_undohash = App::registerTest("undohash", testUndoHash);
+
+    void testHistoryPage() {
+        TxNumVec nums;
+        for (TxNum n = 1'000; nums.size() < 100u; n += 1u + nums.size() % 7u)
+            nums.push_back(n);
+        nums.push_back(0xffff'ffff'fff0u); // exercises all 6 bytes of a compact TxNum
+        const size_t n = nums.size();
+        const QByteArray rec = Serialize(nums);
+        const QString err("testHistoryPage");
+        const auto Check = [&](TxNum start, size_t limit, size_t expectBegin, size_t expectEnd) {
+            const auto slice = SliceHistoryRecord(ToSlice(rec), start, limit, err);
+            const TxNumVec expect(nums.begin() + expectBegin, nums.begin() + expectEnd);
+            const auto expectNext = expectEnd < n ? std::optional<TxNum>(nums[expectEnd]) : std::nullopt;
+            if (slice.nums != expect || slice.nextTxNum != expectNext)
+                throw Exception(QString("Unexpected page for cursor %1, limit %2: got %3 items%4")
+                                .arg(start).arg(limit).arg(slice.nums.size())
+                                .arg(slice.nextTxNum ? QString(", next %1").arg(*slice.nextTxNum) : QString()));
+        };
+        Check(0, 10, 0, 10); // cursor 0
+        Check(0, n, 0, n); // limit == n: everything, and no next page
+        Check(0, n + 1u, 0, n);
+        Check(nums[10], 5, 10, 15); // cursor on a record
+        Check(nums[10] + 1u, 5, 11, 16); // mid-record cursor: starts at the next TxNum in the record
+        Check(nums[n - 3u] + 1u, 10, n - 2u, n); // the last page is short
+        Check(nums.back() + 1u, 10, n, n); // cursor past the end
+        // walking the pages with the returned cursor visits every TxNum exactly once
+        TxNumVec walked;
+        for (std::optional<TxNum> cursor = 0; cursor; ) {
+            auto slice = SliceHistoryRecord(ToSlice(rec), *cursor, 7, err);
+            walked.insert(walked.end(), slice.nums.begin(), slice.nums.end());
+            cursor = slice.nextTxNum;
+        }
+        if (walked != nums) throw Exception("Paging through the record did not visit every TxNum exactly once");
+        if (!SliceHistoryRecord(rocksdb::Slice(), 0, 10, err).nums.empty())
+            throw Exception("Expected an empty page for an empty record");
+        try {
+            SliceHistoryRecord(ToSlice(rec.left(rec.size() - 1)), 0, 10, err);
+            throw Exception("A record of a bad length was not rejected");
+        } catch (const DatabaseSerializationError &) {}
+        Log() << "History page: ok";
+    }
+
+    const auto t_historypage = App::registerTest("historypage", testHistoryPage);
+
+    /// Replays a query mix against a synthetic utxoset, scripthash_history & scripthash_unspent, once per block cache
+    /// configuration, and reports the throughput and per-table hit ratios of each. The query mix is read from the file
+    /// named by BLOCKCACHE_BENCH_TRACE if set (one query per line: "<table> <key#>"), otherwise it is generated (with
+    /// a skew towards popular keys) and, if BLOCKCACHE_BENCH_SAVE names a file, written there for later replays.
+    void benchBlockCache() {
+        const auto EnvNum = [](const char *name, size_t def) {
+            const char *v = std::getenv(name);
+            return v && std::atoll(v) > 0 ? size_t(std::atoll(v)) : def;
+        };
+        const size_t nKeys = EnvNum("BLOCKCACHE_BENCH_KEYS", 500'000), nOps = EnvNum("BLOCKCACHE_BENCH_OPS", 500'000);
+        const size_t cacheMem = EnvNum("BLOCKCACHE_BENCH_MEM", 16) * 1024u * 1024u;
+        Log() << "Keys: " << nKeys << ", ops: " << nOps << ", cache: " << cacheMem / 1024u / 1024u << " MiB"
+              << " (set BLOCKCACHE_BENCH_KEYS / BLOCKCACHE_BENCH_OPS / BLOCKCACHE_BENCH_MEM to change)";
+
+        struct Table { const char *name; size_t nKeys; double memFactor; };
+        // ratios as in Storage::startup(), normalized to the 3 tables we have
+        const std::array<Table, 3> tables = {{
+            {"utxoset", nKeys, 0.25 / 0.78},
+            {"scripthash_history", nKeys / 10u, 0.28 / 0.78},
+            {"scripthash_unspent", nKeys / 10u, 0.25 / 0.78},
+        }};
+        enum : size_t { Utxo, Hist, Unspent };
+        const auto Mix = [](uint64_t x) { // splitmix64
+            x += 0x9e3779b97f4a7c15ull;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        };
+        const auto HashFor = [&Mix](size_t table, size_t i) {
+            std::string ret(HashLen, '\0');
+            for (size_t j = 0; j < size_t(HashLen); j += sizeof(uint64_t)) {
+                const uint64_t w = Mix((uint64_t(table) << 56) ^ (uint64_t(i) << 3) ^ j);
+                std::memcpy(ret.data() + j, &w, sizeof(w));
+            }
+            return ret;
+        };
+
+        // the query mix
+        std::vector<std::pair<size_t, size_t>> trace; // (table, key#)
+        trace.reserve(nOps);
+        if (const char *f = std::getenv("BLOCKCACHE_BENCH_TRACE"); f && *f) {
+            QFile file(f);
+            if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+                throw Exception(QString("Cannot open %1").arg(f));
+            while (!file.atEnd()) {
+                const auto parts = file.readLine().simplified().split(' ');
+                if (parts.size() != 2) continue;
+                const auto it = std::find_if(tables.begin(), tables.end(), [&](const Table &t) { return parts[0] == t.name; });
+                bool ok;
+                const size_t k = parts[1].toULongLong(&ok);
+                if (it == tables.end() || !ok || k >= it->nKeys)
+                    throw Exception(QString("Bad trace line: %1").arg(QString(parts.join(' '))));
+                trace.emplace_back(size_t(it - tables.begin()), k);
+            }
+            Log() << "Replaying " << trace.size() << " queries from " << f;
+        } else {
+            QRandomGenerator rgen{0x5eed};
+            for (size_t i = 0; i < nOps; ++i) {
+                const double r = rgen.generateDouble();
+                const size_t t = r < 0.55 ? Utxo : r < 0.80 ? Hist : Unspent;
+                // cubing a uniform variate: the lowest 10% of keys get ~46% of the queries
+                const double u = rgen.generateDouble();
+                trace.emplace_back(t, std::min(size_t(u * u * u * double(tables[t].nKeys)), tables[t].nKeys - 1u));
+            }
+            if (const char *f = std::getenv("BLOCKCACHE_BENCH_SAVE"); f && *f) {
+                QSaveFile file(f);
+                if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+                    throw Exception(QString("Cannot open %1").arg(f));
+                for (const auto & [t, k] : trace)
+                    file.write(QByteArray(tables[t].name) + ' ' + QByteArray::number(qulonglong(k)) + '\n');
+                if (!file.commit()) throw Exception(QString("Cannot write %1").arg(f));
+                Log() << "Saved the query mix to " << f;
+            }
+        }
+
+        // the synthetic DBs
+        QTemporaryDir dir;
+        if (!dir.isValid()) throw Exception("Failed to create temporary directory");
+        const auto DBPath = [&dir](const Table &t) { return (dir.path() + QDir::separator() + t.name).toStdString(); };
+        {
+            Tic t0;
+            for (size_t ti = 0; ti < tables.size(); ++ti) {
+                const Table &t = tables[ti];
+                rocksdb::Options opts;
+                opts.create_if_missing = true;
+                opts.compression = rocksdb::CompressionType::kNoCompression;
+                rocksdb::DB *dbp = nullptr;
+                if (auto st = rocksdb::DB::Open(opts, DBPath(t), &dbp); !st.ok() || !dbp)
+                    throw Exception(QString("Failed to create %1: %2").arg(t.name, StatusString(st)));
+                std::unique_ptr<rocksdb::DB> db(dbp);
+                rocksdb::WriteBatch batch;
+                const auto Put = [&](const std::string &k, const std::string &v) {
+                    batch.Put(k, v);
+                    if (batch.Count() < 10'000) return;
+                    if (auto st = db->Write(rocksdb::WriteOptions(), &batch); !st.ok())
+                        throw Exception(QString("Write to %1 failed: %2").arg(t.name, StatusString(st)));
+                    batch.Clear();
+                };
+                for (size_t i = 0; i < t.nKeys; ++i) {
+                    const std::string h = HashFor(ti, i);
+                    if (ti == Utxo) {
+                        Put(h + std::string(4, char(i)), HashFor(ti + 8u, i).substr(0, 16)); // TXO -> TXOInfo-ish
+                    } else if (ti == Hist) {
+                        // most scripthashes have a few txs, a handful have thousands
+                        const double u = std::max(double(Mix(i) >> 11) * 0x1.0p-53, 1e-9);
+                        const size_t nTx = std::min<size_t>(1u + size_t(std::pow(u, -0.8)), 5'000);
+                        std::string v(nTx * 6u, '\0');
+                        for (size_t j = 0; j < nTx; ++j) std::memcpy(v.data() + j * 6u, HashFor(ti + 8u, i * 8u + j).data(), 6);
+                        Put(h, v);
+                    } else {
+                        for (size_t j = 0, n = 1u + Mix(i) % 8u; j < n; ++j) // HashX + CompactTXO -> amount
+                            Put(h + HashFor(ti + 8u, i * 8u + j).substr(0, 8), std::string(8, char(j)));
+                    }
+                }
+                if (auto st = db->Write(rocksdb::WriteOptions(), &batch); !st.ok())
+                    throw Exception(QString("Write to %1 failed: %2").arg(t.name, StatusString(st)));
+                // push everything out of the memtable and L0 so that all reads go through the block cache
+                db->Flush(rocksdb::FlushOptions());
+                db->CompactRange(rocksdb::CompactRangeOptions(), nullptr, nullptr);
+                if (auto st = db->Close(); !st.ok())
+                    throw Exception(QString("Failed to close %1: %2").arg(t.name, StatusString(st)));
+            }
+            Log() << "Created the synthetic DBs in " << t0.secsStr(1) << " sec";
+        }
+
+        const auto Config = [](Options::DBOpts::BlockCacheType type, bool perTable, bool pin, size_t secondary) {
+            Options::DBOpts dbo;
+            dbo.blockCacheType = type;
+            dbo.blockCachePerTable = perTable;
+            dbo.pinIndexFilter = pin;
+            dbo.secondaryCacheMem = secondary;
+            return dbo;
+        };
+        using BCT = Options::DBOpts::BlockCacheType;
+        const std::vector<std::pair<QString, Options::DBOpts>> configs = {
+            {"lru, shared", Config(BCT::LRU, false, false, 0)},
+            {"lru, per table", Config(BCT::LRU, true, false, 0)},
+            {"lru, per table, pinned", Config(BCT::LRU, true, true, 0)},
+            {"lru, per table, pinned, secondary", Config(BCT::LRU, true, true, cacheMem)},
+            {"hyperclock, shared", Config(BCT::HyperClock, false, false, 0)},
+            {"hyperclock, per table, pinned", Config(BCT::HyperClock, true, true, 0)},
+        };
+        for (const auto & [cname, dbo] : configs) {
+            std::array<std::unique_ptr<rocksdb::DB>, 3> dbs;
+            const auto sharedCache = dbo.blockCachePerTable ? nullptr
+                                                            : MakeBlockCache(dbo, cacheMem, MakeSecondaryCache(dbo.secondaryCacheMem));
+            for (size_t ti = 0; ti < tables.size(); ++ti) {
+                const Table &t = tables[ti];
+                rocksdb::Options opts;
+                opts.statistics = rocksdb::CreateDBStatistics();
+                opts.statistics->set_stats_level(rocksdb::StatsLevel::kExceptHistogramOrTimers);
+                opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(MakeTableOptions(dbo, sharedCache ? sharedCache
+                    : MakeBlockCache(dbo, size_t(cacheMem * t.memFactor), MakeSecondaryCache(size_t(dbo.secondaryCacheMem * t.memFactor))))));
+                rocksdb::DB *dbp = nullptr;
+                if (auto st = rocksdb::DB::Open(opts, DBPath(t), &dbp); !st.ok() || !dbp)
+                    throw Exception(QString("Failed to open %1: %2").arg(t.name, StatusString(st)));
+                dbs[ti].reset(dbp);
+            }
+            std::string val;
+            size_t nFound = 0;
+            const auto Replay = [&] {
+                for (const auto & [ti, k] : trace) {
+                    const std::string h = HashFor(ti, k);
+                    if (ti == Unspent) {
+                        std::unique_ptr<rocksdb::Iterator> it(dbs[ti]->NewIterator(rocksdb::ReadOptions()));
+                        for (it->Seek(h); it->Valid() && it->key().starts_with(h); it->Next())
+                            ++nFound;
+                    } else {
+                        nFound += dbs[ti]->Get(rocksdb::ReadOptions(), ti == Utxo ? h + std::string(4, char(k)) : h, &val).ok();
+                    }
+                }
+            };
+            Replay(); // warm up the cache(s), then measure a second pass
+            for (const auto & db : dbs) db->GetOptions().statistics->Reset();
+            nFound = 0;
+            Tic t0;
+            Replay();
+            t0.fin();
+            QStringList ratios;
+            for (size_t ti = 0; ti < tables.size(); ++ti) {
+                const auto cs = BlockCacheStats(*dbs[ti]->GetOptions().statistics);
+                const QVariant r = cs.value("all").toMap().value("hit ratio");
+                ratios.push_back(QString("%1: %2").arg(tables[ti].name, r.isNull() ? QString("n/a")
+                                                                                   : QString::number(r.toDouble() * 100., 'f', 1) + "%"));
+            }
+            Log() << cname << ": " << QString::number(double(trace.size()) / std::max(t0.secs<double>(), 1e-9), 'f', 0)
+                  << " queries/sec (" << t0.msecStr() << " msec, found: " << nFound << ") -- hit ratio " << ratios.join(", ");
+        }
+    }
+
+    const auto b_blockcache = App::registerBench("blockcache", benchBlockCache);
+
+    /// Measures how long history readers wait on locks while a writer commits blocks to a synthetic scripthash_history
+    /// table, first the old way (readers take the blocks lock shared, the writer holds it exclusively for the whole
+    /// block) and then the new way (readers take an uncontended reorg lock and read against the last published
+    /// snapshot, as Pvt::withReadView does). The writer's per-block work besides its db writes is emulated with a
+    /// sleep of READVIEW_BENCH_BLOCK_MS.
+    void benchReadView() {
+        const auto EnvNum = [](const char *name, size_t def) {
+            const char *v = std::getenv(name);
+            return v && std::atoll(v) > 0 ? size_t(std::atoll(v)) : def;
+        };
+        const size_t nKeys = EnvNum("READVIEW_BENCH_KEYS", 200'000), nBlocks = EnvNum("READVIEW_BENCH_BLOCKS", 50),
+                     nPerBlock = EnvNum("READVIEW_BENCH_BLOCK_KEYS", 5'000), blockMs = EnvNum("READVIEW_BENCH_BLOCK_MS", 50),
+                     nReaders = EnvNum("READVIEW_BENCH_READERS", 8);
+        Log() << "Keys: " << nKeys << ", blocks: " << nBlocks << " of " << nPerBlock << " keys + " << blockMs
+              << " msec, readers: " << nReaders << " (set READVIEW_BENCH_KEYS / READVIEW_BENCH_BLOCKS /"
+              << " READVIEW_BENCH_BLOCK_KEYS / READVIEW_BENCH_BLOCK_MS / READVIEW_BENCH_READERS to change)";
+
+        QTemporaryDir dir;
+        if (!dir.isValid()) throw Exception("Failed to create temporary directory");
+        rocksdb::Options opts;
+        opts.create_if_missing = true;
+        rocksdb::DB *dbp = nullptr;
+        if (auto st = rocksdb::DB::Open(opts, dir.path().toStdString(), &dbp); !st.ok() || !dbp)
+            throw Exception(QString("Failed to create the db: %1").arg(StatusString(st)));
+        const std::unique_ptr<rocksdb::DB> db(dbp);
+        const auto KeyFor = [](size_t i) {
+            std::string ret(HashLen, '\0');
+            for (size_t j = 0; j < size_t(HashLen); j += sizeof(uint64_t)) {
+                const uint64_t w = (uint64_t(i) + 1u) * 0x9e3779b97f4a7c15ull ^ j;
+                std::memcpy(ret.data() + j, &w, sizeof(w));
+            }
+            return ret;
+        };
+        {
+            rocksdb::WriteBatch batch;
+            for (size_t i = 0; i < nKeys; ++i) batch.Put(KeyFor(i), std::string(6u * (1u + i % 16u), char(i)));
+            if (auto st = db->Write(rocksdb::WriteOptions(), &batch); !st.ok())
+                throw Exception(QString("Write failed: %1").arg(StatusString(st)));
+        }
+
+        for (const bool useViews : {false, true}) {
+            Storage::RWLock blocksLock, reorgLock;
+            std::mutex viewMut;
+            using SnapPtr = std::shared_ptr<const rocksdb::Snapshot>;
+            const auto Snap = [&db]{
+                return SnapPtr(db->GetSnapshot(), [d = db.get()](const rocksdb::Snapshot *s){ d->ReleaseSnapshot(s); });
+            };
+            SnapPtr view = Snap(); // guarded by viewMut
+            std::atomic_bool done = false;
+            std::vector<std::vector<int64_t>> waits(nReaders); // nanos, per reader
+
+            std::vector<std::thread> readers;
+            Defer joiner([&]{ done = true; for (auto & t : readers) t.join(); });
+            for (size_t r = 0; r < nReaders; ++r) {
+                readers.emplace_back([&, r]{
+                    std::string val;
+                    for (size_t i = r * 7919u; !done; i += 104729u) {
+                        const auto t0 = Util::getTimeNS();
+                        if (!useViews) {
+                            Storage::SharedLockGuard g(blocksLock);
+                            waits[r].push_back(Util::getTimeNS() - t0);
+                            db->Get(rocksdb::ReadOptions(), KeyFor(i % nKeys), &val);
+                        } else {
+                            Storage::SharedLockGuard g(reorgLock);
+                            const SnapPtr snap = [&]{ std::unique_lock g2(viewMut); return view; }();
+                            waits[r].push_back(Util::getTimeNS() - t0);
+                            rocksdb::ReadOptions ropts;
+                            ropts.snapshot = snap.get();
+                            db->Get(ropts, KeyFor(i % nKeys), &val);
+                        }
+                    }
+                });
+            }
+
+            Tic t0;
+            for (size_t b = 0; b < nBlocks; ++b) {
+                Storage::ExclusiveLockGuard g(blocksLock);
+                rocksdb::WriteBatch batch;
+                for (size_t i = 0; i < nPerBlock; ++i) {
+                    const size_t k = (b * nPerBlock + i) * 31u % nKeys;
+                    batch.Put(KeyFor(k), std::string(6u * (1u + (k + b) % 16u), char(b)));
+                }
+                if (auto st = db->Write(rocksdb::WriteOptions(), &batch); !st.ok())
+                    throw Exception(QString("Write failed: %1").arg(StatusString(st)));
+                std::this_thread::sleep_for(std::chrono::milliseconds(blockMs));
+                if (useViews) {
+                    auto snap = Snap();
+                    std::unique_lock g2(viewMut);
+                    view = std::move(snap);
+                }
+            }
+            t0.fin();
+            joiner.disable(); // join now, before we look at `waits`
+            done = true;
+            for (auto & t : readers) t.join();
+
+            std::vector<int64_t> all;
+            for (const auto & w : waits) all.insert(all.end(), w.begin(), w.end());
+            std::sort(all.begin(), all.end());
+            const auto Pct = [&all](double pct) {
+                return all.empty() ? 0. : double(all[std::min(all.size() - 1u, size_t(pct * double(all.size())))]) / 1e6;
+            };
+            const double total = double(std::accumulate(all.begin(), all.end(), int64_t{0})) / 1e6;
+            Log() << (useViews ? "after (read views)" : "before (blocksLock)") << ": " << all.size() << " reads in "
+                  << t0.secsStr(2) << " sec, lock wait total: " << QString::number(total, 'f', 1) << " msec, avg: "
+                  << QString::number(all.empty() ? 0. : total / double(all.size()), 'f', 4) << " msec, p50: "
+                  << QString::number(Pct(0.50), 'f', 4) << " msec, p99: " << QString::number(Pct(0.99), 'f', 3)
+                  << " msec, max: " << QString::number(all.empty() ? 0. : double(all.back()) / 1e6, 'f', 3) << " msec";
+        }
+    }
+
+    const auto b_readview = App::registerBench("readview", benchReadView);
+    const auto t_utxocache = App::registerTest("utxocache", &Storage::testUTXOCachePeek);
 } // end anon namespace
+
+/* static */
+void Storage::testUTXOCachePeek()
+{
+    QTemporaryDir dir;
+    if (!dir.isValid()) throw Exception("Failed to create a temporary directory");
+    const auto Open = [&dir](const QString &name) {
+        rocksdb::Options opts;
+        opts.create_if_missing = true;
+        rocksdb::DB *dbp = nullptr;
+        if (auto st = rocksdb::DB::Open(opts, (dir.path() + QDir::separator() + name).toStdString(), &dbp); !st.ok() || !dbp)
+            throw Exception(QString("Failed to open %1: %2").arg(name, StatusString(st)));
+        return std::unique_ptr<rocksdb::DB>(dbp);
+    };
+    const auto utxoset = Open("utxoset"), shunspent = Open("scripthash_unspent"), shbalance = Open("scripthash_balance");
+    const rocksdb::ReadOptions ropts;
+    const rocksdb::WriteOptions wopts;
+    const auto RandTXO = [] {
+        QByteArray h(HashLen, Qt::Uninitialized);
+        Util::getRandomBytes(h.data(), size_t(h.size()));
+        return TXO{h, 0};
+    };
+    TXOInfo info;
+    info.amount = 1000 * bitcoin::Amount::satoshi();
+    info.hashX = QByteArray(HashLen, 'x');
+    info.confirmedHeight = 1u;
+    info.txNum = 1u;
+    const TXO inDB = RandTXO(), added = RandTXO(), unknown = RandTXO();
+    GenericDBPut(utxoset.get(), inDB, info, "Failed to put a utxo", wopts);
+    const auto InDB = [&] { return GenericDBGet<TXOInfo>(utxoset.get(), inDB, true, "Failed to get a utxo", false, ropts); };
+    using P = UTXOCache::Peek;
+    {
+        UTXOCache cache("Test UTXOCache", utxoset, shunspent, shbalance, ropts, wopts);
+        cache.put(added, info);
+        cache.remove(inDB); // spent in a block that is not flushed yet: the db row is stale but still there
+        if (!InDB()) throw Exception("Expected the spent utxo's db row to still be there before the flush");
+        if (cache.peek(inDB).status != P::Spent || cache.peek(inDB).info)
+            throw Exception("Expected peek() to report the unflushed spend as spent");
+        if (const auto pk = cache.peek(added); pk.status != P::Found || pk.info != info)
+            throw Exception("Expected peek() to find the unflushed add");
+        if (cache.peek(unknown).status != P::Unknown)
+            throw Exception("Expected peek() to leave a utxo it knows nothing about to the db");
+        cache.flush();
+        if (InDB() || cache.peek(inDB).status != P::Unknown)
+            throw Exception("Expected the flush to delete the spent utxo from the db and forget about it");
+        if (GenericDBGet<TXOInfo>(utxoset.get(), added, true, "Failed to get a utxo", false, ropts) != info)
+            throw Exception("Expected the flush to write the added utxo to the db");
+    }
+    Log() << "UTXOCache peek: ok";
+}
 #endif
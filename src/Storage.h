@@ -81,10 +81,22 @@ public:
     ~Storage() override;
 
     // Mgr interface
-    void startup() override;
+    void startup() override; ///< equivalent to beginStartup({}) followed by completeStartup()
     void cleanup() override;
     // /Mgr
 
+    /// The first half of startup(): loads the meta, the headers (and merkle cache), blkinfo, the txhash2txnum index
+    /// and the undo info. Once this returns, the header-related methods (headerForHeight, latestTip, etc) may be used.
+    /// The slow utxoset, scripthash_unspent, scripthash_balance and RPA checks then run next: right here if
+    /// `slowChecksDone` is empty, or else in the background, in which case `slowChecksDone` is called from the
+    /// background thread once they finish (or fail). May throw.
+    void beginStartup(const std::function<void()> &slowChecksDone);
+    /// The second half of startup(): waits for the slow checks (rethrowing their exception, if any), then finishes
+    /// startup and starts our thread. Must be called from the thread that called beginStartup(). May throw.
+    void completeStartup();
+    /// True once completeStartup() has returned successfully. Thread-safe.
+    bool isStartupComplete() const;
+
     /// returns a string of the form "6.14.6-ed43161" for the rocksdb version that this application is compiled against
     /// NB: The version number is from headers (compile-time) but the commit hash comes from the lib itself (runtime).
     static QString rocksdbVersion();
@@ -123,7 +135,8 @@ public:
     ///   .first - the latest valid height we have synched or -1 if no headers.
     ///   .second - the latest valid chainTip 32-byte sha256 double hash of the header (the chainTip as it's called in
     ///             bitcoind parlance), in bitcoind REVERSED memory order (that is, big endian order, ready for json
-    ///             sending/receiving). (Empty if no headers yet).
+    ///             sending/receiving). (Empty if no headers yet). The header is hashed as serialized: the first 80
+    ///             bytes of a pre-RandomX header record, and all 112 bytes of a RandomX one.
     std::pair<int, HeaderHash> latestTip(Header *header = nullptr) const;
 
     /// Returns the current block height, or an empty optional if no genesisHash and no blocks;
@@ -246,6 +259,24 @@ public:
     History getHistory(const HashX &, bool includeConfirmed, bool includeMempool, BlockHeight fromHeight = 0,
                        std::optional<BlockHeight> optToHeight = std::nullopt) const;
 
+    /// Thread-safe. Like getHistory() but for many scripthashes at once: the confirmed histories are fetched with a
+    /// single RocksDB MultiGet against one pinned read view, and the mempool lock is taken once for all of them.
+    /// Returns one History per input hashX, in the same order. The max_history limit applies to each item separately.
+    std::vector<History> getHistories(const std::vector<HashX> &, bool includeConfirmed, bool includeMempool,
+                                      BlockHeight fromHeight = 0, std::optional<BlockHeight> optToHeight = std::nullopt) const;
+
+    struct HistoryPage {
+        History items;
+        /// If set, there is more confirmed history: pass this as `startTxNum` to get the next page.
+        std::optional<TxNum> nextTxNum;
+    };
+
+    /// Thread-safe. Returns the first `limit` confirmed history items of the scripthash whose TxNum is >= startTxNum,
+    /// and if that exhausts the confirmed history, all of the scripthash's mempool items as well (if includeMempool).
+    /// Only the requested slice of the db record is decoded, and max_history does not apply, so that clients can page
+    /// through histories of any size with bounded memory use on our end.
+    HistoryPage getHistoryPage(const HashX &, TxNum startTxNum, size_t limit, bool includeMempool) const;
+
     /// Thread-safe. Will return a truncated vector if the history size exceeds rpa_max_history. Range is [from, end)
     History getRpaHistory(const Rpa::Prefix &prefix, bool includeConfirmed, bool includeMempool,
                           BlockHeight fromHeight = 0, std::optional<BlockHeight> endHeight = std::nullopt) const;
@@ -270,6 +301,9 @@ public:
 
     /// thread safe -- returns confirmd, unconfirmed balance for a scripthash
     std::pair<bitcoin::Amount, bitcoin::Amount> getBalance(const HashX &, TokenFilterOption) const;
+    /// thread safe -- batched version of the above: one MultiGet of the balance aggregates and one mempool lock
+    /// acquisition for all of the hashXs. Returns one (confirmed, unconfirmed) pair per input hashX, in the same order.
+    std::vector<std::pair<bitcoin::Amount, bitcoin::Amount>> getBalances(const std::vector<HashX> &, TokenFilterOption) const;
 
     //-- scriptHash first use
     struct FirstUse {
@@ -304,6 +338,12 @@ public:
     /// Thread-safe. Query db (but not mempool) for a UTXO, and return its info if found.  May throw on database error.
     /// (Does not take the blocks lock)
     std::optional<TXOInfo> utxoGetFromDB(const TXO &, bool throwIfMissing = false);
+    /// Thread-safe. Batched version of the above: looks up all of `txos` with a single RocksDB MultiGet (issued in key
+    /// order), after first consulting the UTXO cache if one is active. Returns one optional per TXO, in the same order
+    /// as `txos` (nullopt if not found or spent). If `nFromCache` is not null, it receives the number of results that were
+    /// served from the UTXO cache (including TXOs the cache knows to be spent). May throw on database error. (Takes
+    /// the blocks lock, shared, while it consults the UTXO cache)
+    std::vector<std::optional<TXOInfo>> utxoGetManyFromDB(const std::vector<TXO> &txos, size_t *nFromCache = nullptr);
 
     /// Thread-safe. Query the mempool and the DB for a TXO. If the TXO is unspent, will return a valid
     /// optional.  If the TXO is spent or non-existant, will return a !has_value optional. May throw on internal
@@ -325,11 +365,8 @@ public:
     /// Identical to above, but points to the TransactionSubsMgr for this instance.
     TransactionSubsMgr * txSubs() const { return txsubsmgr.get(); }
 
-    /// called from a timer periodically from Controller (see Controller.cpp)
-    /// -- takes locks, updates compact fee histogram for the mempool
-    void refreshMempoolHistogram();
-
-    /// Takes a shared lock and returns the cached mempool histogram (calculated periodically in refreshMempoolHistogram above)
+    /// Takes a shared lock and returns the compact mempool fee histogram, computed on-the-fly from the mempool's
+    /// incrementally-maintained per-fee-rate sizes (see Mempool::calcCompactFeeHistogram).
     Mempool::FeeHistogramVec mempoolHistogram() const;
 
     // -- Tx Hash index based methods
@@ -459,7 +496,8 @@ protected:
         /// Enqueue an add of a utxo -- does not take effect in db until Storage::issueUpdates() is called -- may throw.
         void add(const TXO &, const TXOInfo &, const CompactTXO &);
         /// Enqueue a removal -- does not take effect in db until Storage::issueUpdates() is called -- may throw.
-        void remove(const TXO &, const HashX &, const CompactTXO &);
+        /// `amount` and `hasToken` must match what was passed to add() for this utxo (used to update the balance aggregate).
+        void remove(const TXO &, const HashX &, const CompactTXO &, bitcoin::Amount amount, bool hasToken);
 
     private:
         friend class Storage;
@@ -477,7 +515,8 @@ protected:
     /// Appends header h to the database at height. Note that it is undefined to call this function
     /// if height already exists in the database or if height is more than 1+ latestTip().first. For internal use
     /// in addBlock, basically.
-    void appendHeader(const Header &h, BlockHeight height);
+    /// `precomputedHash`, if not empty, must be the sha256d of the first 80 bytes of `h` (see BTC::HeaderVerifier::prepare)
+    void appendHeader(const Header &h, BlockHeight height, const QByteArray &precomputedHash = {});
     /// Internally called by undoLatestBlock. Call this with the headerVerifier lock held.
     /// Rewinds the headers until the latest header is at the specified height.  May throw on error.
     void deleteHeadersPastHeight(BlockHeight height);
@@ -527,13 +566,27 @@ private:
     void save_impl(SaveSpec override = SaveItem::None); ///< may abort app on database failure (unlikely).
     void saveMeta_impl(); ///< This may throw if db error. Caller should hold locks or be in single-threaded mode.
 
+    void runSlowStartupChecks(); ///< may throw -- the utxoset, scripthash_unspent, scripthash_balance & RPA checks
+    void openHeadersFile(); ///< may throw -- called from startup() before any of the loadCheck* functions below
     void loadCheckHeadersInDB(); ///< may throw -- called from startup()
+    /// Called by loadCheckHeadersInDB(). Repairs the header hash column against `headers` (truncating, spot-checking and
+    /// back-filling it as needed) and returns all of its hashes. May throw.
+    std::vector<HeaderHash> loadCheckHeaderHashes(const std::vector<Header> &headers);
     void loadCheckUTXOsInDB(); ///< may throw -- called from startup()
     void loadCheckShunspentInDB(); ///< may throw -- called from startup()
     void loadCheckRpaDB(); ///< may throw -- called from startup()
+    /// May throw -- called from startup() after the utxo checks. Builds the scripthash_balance table from
+    /// scripthash_unspent if it was never built (older db or interrupted build); verifies it if -C -C was specified.
+    void loadCheckBalanceDB();
     void loadCheckTxNumsFileAndBlkInfo(); ///< may throw -- called from startup()
     void loadCheckTxHash2TxNumMgr(); ///< may throw -- called from startup()
     void loadCheckEarliestUndo(); ///< may throw -- called from startup()
+    /// Called from loadCheckTxNumsFileAndBlkInfo. Returns true if blkInfos was populated from the snapshot file written
+    /// by saveBlkInfoSnapshot() at the last clean shutdown, false if the snapshot is missing or stale (caller must then
+    /// fall back to scanning the blkinfo table). May throw only on a hard db read error.
+    bool loadBlkInfoSnapshot(int tipHeight);
+    /// Called from cleanup. Writes blkInfos to a compact file so the next startup can skip the full blkinfo table scan.
+    void saveBlkInfoSnapshot() const;
     void checkUpgradeDBVersion(); ///< may throw -- called from startup() as the last thing
 
     std::optional<Header> headerForHeight_nolock(BlockHeight height, QString *errMsg = nullptr) const;
@@ -550,9 +603,18 @@ private:
 
     // Called by heightForTxNum which calls this with the blockInfo lock held
     std::optional<unsigned> heightForTxNum_nolock(TxNum) const;
+    /// Like hashesForHeightAndPosVec() but takes no blocksLock. The caller must ensure `height` cannot be undone while
+    /// this runs (e.g. by reading against a pinned ReadView, or by holding blocksLock).
+    std::vector<std::optional<TxHash>> hashesForHeightAndPosVec_nolock(BlockHeight height, Span<const uint32_t> positionsInBlock) const;
 
     /// Writes to the RPA table. Called from addBlock()
     void addRpaDataForHeight_nolock(BlockHeight height, const QByteArray &serializedRpaPrefixTable);
+
+#ifdef ENABLE_TESTS
+public:
+    /// Checks what UTXOCache::peek() reports for unflushed adds and spends (the "utxocache" test)
+    static void testUTXOCachePeek();
+#endif
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(Storage::SaveSpec)
@@ -20,27 +20,21 @@
 #include "Util.h"
 
 #include "bitcoin/hash.h"
+#include "robin_hood/robin_hood.h"
 
+#include <QMetaObject>
 #include <QThread>
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cmath>
+#include <cstring>
+#include <iterator>
 #include <mutex>
-
-/* static */ std::atomic_int64_t Subscription::nGlobalInstances = 0;
-
-Subscription::Subscription(const HashX &k)
-    : QObject(nullptr), key(k)
-{
-    ++nGlobalInstances;
-}
-
-Subscription::~Subscription()
-{
-    if (const auto n = --nGlobalInstances; UNLIKELY(n < 0))
-        // should never happen
-        Error() << "BUG! Subscription::nGlobalInstances (" << n << ") is negative! FIXME!";
-}
+#include <new>
+#include <unordered_map>
+#include <vector>
 
 namespace {
     using LockGuard = std::lock_guard<std::mutex>;
@@ -50,32 +44,363 @@ namespace {
     constexpr const char *kRemoveZombiesTimerName = "ZombieTimer";
 
     constexpr bool debugPrint = false; ///< some of the more performance critical code in this file has its trace/debug prints compiled in or out based on this flag.
-}
+
+    /// Subscription keys are stored inline as raw bytes rather than as (heap-allocated) QByteArrays.
+    using Key = std::array<char, HashLen>;
+
+    bool ToKey(const HashX &hx, Key &out) noexcept {
+        if (UNLIKELY(hx.size() != HashLen)) return false;
+        std::memcpy(out.data(), hx.constData(), HashLen);
+        return true;
+    }
+    HashX FromKey(const Key &k) { return HashX(k.data(), HashLen); }
+
+    /// Keys come from clients, so we don't trust their leading bytes to be uniformly distributed: we mix all 32 bytes
+    /// with a per-process random seed.
+    uint64_t KeyHash(const Key &k) noexcept {
+        static const uint64_t seed = [] {
+            uint64_t ret;
+            Util::getRandomBytes(reinterpret_cast<std::byte *>(&ret), sizeof(ret));
+            return ret;
+        }();
+        std::array<uint64_t, HashLen / sizeof(uint64_t)> w;
+        std::memcpy(w.data(), k.data(), HashLen);
+        uint64_t h = seed;
+        for (const uint64_t x : w) {
+            h = (h ^ x) * 0x9e37'79b9'7f4a'7c15ull;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+    struct KeyHasher { size_t operator()(const Key &k) const noexcept { return size_t(KeyHash(k)); } };
+
+    /// The sorted ids of the clients subscribed to a key. The (very common) single-client case is stored inline, larger
+    /// lists live in a heap array. 16 bytes, versus ~56 bytes + ~32 bytes per client for a std::unordered_set.
+    class ClientIdList {
+        union { quint64 one; quint64 *many; };
+        uint32_t n = 0, cap = 0; ///< cap == 0 means `one` is the active member
+    public:
+        ClientIdList() noexcept : one{} {}
+        ClientIdList(ClientIdList &&o) noexcept : n{o.n}, cap{o.cap} {
+            if (cap) many = o.many; else one = o.one;
+            o.n = o.cap = 0;
+        }
+        ClientIdList & operator=(ClientIdList &&o) noexcept {
+            if (this != &o) { this->~ClientIdList(); new (this) ClientIdList(std::move(o)); }
+            return *this;
+        }
+        ClientIdList(const ClientIdList &) = delete;
+        ClientIdList & operator=(const ClientIdList &) = delete;
+        ~ClientIdList() { if (cap) delete [] many; }
+
+        const quint64 *begin() const noexcept { return cap ? many : &one; }
+        const quint64 *end() const noexcept { return begin() + n; }
+        size_t size() const noexcept { return n; }
+        bool empty() const noexcept { return !n; }
+        size_t heapBytes() const noexcept { return cap * sizeof(quint64); }
+
+        /// Returns false if `id` was already present.
+        bool insert(quint64 id) {
+            const quint64 *pos = std::lower_bound(begin(), end(), id);
+            if (pos != end() && *pos == id) return false;
+            const size_t idx = size_t(pos - begin());
+            if (!n) {
+                one = id;
+            } else {
+                if (n == std::max(cap, 1u)) {
+                    const uint32_t newCap = std::max(cap * 2u, 4u);
+                    quint64 *arr = new quint64[newCap];
+                    std::copy(begin(), end(), arr);
+                    if (cap) delete [] many;
+                    many = arr;
+                    cap = newCap;
+                }
+                std::copy_backward(many + idx, many + n, many + n + 1);
+                many[idx] = id;
+            }
+            ++n;
+            return true;
+        }
+        /// Returns false if `id` was not present.
+        bool erase(quint64 id) {
+            const quint64 *pos = std::lower_bound(begin(), end(), id);
+            if (pos == end() || *pos != id) return false;
+            if (!cap) { n = 0; return true; }
+            const size_t idx = size_t(pos - begin());
+            std::copy(many + idx + 1, many + n, many + idx);
+            if (--n == 1) {
+                // back to inline storage
+                const quint64 last = many[0];
+                delete [] many;
+                one = last;
+                cap = 0;
+            }
+            return true;
+        }
+    };
+
+    /// A single subscription to a "HashX" key.
+    struct SubEntry {
+        Key key;
+        ClientIdList clients;
+        /// The last status sent out as a notification. If it has_value, it's guaranteed to be the most recent one
+        /// announced to clients, so it is suitable for use in the respone to e.g. blockchain.scripthash.subscribe (iff
+        /// has_value).
+        SubStatus lastStatusNotified;
+        /// The last status that was computed as the result of a blockchain.[scripthash|dsproof].subscribe RPC call
+        /// This status is returned as the immediate result for subsequent .subscribe calls after the first client
+        /// subscribes (as a performance optimization).  This value is correctly maintained by the notification
+        /// mechanism in collaboration with Servers.cpp.  In rare cases it is not the most recent possible status since
+        /// it is a slightly delayed value -- but that's ok as a future notification to a client will rectify the
+        /// situation with the most up-to-date status in the near future anyway.
+        SubStatus cachedStatus;
+        /// The last time this sub was accessed in milliseconds (Util::getTime()). If the ts goes beyond 1 minute in the
+        /// past, and it has no clients attached, its entry may be removed.
+        int64_t tsMsec = Util::getTime();
+
+        void updateTS() { tsMsec = Util::getTime(); }
+    };
+
+    /// Open-addressing (linear probing) index over a dense array of SubEntry. Each slot holds an entry's index plus
+    /// the upper 32 bits of its hash, so that most probes don't touch the entry itself. There is no single-entry
+    /// erase: entries only ever go away in bulk (zombie removal), which compacts the array and rebuilds the index.
+    /// Not thread-safe; guarded by the owning stripe's lock.
+    class SubTable {
+        std::vector<SubEntry> entries;
+        std::vector<uint64_t> slots; ///< 0 = empty, otherwise (hash & kTagMask) | (index + 1)
+        static constexpr uint64_t kTagMask = 0xffff'ffff'0000'0000ull, kIdxMask = ~kTagMask;
+        static constexpr size_t kMinSlots = 16;
+
+        void place(uint64_t h, size_t idx) noexcept {
+            const size_t mask = slots.size() - 1u;
+            size_t i = h & mask;
+            while (slots[i]) i = (i + 1u) & mask;
+            slots[i] = (h & kTagMask) | uint64_t(idx + 1u);
+        }
+        void rebuild(size_t nSlots) {
+            slots.assign(nSlots, 0u);
+            for (size_t i = 0; i < entries.size(); ++i)
+                place(KeyHash(entries[i].key), i);
+        }
+    public:
+        size_t size() const noexcept { return entries.size(); }
+        size_t numSlots() const noexcept { return slots.size(); }
+        size_t memoryUsage() const noexcept {
+            size_t ret = entries.capacity() * sizeof(SubEntry) + slots.capacity() * sizeof(uint64_t);
+            for (const auto & e : entries) ret += e.clients.heapBytes();
+            return ret;
+        }
+        std::vector<SubEntry> & all() noexcept { return entries; }
+        const std::vector<SubEntry> & all() const noexcept { return entries; }
+
+        SubEntry * find(const Key &k, uint64_t h) noexcept {
+            if (slots.empty()) return nullptr;
+            const size_t mask = slots.size() - 1u;
+            for (size_t i = h & mask; slots[i]; i = (i + 1u) & mask)
+                if ((slots[i] & kTagMask) == (h & kTagMask))
+                    if (auto & e = entries[(slots[i] & kIdxMask) - 1u]; e.key == k)
+                        return &e;
+            return nullptr;
+        }
+        /// Returns the entry and whether it was newly inserted. Invalidates previously returned pointers.
+        std::pair<SubEntry *, bool> findOrInsert(const Key &k, uint64_t h) {
+            if (auto *e = find(k, h)) return {e, false};
+            if ((entries.size() + 1u) * 2u > slots.size()) // keep the load factor <= 0.5
+                rebuild(std::max(kMinSlots, slots.size() * 2u));
+            entries.push_back(SubEntry{k, {}, {}, {}});
+            place(h, entries.size() - 1u);
+            return {&entries.back(), true};
+        }
+        /// Removes all entries for which pred(entry) is true, shrinking memory if the table became sparse. Returns the
+        /// number of entries removed.
+        template <typename Pred>
+        size_t eraseIf(Pred &&pred) {
+            size_t ret = 0;
+            for (size_t i = 0; i < entries.size(); /* */) {
+                if (pred(entries[i])) {
+                    if (i + 1u != entries.size()) entries[i] = std::move(entries.back());
+                    entries.pop_back();
+                    ++ret;
+                } else
+                    ++i;
+            }
+            if (ret) {
+                if (entries.capacity() > 2u * entries.size() + kMinSlots) entries.shrink_to_fit();
+                if (entries.empty()) { slots.clear(); slots.shrink_to_fit(); }
+                else rebuild(std::max(kMinSlots, std::bit_ceil(entries.size() * 2u)));
+            }
+            return ret;
+        }
+    };
+} // namespace
+
+/// Per-client-thread queue of notifications for the clients that live in that thread. The SubsMgr thread appends to
+/// it in batches, and a single queued call per batch drains it in the client thread (rather than one queued signal
+/// per subscription per client, as would be the case with Qt signal delivery). Lives in the client thread.
+struct SubsMgr::Mailbox : QObject
+{
+    struct Item {
+        quint64 clientId;
+        HashX key;
+        SubStatus status;
+        bool unsubscribe; ///< if true, the sub is going away: send an empty status and unsubscribe the client
+    };
+
+    explicit Mailbox(SubsMgr *mgr) : mgr(mgr) {}
+
+    /// Thread-safe. Called from the SubsMgr thread.
+    void post(std::vector<Item> &&batch) {
+        bool wasEmpty;
+        {
+            LockGuard g(mut);
+            wasEmpty = items.empty();
+            if (wasEmpty) items = std::move(batch);
+            else items.insert(items.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+        }
+        if (wasEmpty)
+            QMetaObject::invokeMethod(this, [this]{ drain(); }, Qt::QueuedConnection);
+    }
+
+    /// Runs in the client thread. Invokes the subscribed callbacks for the items posted so far.
+    void drain();
+
+    std::mutex mut; ///< guards `items`
+    std::vector<Item> items;
+    std::mutex mgrMut; ///< guards `mgr`, which is nulled when the SubsMgr is destroyed
+    SubsMgr *mgr;
+    QMetaObject::Connection threadFinishedConn;
+};
 
 struct SubsMgr::Pvt
 {
-    std::mutex mut;
-    std::unordered_map<HashX, SubsMgr::SubRef, HashHasher> subs;
+    static constexpr size_t kStripeBits = 6, kStripes = size_t(1) << kStripeBits, kClientStripes = 16;
+
+    struct alignas(64) Stripe {
+        mutable std::mutex mut;
+        SubTable table;
+    };
+    std::array<Stripe, kStripes> stripes;
+    Stripe & stripeFor(uint64_t h) noexcept { return stripes[h >> (64u - kStripeBits)]; }
+
+    /// Per-client state. Only ever mutated from the client's own thread (subscribe/unsubscribe/destruction), but read
+    /// from the SubsMgr thread to route notifications, hence the lock.
+    struct ClientRec {
+        RPC::ConnectionBase *conn = nullptr;
+        std::shared_ptr<Mailbox> mailbox;
+        QMetaObject::Connection destroyedConn;
+        robin_hood::unordered_map<Key, StatusCallback, KeyHasher> callbacks;
+    };
+    struct alignas(64) ClientStripe {
+        std::mutex mut;
+        std::unordered_map<quint64, ClientRec> recs;
+    };
+    std::array<ClientStripe, kClientStripes> clientStripes;
+    ClientStripe & clientStripeFor(quint64 id) noexcept { return clientStripes[id % kClientStripes]; }
+
+    std::mutex mailboxesMut;
+    std::unordered_map<QThread *, std::shared_ptr<Mailbox>> mailboxes;
+
+    std::mutex mut; ///< guards pendingNotificatons
     std::unordered_set<HashX, HashHasher> pendingNotificatons;
 
-    static std::atomic_int64_t nGlobalClientSubsActive;
-    std::atomic_int64_t nClientSubsActive{0};
+    static std::atomic_int64_t nGlobalClientSubsActive, nGlobalSubs;
+    std::atomic_int64_t nClientSubsActive{0}, nSubs{0};
     std::atomic_uint64_t cacheHits{0}, cacheMisses{0};
 
-    static constexpr size_t kSubsReserveSize = 16384;
     Pvt() {
-        subs.reserve(kSubsReserveSize);
         pendingNotificatons.reserve(kRecommendedPendingNotificationsReserveSize);
     }
+    ~Pvt() {
+        // sever all ties from client objects and client threads back to us
+        for (auto & cs : clientStripes) {
+            LockGuard g(cs.mut);
+            for (auto & [id, rec] : cs.recs)
+                QObject::disconnect(rec.destroyedConn);
+        }
+        LockGuard g(mailboxesMut);
+        for (auto & [thr, mb] : mailboxes) {
+            QObject::disconnect(mb->threadFinishedConn);
+            LockGuard g2(mb->mgrMut);
+            mb->mgr = nullptr;
+        }
+        nGlobalSubs -= nSubs;
+        nGlobalClientSubsActive -= nClientSubsActive;
+    }
+
     /// call this with the lock held
     inline void clearPending_nolock() {
         decltype(pendingNotificatons) emptySet;
         pendingNotificatons.swap(emptySet);
         pendingNotificatons.reserve(kRecommendedPendingNotificationsReserveSize);
     }
+
+    /// Notifications about to be posted, grouped by destination mailbox.
+    using Batches = std::unordered_map<Mailbox *, std::pair<std::shared_ptr<Mailbox>, std::vector<Mailbox::Item>>>;
+
+    /// Appends an item for each of `clientIds` to `batches`. Takes the client stripe locks.
+    void route(const std::vector<quint64> &clientIds, const HashX &key, const SubStatus &status, bool unsubscribe,
+               Batches &batches) {
+        for (const auto id : clientIds) {
+            std::shared_ptr<Mailbox> mb;
+            {
+                auto & cs = clientStripeFor(id);
+                LockGuard g(cs.mut);
+                if (auto it = cs.recs.find(id); it != cs.recs.end())
+                    mb = it->second.mailbox;
+            }
+            if (UNLIKELY(!mb)) continue; // client is gone
+            auto & [ref, items] = batches[mb.get()];
+            if (!ref) ref = std::move(mb);
+            items.push_back(Mailbox::Item{id, key, status, unsubscribe});
+        }
+    }
+    static void post(Batches &batches) {
+        for (auto & [ign, pair] : batches)
+            pair.first->post(std::move(pair.second));
+        batches.clear();
+    }
 };
 
 /*static*/ std::atomic_int64_t SubsMgr::Pvt::nGlobalClientSubsActive{0};
+/*static*/ std::atomic_int64_t SubsMgr::Pvt::nGlobalSubs{0};
+
+void SubsMgr::Mailbox::drain()
+{
+    std::vector<Item> batch;
+    {
+        LockGuard g(mut);
+        batch.swap(items);
+    }
+    LockGuard g(mgrMut);
+    if (UNLIKELY(!mgr)) return; // SubsMgr is gone (app shutdown)
+    for (const auto & item : batch) {
+        Key k;
+        if (UNLIKELY(!ToKey(item.key, k))) continue;
+        StatusCallback cb;
+        RPC::ConnectionBase *c = nullptr;
+        {
+            // Take a copy of the callback, since it may re-enter us (e.g. if it ends up unsubscribing the client).
+            auto & cs = mgr->p->clientStripeFor(item.clientId);
+            LockGuard g2(cs.mut);
+            if (const auto it = cs.recs.find(item.clientId); it != cs.recs.end())
+                if (const auto it2 = it->second.callbacks.find(k); it2 != it->second.callbacks.end()) {
+                    cb = it2->second;
+                    c = it->second.conn;
+                }
+        }
+        if (!cb) continue; // client unsubscribed or was deleted since the notification was posted
+        if (!item.unsubscribe) {
+            cb(item.key, item.status);
+        } else {
+            // tell client the sub is gone -- send them an empty status immediately
+            cb(item.key, {});
+            DebugM("unsubscribe requested, proceeding to unsubscribe client ", item.clientId, " for key ",
+                   item.key.toHex(), " ...");
+            // just call unsubscribe. this will zombify this sub and it will be deleted
+            mgr->unsubscribe(c, item.key, false /* don't update ts */);
+        }
+    }
+}
 
 SubsMgr::LimitReached::~LimitReached() {} // vtable
 
@@ -127,88 +452,75 @@ void SubsMgr::doNotifyAllPending()
     size_t ctr = 0, ctrSH = 0;
     bool emitQueueEmpty = false;
     const bool useCache = useStatusCache();
-    std::vector<SubRef> pending; // this ends up being the intersection of the sh's in p->pendingNotifications and p->subs
+    std::unordered_set<HashX, HashHasher> pending;
     {
         LockGuard g(p->mut);
-        const bool pendingWasEmpty = p->pendingNotificatons.empty();
-        if (!pendingWasEmpty && !p->subs.empty()) {
-            const size_t pnsize = p->pendingNotificatons.size(), subsize = p->subs.size();
-            pending.reserve(std::min(pnsize, subsize));
-            // The loop should always loop through the smaller structure, as a performance optimization, hence
-            // this `if` here.
-            if (pnsize < subsize) {
-                // p->pendingNotifications is smaller, loop over that, doing constant-time checks against the larger
-                // p->subs for each scripthash.
-                // Under current BCH typical network usage, this is usually the more likely branch, unless blocks are
-                // full or the network is very busy, in which case the other branch is more likely.
-                for (const auto & sh : p->pendingNotificatons) {
-                    if (const auto it = p->subs.find(sh); it != p->subs.end()) {
-                        pending.push_back( it->second );
-                    }
-                }
-            } else {
-                // p->subs is smaller (or equal), loop over that, doing constant-time checks against the larger
-                // p->pendingNotification for each scripthash.
-                for (const auto & [sh, subref] : p->subs) {
-                    if (p->pendingNotificatons.count(sh)) {
-                        pending.push_back( subref );
-                    }
-                }
-            }
-        }
+        emitQueueEmpty = !p->pendingNotificatons.empty(); // emit queueEmpty below only if it wasn't empty before
+        pending.swap(p->pendingNotificatons);
         p->clearPending_nolock();
-        emitQueueEmpty = !pendingWasEmpty; // emit queueEmpty below only if it wasn't empty before
     }
     if (emitQueueEmpty) {
         // defensive programming nit, let's emit the signal with no locks held in case somebody someday connects this
         // signal via a direct connection to a slot in this thread that then tries to take the same lock.
         emit queueEmpty();
     }
-    // at this point we got all the subrefs for the scripthashes that changed.. and the lock is released .. now run through them all and notify each
-    for (const auto & sub : pending) {
-        HashX sh; // we take a copy of this from sub in the block below with the lock held for paranoia purposes (technically we could take it now, though)
-        ++ctrSH;
+    Pvt::Batches batches;
+    std::vector<quint64> clientIds;
+    for (const auto & sh : pending) {
+        Key k;
+        if (!ToKey(sh, k)) continue;
+        const uint64_t h = KeyHash(k);
+        auto & stripe = p->stripeFor(h);
         {
-            LockGuard g(sub->mut);
-            if (sub->subscribedClientIds.empty()) {
+            LockGuard g(stripe.mut);
+            auto *e = stripe.table.find(k, h);
+            if (!e) continue; // not subscribed
+            ++ctrSH;
+            if (e->clients.empty()) {
                 // We need to clear the "last status notified" because we have no clients now and we are skipping a
                 // notification. The "last status notified"'s primary purpose is to prevent sending existing clients
                 // dupe notifications (if status didn't change). Since we are skipping a notification, we must clear
                 // it to invalidate it.
-                sub->lastStatusNotified.reset();
-                sub->cachedStatus.reset(); // forget the cached status as it is now very definitely wrong.
+                e->lastStatusNotified.reset();
+                e->cachedStatus.reset(); // forget the cached status as it is now very definitely wrong.
                 continue;
-            } // else..
-            sh = sub->key;
+            }
         }
         // ^^^ We must release the above lock here temporarily because we do not want to hold it while also implicitly
         // grabbing the Storage 'blocksLock' below for getFullStatus* (storage->getHistory acquires that lock in
         // read-only mode).
         try {
             const auto status = getFullStatus(sh);
-            // Now, re-acquire sub lock. Temporarily having released it above should be fine for our purposes, since the
-            // above empty() check was only a performance optimization and the predicate not holding for the duration of
-            // this code block is fine. In the unlikely event that a sub lost its clients while the lock was released, the
-            // below emit sub->statusChanged(...) will just be a no-op.
-            LockGuard g(sub->mut);
-            const bool doemit = !sub->lastStatusNotified.has_value() || sub->lastStatusNotified != status;
-            // we basically cache 2 statuses -- one for what we return immediately to new subs and one to
-            // keep track of not notifying twice on the same sub.
-            sub->lastStatusNotified = status;
-            if (useCache)
-                sub->cachedStatus = status;
-            if (doemit) {
-                const auto nClients = sub->subscribedClientIds.size();
-                ctr += nClients;
-                DebugM("Notifying ", nClients, Util::Pluralize(" client", nClients), " of status for ", Util::ToHexFast(sh));
-                sub->updateTS();
-                emit sub->statusChanged(sh, status);
+            // Now, re-acquire the stripe lock and look the entry up again (the table may have been modified while the
+            // lock was released). In the unlikely event that the sub lost its clients in the meantime, there is simply
+            // nobody to notify.
+            clientIds.clear();
+            {
+                LockGuard g(stripe.mut);
+                auto *e = stripe.table.find(k, h);
+                if (UNLIKELY(!e)) continue;
+                const bool doemit = !e->lastStatusNotified.has_value() || e->lastStatusNotified != status;
+                // we basically cache 2 statuses -- one for what we return immediately to new subs and one to
+                // keep track of not notifying twice on the same sub.
+                e->lastStatusNotified = status;
+                if (useCache)
+                    e->cachedStatus = status;
+                if (doemit) {
+                    clientIds.assign(e->clients.begin(), e->clients.end());
+                    e->updateTS();
+                }
             }
+            if (clientIds.empty()) continue;
+            const auto nClients = clientIds.size();
+            ctr += nClients;
+            DebugM("Notifying ", nClients, Util::Pluralize(" client", nClients), " of status for ", Util::ToHexFast(sh));
+            p->route(clientIds, sh, status, false, batches);
         } catch (const std::exception & e) {
             // Defensive programming here in case getFullStatus() or other functions throw (extremely unlikely)
             Error() << "ERROR: Caught exception attempting to calculate status for subscribable: " << sh.toHex();
         }
     }
+    Pvt::post(batches);
     if (ctr || ctrSH) {
         DebugM(__func__, ": ", ctr, Util::Pluralize(" client", ctr), ", ", ctrSH, Util::Pluralize(" subscribable", ctrSH),
                " in ", t0.msecStr(4), " msec");
@@ -234,47 +546,46 @@ void SubsMgr::unsubscribeClientsForKeys(const std::unordered_set<HashX, HashHash
     }
     if (keys.empty()) return;
     const Tic t0;
-    std::vector<SubRef> matchedSubs;
-    matchedSubs.reserve(std::min(keys.size(), kRecommendedPendingNotificationsReserveSize));
-    size_t subsSize;
-    {
-        LockGuard g(p->mut);
-        subsSize = p->subs.size();
-        if (keys.size() < subsSize) {
-            // iterate over keys
-            for (const auto &key : keys)
-                if (auto it = p->subs.find(key); it != p->subs.end())
-                    matchedSubs.push_back(it->second);
-        } else {
-            // iterate over subs
-            for (const auto &[key, sub] : p->subs)
-                if (keys.count(key))
-                    matchedSubs.push_back(sub);
-        }
-    }
-    // now, emit the signal with locks not held
-    for (const auto &sub : matchedSubs) {
+    size_t nMatched = 0;
+    Pvt::Batches batches;
+    std::vector<quint64> clientIds;
+    for (const auto &key : keys) {
+        Key k;
+        if (!ToKey(key, k)) continue;
+        const uint64_t h = KeyHash(k);
+        auto & stripe = p->stripeFor(h);
         {
-            LockGuard g(sub->mut);
+            LockGuard g(stripe.mut);
+            auto *e = stripe.table.find(k, h);
+            if (!e) continue;
+            ++nMatched;
             // clear cached status since this sub is going away very sooon because the associated txid is gone;
             // as such, if a new sub comes in right after this runs, we want to return a fresh status not a cached one.
-            sub->cachedStatus.reset();
+            e->cachedStatus.reset();
+            clientIds.assign(e->clients.begin(), e->clients.end());
         }
-        emit sub->unsubscribeRequested(); // will run in client thread(s) for subscribed client(s)
+        p->route(clientIds, key, {}, true, batches); // will run in client thread(s) for subscribed client(s)
     }
-    if (!matchedSubs.empty())
-        DebugM(__func__, ": enqueued unsubscribe for ", matchedSubs.size(), "/", subsSize, " txids in ", t0.msecStr(), " msec");
+    Pvt::post(batches);
+    if (nMatched)
+        DebugM(__func__, ": enqueued unsubscribe for ", nMatched, "/", p->nSubs.load(), " txids in ", t0.msecStr(), " msec");
 }
 
-
-auto SubsMgr::makeSubRef(const HashX &key) -> SubRef
+auto SubsMgr::mailboxForCurrentThread() -> std::shared_ptr<Mailbox>
 {
-    static const auto Deleter = [](Subscription *s){ s->deleteLater(); };
-    SubRef ret(new Subscription(key), Deleter);
-    if (QThread::currentThread() != this->thread()) {
-        ret->moveToThread(this->thread());
+    QThread * const thr = QThread::currentThread();
+    LockGuard g(p->mailboxesMut);
+    auto & mb = p->mailboxes[thr];
+    if (!mb) {
+        static const auto Deleter = [](Mailbox *m){ m->deleteLater(); };
+        mb.reset(new Mailbox(this), Deleter); // lives in the calling (client) thread
+        // forget the mailbox when its thread ends (the QThread object may be deleted and its address reused)
+        mb->threadFinishedConn = connect(thr, &QThread::finished, mb.get(), [this, thr]{
+            LockGuard g(p->mailboxesMut);
+            p->mailboxes.erase(thr);
+        }, Qt::DirectConnection);
     }
-    return ret;
+    return mb;
 }
 
 bool SubsMgr::isSubsLimitExceeded(int64_t & limit) const {
@@ -282,80 +593,64 @@ bool SubsMgr::isSubsLimitExceeded(int64_t & limit) const {
     return numGlobalSubscriptions() >= limit;
 }
 
-// may throw LimitReached
-auto SubsMgr::getOrMakeSubRef(const HashX &key) -> std::pair<SubRef, bool>
-{
-    if (int64_t limit; UNLIKELY(isSubsLimitExceeded(limit)))
-        // Note we check the limit against all subs (including zombies) to prevent a DoS attack that circumvents
-        // the limit by repeatedly creating subs, disconnecting, reconnecting, creating a different set of subs, etc.
-        throw LimitReached(QString("Subs limit of %1 has been reached").arg(limit));
-
-    std::pair<SubRef, bool> ret;
-    LockGuard g(p->mut);
-
-    if (auto it = p->subs.find(key); it != p->subs.end()) {
-        ret.first = it->second;
-        ret.second = false; // was not new
-    } else {
-        ret.first = makeSubRef(key);
-        p->subs[key] = ret.first;
-        ret.second = true; // was new
-    }
-    return ret;
-}
-
-auto SubsMgr::findExistingSubRef(const HashX &key) const -> SubRef
-{
-    SubRef ret;
-    LockGuard g(p->mut);
-    if (auto it = p->subs.find(key); it != p->subs.end())
-        ret = it->second;
-    return ret;
-}
-
 auto SubsMgr::subscribe(RPC::ConnectionBase *c, const HashX &key, const StatusCallback &notifyCB) -> SubscribeResult
 {
     const auto t0 = debugPrint ? Util::getTimeNS() : 0LL;
     const bool useCache = useStatusCache();
     if (UNLIKELY(!notifyCB))
         throw BadArgs("SubsMgr::subscribe must be called with a valid notifyCB. FIXME!");
+    Key k;
+    if (UNLIKELY(!ToKey(key, k)))
+        throw BadArgs(QString("SubsMgr::subscribe: key must be %1 bytes, got %2").arg(HashLen).arg(key.size()));
+    if (int64_t limit; UNLIKELY(isSubsLimitExceeded(limit)))
+        // Note we check the limit against all subs (including zombies) to prevent a DoS attack that circumvents
+        // the limit by repeatedly creating subs, disconnecting, reconnecting, creating a different set of subs, etc.
+        throw LimitReached(QString("Subs limit of %1 has been reached").arg(limit));
 
-    SubscribeResult ret = { false, {} };
-    auto [sub, wasnew] = getOrMakeSubRef(key); // may throw LimitReached
+    // First, register the callback for this client + key (replacing any previous one). This must happen before the
+    // client is added to the sub's client list below, so that any notification routed to it can be delivered.
     {
-        LockGuard g(sub->mut);
-        if (!wasnew && sub->subscribedClientIds.count(c->id)) {
-            // already had a sub for this client, disconnect it because we will re-add the new functor below
-            bool res = QObject::disconnect(sub.get(), &Subscription::statusChanged, c, nullptr);
-            if constexpr (debugPrint) Debug() << "Existing sub disconnected signal: " << (res ? "ok" : "not ok!");
-        } else {
-            // did not have a sub for this client, add its id and also add the destroyed signal to clean up the id
-            // upon client object destruction
-            ret.first = true;
-            sub->subscribedClientIds.insert(c->id);
-            auto conn = QObject::connect(c, &QObject::destroyed, sub.get(), [sub=sub.get(), id=c->id, this](QObject *){
-                --p->nClientSubsActive;
-                --Pvt::nGlobalClientSubsActive;
-                LockGuard g(sub->mut);
-                sub->subscribedClientIds.erase(id);
-                sub->updateTS();
-                //Debug() << "client id " << id << " destroyed, implicitly unsubbed from " << sub->key.toHex()
-                //        << ", " << sub->subscribedClientIds.size() << " sub(s) remain";
+        auto & cs = p->clientStripeFor(c->id);
+        LockGuard g(cs.mut);
+        auto & rec = cs.recs[c->id];
+        if (!rec.conn) {
+            // first subscription for this client: clean up after it when it is deleted (runs in its thread)
+            rec.destroyedConn = QObject::connect(c, &QObject::destroyed, [this, id=c->id](QObject *){
+                on_clientDestroyed(id);
             });
-            if (UNLIKELY(!conn))
+            if (UNLIKELY(!rec.destroyedConn)) {
+                cs.recs.erase(c->id);
                 throw InternalError("SubsMgr::subscribe: Failed to make the 'destroyed' connection for the client object! FIXME!");
-            ++p->nClientSubsActive;
-            ++Pvt::nGlobalClientSubsActive;
+            }
+            rec.conn = c;
+            rec.mailbox = mailboxForCurrentThread();
         }
+        rec.callbacks[k] = notifyCB;
+    }
+
+    SubscribeResult ret = { false, {} };
+    bool wasNewSub;
+    {
+        const uint64_t h = KeyHash(k);
+        auto & stripe = p->stripeFor(h);
+        LockGuard g(stripe.mut);
+        auto [e, wasNew] = stripe.table.findOrInsert(k, h);
+        wasNewSub = wasNew;
+        ret.first = e->clients.insert(c->id);
         if (useCache) {
             // Copy the last known StatusHash to caller. This is guaranteed to either be a recent status since the
             // last notification sent (if known), or !has_value if not known.
-            ret.second = sub->cachedStatus;
+            ret.second = e->cachedStatus;
         }
-        sub->updateTS(); // our basic 'mtime'
-        auto conn = QObject::connect(sub.get(), &Subscription::statusChanged, c, notifyCB, Qt::QueuedConnection); // QueuedConnection paranoia in case client 'c' "lives" in our thread
-        if (UNLIKELY(!conn))
-            throw InternalError("SubsMgr::subscribe: Failed to make the 'statusChanged' connection to the notifyCB functor! FIXME!");
+        e->updateTS(); // our basic 'mtime'
+    }
+    if (wasNewSub) {
+        ++p->nSubs;
+        ++Pvt::nGlobalSubs;
+    }
+    if (ret.first) {
+        ++p->nClientSubsActive;
+        ++Pvt::nGlobalClientSubsActive;
     }
 
     if (useCache) {
@@ -372,31 +667,27 @@ auto SubsMgr::subscribe(RPC::ConnectionBase *c, const HashX &key, const StatusCa
     return ret;
 }
 
-auto DSProofSubsMgr::subscribe(RPC::ConnectionBase *c, const HashX &key, const StatusCallback &notifyCB) -> SubscribeResult
+void SubsMgr::on_clientDestroyed(const quint64 id)
 {
-    auto ret = SubsMgr::subscribe(c, key, notifyCB);
-    if (ret.first) { // this sub <-> client association is new, attach signal for unsubscribeAllClients() to work
-        if (SubRef sub = findExistingSubRef(key)) {
-            auto conn = QObject::connect(sub.get(), &Subscription::unsubscribeRequested, c, [this, c, key, notifyCB] {
-                if (notifyCB) {
-                    // tell client the sub is gone -- send them an empty status immediately
-                    notifyCB(key, {});
-                }
-                DebugM("unsubscribeRequested signal invoked lambda, proceeding to unsubscribe client ", c->id,
-                       " for key ", key.toHex(), " ...");
-                // just call unsubscribe. this will zombify this sub and it will be deleted
-                unsubscribe(c, key, false /* don't update ts */);
-            });
-            if (UNLIKELY(!conn)) {
-                // this should never happen
-                Error() << "INTERNAL ERROR: failed to make the connecttion to the 'unsubscribeRequested' signal for client " << c->id << ". FIXME!";
-            }
-        } else {
-            // should never happen
-            Error() << "INTERNAL ERROR: sub immediately lost its subref for " << key.toHex() << ". FIXME!";
+    Pvt::ClientRec rec;
+    {
+        auto & cs = p->clientStripeFor(id);
+        LockGuard g(cs.mut);
+        const auto it = cs.recs.find(id);
+        if (it == cs.recs.end()) return;
+        rec = std::move(it->second);
+        cs.recs.erase(it);
+    }
+    for (const auto & [k, cb] : rec.callbacks) {
+        const uint64_t h = KeyHash(k);
+        auto & stripe = p->stripeFor(h);
+        LockGuard g(stripe.mut);
+        if (auto *e = stripe.table.find(k, h); e && e->clients.erase(id)) {
+            e->updateTS();
+            --p->nClientSubsActive;
+            --Pvt::nGlobalClientSubsActive;
         }
     }
-    return ret;
 }
 
 void SubsMgr::maybeCacheStatusResult(const HashX &sh, const SubStatus &status)
@@ -410,33 +701,40 @@ void SubsMgr::maybeCacheStatusResult(const HashX &sh, const SubStatus &status)
         // we only allow empty (default constructred) DSProofs or ones that are isComplete(), otherwise reject
         return;
     // else .. we always cache status.blockHeight() ..
-    SubRef sub = findExistingSubRef(sh);
-    if (sub) {
-        LockGuard g(sub->mut);
-        if (!sub->lastStatusNotified.has_value() && !sub->cachedStatus.has_value())
-            sub->cachedStatus = status;
-    }
+    Key k;
+    if (!ToKey(sh, k)) return;
+    const uint64_t h = KeyHash(k);
+    auto & stripe = p->stripeFor(h);
+    LockGuard g(stripe.mut);
+    if (auto *e = stripe.table.find(k, h); e && !e->lastStatusNotified.has_value() && !e->cachedStatus.has_value())
+        e->cachedStatus = status;
 }
 
 bool SubsMgr::unsubscribe(RPC::ConnectionBase *c, const HashX &key, bool updateTS)
 {
     bool ret = false;
     const auto t0 = debugPrint ? Util::getTimeNS() : 0LL;
-    SubRef sub = findExistingSubRef(key);
-    if (sub) {
-        // found
-        LockGuard g(sub->mut);
-        if (auto it = sub->subscribedClientIds.find(c->id); it != sub->subscribedClientIds.end()) {
-            sub->subscribedClientIds.erase(it);
-            if (updateTS) sub->updateTS();
-            QObject::disconnect(sub.get(), &Subscription::statusChanged, c, nullptr);
-            QObject::disconnect(c, &QObject::destroyed, sub.get(), nullptr);
-            QObject::disconnect(sub.get(), &Subscription::unsubscribeRequested, c, nullptr);
+    Key k;
+    if (!ToKey(key, k)) return false;
+    {
+        const uint64_t h = KeyHash(k);
+        auto & stripe = p->stripeFor(h);
+        LockGuard g(stripe.mut);
+        if (auto *e = stripe.table.find(k, h); e && e->clients.erase(c->id)) {
+            if (updateTS) e->updateTS();
             ret = true;
-            --p->nClientSubsActive;
-            --Pvt::nGlobalClientSubsActive;
         }
     }
+    if (ret) {
+        {
+            auto & cs = p->clientStripeFor(c->id);
+            LockGuard g(cs.mut);
+            if (const auto it = cs.recs.find(c->id); it != cs.recs.end())
+                it->second.callbacks.erase(k);
+        }
+        --p->nClientSubsActive;
+        --Pvt::nGlobalClientSubsActive;
+    }
     if constexpr (debugPrint) {
         const auto elapsed = Util::getTimeNS() - t0;
         Debug() << int(ret) << " unsubscribed " << Util::ToHexFast(key) << " in " << QString::number(elapsed/1e6, 'f', 4) << " msec";
@@ -445,11 +743,10 @@ bool SubsMgr::unsubscribe(RPC::ConnectionBase *c, const HashX &key, bool updateT
 }
 
 int64_t SubsMgr::numActiveClientSubscriptions() const { return p->nClientSubsActive; }
-int64_t SubsMgr::numScripthashesSubscribed() const {
-    LockGuard g(p->mut);
-    return int64_t(p->subs.size());
-}
+int64_t SubsMgr::numScripthashesSubscribed() const { return p->nSubs; }
 
+/*static*/
+int64_t SubsMgr::numGlobalSubscriptions() { return Pvt::nGlobalSubs.load(); }
 /*static*/
 int64_t SubsMgr::numGlobalActiveClientSubscriptions() { return Pvt::nGlobalClientSubsActive.load(); }
 
@@ -516,26 +813,18 @@ auto ScriptHashSubsMgr::getFullStatus(const HashX &sh) const -> SubStatus
 void SubsMgr::removeZombies(bool forced)
 {
     const Tic t0;
-    int ctr = 0;
+    size_t ctr = 0, total = 0;
     const auto now = Util::getTime();
-    LockGuard g(p->mut);
-    const auto total = p->subs.size();
-    for (auto it = p->subs.begin(); it != p->subs.end(); /* */) {
-        SubRef sub = it->second; // take a copy to increment refct so it doesn't get deleted before we unlock it (erase() below)...
-        if (UNLIKELY(!sub)) { // paranoia
-            Fatal() << "A SubRef was null in " << __func__ << ". FIXME!";
-            return;
-        }
-        LockGuard g(sub->mut);
-        if (sub->subscribedClientIds.empty() && (forced || now - sub->tsMsec > kRemoveZombiesTimerIntervalMS)) {
-            ++ctr;
-            it = p->subs.erase(it);
-        } else
-            ++it;
+    for (auto & stripe : p->stripes) {
+        LockGuard g(stripe.mut);
+        total += stripe.table.size();
+        ctr += stripe.table.eraseIf([&](const SubEntry &e) {
+            return e.clients.empty() && (forced || now - e.tsMsec > kRemoveZombiesTimerIntervalMS);
+        }); // also reclaims memory if the stripe became sparse
     }
     if (ctr) {
-        if (p->subs.load_factor() <= 0.5)
-            p->subs.rehash(p->kSubsReserveSize); // shrink_to_fit down toward kSubsReserveSize (reclaim memory)
+        p->nSubs -= int64_t(ctr);
+        Pvt::nGlobalSubs -= int64_t(ctr);
         DebugM(objectName(), ": Removed ", ctr, " zombie ", Util::Pluralize("sub", ctr), " out of ", total,
                " in ", t0.msecStr(4), " msec");
     }
@@ -545,11 +834,11 @@ std::unordered_set<HashX, HashHasher> SubsMgr::nonZombieKeysOlderThan(const int6
 {
     std::unordered_set<HashX, HashHasher> ret;
     const auto now = Util::getTime();
-    LockGuard g(p->mut);
-    for (const auto & [key, sub] : p->subs) {
-        LockGuard g(sub->mut);
-        if (!sub->subscribedClientIds.empty() && now - sub->tsMsec > msec)
-            ret.insert(key); // it is not a zombie and it's older than msec, add to return set
+    for (const auto & stripe : p->stripes) {
+        LockGuard g(stripe.mut);
+        for (const auto & e : stripe.table.all())
+            if (!e.clients.empty() && now - e.tsMsec > msec)
+                ret.insert(FromKey(e.key)); // it is not a zombie and it's older than msec, add to return set
     }
     return ret;
 }
@@ -560,37 +849,25 @@ auto SubsMgr::debug(const StatsParams &params) const -> Stats
     QVariant ret;
     if (params.contains("subs") || params.contains("dspsubs") || params.contains("txsubs")) {
         QVariantMap subs;
-        qulonglong collisions{}, largestBucket{}, medianBucket{}, medianNonzeroBucket{};
-        {
-            LockGuard g(p->mut);
-            for (const auto & [sh, sub] : p->subs) {
+        const auto now = Util::getTime();
+        for (const auto & stripe : p->stripes) {
+            LockGuard g(stripe.mut);
+            for (const auto & e : stripe.table.all()) {
                 QVariantMap m2;
-                {
-                    LockGuard g2(sub->mut);
-                    m2["count"] = qlonglong(sub->subscribedClientIds.size());
-                    m2["lastStatusNotified"] = sub->lastStatusNotified.toVariant();
-                    m2["cachedStatus"] = sub->cachedStatus.toVariant();
-                    m2["idleSecs"] = (Util::getTime() - sub->tsMsec)/1e3;
-                    const auto & clients = sub->subscribedClientIds;
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-                    // Qt < 5.14 lacks the ranged constructors for containers so we must do this.
-                    m2["clientIds"] = QVariantList::fromStdList(Util::toList<std::list<QVariant>>(clients));
-#else
-                    m2["clientIds"] = Util::toList<QVariantList>(clients);
-#endif
-                }
-                subs[QString(Util::ToHexFast(sh))] = m2;
+                m2["count"] = qlonglong(e.clients.size());
+                m2["lastStatusNotified"] = e.lastStatusNotified.toVariant();
+                m2["cachedStatus"] = e.cachedStatus.toVariant();
+                m2["idleSecs"] = (now - e.tsMsec)/1e3;
+                QVariantList clientIds;
+                for (const auto id : e.clients)
+                    clientIds.push_back(qulonglong(id));
+                m2["clientIds"] = clientIds;
+                subs[QString(Util::ToHexFast(FromKey(e.key)))] = m2;
             }
-            std::tie(collisions, largestBucket, medianBucket, medianNonzeroBucket) = Util::bucketStats(p->subs);
         }
         QVariantMap m;
         m["subs"] = std::move(subs);
-        auto stats = this->stats().toMap();
-        stats["subscriptions bucket collisions"] = collisions;
-        stats["subscriptions largest bucket"] = largestBucket;
-        stats["subscriptions median bucket"] = medianBucket;
-        stats["subscriptions median non-zero bucket"] = medianNonzeroBucket;
-        m["stats"] = std::move(stats);
+        m["stats"] = this->stats();
         ret = std::move(m);
     }
     return ret;
@@ -599,10 +876,30 @@ auto SubsMgr::debug(const StatsParams &params) const -> Stats
 auto SubsMgr::stats() const -> Stats
 {
     QVariantMap ret;
+    size_t nEntries = 0, nSlots = 0, nBytes = 0, nClients = 0, nCallbacks = 0;
+    for (const auto & stripe : p->stripes) {
+        LockGuard g(stripe.mut);
+        nEntries += stripe.table.size();
+        nSlots += stripe.table.numSlots();
+        nBytes += stripe.table.memoryUsage();
+    }
+    for (auto & cs : p->clientStripes) {
+        LockGuard g(cs.mut);
+        nClients += cs.recs.size();
+        for (const auto & [id, rec] : cs.recs)
+            nCallbacks += rec.callbacks.size();
+    }
+    ret["subscriptions load factor"] = nSlots ? double(nEntries) / double(nSlots) : 0.;
+    ret["subscriptions table slots"] = qulonglong(nSlots);
+    ret["subscriptions table bytes (est.)"] = qulonglong(nBytes);
+    ret["clients"] = qulonglong(nClients);
+    ret["client callbacks"] = qulonglong(nCallbacks);
+    {
+        LockGuard g(p->mailboxesMut);
+        ret["mailboxes"] = qulonglong(p->mailboxes.size());
+    }
     {
         LockGuard g(p->mut);
-        ret["subscriptions load factor"] = p->subs.load_factor();
-        ret["subscriptions bucket count"] = qulonglong(p->subs.bucket_count());
         QVariantList l;
         for (const auto & sh : p->pendingNotificatons) {
             l.push_back(Util::ToHexFast(sh));
@@ -611,7 +908,6 @@ auto SubsMgr::stats() const -> Stats
     }
     ret["subscriptions cache hits"] = qlonglong(p->cacheHits.load()); // atomic, no lock needed
     ret["subscriptions cache misses"] = qlonglong(p->cacheMisses.load()); // atomic, no lock needed
-    // these below 2 take the above lock again so we do them without the lock held
     ret["Num. active client subscriptions"] = qlonglong(numActiveClientSubscriptions());
     ret["Num. unique scripthashes subscribed (including zombies)"] = qlonglong(numScripthashesSubscribed());
     ret["Num. active client subscriptions (global)"] = qlonglong(numGlobalActiveClientSubscriptions());
@@ -687,6 +983,10 @@ SubStatus TransactionSubsMgr::getFullStatus(const HashX &txHash) const
 #ifdef ENABLE_TESTS
 #include "App.h"
 #include "BlockProcTypes.h"
+
+#include <QCoreApplication>
+
+#include <cstdlib>
 #include <utility>
 #include <vector>
 
@@ -755,5 +1055,83 @@ namespace {
     }
 
     const auto t1 = App::registerTest("statushash", testStatusHash);
+
+    /// A SubsMgr without a Storage whose statuses change every notification "round".
+    class BenchSubsMgr final : public SubsMgr {
+    public:
+        explicit BenchSubsMgr(const std::shared_ptr<const Options> &opts) : SubsMgr(opts, nullptr, "SubsMgr (bench)") {}
+        ~BenchSubsMgr() override {}
+        SubStatus getFullStatus(const HashX &key) const override {
+            QByteArray ret = key;
+            ret[0] = char(round);
+            return ret;
+        }
+        QVariantMap statsMap() const { return stats().toMap(); }
+        using SubsMgr::doNotifyAllPending;
+        using SubsMgr::removeZombies;
+        unsigned round = 0;
+    };
+
+    void benchSubsMgr() {
+        const size_t nSubs = std::getenv("SUBSMGR_NSUBS") ? std::atoll(std::getenv("SUBSMGR_NSUBS")) : 2'000'000;
+        const size_t nClients = std::max<size_t>(1, std::getenv("SUBSMGR_NCLIENTS") ? std::atoll(std::getenv("SUBSMGR_NCLIENTS")) : 40'000);
+        auto opts = std::make_shared<Options>();
+        opts->maxSubsGlobally = Options::maxSubsGloballyMax;
+        BenchSubsMgr mgr(opts);
+
+        Log() << "Creating " << nClients << " clients and " << nSubs << " random keys ...";
+        std::vector<std::unique_ptr<RPC::ElectrumConnection>> clients;
+        clients.reserve(nClients);
+        for (size_t i = 0; i < nClients; ++i)
+            clients.push_back(std::make_unique<RPC::ElectrumConnection>(nullptr, IdMixin::Id(i + 1u)));
+        std::vector<HashX> keys;
+        keys.reserve(nSubs);
+        for (size_t i = 0; i < nSubs; ++i) {
+            QByteArray k(HashLen, Qt::Uninitialized);
+            Util::getRandomBytes(k.data(), HashLen);
+            keys.push_back(std::move(k));
+        }
+        size_t nNotified = 0;
+        const StatusCallback cb = [&nNotified](const HashX &, const SubStatus &) { ++nNotified; };
+
+        const auto rss0 = Util::getProcessMemoryUsage().phys;
+        Tic t0;
+        for (size_t i = 0; i < nSubs; ++i)
+            mgr.subscribe(clients[i % nClients].get(), keys[i], cb);
+        t0.fin();
+        const auto rss1 = Util::getProcessMemoryUsage().phys;
+        const auto stats = mgr.statsMap();
+        Log() << "subscribe: " << nSubs << " subs in " << t0.msecStr() << " msec ("
+              << QString::number(t0.nsec() / double(std::max<size_t>(nSubs, 1)), 'f', 1) << " nsec/sub)";
+        Log() << "bytes per subscription: " << QString::number(stats["subscriptions table bytes (est.)"].toDouble() / nSubs, 'f', 1)
+              << " (table est.), " << QString::number((double(rss1) - double(rss0)) / nSubs, 'f', 1) << " (RSS delta, incl. callbacks)";
+
+        for (int r = 1; r <= 3; ++r) {
+            mgr.round = unsigned(r);
+            nNotified = 0;
+            Tic t1;
+            mgr.enqueueNotifications(std::unordered_set<HashX, HashHasher>(keys.begin(), keys.end()));
+            mgr.doNotifyAllPending(); // computes statuses and posts to this thread's mailbox
+            t1.fin();
+            Tic t2;
+            QCoreApplication::sendPostedEvents(); // drains the mailbox
+            t2.fin();
+            if (nNotified != nSubs)
+                throw Exception(QString("Expected %1 notifications, got %2").arg(nSubs).arg(nNotified));
+            Log() << "round " << r << ": routed " << nNotified << " notifications in " << t1.msecStr() << " msec ("
+                  << QString::number(nNotified / std::max(t1.secs(), 1e-9), 'f', 0) << "/sec), delivered in "
+                  << t2.msecStr() << " msec (" << QString::number(nNotified / std::max(t2.secs(), 1e-9), 'f', 0) << "/sec)";
+        }
+
+        clients.clear(); // all subs become zombies
+        if (mgr.numActiveClientSubscriptions() != 0)
+            throw Exception(QString("%1 active subs remain after deleting all clients").arg(mgr.numActiveClientSubscriptions()));
+        mgr.removeZombies(true);
+        if (mgr.numScripthashesSubscribed() != 0)
+            throw Exception(QString("%1 subs remain after removing zombies").arg(mgr.numScripthashesSubscribed()));
+        Log() << "SubsMgr: ok";
+    }
+
+    const auto b_subsmgr = App::registerBench("subsmgr", benchSubsMgr);
 }
 #endif
@@ -38,72 +38,24 @@
 #include <unordered_set>
 #include <utility> // for pair
 
-class SubsMgr;
-
-/// A class encapsulating a single subscription to a "HashX" key. Originally this was designed to work with
-/// ElectrumX-style scripthashes but has been extended whereby a client can subscribe to any "key" that is a
-/// 32-byte hash (such as scripthash, txid, etc).
-///
-/// This class acts as a signal "fusebox" where many Clients can sign up to the `statusChanged` signal given
-/// a particular HashX key.
-class Subscription : public QObject
-{
-    Q_OBJECT
-protected:
-    friend class SubsMgr;
-
-    /// The number of global Subscription instances. This is the total across all SubsMgrs that exist (zombie + active subs)
-    static std::atomic_int64_t nGlobalInstances;
-
-    explicit Subscription(const HashX & key);
-    ~Subscription() override;
-
-    const HashX key; ///< This is typically an implicitly shared copy of the same bytes as in the map key pointing to this instance (thus it's cheap to keep around here too)
-
-    std::mutex mut; ///< this mutex guards the below data structures.
-
-    std::unordered_set<quint64> subscribedClientIds; ///< this is atomically updated as clients subscribe/unsubscribe or as they are deleted/disconnected
-    /// The last status sent out as a notification. If it has_value, it's guaranteed to be the most recent one announced
-    /// to clients, so it is suitable for use in the respone to e.g. blockchain.scripthash.subscribe (iff has_value).
-    SubStatus lastStatusNotified;
-    /// The last status that was computed as the result of a blockchain.[scripthash|dsproof].subscribe RPC call
-    /// This status is returned as the immediate result for subsequent .subscribe calls after the first client
-    /// subscribes (as a performance optimization).  This value is correctly maintained by the notification mechanism
-    /// in collaboration with Servers.cpp.  In rare cases it is not the most recent possible status since it is a
-    /// slightly delayed value -- but that's ok as a future notification to a client will rectify the situation with
-    /// the most up-to-date status in the near future anyway.
-    SubStatus cachedStatus;
-    /// The last time this sub was accessed in milliseconds (Util::getTime()). If the ts goes beyond 1 minute in the
-    /// past, and it has no clients attached, its entry may be removed.
-    int64_t tsMsec = Util::getTime();
-
-    /// Call this with the lock held.
-    void updateTS() { tsMsec = Util::getTime(); }
-
-signals:
-    /// @param key is the subscription key (ScriptHash or TxHash) (raw 32 bytes).
-    /// @param status is raw 32 bytes as well if the manager is ScriptHashSubsMgr, otherwise it is whatever is
-    ///     specified for that SubsMgr  (e.g. if DSProofSubsMgr, then it's a DSProof object).
-    void statusChanged(const HashX &key, const SubStatus &status);
-
-    /// This is a private signal. Do not emit this in code outside SubsMgr.cpp internals.
-    ///
-    /// It is connected to a lambda that will execute in the thread for all the subscribed clients for this sub.
-    /// It will automatically unsubscribe them. Used by the DSProofSubsMgr when txids get confirmed and are no longer
-    /// in the mempool.
-    void unsubscribeRequested();
-};
-
 using StatusCallback = std::function<void(const HashX &, const SubStatus &)>;
 
 /// The Subscriptions Manager. Thread-safe operations for managing subscriptions and doing notifications.
 ///
-/// This class is "owned" by the Storage instance.  Internally it takes a class-level data lock for some operations,
-/// and also a per-Subscription-level locks for others.
+/// This class is "owned" by the Storage instance.  A subscription is to a "HashX" key. Originally this was designed
+/// to work with ElectrumX-style scripthashes but has been extended whereby a client can subscribe to any "key" that is
+/// a 32-byte hash (such as scripthash, txid, etc).
+///
+/// Subscriptions are plain structs (no QObjects, no per-sub mutex or signal connections) kept in a flat
+/// open-addressing table that is split into stripes by key hash, each stripe with its own lock. Each subscription
+/// holds a compact list of the ids of its subscribed clients; the clients' callbacks are kept per client. Notifications
+/// are delivered through a "mailbox" per client thread: the SubsMgr thread appends them to the mailbox in batches, and
+/// the mailbox invokes the callbacks in the client thread.
 ///
 /// Note about deadlocking: This class's locks are *SUBSERVIENT* to the "Storage" instance that owns it! Currently
-/// it takes no locks at the same time as holding a Storage lock.  However, if one must take multiple locks the order
-/// should be:  1. Storage Locks (in their defined order),  2. p->mut (Pvt::mut),  3. sub->mut (Subscription::mut).
+/// it takes no locks at the same time as holding a Storage lock.  Internally, at most one stripe lock (either a
+/// subscription stripe or a client stripe) is held at a time, except that a client stripe lock may be held while
+/// taking the mailboxes lock.
 class SubsMgr : public Mgr, public ThreadObjectMixin, public TimersByNameMixin
 {
     Q_OBJECT
@@ -144,11 +96,11 @@ public:
     /// status for the scripthash in question (but one still may exist!) -- client code should follow up with a
     /// getFullStatus() call to get the updated (non-cached) status.
     ///
-    /// Doesn't normally throw but may throw BadArgs if notifyCB is invalid, or InternalError if it failed to
-    /// make a QMetaObject::Connection for the subscription (or some other invariant failed to be satisfied).
+    /// Doesn't normally throw but may throw BadArgs if notifyCB is invalid or `key` is not HashLen bytes, or
+    /// InternalError if this is the client's first subscription and connecting to its QObject::destroyed signal
+    /// failed. (Notifications reach the client via its thread's mailbox, so no per-subscription connection is made.)
     ///
     /// Will throw LimitReached if the subs table is full.  Calling code should catch this exception.
-    /// (May also throw BadArgs).
     virtual SubscribeResult subscribe(RPC::ConnectionBase *client, const HashX &key, const StatusCallback &notifyCB);
     /// Thread-safe. The inverse of subscribe. Returns true if the client was previously subscribed, false otherwise.
     /// Always call this from the client's thread otherwise undefined behavior may result.
@@ -164,8 +116,9 @@ public:
     /// as well since it includes the aforementioned "zombies".
     int64_t numScripthashesSubscribed() const;
 
-    /// Returns the number of Subscription objects extant across all instances of SubsMgr (and its subclasses), app-wide.
-    static int64_t numGlobalSubscriptions() { return Subscription::nGlobalInstances.load(); }
+    /// Returns the number of subscriptions (zombie + active) extant across all instances of SubsMgr (and its
+    /// subclasses), app-wide.
+    static int64_t numGlobalSubscriptions();
     static int64_t numGlobalActiveClientSubscriptions();
 
     /// Returns a pair of (limitActive, limitAll)
@@ -203,8 +156,9 @@ signals:
 
 protected:
     /// Thread-safe. Takes exclusive locks. Unsubscribes all clients currently subscribed for keys in subKeys. This
-    /// effectively iterates over all the subs matching subKeys and emits the unsubscribeRequested() private signal.
-    /// The actual unsubscribe is effectuated in the thread for each subscribed client.
+    /// effectively iterates over all the subs matching subKeys and posts an "unsubscribe" item to the mailbox of each
+    /// subscribed client. The actual unsubscribe is effectuated in the thread for each subscribed client, after its
+    /// callback is invoked one last time with an empty status.
     ///
     /// Only for use with the DSProofSubsMgr.
     void unsubscribeClientsForKeys(const std::unordered_set<HashX, HashHasher> & subKeys);
@@ -229,8 +183,11 @@ protected:
     const std::shared_ptr<const Options> options;
     Storage * const storage; ///< pointer guaranteed to be valid since Storage "owns" us and if we are alive, it is alive.
 
-    using SubRef = std::shared_ptr<Subscription>;
-    SubRef findExistingSubRef(const HashX &) const; // takes locks, returns an existing subref or empty ref.
+    /// Runs in our thread (from a timer). Computes the status of each pending key that has clients and posts the
+    /// notifications to the clients' mailboxes.
+    void doNotifyAllPending();
+    /// Runs in our thread (from a timer). Removes subscriptions without clients that have been idle for a while.
+    void removeZombies(bool forced);
 
     /// Used by the DSProofSubsMgr expireSubsNotInMempool() function to get a set of txids that maybe should be expired
     /// because they are subscribed but have no mempool tx.
@@ -240,11 +197,11 @@ private:
     struct Pvt;
     std::unique_ptr<Pvt> p;
 
-    SubRef makeSubRef(const HashX &key);
-    std::pair<SubRef, bool> getOrMakeSubRef(const HashX &key); // takes locks, returns a new subref or an existing subref, may throw LimitReached
-
-    void doNotifyAllPending();
-    void removeZombies(bool forced);
+    struct Mailbox;
+    /// Returns the mailbox for the calling (client) thread, creating it if needed. Takes the mailboxes lock.
+    std::shared_ptr<Mailbox> mailboxForCurrentThread();
+    /// Forgets all subscriptions of a client that is being deleted. Runs in the client's thread.
+    void on_clientDestroyed(quint64 clientId);
 };
 
 class ScriptHashSubsMgr final : public SubsMgr {
@@ -282,13 +239,9 @@ public:
     /// Note that this implicitly will take the Storage "mempool lock" as a shared lock -- so bear that in mind if
     /// calling this from `Storage` with that lock already held.
     SubStatus getFullStatus(const HashX &txHash) const override;
-    /// Identical to superclass implementation but it also attaches the unsubscribeRequested() signal to a lambda
-    /// for client, so that SubsMgr::unsubscribeClientsForKeys() is not a no-op.
-    ///
-    /// Note that for the DSProofSubsMgr, we never return a cached value here -- SubscribeResult.second is always
-    /// !has_value() (empty).  Calling code can just query getFullStatus() (this is because getFullStatus() is very
-    /// cheap to call for this SubsMgr, and caching just wastes memory).
-    SubscribeResult subscribe(RPC::ConnectionBase *client, const HashX &sh, const StatusCallback &notifyCB) override;
+    // Note that for the DSProofSubsMgr, subscribe() never returns a cached value -- SubscribeResult.second is always
+    // !has_value() (empty).  Calling code can just query getFullStatus() (this is because getFullStatus() is very
+    // cheap to call for this SubsMgr, and caching just wastes memory).
 
 protected:
     void on_started() override;
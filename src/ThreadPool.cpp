@@ -17,17 +17,157 @@
 // <https://www.gnu.org/licenses/>.
 //
 #include "ThreadPool.h"
+#include "Metrics.h"
+#include "ThreadTopology.h"
 #include "Util.h"
 
+#include <QHash>
 #include <QThreadPool>
 
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
 namespace {
     constexpr bool debugPrt = false;
+
+    struct ClassMetrics {
+        Metrics::Gauge & depth;
+        Metrics::Histogram & delay;
+        Metrics::Counter & drops;
+    };
+    const ClassMetrics & classMetrics(ThreadPool::WorkClass c) {
+        static const auto make = [](ThreadPool::WorkClass wc) -> ClassMetrics {
+            auto & reg = Metrics::Registry::instance();
+            const Metrics::Labels labels{{"class", ThreadPool::workClassName(wc)}};
+            return {
+                reg.gauge("fulcrum_threadpool_queue_depth", "Number of ThreadPool jobs waiting to start", labels),
+                reg.histogram("fulcrum_threadpool_queue_delay_seconds",
+                              "Time a ThreadPool job waited in the queue before starting", labels),
+                reg.counter("fulcrum_threadpool_deadline_drops_total",
+                            "ThreadPool jobs dropped because their deadline passed while they were queued", labels),
+            };
+        };
+        static const std::array<ClassMetrics, ThreadPool::kNumWorkClasses> all{
+            make(ThreadPool::WorkClass::Light), make(ThreadPool::WorkClass::Normal), make(ThreadPool::WorkClass::Heavy)
+        };
+        return all[size_t(c)];
+    }
 }
 
+/// The per-class, per-fair-key job queues, and the cost model used to pick a job's class. Classes are served by
+/// stride scheduling: each class has a "pass" that advances by its stride every time it is served, and the queued
+/// class with the lowest pass goes next. A class that was idle resumes at the current pass, so it can't bank credit.
+struct ThreadPool::Sched {
+    struct ClassQueue {
+        std::unordered_map<uint64_t, std::deque<Job *>> byFairKey;
+        std::deque<uint64_t> rotation; ///< fair keys that have queued jobs, in the order they will be served
+        size_t size = 0, running = 0;
+        uint64_t pass = 0, nSubmitted = 0;
+    };
+    /// 24 / the class weights 8:3:1
+    static constexpr std::array<uint64_t, kNumWorkClasses> kStride = {3, 8, 24};
+    /// We forget all per-subKey costs if we are tracking more than this many of them
+    static constexpr int kMaxSubKeys = 65'536;
+
+    mutable std::mutex mut;
+    std::array<ClassQueue, kNumWorkClasses> queues;
+    uint64_t vtime = 0; ///< the pass of the class last served
+    QHash<QString, int64_t> costByKey; ///< exponential moving average of run time in nanos, per SchedHints::costKey
+    QHash<QByteArray, int64_t> heavySubKeys; ///< ditto, but only for (costKey, subKey) pairs whose last run was Heavy
+
+    static WorkClass classFor(int64_t costNS) noexcept {
+        return costNS < kLightMaxNS ? WorkClass::Light : (costNS < kHeavyMinNS ? WorkClass::Normal : WorkClass::Heavy);
+    }
+    static QByteArray subKeyFor(const SchedHints &h) { return h.costKey.toUtf8() + '\0' + h.subKey; }
+
+    // -- all of the below must be called with `mut` held
+
+    WorkClass classify(const SchedHints &h) const {
+        if (h.costKey.isEmpty()) return WorkClass::Normal;
+        if (!h.subKey.isEmpty())
+            if (auto it = heavySubKeys.find(subKeyFor(h)); it != heavySubKeys.end())
+                return classFor(*it);
+        if (auto it = costByKey.find(h.costKey); it != costByKey.end())
+            return classFor(*it);
+        return WorkClass::Normal;
+    }
+
+    /// Heavy runs with a subKey are remembered for that subKey only, so that a few whales don't skew the estimate
+    /// for everybody else using the same costKey.
+    void recordCost(const SchedHints &h, int64_t ns) {
+        if (h.costKey.isEmpty()) return;
+        if (!h.subKey.isEmpty()) {
+            if (ns >= kHeavyMinNS) {
+                if (heavySubKeys.size() >= kMaxSubKeys) heavySubKeys.clear();
+                heavySubKeys[subKeyFor(h)] = ns;
+                return;
+            }
+            if (!heavySubKeys.isEmpty()) heavySubKeys.remove(subKeyFor(h));
+        }
+        if (auto it = costByKey.find(h.costKey); it != costByKey.end())
+            *it += (ns - *it) / 8;
+        else
+            costByKey.insert(h.costKey, ns);
+    }
+
+    void push(Job *job) {
+        auto & q = queues[size_t(job->workClass)];
+        if (!q.size) q.pass = std::max(q.pass, vtime);
+        auto & dq = q.byFairKey[job->hints.fairKey];
+        if (dq.empty()) q.rotation.push_back(job->hints.fairKey);
+        dq.push_back(job);
+        ++q.size;
+        ++q.nSubmitted;
+    }
+
+    /// Returns nullptr if there are no queued jobs. Heavy jobs only get more than `heavyLimit` threads if no other
+    /// class has queued jobs.
+    Job *pop(size_t heavyLimit) {
+        constexpr size_t H = size_t(WorkClass::Heavy);
+        int best = -1;
+        for (size_t i = 0; i < H; ++i)
+            if (queues[i].size && (best < 0 || queues[i].pass < queues[best].pass))
+                best = int(i);
+        if (queues[H].size && (best < 0 || (queues[H].pass < queues[best].pass && queues[H].running < heavyLimit)))
+            best = int(H);
+        if (best < 0) return nullptr;
+        auto & q = queues[best];
+        vtime = q.pass;
+        q.pass += kStride[best];
+        const uint64_t key = q.rotation.front();
+        q.rotation.pop_front();
+        auto it = q.byFairKey.find(key);
+        Job * const job = it->second.front();
+        it->second.pop_front();
+        if (it->second.empty()) q.byFairKey.erase(it);
+        else q.rotation.push_back(key);
+        --q.size;
+        ++q.running;
+        return job;
+    }
+
+    /// Deletes all queued jobs. Returns how many there were.
+    size_t clear() {
+        size_t n = 0;
+        for (auto & q : queues) {
+            for (auto & [key, dq] : q.byFairKey) {
+                classMetrics(WorkClass(&q - queues.data())).depth.add(-int64_t(dq.size()));
+                for (Job *job : dq) delete job;
+                n += dq.size();
+            }
+            q.byFairKey.clear();
+            q.rotation.clear();
+            q.size = 0;
+        }
+        return n;
+    }
+};
 
 ThreadPool::ThreadPool(QObject *parent)
-    : QObject(parent), pool(std::make_unique<QThreadPool>(this))
+    : QObject(parent), pool(std::make_unique<QThreadPool>(this)), sched(std::make_unique<Sched>())
 {
 }
 
@@ -37,8 +177,10 @@ ThreadPool::~ThreadPool()
 }
 
 
-Job::Job(QObject *context, ThreadPool *pool, const VoidFunc & work, const VoidFunc & completion, const FailFunc &fail) noexcept
-    : QObject(nullptr), pool(pool), work(work), weakContextRef(context ? context : pool)
+Job::Job(QObject *context, ThreadPool *pool, const VoidFunc & work, const VoidFunc & completion, const FailFunc &fail,
+         const ThreadPool::SchedHints & hints, ThreadPool::WorkClass workClass) noexcept
+    : QObject(nullptr), pool(pool), work(work), weakContextRef(context ? context : pool), tSubmitNS(Util::getTimeNS()),
+      hints(hints), workClass(workClass)
 {
     if (!context && (completion || fail))
         Debug(Log::Magenta) << "Warning: use of ThreadPool jobs without a context is not recommended, FIXME!";
@@ -63,6 +205,7 @@ void Job::run() {
         DebugM(objectName(), ": context already deleted, exiting early without doing any work");
         return;
     }
+    didWork = true;
     if (LIKELY(work)) {
         try {
             work();
@@ -77,7 +220,25 @@ void Job::run() {
     emit completed();
 }
 
-void ThreadPool::submitWork(QObject *context, const VoidFunc & work, const VoidFunc & completion, const FailFunc & fail, int priority)
+const char *ThreadPool::workClassName(WorkClass c) noexcept
+{
+    switch (c) {
+    case WorkClass::Light: return "light";
+    case WorkClass::Normal: return "normal";
+    case WorkClass::Heavy: return "heavy";
+    case WorkClass::NumClasses: break;
+    }
+    return "unknown";
+}
+
+ThreadPool::WorkClass ThreadPool::classify(const SchedHints &hints) const
+{
+    std::unique_lock g(sched->mut);
+    return sched->classify(hints);
+}
+
+void ThreadPool::submitWork(QObject *context, const VoidFunc & work, const VoidFunc & completion, const FailFunc & fail,
+                            const SchedHints & hints)
 {
     if (blockNewWork) {
         Debug() << __func__ << ": Ignoring new work submitted because blockNewWork = true";
@@ -87,7 +248,7 @@ void ThreadPool::submitWork(QObject *context, const VoidFunc & work, const VoidF
             Warning() << "A ThreadPool job failed with the error message: " << msg;
     };
     const FailFunc & failFuncToUse (fail ? fail : defaultFail);
-    Job *job = new Job(context, this, work, completion, failFuncToUse);
+    Job *job = new Job(context, this, work, completion, failFuncToUse, hints, classify(hints));
     QObject::connect(job, &QObject::destroyed, this, [this](QObject *){ --extant;}, Qt::DirectConnection);
     if (const auto njobs = ++extant; njobs > extantLimit) {
         ++noverflows;
@@ -101,7 +262,6 @@ void ThreadPool::submitWork(QObject *context, const VoidFunc & work, const VoidF
     } else if (njobs > extantMaxSeen)
         // FIXME: this isn't entirely atomic but this value is for diagnostic purposes and doesn't need to be strictly correct
         extantMaxSeen = njobs;
-    job->setAutoDelete(true);
     const auto num = ++ctr;
     job->setObjectName(QStringLiteral("Job %1 for '%2'").arg(num).arg( context ? context->objectName() : QStringLiteral("<no context>")));
     if constexpr (debugPrt) {
@@ -115,7 +275,51 @@ void ThreadPool::submitWork(QObject *context, const VoidFunc & work, const VoidF
             Debug() << n << " -- failed: " << msg;
         }, Qt::DirectConnection);
     }
-    pool->start(job, priority);
+    job->setAutoDelete(false); // owned by `sched` until popped, then by runNext()
+    classMetrics(job->workClass).depth.add(1);
+    {
+        std::unique_lock g(sched->mut);
+        sched->push(job);
+    }
+    // Each job submitted posts one runNext() to the pool, which runs whichever job is due by then (not necessarily
+    // this one).
+    pool->start([this]{ runNext(); });
+}
+
+void ThreadPool::runNext()
+{
+    static thread_local const bool placed = (ThreadTopology::placeCurrentThread(ThreadTopology::Group::Workers), true);
+    Q_UNUSED(placed)
+    Job *job;
+    {
+        // Heavy jobs may use at most half the threads while other work is waiting
+        const size_t heavyLimit = size_t(std::max(1, (pool->maxThreadCount() + 1) / 2));
+        std::unique_lock g(sched->mut);
+        job = sched->pop(heavyLimit);
+    }
+    if (UNLIKELY(!job)) return; // sched was cleared by shutdownWaitForJobs()
+    const std::unique_ptr<Job> jobGuard(job);
+    const auto & metrics = classMetrics(job->workClass);
+    metrics.depth.add(-1);
+    const qint64 t0 = Util::getTimeNS();
+    metrics.delay.recordNanos(t0 - job->tSubmitNS);
+    if (job->hints.deadlineNS && t0 > job->hints.deadlineNS && !isShuttingDown() && job->weakContextRef) {
+        ++ndeadlineDrops;
+        metrics.drops.add();
+        emit job->failed(QStringLiteral("Request timed out waiting in the work queue (%1 msec)")
+                         .arg((t0 - job->tSubmitNS) / 1'000'000));
+    } else
+        job->run();
+    const qint64 elapsed = Util::getTimeNS() - t0;
+    {
+        std::unique_lock g(sched->mut);
+        --sched->queues[size_t(job->workClass)].running;
+        if (job->didWork)
+            sched->recordCost(job->hints, elapsed);
+    }
+#ifdef ENABLE_TESTS
+    if (testHookJobDone) testHookJobDone();
+#endif
 }
 
 bool ThreadPool::shutdownWaitForJobs(int timeout_ms)
@@ -125,7 +329,10 @@ bool ThreadPool::shutdownWaitForJobs(int timeout_ms)
         Debug() << __func__ << ": waiting for jobs ...";
     }
     pool->clear();
-    return pool->waitForDone(timeout_ms);
+    const bool ret = pool->waitForDone(timeout_ms);
+    std::unique_lock g(sched->mut);
+    sched->clear();
+    return ret;
 }
 
 int ThreadPool::extantJobs() const noexcept { return extant.load(); }
@@ -139,6 +346,7 @@ bool ThreadPool::setExtantJobLimit(int limit)  noexcept {
 }
 uint64_t ThreadPool::numJobsSubmitted() const noexcept { return ctr.load(); }
 uint64_t ThreadPool::overflows() const noexcept { return noverflows.load(); }
+uint64_t ThreadPool::numDeadlineDrops() const noexcept { return ndeadlineDrops.load(); }
 int ThreadPool::maxThreadCount() const noexcept { return pool->maxThreadCount(); }
 bool ThreadPool::setMaxThreadCount(int max) {
     if (max < 1)
@@ -156,5 +364,95 @@ QVariantMap ThreadPool::stats() const noexcept
     m["job count (lifetime)"] = qulonglong(numJobsSubmitted());
     m["job queue overflows (lifetime)"] = qulonglong(overflows());
     m["thread count (max)"] = maxThreadCount();
+    m["deadline drops (lifetime)"] = qulonglong(numDeadlineDrops());
+    QVariantMap classes, costs;
+    std::unique_lock g(sched->mut);
+    for (int i = 0; i < kNumWorkClasses; ++i) {
+        const auto & q = sched->queues[i];
+        classes[workClassName(WorkClass(i))] = QVariantMap{
+            {"queued", qulonglong(q.size)},
+            {"running", qulonglong(q.running)},
+            {"clients queued", qulonglong(q.byFairKey.size())},
+            {"job count (lifetime)", qulonglong(q.nSubmitted)},
+        };
+    }
+    for (auto it = sched->costByKey.cbegin(); it != sched->costByKey.cend(); ++it)
+        costs[it.key()] = QString("%1 msec (%2)").arg(double(it.value()) / 1e6, 0, 'f', 3)
+                                                 .arg(workClassName(Sched::classFor(it.value())));
+    m["work classes"] = classes;
+    m["cost estimates"] = costs;
+    m["heavy subkeys tracked"] = sched->heavySubKeys.size();
     return m;
 }
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+#include <QSemaphore>
+
+#include <chrono>
+#include <thread>
+
+namespace {
+    void testThreadPool() {
+        using namespace std::chrono_literals;
+        using WC = ThreadPool::WorkClass;
+        ThreadPool tp;
+        if (!tp.setMaxThreadCount(1)) throw Exception("Unable to set thread count");
+        QSemaphore done, gate, gateTaken, jobsDone;
+        tp.testHookJobDone = [&jobsDone]{ jobsDone.release(); };
+        const auto submit = [&](const ThreadPool::SchedHints &h, const ThreadPool::VoidFunc &f) {
+            tp.submitWork(nullptr, [&done, f]{ if (f) f(); done.release(); }, {}, {}, h);
+        };
+        // occupies the pool's one thread until `gate` is released; wait on `gateTaken` before queueing behind it
+        const auto submitGate = [&] { submit({}, [&]{ gateTaken.release(); gate.acquire(); }); };
+        const ThreadPool::SchedHints heavy{"test.heavy"}, light{"test.light"}, whale{"test.light", "whale"};
+
+        // cost model
+        if (tp.classify(heavy) != WC::Normal) throw Exception("Unseen costKey should be Normal");
+        submit(heavy, []{ std::this_thread::sleep_for(60ms); });
+        submit(light, {});
+        submit(whale, []{ std::this_thread::sleep_for(60ms); });
+        jobsDone.acquire(3); // runNext() records the cost after `work` returns (and releases `done`)
+        done.acquire(3);
+        if (tp.classify(heavy) != WC::Heavy || tp.classify(light) != WC::Light || tp.classify(whale) != WC::Heavy)
+            throw Exception("Bad classification after training");
+
+        // class shares and fair keys: with the one thread blocked, queue 10 Heavy jobs, then 6 Light jobs from one
+        // client and 2 from another.
+        std::mutex orderMut;
+        QString order;
+        const auto append = [&](QChar c) { return [&, c]{ std::unique_lock g(orderMut); order += c; }; };
+        submitGate();
+        gateTaken.acquire();
+        for (int i = 0; i < 10; ++i) submit({"test.heavy", {}, 1}, append('H'));
+        for (int i = 0; i < 6; ++i) submit({"test.light", {}, 2}, append('a'));
+        for (int i = 0; i < 2; ++i) submit({"test.light", {}, 3}, append('b'));
+        gate.release();
+        done.acquire(19);
+        Log() << "ThreadPool: run order: " << order;
+        if (order.left(9).count('H') > 1)
+            throw Exception("Light jobs were starved by Heavy ones: " + order);
+        if (order.lastIndexOf('b') > 5)
+            throw Exception("Light jobs were not served round-robin by fair key: " + order);
+
+        // deadlines: with the one thread blocked, queue a job whose deadline has already passed and one whose
+        // deadline is far off
+        bool ran = false, ranLate = false;
+        submitGate();
+        gateTaken.acquire();
+        submit({{}, {}, 0, Util::getTimeNS() - 1}, [&ran]{ ran = true; });
+        submit({{}, {}, 0, Util::getTimeNS() + 3'600'000'000'000}, [&ranLate]{ ranLate = true; });
+        tp.submitWork(nullptr, [&done]{ done.release(); }); // the dropped job never releases `done`, so release it here
+        gate.release();
+        done.acquire(3);
+        if (ran || tp.numDeadlineDrops() != 1)
+            throw Exception("Job past its deadline was not dropped");
+        if (!ranLate)
+            throw Exception("Job within its deadline was not run");
+        Log() << "ThreadPool: ok";
+    }
+
+    const auto t_threadpool = App::registerTest("threadpool", testThreadPool);
+} // namespace
+#endif
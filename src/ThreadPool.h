@@ -18,11 +18,14 @@
 //
 #pragma once
 
+#include <QByteArray>
 #include <QObject>
 #include <QPointer>
 #include <QRunnable>
+#include <QString>
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
 
@@ -35,6 +38,12 @@ class QThreadPool;
 /// Each instance of this class internally creates its own QThreadPool instance, thus each instance never conflicts with
 /// other thread pools such as the Qt-provided QThreadPool::globalInstance().
 ///
+/// Jobs are not handed to the QThreadPool in submission order. Each job is placed in the queue of its WorkClass
+/// (estimated from how long jobs with the same SchedHints::costKey took in the past), and within that queue, in a
+/// per-SchedHints::fairKey sub-queue. Every time a pool thread becomes free it takes the next job from whichever class
+/// is furthest behind its weighted share of the threads, and from that class's fair keys round-robin. Thus a backlog
+/// of expensive requests from one client cannot starve cheap requests from other clients.
+///
 /// All of the public methods of this class are thread-safe.  None of the methods of this class throw.
 class ThreadPool : public QObject
 {
@@ -49,6 +58,28 @@ public:
     using FailFunc = std::function<void(const QString &)>;
     using VoidFunc = std::function<void()>;
 
+    /// Scheduling class of a job, by its estimated run time. Classes share the pool's threads in the ratio 8:3:1.
+    enum class WorkClass : uint8_t { Light, Normal, Heavy, NumClasses };
+    static constexpr int kNumWorkClasses = int(WorkClass::NumClasses);
+    static const char *workClassName(WorkClass) noexcept;
+    /// Jobs whose cost estimate is below this are Light, and those at or above kHeavyMinNS are Heavy.
+    static constexpr int64_t kLightMaxNS = 2'000'000, kHeavyMinNS = 50'000'000;
+
+    /// Optional scheduling hints for submitWork().
+    struct SchedHints {
+        /// What kind of work this is, e.g. an RPC method name. The job's WorkClass is estimated from the run times of
+        /// previous jobs with this costKey. Jobs with no costKey, or one not seen before, are WorkClass::Normal.
+        QString costKey;
+        /// What the work is about, e.g. a scripthash. If a previous job with this (costKey, subKey) was Heavy, its run
+        /// time is used instead of the costKey's, so that repeat requests for a huge address are classed as Heavy.
+        QByteArray subKey;
+        /// Who the work is for, e.g. a client id. Within a WorkClass, fair keys are served round-robin.
+        uint64_t fairKey = 0;
+        /// If nonzero: a Util::getTimeNS() timestamp after which the job is no longer worth starting (because the
+        /// requester will have given up on it by then). Such a job is dropped and `fail` is called instead.
+        int64_t deadlineNS = 0;
+    };
+
     /// Submit work to be performed asynchronously from a thread pool thread.
     ///
     /// `work` is called in the context of one of this instance's QThreadPool threads (it should lambda-capture all
@@ -71,8 +102,10 @@ public:
     ///
     /// Using shared_ptr to share data between `work` and `completion` (via lambda-capture) is thus the intended
     /// way to use this mechanism.
+    ///
+    /// `hints` controls where the job is queued; see SchedHints.
     void submitWork(QObject *context, const VoidFunc & work, const VoidFunc & completion = VoidFunc(),
-                    const FailFunc & fail = FailFunc(), int priority = 0);
+                    const FailFunc & fail = FailFunc(), const SchedHints & hints = SchedHints());
 
     /// Call this on app or pool shutdown to wait for extant jobs that may be running to complete. This prevents jobs
     /// that are currently running from referencing data that may go away during shutdown (a situation that would cause
@@ -113,6 +146,11 @@ public:
 
     /// Returns the number of jobs that were ever successfilly submitted via SubmitWork
     uint64_t numJobsSubmitted() const noexcept;
+    /// Returns the number of jobs that were dropped because their SchedHints::deadlineNS passed while they were queued.
+    uint64_t numDeadlineDrops() const noexcept;
+
+    /// Returns the WorkClass a job with these hints would be queued in right now.
+    WorkClass classify(const SchedHints &hints) const;
 
     /// Returns true if the ThreadPool is currently being shutdown. A shutting-down ThreadPool will reject all new work.
     inline bool isShuttingDown() const noexcept { return blockNewWork.load(); }
@@ -122,12 +160,24 @@ public:
     QVariantMap stats() const noexcept;
 
 private:
+    struct Sched;
+    /// Runs in a pool thread: takes the next job from `sched`, runs it, and feeds its run time to the cost model.
+    void runNext();
+
     const std::unique_ptr<QThreadPool> pool;
-    std::atomic_uint64_t ctr = 0, noverflows = 0;
+    const std::unique_ptr<Sched> sched;
+    std::atomic_uint64_t ctr = 0, noverflows = 0, ndeadlineDrops = 0;
     std::atomic_int extant = 0, extantMaxSeen = 0;
     std::atomic_bool blockNewWork = false;
     /// maximum number of extant jobs we allow before failing and not enqueuing more.
     std::atomic_int extantLimit = 15'000;
+
+#ifdef ENABLE_TESTS
+public:
+    /// If set, runNext() calls this in the pool thread once it is all done with a job (its cost has been recorded).
+    /// Set it before submitting any work.
+    VoidFunc testHookJobDone;
+#endif
 };
 
 /// Semi-private class not intended to be constructed by client code, but used inside ThreadPool::SubmitWork.
@@ -142,12 +192,17 @@ class Job : public QObject, public QRunnable {
     const ThreadPool * const pool; ///< since the ThreadPool object owns us, this pointer is always valid if we exist.
     const VoidFunc work;
     QPointer<QObject> weakContextRef;
+    const qint64 tSubmitNS; ///< when this job was created (enqueued); for the queue delay metric
+    const ThreadPool::SchedHints hints;
+    const ThreadPool::WorkClass workClass;
+    bool didWork = false; ///< set by run() if it got as far as calling `work`
 
 
     Job(QObject *context, ThreadPool *pool,
         const VoidFunc & work,
-        const VoidFunc & completion = VoidFunc(),
-        const FailFunc & = FailFunc()) noexcept;
+        const VoidFunc & completion,
+        const FailFunc & fail,
+        const ThreadPool::SchedHints & hints, ThreadPool::WorkClass workClass) noexcept;
 
 public:
     void run() override;
@@ -0,0 +1,288 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#include "ThreadTopology.h"
+#include "Common.h"
+#include "Util.h"
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+
+#if defined(Q_OS_LINUX)
+#  include <sched.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+namespace ThreadTopology {
+
+namespace {
+    std::mutex mut;
+    std::array<CpuSet, kNumGroups> cpusByGroup; ///< guarded by mut
+    std::map<long, Group> groupByTid; ///< guarded by mut; the threads we placed (or tried to), by system thread id
+
+    /// Parses "0-7,16-23" style ranges into `out`. Throws BadArgs on malformed input.
+    void parseCpuRanges(const QString &s, std::set<unsigned> &out) {
+        for (const QString & tokRaw : s.split(',')) {
+            const QString tok = tokRaw.trimmed();
+            if (tok.isEmpty()) continue;
+            const auto parts = tok.split('-');
+            bool ok1 = false, ok2 = true;
+            const unsigned lo = parts[0].trimmed().toUInt(&ok1);
+            const unsigned hi = parts.size() == 2 ? parts[1].trimmed().toUInt(&ok2) : lo;
+            if (!ok1 || !ok2 || parts.size() > 2 || hi < lo)
+                throw BadArgs(QString("Bad CPU range \"%1\"").arg(tok));
+            if (hi - lo >= 65'536u)
+                throw BadArgs(QString("CPU range \"%1\" is too large").arg(tok));
+            for (unsigned c = lo; c <= hi; ++c)
+                out.insert(c);
+        }
+    }
+
+#if defined(Q_OS_LINUX)
+    long currentTid() { return long(::syscall(SYS_gettid)); }
+
+    bool setAffinity(long tid, const CpuSet &cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const unsigned c : cpus)
+            if (c < CPU_SETSIZE) CPU_SET(c, &set);
+        return ::sched_setaffinity(pid_t(tid), sizeof(set), &set) == 0;
+    }
+
+    std::optional<CpuSet> getAffinity(long tid) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity(pid_t(tid), sizeof(set), &set) != 0)
+            return std::nullopt;
+        CpuSet ret;
+        for (unsigned c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set)) ret.push_back(c);
+        return ret;
+    }
+
+    /// The threads of this process, with their system names
+    std::map<long, QByteArray> listThreads() {
+        std::map<long, QByteArray> ret;
+        const QDir dir("/proc/self/task");
+        for (const QString & ent : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+            bool ok;
+            const long tid = ent.toLong(&ok);
+            if (!ok) continue;
+            QFile f(dir.filePath(ent + "/comm"));
+            ret[tid] = f.open(QIODevice::ReadOnly) ? f.readAll().trimmed() : QByteArray();
+        }
+        return ret;
+    }
+#endif
+} // namespace
+
+const char *groupName(Group g) noexcept
+{
+    switch (g) {
+    case Group::Workers: return "workers";
+    case Group::DB: return "db";
+    case Group::CoTask: return "cotask";
+    case Group::IO: return "io";
+    case Group::NumGroups: break;
+    }
+    return "unknown";
+}
+
+bool isSupported() noexcept
+{
+#if defined(Q_OS_LINUX)
+    return true;
+#else
+    return false;
+#endif
+}
+
+CpuSet parseCpuList(const QString &s)
+{
+    std::set<unsigned> cpus;
+    QStringList plain;
+    for (const QString & tokRaw : s.split(',')) {
+        const QString tok = tokRaw.trimmed();
+        if (!tok.startsWith(QLatin1String("node"))) {
+            plain.push_back(tok);
+            continue;
+        }
+        bool ok;
+        const unsigned node = tok.mid(4).toUInt(&ok);
+        QFile f(QString("/sys/devices/system/node/node%1/cpulist").arg(node));
+        if (!ok || !f.open(QIODevice::ReadOnly))
+            throw BadArgs(QString("Unknown NUMA node \"%1\"").arg(tok));
+        parseCpuRanges(QString::fromLatin1(f.readAll()), cpus);
+    }
+    parseCpuRanges(plain.join(','), cpus);
+    if (cpus.empty())
+        throw BadArgs(QString("Empty CPU list \"%1\"").arg(s));
+    CpuSet ret(cpus.begin(), cpus.end());
+#if defined(Q_OS_LINUX)
+    if (const auto allowed = getAffinity(0)) {
+        for (const unsigned c : ret)
+            if (!std::binary_search(allowed->begin(), allowed->end(), c))
+                throw BadArgs(QString("CPU %1 is not available to this process (available: %2)")
+                              .arg(c).arg(toCpuList(*allowed)));
+    }
+#endif
+    return ret;
+}
+
+QString toCpuList(const CpuSet &cpus)
+{
+    QStringList ranges;
+    for (size_t i = 0; i < cpus.size(); ) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1u) ++j;
+        ranges.push_back(i == j ? QString::number(cpus[i]) : QString("%1-%2").arg(cpus[i]).arg(cpus[j]));
+        i = j + 1;
+    }
+    return ranges.join(',');
+}
+
+void setGroupCpus(Group g, const CpuSet &cpus)
+{
+    std::unique_lock l(mut);
+    cpusByGroup[size_t(g)] = cpus;
+}
+
+CpuSet groupCpus(Group g)
+{
+    std::unique_lock l(mut);
+    return cpusByGroup[size_t(g)];
+}
+
+void placeCurrentThread(Group g)
+{
+#if defined(Q_OS_LINUX)
+    const long tid = currentTid();
+    std::unique_lock l(mut);
+    groupByTid[tid] = g;
+    if (const auto & cpus = cpusByGroup[size_t(g)]; !cpus.empty() && !setAffinity(tid, cpus))
+        Warning() << "Failed to pin thread " << Util::ThreadName::Get() << " to CPUs " << toCpuList(cpus);
+#else
+    Q_UNUSED(g)
+#endif
+}
+
+unsigned placeThreadsByName(Group g, const QByteArray &namePrefix)
+{
+    unsigned ret = 0;
+#if defined(Q_OS_LINUX)
+    const auto threads = listThreads();
+    std::unique_lock l(mut);
+    const auto & cpus = cpusByGroup[size_t(g)];
+    for (const auto & [tid, name] : threads) {
+        if (!name.startsWith(namePrefix)) continue;
+        ++ret;
+        groupByTid[tid] = g;
+        if (!cpus.empty() && !setAffinity(tid, cpus))
+            Warning() << "Failed to pin thread " << name << " (" << tid << ") to CPUs " << toCpuList(cpus);
+    }
+#else
+    Q_UNUSED(g) Q_UNUSED(namePrefix)
+#endif
+    return ret;
+}
+
+QVariantMap stats()
+{
+    QVariantMap ret;
+#if defined(Q_OS_LINUX)
+    const auto threads = listThreads();
+#endif
+    std::unique_lock l(mut);
+    std::array<QVariantMap, kNumGroups> actual; ///< per group: cpu list -> number of threads with that affinity
+    std::array<unsigned, kNumGroups> nThreads{};
+#if defined(Q_OS_LINUX)
+    for (auto it = groupByTid.begin(); it != groupByTid.end(); ) {
+        const auto aff = threads.count(it->first) ? getAffinity(it->first) : std::nullopt;
+        if (!aff) {
+            it = groupByTid.erase(it); // thread exited
+            continue;
+        }
+        auto & v = actual[size_t(it->second)][toCpuList(*aff)];
+        v = v.toUInt() + 1u;
+        ++nThreads[size_t(it->second)];
+        ++it;
+    }
+#endif
+    for (int i = 0; i < kNumGroups; ++i) {
+        const auto & cpus = cpusByGroup[size_t(i)];
+        ret[groupName(Group(i))] = QVariantMap{
+            {"cpus (configured)", cpus.empty() ? QVariant() : QVariant(toCpuList(cpus))},
+            {"threads", nThreads[size_t(i)]},
+            {"cpus (actual)", actual[size_t(i)]},
+        };
+    }
+    ret["supported"] = isSupported();
+    return ret;
+}
+
+} // namespace ThreadTopology
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+namespace {
+    void testThreadTopology() {
+        using namespace ThreadTopology;
+        const auto ranges = [](const QString &s) {
+            std::set<unsigned> out;
+            parseCpuRanges(s, out);
+            return toCpuList(CpuSet(out.begin(), out.end()));
+        };
+        for (const auto & [in, out] : std::vector<std::pair<QString, QString>>{
+                 {"0", "0"}, {"0-3", "0-3"}, {" 3, 1 ,2,0 ", "0-3"}, {"0-7,16-23", "0-7,16-23"},
+                 {"5,0-2,3", "0-3,5"}, {"1-1,9", "1,9"}, {"", ""}})
+            if (const auto got = ranges(in); got != out)
+                throw Exception(QString("CPU list \"%1\" parsed as \"%2\", expected \"%3\"").arg(in, got, out));
+        for (const QString bad : {"x", "3-1", "1-2-3", "-1", "1-", "0-100000"}) {
+            bool threw = false;
+            try { ranges(bad); } catch (const BadArgs &) { threw = true; }
+            if (!threw) throw Exception(QString("Malformed CPU list \"%1\" was accepted").arg(bad));
+        }
+#if defined(Q_OS_LINUX)
+        // pin ourselves to one of the CPUs we may use, check that stats() sees it, then undo that
+        const auto allowed = getAffinity(0);
+        if (!allowed || allowed->empty()) throw Exception("sched_getaffinity failed");
+        const CpuSet one = parseCpuList(QString::number(allowed->back()));
+        setGroupCpus(Group::IO, one);
+        placeCurrentThread(Group::IO);
+        const auto io = stats().value("io").toMap();
+        setGroupCpus(Group::IO, {});
+        setAffinity(currentTid(), *allowed);
+        if (io.value("threads").toUInt() < 1u || !io.value("cpus (actual)").toMap().contains(toCpuList(one)))
+            throw Exception("Thread placement not reflected in stats");
+#endif
+        Log() << "ThreadTopology: ok";
+    }
+
+    const auto t_threadtopology = App::registerTest("threadtopology", testThreadTopology);
+} // namespace
+#endif
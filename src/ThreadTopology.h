@@ -0,0 +1,69 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QVariantMap>
+
+#include <cstdint>
+#include <vector>
+
+/// Optional pinning of the app's threads to CPU sets, by thread group, so that on multi-socket machines e.g. the
+/// RocksDB background threads and the RPC worker threads can be kept on separate NUMA nodes. The CPU set of each group
+/// is configured once at startup (see the cpu_affinity_* config options); threads then place themselves as they start.
+///
+/// Pinning is only supported on Linux. Elsewhere, all of the functions below are no-ops (and stats() reports only
+/// the configuration).
+namespace ThreadTopology {
+    enum class Group : uint8_t {
+        Workers, ///< the ThreadPool threads that serve async RPC requests
+        DB,      ///< the RocksDB background flush and compaction threads
+        CoTask,  ///< the CoTask threads (block processing helpers, UTXO cache prefetcher and flusher, etc)
+        IO,      ///< the event-loop threads (servers, bitcoind connections, controller, etc)
+        NumGroups
+    };
+    inline constexpr int kNumGroups = int(Group::NumGroups);
+    /// "workers", "db", "cotask", or "io" (as used in the cpu_affinity_* config option names)
+    const char *groupName(Group) noexcept;
+
+    using CpuSet = std::vector<unsigned>; ///< sorted, no duplicates
+
+    bool isSupported() noexcept;
+
+    /// Parses a CPU list in the format used by Linux (e.g. "0-7,16-23"), in which "nodeN" also stands for all of the
+    /// CPUs of NUMA node N. Throws BadArgs if it is malformed, or names a node or a CPU that this process may not use.
+    CpuSet parseCpuList(const QString &);
+    /// The inverse of parseCpuList() (without node names), e.g. "0-7,16-23".
+    QString toCpuList(const CpuSet &);
+
+    /// Sets the CPUs that threads of `group` will be pinned to. Empty (the default) means they are not pinned.
+    /// Intended to be called at startup, before the threads in question start.
+    void setGroupCpus(Group, const CpuSet &);
+    CpuSet groupCpus(Group);
+
+    /// Pins the calling thread to its group's CPUs (if configured), and remembers which group it is in, for stats().
+    void placeCurrentThread(Group);
+    /// Pins all threads of this process whose system name starts with `namePrefix` (e.g. "rocksdb:") to `group`'s
+    /// CPUs (if configured). For threads we don't create ourselves. Returns the number of threads found.
+    unsigned placeThreadsByName(Group, const QByteArray &namePrefix);
+
+    /// Per group: the configured CPUs, and the actual CPU affinity of each of its threads that are still alive.
+    QVariantMap stats();
+} // namespace ThreadTopology
@@ -0,0 +1,299 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#include "TxHashIndex.h"
+#include "Common.h"
+
+#include <bit>
+#include <limits>
+#include <numeric>
+
+BlockedBloomFilter::BlockedBloomFilter(size_t expectedKeys, unsigned bitsPerKey)
+    : capacityKeys(expectedKeys)
+{
+    const size_t nBlocks = std::max<size_t>(size_t(1) << kMinBlockBits,
+                                            std::bit_ceil((expectedKeys * bitsPerKey + kBlockBits - 1u) / kBlockBits));
+    blockBits = unsigned(std::countr_zero(nBlocks));
+    words.assign(nBlocks * kWordsPerBlock, 0u);
+}
+
+TxHashIndex::TxHashIndex(size_t expectedTxs) : bloom(expectedTxs) {}
+
+void TxHashIndex::Run::buildFence()
+{
+    // ~4 keys per fence slot: enough to make the scan after the fence lookup trivially short
+    fenceBits = keys.size() >= 8u ? std::min(unsigned(std::bit_width(keys.size())) - 3u, 24u) : 0u;
+    fence.assign((size_t(1) << fenceBits) + 1u, 0u);
+    size_t i = 0;
+    for (size_t p = 0; p < fence.size() - 1u; ++p) {
+        for ( ; i < keys.size() && (fenceBits ? keys[i] >> (64u - fenceBits) : 0u) < p; ++i) {}
+        fence[p] = uint32_t(i);
+    }
+    fence.back() = uint32_t(keys.size());
+}
+
+auto TxHashIndex::merge(Run &&a, Run &&b) -> Run
+{
+    // a covers the TxNums just before b's
+    Run ret;
+    ret.txNum0 = a.txNum0;
+    const auto bias = uint32_t(b.txNum0 - a.txNum0);
+    ret.keys.resize(a.keys.size() + b.keys.size());
+    ret.offs.resize(ret.keys.size());
+    size_t i = 0, j = 0, k = 0;
+    while (i < a.keys.size() || j < b.keys.size()) {
+        if (j >= b.keys.size() || (i < a.keys.size() && a.keys[i] <= b.keys[j])) {
+            ret.keys[k] = a.keys[i]; ret.offs[k++] = a.offs[i++];
+        } else {
+            ret.keys[k] = b.keys[j]; ret.offs[k++] = b.offs[j++] + bias;
+        }
+    }
+    a = Run{}; b = Run{}; // release memory before building the fence
+    ret.buildFence();
+    return ret;
+}
+
+void TxHashIndex::compact()
+{
+    // Size-tiered: merge the last 2 runs while the older one is no more than twice as big as the newer one. This keeps
+    // run sizes roughly doubling going back in time, so there are O(log n) runs and each key is merged O(log n) times.
+    constexpr size_t kMaxRunKeys = std::numeric_limits<uint32_t>::max() / 2u; // offs must fit in a uint32_t
+    while (runs.size() >= 2u) {
+        auto & a = runs[runs.size() - 2u], & b = runs.back();
+        if (a.keys.size() > 2u * b.keys.size() || a.keys.size() + b.keys.size() > kMaxRunKeys)
+            break;
+        a = merge(std::move(a), std::move(b));
+        runs.pop_back();
+    }
+}
+
+void TxHashIndex::rebuildBloom(size_t expectedTxs)
+{
+    bloom = BlockedBloomFilter(expectedTxs);
+    for (const auto & run : runs)
+        for (const auto key : run.keys)
+            bloom.add(key);
+}
+
+void TxHashIndex::append(TxNum txNum0, const std::vector<uint64_t> &keys)
+{
+    if (UNLIKELY(txNum0 != nextTxNum()))
+        throw InternalError(QString("TxHashIndex::append: expected txNum0 %1, got %2").arg(nextTxNum()).arg(txNum0));
+    if (keys.empty()) return;
+    Run run;
+    run.txNum0 = txNum0;
+    run.offs.resize(keys.size());
+    std::iota(run.offs.begin(), run.offs.end(), 0u);
+    std::sort(run.offs.begin(), run.offs.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    run.keys.reserve(keys.size());
+    for (const auto off : run.offs)
+        run.keys.push_back(keys[off]);
+    run.buildFence();
+    runs.push_back(std::move(run));
+    compact();
+
+    if (const size_t n = nextTxNum(); n > bloom.capacity())
+        rebuildBloom(n * 2u); // amortized: grows geometrically
+    else
+        for (const auto key : keys)
+            bloom.add(key);
+}
+
+void TxHashIndex::truncate(TxNum txNum)
+{
+    while (!runs.empty() && runs.back().txNum0 >= txNum)
+        runs.pop_back();
+    if (runs.empty() || nextTxNum() <= txNum)
+        return;
+    auto & run = runs.back();
+    const auto keep = uint32_t(txNum - run.txNum0);
+    size_t k = 0;
+    for (size_t i = 0; i < run.keys.size(); ++i) {
+        if (run.offs[i] < keep) {
+            run.keys[k] = run.keys[i];
+            run.offs[k++] = run.offs[i];
+        }
+    }
+    run.keys.resize(k);
+    run.offs.resize(k);
+    run.buildFence();
+}
+
+void TxHashIndex::find(uint64_t key, std::vector<TxNum> &out) const
+{
+    for (const auto & run : runs) {
+        const size_t p = run.fenceBits ? size_t(key >> (64u - run.fenceBits)) : 0u;
+        for (uint32_t i = run.fence[p], end = run.fence[p + 1u]; i < end && run.keys[i] <= key; ++i)
+            if (run.keys[i] == key)
+                out.push_back(run.txNum0 + run.offs[i]);
+    }
+}
+
+size_t TxHashIndex::memoryUsage() const noexcept
+{
+    size_t ret = bloom.memoryUsage() + runs.capacity() * sizeof(Run);
+    for (const auto & run : runs)
+        ret += run.keys.capacity() * sizeof(uint64_t) + (run.offs.capacity() + run.fence.capacity()) * sizeof(uint32_t);
+    return ret;
+}
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+#include "RecordFile.h"
+
+#include <QFile>
+#include <QRandomGenerator>
+
+#include <cstdlib>
+#include <map>
+
+namespace {
+    void testTxHashIndex() {
+        auto *rng = QRandomGenerator::global();
+        TxHashIndex idx;
+        std::multimap<uint64_t, TxNum> expected;
+        std::vector<uint64_t> all;
+        // blocks of random sizes, with some deliberately colliding keys
+        for (int blk = 0; blk < 300; ++blk) {
+            std::vector<uint64_t> keys(rng->bounded(1, 400));
+            for (auto & k : keys)
+                k = all.empty() || rng->bounded(50) ? rng->generate64() : all[rng->bounded(int(all.size()))];
+            for (size_t i = 0; i < keys.size(); ++i)
+                expected.emplace(keys[i], idx.nextTxNum() + i);
+            idx.append(idx.nextTxNum(), keys);
+            all.insert(all.end(), keys.begin(), keys.end());
+        }
+        if (idx.numRuns() > 64u)
+            throw Exception(QString("Too many runs: %1").arg(idx.numRuns()));
+        const auto Check = [&] {
+            std::vector<TxNum> got;
+            for (const auto key : all) {
+                if (!idx.mayContain(key)) throw Exception("Bloom filter false negative");
+                got.clear();
+                idx.find(key, got);
+                std::sort(got.begin(), got.end());
+                std::vector<TxNum> want;
+                for (auto [it, end] = expected.equal_range(key); it != end; ++it)
+                    want.push_back(it->second);
+                std::sort(want.begin(), want.end());
+                if (got != want) throw Exception(QString("Wrong TxNums for key %1").arg(key));
+            }
+        };
+        Check();
+        // undo to the middle of some run, then check that the forgotten txs are gone
+        const TxNum cut = idx.nextTxNum() * 2 / 3 + 1;
+        idx.truncate(cut);
+        if (idx.nextTxNum() != cut) throw Exception("Bad nextTxNum after truncate");
+        for (auto it = expected.begin(); it != expected.end(); )
+            it = it->second >= cut ? expected.erase(it) : std::next(it);
+        all.resize(cut);
+        Check();
+        // false positive rate of the Bloom filter for keys that were never added
+        size_t fps = 0;
+        constexpr size_t nProbes = 200'000;
+        for (size_t i = 0; i < nProbes; ++i)
+            fps += idx.mayContain(rng->generate64());
+        if (fps > nProbes / 20u) throw Exception(QString("Bloom filter false positive rate too high: %1").arg(fps));
+        Log() << "TxHashIndex: ok (runs: " << idx.numRuns() << ", bloom false positives: " << fps << "/" << nProbes << ")";
+    }
+
+    const auto t_txhashindex = App::registerTest("txhashindex", testTxHashIndex);
+
+    /// Builds a TxHashIndex from the "txnum2txhash" record file given by the TFILE env var (or, if TFILE is not set,
+    /// from 10M random keys in 2000-tx blocks), then times hits and misses against it and against a flat sorted array.
+    void benchTxHashIndex() {
+        auto *rng = QRandomGenerator::global();
+        std::vector<std::vector<uint64_t>> blocks;
+        size_t nKeys = 0;
+        if (const QString txnumsFile = std::getenv("TFILE") ? std::getenv("TFILE") : ""; !txnumsFile.isEmpty()) {
+            if (!QFile::exists(txnumsFile))
+                throw Exception("Please pass the TFILE env var as a path to an existing \"txnum2txhash\" data record file");
+            RecordFile rf(txnumsFile, HashLen, 0x000012e2); // this may throw
+            constexpr size_t batchSize = 50'000;
+            for (size_t i = 0, nrec = rf.numRecords(); i < nrec; i += batchSize) {
+                QString err;
+                const auto recs = rf.readRecords(i, std::min(batchSize, nrec - i), &err);
+                if (!err.isEmpty()) throw Exception(err);
+                auto & keys = blocks.emplace_back();
+                for (const auto & rec : recs)
+                    keys.push_back(TxHashIndex::keyFor(rec));
+                nKeys += keys.size();
+            }
+        } else {
+            for (size_t i = 0; i < 5'000; ++i) {
+                auto & keys = blocks.emplace_back(2'000);
+                for (auto & k : keys) k = rng->generate64();
+                nKeys += keys.size();
+            }
+        }
+        Log() << "Keys: " << nKeys << ", blocks: " << blocks.size();
+
+        Tic t0;
+        TxHashIndex idx;
+        for (const auto & keys : blocks)
+            idx.append(idx.nextTxNum(), keys);
+        Log() << "TxHashIndex: built in " << t0.msecStr() << " msec, runs: " << idx.numRuns() << ", memory: "
+              << QString::number(idx.memoryUsage() / 1e6, 'f', 1) << " MB ("
+              << QString::number(double(idx.memoryUsage()) / double(std::max<size_t>(nKeys, 1)), 'f', 1) << " bytes/tx)";
+        t0 = Tic();
+        std::vector<uint64_t> flat;
+        flat.reserve(nKeys);
+        for (const auto & keys : blocks)
+            flat.insert(flat.end(), keys.begin(), keys.end());
+        std::sort(flat.begin(), flat.end());
+        Log() << "Flat sorted array: built in " << t0.msecStr() << " msec";
+
+        constexpr size_t nProbes = 1'000'000;
+        std::vector<uint64_t> hits, misses(nProbes);
+        hits.reserve(nProbes);
+        for (size_t i = 0; i < nProbes; ++i) {
+            const auto & keys = blocks[rng->bounded(quint32(blocks.size()))];
+            if (!keys.empty()) hits.push_back(keys[rng->bounded(quint32(keys.size()))]);
+        }
+        for (auto & k : misses) k = rng->generate64();
+
+        const auto TimeIdx = [&](const char *what, const std::vector<uint64_t> &probes) {
+            std::vector<TxNum> out;
+            size_t found = 0, bloomRejects = 0;
+            const Tic t;
+            for (const auto key : probes) {
+                if (!idx.mayContain(key)) { ++bloomRejects; continue; }
+                out.clear();
+                idx.find(key, out);
+                found += !out.empty();
+            }
+            Log() << "TxHashIndex " << what << ": " << QString::number(t.nsec() / double(probes.size()), 'f', 1)
+                  << " ns/lookup, found: " << found << ", bloom rejects: " << bloomRejects << "/" << probes.size();
+        };
+        const auto TimeFlat = [&](const char *what, const std::vector<uint64_t> &probes) {
+            size_t found = 0;
+            const Tic t;
+            for (const auto key : probes)
+                found += std::binary_search(flat.begin(), flat.end(), key);
+            Log() << "Flat sorted array " << what << ": " << QString::number(t.nsec() / double(probes.size()), 'f', 1)
+                  << " ns/lookup, found: " << found;
+        };
+        TimeIdx("hits", hits);
+        TimeFlat("hits", hits);
+        TimeIdx("misses", misses);
+        TimeFlat("misses", misses);
+    }
+
+    const auto b_txindex = App::registerBench("txindex", benchTxHashIndex);
+} // namespace
+#endif
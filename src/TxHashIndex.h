@@ -0,0 +1,131 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2025 Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "BlockProcTypes.h"
+#include "ByteView.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// A Bloom filter whose k probes for a key all land in the same 64-byte block (one cache line), so that a query costs
+/// a single cache miss. Keys are expected to already be uniformly distributed 64-bit values (e.g. bytes of a txid),
+/// so no hashing beyond a cheap mix is done. Not thread-safe for concurrent writes; concurrent reads are fine.
+class BlockedBloomFilter {
+public:
+    static constexpr unsigned kBlockBits = 512, kWordsPerBlock = kBlockBits / 64, kProbes = 7;
+    static constexpr unsigned kDefaultBitsPerKey = 10; ///< ~1% false positive rate with kProbes in a 512-bit block
+
+    /// Sizes the filter for `expectedKeys` keys at `bitsPerKey` (the block count is rounded up to a power of 2).
+    explicit BlockedBloomFilter(size_t expectedKeys = 0, unsigned bitsPerKey = kDefaultBitsPerKey);
+
+    void add(uint64_t key) noexcept {
+        const uint64_t h = mix(key);
+        uint64_t * const block = &words[blockFor(key) * kWordsPerBlock];
+        for (unsigned i = 0; i < kProbes; ++i) {
+            const unsigned bit = unsigned(h >> (i * 9)) & (kBlockBits - 1u);
+            block[bit / 64u] |= uint64_t(1) << (bit % 64u);
+        }
+    }
+    /// Returns false if `key` was definitely never add()ed.
+    bool mayContain(uint64_t key) const noexcept {
+        const uint64_t h = mix(key);
+        const uint64_t * const block = &words[blockFor(key) * kWordsPerBlock];
+        for (unsigned i = 0; i < kProbes; ++i) {
+            const unsigned bit = unsigned(h >> (i * 9)) & (kBlockBits - 1u);
+            if (!(block[bit / 64u] & (uint64_t(1) << (bit % 64u)))) return false;
+        }
+        return true;
+    }
+
+    size_t capacity() const noexcept { return capacityKeys; } ///< the `expectedKeys` this filter was sized for
+    size_t memoryUsage() const noexcept { return words.capacity() * sizeof(uint64_t); }
+
+private:
+    /// The probe bits: 7 x 9 bits of a murmur3-style mix of the key
+    static constexpr uint64_t mix(uint64_t k) noexcept {
+        k ^= k >> 33; k *= 0xff51afd7ed558ccdULL; k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ULL; k ^= k >> 33;
+        return k;
+    }
+    /// The block: Fibonacci hashing of the key, so it is independent of the probe bits
+    size_t blockFor(uint64_t key) const noexcept { return size_t((key * 0x9e3779b97f4a7c15ULL) >> (64u - blockBits)); }
+
+    static constexpr unsigned kMinBlockBits = 6;
+    std::vector<uint64_t> words;
+    unsigned blockBits = kMinBlockBits; ///< log2 of the number of blocks
+    size_t capacityKeys = 0;
+};
+
+/// Memory-resident txhash -> TxNum index, used as an alternative to the txhash2txnum rocksdb table for lookups.
+///
+/// Keys are 8 bytes of the txid (vs 6 in the db), so collisions that must be resolved against the txnum2txhash file
+/// are ~65536 times rarer. The index is a list of append-only sorted runs, each covering a contiguous range of TxNums
+/// (and thus of blocks). Each block appends one run; adjacent runs are merged as they accumulate, so that there are
+/// O(log n) of them. Every run has a fence table over the top bits of its keys, so a probe is one table lookup plus a
+/// scan of ~4 keys. A BlockedBloomFilter over all keys answers most lookups for unconfirmed txids without probing any
+/// run at all.
+///
+/// Not thread-safe for concurrent writes; concurrent const access is fine. Storage serializes writes against reads
+/// via its blocksLock.
+class TxHashIndex {
+public:
+    /// The key we use for `txHash`: its first 8 bytes.
+    static uint64_t keyFor(const ByteView &txHash) noexcept {
+        uint64_t ret{};
+        std::memcpy(&ret, txHash.data(), std::min(txHash.size(), sizeof(ret)));
+        return ret;
+    }
+
+    explicit TxHashIndex(size_t expectedTxs = 0);
+
+    /// Appends a run covering TxNums [txNum0, txNum0 + keys.size()), where keys[i] is keyFor() of tx txNum0 + i.
+    /// txNum0 must equal nextTxNum().
+    void append(TxNum txNum0, const std::vector<uint64_t> &keys);
+    /// Forgets all TxNums >= txNum (for block undo). The Bloom filter keeps the forgotten keys as false positives.
+    void truncate(TxNum txNum);
+
+    /// Returns false if no tx with this key is in the index. Cheap; use this before find().
+    bool mayContain(uint64_t key) const noexcept { return bloom.mayContain(key); }
+    /// Appends to `out` the TxNum of every tx whose key is `key` (normally 0 or 1 of them).
+    void find(uint64_t key, std::vector<TxNum> &out) const;
+
+    TxNum nextTxNum() const noexcept { return runs.empty() ? 0 : runs.back().txNum0 + runs.back().keys.size(); }
+    size_t numRuns() const noexcept { return runs.size(); }
+    size_t memoryUsage() const noexcept;
+
+private:
+    struct Run {
+        TxNum txNum0 = 0;
+        std::vector<uint64_t> keys; ///< sorted
+        std::vector<uint32_t> offs; ///< parallel to keys: TxNum - txNum0
+        std::vector<uint32_t> fence; ///< (1 << fenceBits) + 1 entries; fence[p] = index of first key with top bits >= p
+        unsigned fenceBits = 0;
+
+        void buildFence();
+    };
+    static Run merge(Run &&a, Run &&b);
+    void compact(); ///< merges trailing runs of similar size
+    void rebuildBloom(size_t expectedTxs);
+
+    std::vector<Run> runs; ///< ordered by txNum0, covering contiguous TxNum ranges
+    BlockedBloomFilter bloom;
+};
@@ -59,6 +59,7 @@
 #include <QRegularExpression>
 #include <QHostAddress>
 
+#include <bit>                 // for std::endian
 #include <cctype>
 #include <cstddef>             // for std::byte, offsetof()
 #include <cstring>             // for strerror
@@ -244,6 +245,32 @@ namespace Util {
     unsigned getNPhysicalProcessors() { return std::thread::hardware_concurrency(); }
 #endif
 
+    bool ParseHexFastInPlace(const char *hex, size_t size, char *out)
+    {
+        if (UNLIKELY(size % 2)) return false;
+        const char * const end = hex + size;
+        if constexpr (std::endian::native == std::endian::little) {
+            // SWAR: decode 8 hex digits -> 4 bytes per iteration, branch-free. For each of '0'-'9', 'a'-'f', 'A'-'F',
+            // the low nibble of the char plus 9 if bit 6 is set (letters) yields the digit's value.
+            constexpr uint64_t lo4 = 0x0f0f0f0f0f0f0f0fULL, bit0 = 0x0101010101010101ULL;
+            for ( ; end - hex >= 8; hex += 8, out += 4) {
+                uint64_t x;
+                std::memcpy(&x, hex, 8);
+                x = (x & lo4) + ((x >> 6) & bit0) * 9u; // each byte is now a nibble value, first digit in lowest byte
+                x = ((x << 4) | (x >> 8)) & 0x00ff00ff00ff00ffULL; // each 16-bit lane: (hi << 4) | lo in its low byte
+                x = (x | (x >> 8)) & 0x0000ffff0000ffffULL;
+                x = (x | (x >> 16)) & 0x00000000ffffffffULL;
+                const uint32_t w = uint32_t(x);
+                std::memcpy(out, &w, 4); // safe even if out == hex: we already consumed the 8 bytes this may overwrite
+            }
+        }
+        for ( ; hex < end; hex += 2, ++out) {
+            const uint8_t c1 = uint8_t(hex[0]), c2 = uint8_t(hex[1]);
+            *out = char((((c1 & 0xfu) + (c1 >> 6) * 9u) << 4) | ((c2 & 0xfu) + (c2 >> 6) * 9u));
+        }
+        return true;
+    }
+
     QByteArray ParseHexFast(const QByteArray &hex, bool checkDigits)
     {
         const int size = hex.size();
@@ -253,6 +280,10 @@ namespace Util {
             ret.clear();
             return ret;
         }
+        if (!checkDigits) {
+            ParseHexFastInPlace(hex.constData(), size_t(size), ret.data());
+            return ret;
+        }
         const char *d = hex.constData(), * const dend = d + size;
         uint8_t c1, c2;
         for (char *out = ret.data(); d < dend; d += 2, ++out) {
@@ -716,7 +747,7 @@ Log::~Log()
         QString theString = tsStr + thrdStr + (logger && logger->isaTTY() ? colorize(str, color) : str);
 
         if (logger) {
-            emit logger->log(level, theString);
+            logger->submit(level, std::move(theString));
         } else {
             // logger not active yet; just print to console for now..
             static std::mutex mut;
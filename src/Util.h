@@ -607,6 +607,10 @@ namespace Util {
     ///         data if the input contains any non-hex digits (including spaces!).
     /// Note 3: Whitespace is *never* skipped -- the input data must be nothing but hex digits, lower or upprcase is ok.
     QByteArray ParseHexFast(const QByteArray &, bool checkDigits = false);
+    /// Like ParseHexFast() with checkDigits=false, but decodes `size` hex chars at `hex` into the buffer `out`, which
+    /// must have room for size/2 bytes. `out` may alias `hex` so long as `out <= hex`, so that a buffer may be decoded
+    /// in place. Returns false (and writes nothing) if `size` is odd.
+    bool ParseHexFastInPlace(const char *hex, size_t size, char *out);
     /// Identical to Qt's toHex, but 60% faster (returned string is lcase hex encoded).
     QByteArray ToHexFast(const QByteArray &);
     /// More efficient, if less convenient version of above. Operates on a buffer in-place.  Make sure bufsz is at least
@@ -41,6 +41,13 @@
 #include <cstring>
 #include <limits>
 #include <memory>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace WebSocket
 {
@@ -62,6 +69,46 @@ namespace WebSocket
         return QStringLiteral("Unknown (0x%1)").arg(quint8(ft), 2, 16, QChar('0'));
     }
 
+    void applyMask(std::uint8_t *buf, std::size_t len, const std::uint8_t mask[4], std::size_t maskOffset) noexcept
+    {
+        // rotate the mask so that m[0] applies to buf[0]
+        const Byte m[4] = { mask[maskOffset & 0x3], mask[(maskOffset + 1) & 0x3],
+                            mask[(maskOffset + 2) & 0x3], mask[(maskOffset + 3) & 0x3] };
+        quint32 m32;
+        std::memcpy(&m32, m, sizeof(m32));
+        std::size_t i = 0;
+        // Note: all of the wide loops below advance `i` by a multiple of 4, so the mask phase is preserved throughout.
+#if defined(__AVX2__)
+        if (len >= 32) {
+            const __m256i vm = _mm256_set1_epi32(int(m32));
+            for (; i + 32 <= len; i += 32) {
+                auto * const p = reinterpret_cast<__m256i *>(buf + i);
+                _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), vm));
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        if (len - i >= 16) {
+            const __m128i vm = _mm_set1_epi32(int(m32));
+            for (; i + 16 <= len; i += 16) {
+                auto * const p = reinterpret_cast<__m128i *>(buf + i);
+                _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), vm));
+            }
+        }
+#endif
+        // 8 bytes at a time (both halves of m64 are identical, so this is endian-agnostic)
+        const quint64 m64 = (quint64(m32) << 32) | quint64(m32);
+        for (; i + 8 <= len; i += 8) {
+            quint64 v;
+            std::memcpy(&v, buf + i, sizeof(v));
+            v ^= m64;
+            std::memcpy(buf + i, &v, sizeof(v));
+        }
+        // remaining tail, byte-at-a-time
+        for (; i < len; ++i)
+            buf[i] ^= m[i & 0x3];
+    }
+
     namespace Ser {
         QByteArray wrapPayload(const QByteArray &data, FrameType type, bool isMasked, std::size_t fragmentSize)
         {
@@ -133,9 +180,11 @@ namespace WebSocket
                     // first: write the 4 mask bytes themselves to the header so that the other end can decode
                     std::memcpy(dest, pmask, 4);
                     dest += 4;
-                    // next: write the payload xor'd with the mask bytes
-                    for (int j = 0; j < bytes2write; ++j)
-                        *dest++ = *src++ ^ pmask[j % 4];
+                    // next: write the payload, then xor it in-place with the mask bytes
+                    std::memcpy(dest, src, std::size_t(bytes2write));
+                    applyMask(dest, std::size_t(bytes2write), pmask);
+                    dest += bytes2write;
+                    src += bytes2write;
                 }
 
                 // update bytes remaining
@@ -172,35 +221,28 @@ namespace WebSocket
         namespace {
             inline constexpr auto kMessageTooBig1 = "invalid payload length (>INT_MAX!)";
 
-            inline void applyMask(Byte *buf, unsigned bufLen, const Byte *mask) {
-                for (unsigned i = 0; i < bufLen; ++i)
-                    buf[i] = buf[i] ^ mask[i % 4];
-            }
-
-            struct PartialFrame : public Frame {
+            struct PartialFrame {
+                FrameType type = FrameType::Text;
+                bool masked{};
                 bool fin{};  // .fin is always true if .isControl() is true, but not the other way around
                 // these point to the source buffer
-                const Byte *begin = nullptr, *payloadBegin = nullptr, *end = nullptr;
+                Byte *begin = nullptr, *payloadBegin = nullptr, *end = nullptr;
                 const Byte *mask = nullptr; // pointer to mask in src buffer -- non-null only iff this->masked == true
                 bool accepted = false;
                 // helpers -- these refer to the source buffer
+                inline constexpr bool isControl() const noexcept { return type & 0x08; }
                 inline std::size_t srcWireLen() const { return end > begin ? std::size_t(end-begin) : 0U; }
                 inline std::size_t srcPayloadLen() const { return end > payloadBegin ? std::size_t(end-payloadBegin) : 0U; }
-                inline void loadDataFromSrc(QByteArray *dest) {
-                    assert(dest);
-                    if (payloadBegin) {
-                        dest->reserve(std::max(dest->capacity(), dest->size() + int(srcPayloadLen())));
-                        dest->append(reinterpret_cast<const char *>(payloadBegin), int(srcPayloadLen()));
-                        if (mask && masked)
-                            applyMask(reinterpret_cast<Byte *>(dest->data() + dest->length() - int(srcPayloadLen())),
-                                      unsigned(srcPayloadLen()), mask);
-                    }
+                /// Unmasks the payload in-place in the source buffer. Must be called at most once per frame.
+                inline void unmaskInPlace() {
+                    if (mask && masked && payloadBegin)
+                        applyMask(payloadBegin, srcPayloadLen(), mask);
                 }
             };
 
-            // Note the returned frames do NOT have the src data copied in! They all have .payload.isEmpty().
-            // Calling code should use loadDataFromSrc() later to load the frames if/when they are accepted
-            std::optional<PartialFrame> parseFrame(const Byte * const pos, const std::size_t len, MaskEnforcement maskEnforcement) {
+            // Note the returned frames do not copy any data -- they just point into the src buffer. Calling code
+            // should call unmaskInPlace() later if/when they are accepted.
+            std::optional<PartialFrame> parseFrame(Byte * const pos, const std::size_t len, MaskEnforcement maskEnforcement) {
                 std::optional<PartialFrame> ret;
                 if (len >= 2) {
                     std::size_t header = 2;
@@ -259,11 +301,8 @@ namespace WebSocket
                             const Byte *mask = isMasked ? pos + header - 4 : nullptr;
                             ret.emplace(
                                 PartialFrame{
-                                    Frame{
-                                        FrameType(opByte),
-                                        isMasked,
-                                        {}, // .payload; never copy out payload data. Calling code will do this as needed.
-                                    },
+                                    FrameType(opByte),
+                                    isMasked,
                                     isFin,
                                     pos,           // .begin
                                     pos + header,  // .payloadBegin
@@ -281,153 +320,150 @@ namespace WebSocket
                 }
                 return ret;
             }
+
+            inline ByteView makeView(const Byte *begin, std::size_t len) {
+                return ByteView(reinterpret_cast<const std::byte *>(begin), len);
+            }
         }
 
         std::list<Frame> parseBuffer(QByteArray &buf, MaskEnforcement maskEnforcement)
         {
             std::list<Frame> ret;
-            using PFList = std::list<PartialFrame>;
-            PFList allFrames;
-            std::list<PFList::iterator> ctlFrames, allDataFrames, acceptedDataFrames; // iterators pointing into "allFrames"
-            const Byte * d = reinterpret_cast<const Byte *>(buf.constData());
-            std::size_t len = std::size_t(buf.size()), pos = 0;
+            parseBufferInPlace(buf, maskEnforcement, [&ret](const FrameView &fv) { ret.push_back(fv.toFrame()); });
+            return ret;
+        }
+
+        std::size_t parseBufferInPlace(QByteArray &buf, MaskEnforcement maskEnforcement, const FrameViewFunc &func)
+        {
+            std::size_t nDelivered = 0;
+            if (buf.isEmpty())
+                return nDelivered;
+            std::vector<PartialFrame> allFrames;
+            std::vector<std::size_t> ctlFrames, allDataFrames; // indices into "allFrames"
+            Byte * const d = reinterpret_cast<Byte *>(buf.data()); // note: this detaches `buf` if it was shared
+            const std::size_t len = std::size_t(buf.size());
+            std::size_t pos = 0;
             // cf_a df1_a df1_b cf_b df1_c df0_d df0_d df1_d cf_c df0_e df0_e -> cf_a cf_b cf_c df_a df_b df_c df_d [with df0_e left over]
             while (auto optFrame = parseFrame(d + pos, len - pos, maskEnforcement)) {
-                {
-                    PartialFrame & pf = *optFrame;
-                    pos += pf.srcWireLen();
-                    allFrames.emplace_back( std::move(pf) );
-                }
-                auto back_it = allFrames.end();
-                --back_it;
-                if (back_it->isControl()) {
-                    ctlFrames.push_back( back_it );
-                    back_it->accepted = true; // mark accepted -- this is used below to know which data to keep in the buffer and which to discard because it was already copied
-                } else {
-                    // queue the data frames for further analysis below
-                    allDataFrames.push_back( back_it );
-                }
+                pos += optFrame->srcWireLen();
+                (optFrame->isControl() ? ctlFrames : allDataFrames).push_back(allFrames.size());
+                allFrames.push_back(*optFrame);
             }
 
-            // Remember what the unparsed/leftover stuff at the end was because we need to keep that around as leftovers
-            const Byte * const keepAtEndBegin = d + pos;
-            const int keepAtEndLen = int(len) - int(pos);
-            int keepReserveSize = keepAtEndLen;
+            // Remember where the unparsed/leftover stuff at the end was because we need to keep that around as leftovers
+            const std::size_t keepAtEndPos = pos;
 
             // Now we have all the frames.
 
-            // Next, search through the dataFrames and figure out ranges that we accept,
+            // Next, search through the dataFrames and figure out ranges that we accept (each range is one message),
             // as well as predicate violations. We throw if:
             // - we encounter 0x0 continue frames without a preceding start data frame
             // - we encounter FIN frames that have non-zero opcode
             // - we encounter fragment START frames that have a zero opcode
-            for (auto it = allDataFrames.begin(), end = allDataFrames.end(); it != end; ++it) {
-                PFList::iterator pfi = *it;
-                if (pfi->fin) {
-                    if (pfi->type == FrameType::_Continuation)
+            struct MessageRange { std::size_t first, last; }; // inclusive indices into "allDataFrames"
+            std::vector<MessageRange> messages;
+            for (std::size_t i = 0; i < allDataFrames.size(); ++i) {
+                const PartialFrame &pf = allFrames[allDataFrames[i]];
+                if (pf.fin) {
+                    if (pf.type == FrameType::_Continuation)
                         throw ProtocolError("encountered a 'continue' frame with the FIN bit set, but without a corresponding start frame");
                     // non-fragmented FIN data frame, accept.
-                    acceptedDataFrames.push_back(pfi);
+                    messages.push_back({i, i});
                 } else {
                     // search for a range of frames that end in a "FIN" frame
-                    std::list<PFList::iterator> maybes;
-                    auto it2 = it;
-                    int cumSize = 0;
-                    for (; it2 != end; ++it2) {
-                        maybes.push_back(*it2);
-                        cumSize += int(maybes.back()->srcWireLen());
-
-                        if (const auto type = (*it2)->type; it == it2) {
+                    std::size_t j = i;
+                    std::size_t cumSize = 0;
+                    bool gotFin = false;
+                    for (; j < allDataFrames.size(); ++j) {
+                        const PartialFrame &pf2 = allFrames[allDataFrames[j]];
+                        if (j == i) {
                             // make sure that first frame in fragment set has opcode != 0, as per the RFC
-                            if (type == FrameType::_Continuation)
+                            if (pf2.type == FrameType::_Continuation)
                                 throw ProtocolError("encountered a fragment start frame with opcode set to 0");
                         } else {
                             // make sure that all subsequent fragments after the first have opcode == 0, as per the RFC
-                            if (type != FrameType::_Continuation)
+                            if (pf2.type != FrameType::_Continuation)
                                 throw ProtocolError(QString("encountered a continue frame with non-zero opcode: 0x%1")
-                                                    .arg(int(type), 2, 16, QChar('0')));
+                                                    .arg(int(pf2.type), 2, 16, QChar('0')));
                         }
+                        // guard against ridiculously big messages that exceed QByteArray size limits
+                        cumSize += pf2.srcPayloadLen();
+                        if (cumSize > std::size_t(std::numeric_limits<int>::max()))
+                            throw MessageTooBigError(kMessageTooBig1);
                         // we found a FIN frame, indicate this by breaking out of loop
-                        if ((*it2)->fin)
+                        if (pf2.fin) {
+                            gotFin = true;
                             break;
+                        }
                     }
-                    if (it2 != end) { // did we encounter a FIN frame?
-                        // yes, accept all of the maybes
-                        acceptedDataFrames.splice(acceptedDataFrames.end(), std::move(maybes) );
-                        it = it2; // update our outer loop iterator to point past this range
-                    } else {
-                        // no, break out of outer loop since we know nothing good is after 'it'.
-                        keepReserveSize += cumSize; // remember this cumulative size of stuff we didn't process for later: keepBuf.reserve()
+                    if (!gotFin)
+                        // no FIN, break out of outer loop since we know nothing good is after 'i'.
                         break;
-                    }
+                    // yes, accept the whole range
+                    messages.push_back({i, j});
+                    i = j; // update our outer loop iterator to point past this range
                 }
             }
 
-            // now, copy out the PartialFrames -> ret Frame
+            // Now, deliver the accepted frames, unmasking them in-place as we go.
 
             // first, the control frames go in front
-            for (const auto & pfi : ctlFrames) {
-                ret.push_back( *pfi );
-                pfi->loadDataFromSrc(&ret.back().payload); // copy the data now directly to the destination Frame
+            for (const auto idx : ctlFrames) {
+                PartialFrame &pf = allFrames[idx];
+                pf.accepted = true; // mark accepted -- this is used below to know which data to keep in the buffer
+                pf.unmaskInPlace();
+                func(FrameView{pf.type, pf.masked, makeView(pf.payloadBegin, pf.srcPayloadLen())});
+                ++nDelivered;
             }
 
-            // next the acceptable data frames, with fragments collapsed down into one destination Frame
-            std::optional<Frame> tmpFrame;
-            for (auto & pfi : acceptedDataFrames) {
-                pfi->accepted = true; // mark ALL accepted now
-                if (pfi->type == FrameType::Text || pfi->type == FrameType::Binary) {
-                    tmpFrame = *pfi;
-                    tmpFrame->payload.clear(); // this should already be empty, but to be defensive we must ensure data is empty initially
-                    // data will be copied below
-                } else if (pfi->type == FrameType::_Continuation && tmpFrame) {
-                    // data will be copied below
-                } else
-                    // they sent us a continuation frame with a FIN set.. but with no corresponding start frame.
-                    // note that this should not normally get triggered as we guard for it above already, but this
-                    // was left in for defensive programming.
-                    throw ProtocolError(QString("%1: Unexpected state in processing frame -- type=%2 tmpFrame=%3")
-                                        .arg(__func__).arg(pfi->type).arg(tmpFrame ? "valid" : "invalid"));
-
-                // guard against ridiculously big messages that exceed QByteArray size limits
-                if (std::size_t(tmpFrame->payload.length()) + pfi->srcPayloadLen() > std::size_t(std::numeric_limits<int>::max()))
-                    throw MessageTooBigError(kMessageTooBig1);
-
-                // append data to tmpFrame
-                pfi->loadDataFromSrc(&tmpFrame->payload);
-
-                if (pfi->fin) {
-                    ret.emplace_back(std::move(*tmpFrame));
-                    tmpFrame.reset();
+            // next the acceptable data frames, with fragments coalesced in-place down into one contiguous payload.
+            // This overwrites the headers of the fragments (as well as any control frames interleaved between them,
+            // which were already delivered above).
+            for (const auto & [first, last] : messages) {
+                PartialFrame &pf0 = allFrames[allDataFrames[first]];
+                if (pf0.type != FrameType::Text && pf0.type != FrameType::Binary)
+                    // Defensive programming. The checks above should guard against this.
+                    throw ProtocolError(QString("%1: Unexpected state in processing frame -- type=%2")
+                                        .arg(__func__).arg(pf0.type));
+                pf0.accepted = true;
+                pf0.unmaskInPlace();
+                Byte *dest = pf0.end;
+                for (std::size_t i = first + 1; i <= last; ++i) {
+                    PartialFrame &pf = allFrames[allDataFrames[i]];
+                    pf.accepted = true;
+                    pf.unmaskInPlace();
+                    const std::size_t plen = pf.srcPayloadLen();
+                    if (plen) std::memmove(dest, pf.payloadBegin, plen);
+                    dest += plen;
                 }
+                func(FrameView{pf0.type, pf0.masked, makeView(pf0.payloadBegin, std::size_t(dest - pf0.payloadBegin))});
+                ++nDelivered;
             }
-            if (tmpFrame)
-                // code above should guard against this -- this should never happen
-                throw InternalError(QString("%1: Unexpected state -- tmpFrame was not pushed back .. FIXME!").arg(__func__));
 
-            // finally, copy back pieces of data we didn't process so that the `buf` arg now only contains unprocessed data.
-            {
-                QByteArray keepBuf;
-                keepBuf.reserve(keepReserveSize);
-                //qDebug("Reserved: %d", keepReserveSize);
-                for (const auto & f : allFrames) {
-                    if (f.accepted) // this data chunk was accepted, don't keep.
-                        continue;
-                    // data not accepted here, keep the unprocessed frames for next time
-                    keepBuf.append(reinterpret_cast<const char *>(f.begin), int(f.srcWireLen()));
+            // finally, slide the pieces of data we didn't process down to the front so that `buf` now only contains
+            // unprocessed data. Unaccepted data frames all live after the last accepted message, so they are intact
+            // (and still masked).
+            std::size_t keepLen = 0;
+            for (const auto & f : allFrames) {
+                if (f.accepted) // this data chunk was accepted, don't keep.
+                    continue;
+                // data not accepted here, keep the unprocessed frames for next time
+                if (const auto wlen = f.srcWireLen(); wlen) {
+                    if (f.begin != d + keepLen)
+                        std::memmove(d + keepLen, f.begin, wlen);
+                    keepLen += wlen;
                 }
-                if (keepAtEndLen > 0)
-                    keepBuf.append(reinterpret_cast<const char *>(keepAtEndBegin), keepAtEndLen);
-                else if (keepAtEndLen < 0)
-                    // Defensive programming. This should never happen.
-                    throw InternalError("keepAtEndLen < 0! FIXME!");
-
-                //qDebug("Actual: %d", keepBuf.size());
-                buf = keepBuf; // re-assign the buffer now
             }
+            if (keepAtEndPos < len) {
+                if (keepAtEndPos != keepLen)
+                    std::memmove(d + keepLen, d + keepAtEndPos, len - keepAtEndPos);
+                keepLen += len - keepAtEndPos;
+            }
+            // truncate() keeps the capacity, so the next append to `buf` typically needn't reallocate
+            buf.truncate(int(keepLen));
 
-            return ret;
+            return nDelivered;
         }
-
         CloseFrameInfo & CloseFrameInfo::operator=(const Frame &f)
         {
             if (f.payload.size() >= 2) {
@@ -1075,6 +1111,20 @@ namespace WebSocket
         return -1;
     }
 
+    qint64 Wrapper::writeFrame(const QByteArray &frame, qint64 payloadLen)
+    {
+        if (isMasked()) {
+            ::Error() << "Wrapper::writeFrame called in client mode, where frames must be masked. FIXME!";
+            return -1;
+        }
+        TraceM("sending pre-framed ", frame.size(), " bytes");
+        if (socket->write(frame) > -1) {
+            emit bytesWritten(payloadLen);
+            return payloadLen;
+        }
+        return -1;
+    }
+
     void Wrapper::on_readyRead()
     {
         if (!isValid())
@@ -1087,43 +1137,52 @@ namespace WebSocket
             }
         }
         buf += socket->readAll();
-        bool dataQueued = false;
+        bool dataQueued = false, queueExceeded = false;
         try {
-            auto frames = Deser::parseBuffer(buf, _mode == ServerMode ? Deser::MaskEnforcement::RequireMasked : Deser::MaskEnforcement::RequireUnmasked);
-            for (auto & f : frames) {
-                if (!f.isControl()) {
+            // Control frames are tiny (<= 125 bytes) so we just copy them out and process them after parsing is done.
+            // Data frames are unmasked in-place in `buf` by the parser and then copied exactly once, directly into
+            // the message queue.
+            std::vector<Deser::Frame> ctlFrames;
+            Deser::parseBufferInPlace(buf, _mode == ServerMode ? Deser::MaskEnforcement::RequireMasked : Deser::MaskEnforcement::RequireUnmasked,
+                                      [&](const Deser::FrameView &fv) {
+                if (fv.isControl()) {
+                    ctlFrames.push_back(fv.toFrame());
+                } else if (!queueExceeded) {
                     if (dataMessages.size() >= maxframes) {
-                        disconnectFromHost(CloseCode::PolicyViolated, QByteArrayLiteral("Message queue size exceeded"));
-                        break;
+                        queueExceeded = true;
+                        return;
                     }
-                    const auto & back = dataMessages.emplace_back(std::move(f)); // f is invalid now, use `back` instead
+                    const auto & back = dataMessages.emplace_back(fv.toFrame());
                     dataFrameByteCount += back.payload.size();
                     dataQueued = true;
-                } else {
-                    if (f.type == FrameType::Ctl_Close) {
-                        const Deser::CloseFrameInfo info(f);
-                        TraceM("Got CLOSE ", info.code.value_or(0), " ", info.reason);
-                        gotclose = true;
-                        emit closeFrameReceived(info.code.value_or(0), info.reason);
-                        if (!sentclose) {
-                            sendClose();
-                        } else {
-                            TraceM("disconnectFromHost received Close reply");
-                        }
-                        socket->disconnectFromHost();
-                    } else if (f.type == FrameType::Ctl_Ping) {
-                        TraceM("Got PING ", f.payload.size(), " bytes");
-                        if (autopingreply && !gotclose) {
-                            sendPong(f.payload);
-                        }
-                        emit pingFrameReceived(f.payload);
-                    } else if (f.type == FrameType::Ctl_Pong) {
-                        TraceM("Got PONG ", f.payload.size(), " bytes");
-                        lastPongRecvd = Util::getTime();
-                        emit pongFrameReceived(f.payload);
+                }
+            });
+            for (const auto & f : ctlFrames) {
+                if (f.type == FrameType::Ctl_Close) {
+                    const Deser::CloseFrameInfo info(f);
+                    TraceM("Got CLOSE ", info.code.value_or(0), " ", info.reason);
+                    gotclose = true;
+                    emit closeFrameReceived(info.code.value_or(0), info.reason);
+                    if (!sentclose) {
+                        sendClose();
+                    } else {
+                        TraceM("disconnectFromHost received Close reply");
+                    }
+                    socket->disconnectFromHost();
+                } else if (f.type == FrameType::Ctl_Ping) {
+                    TraceM("Got PING ", f.payload.size(), " bytes");
+                    if (autopingreply && !gotclose) {
+                        sendPong(f.payload);
                     }
+                    emit pingFrameReceived(f.payload);
+                } else if (f.type == FrameType::Ctl_Pong) {
+                    TraceM("Got PONG ", f.payload.size(), " bytes");
+                    lastPongRecvd = Util::getTime();
+                    emit pongFrameReceived(f.payload);
                 }
             }
+            if (queueExceeded)
+                disconnectFromHost(CloseCode::PolicyViolated, QByteArrayLiteral("Message queue size exceeded"));
             if (dataQueued) {
                 emit readyRead();
                 emit messagesReady();
@@ -1550,3 +1609,175 @@ namespace WebSocket {
 } // end namespace WebSocket
 
 #endif
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+#include <QRandomGenerator>
+
+#include <array>
+
+namespace WebSocket {
+    namespace {
+        QByteArray randomBytes(std::size_t n) {
+            QByteArray ret(int(n), Qt::Uninitialized);
+            for (auto & c : ret)
+                c = char(QRandomGenerator::global()->bounded(256));
+            return ret;
+        }
+
+        void scalarMask(std::uint8_t *buf, std::size_t len, const std::uint8_t mask[4], std::size_t offset) {
+            for (std::size_t i = 0; i < len; ++i)
+                buf[i] ^= mask[(i + offset) % 4];
+        }
+
+        // ---test websocket
+        void test() {
+            // 1. applyMask() must agree with the trivial scalar implementation for all lengths, offsets & alignments
+            {
+                const auto data = randomBytes(300);
+                const std::array<std::uint8_t, 4> mask = {0x12, 0x9a, 0xfe, 0x07};
+                for (std::size_t align = 0; align < 4; ++align) {
+                    for (std::size_t len = 0; len + align <= std::size_t(data.size()); ++len) {
+                        for (std::size_t offset = 0; offset < 5; ++offset) {
+                            QByteArray a = data, b = data;
+                            applyMask(reinterpret_cast<std::uint8_t *>(a.data()) + align, len, mask.data(), offset);
+                            scalarMask(reinterpret_cast<std::uint8_t *>(b.data()) + align, len, mask.data(), offset);
+                            if (a != b)
+                                throw Exception(QString("applyMask mismatch: align=%1 len=%2 offset=%3").arg(align).arg(len).arg(offset));
+                        }
+                    }
+                }
+                Log() << "applyMask: ok";
+            }
+            // 2. masked, fragmented message with a PING interleaved between fragments, followed by an incomplete message
+            {
+                const QByteArray msg = randomBytes(250), msg2 = randomBytes(100), ping = "ping!";
+                // 100-byte masked fragments have a wire size of 2 + 4 + 100 = 106 bytes
+                const QByteArray frags = Ser::wrapBinary(msg, true, 100);
+                if (frags.size() != 106 * 2 + 2 + 4 + 50)
+                    throw Exception(QString("unexpected wire size: %1").arg(frags.size()));
+                const QByteArray pingFrame = Ser::makePingFrame(true, ping);
+                const QByteArray partial = Ser::wrapText(msg2, true);
+                QByteArray buf = frags.left(106) + pingFrame + frags.mid(106) + partial.left(partial.size() - 1);
+                const auto frames = Deser::parseBuffer(buf, Deser::RequireMasked);
+                if (frames.size() != 2)
+                    throw Exception(QString("expected 2 frames, got %1").arg(frames.size()));
+                if (frames.front().type != FrameType::Ctl_Ping || frames.front().payload != ping)
+                    throw Exception("ping frame mismatch");
+                if (frames.back().type != FrameType::Binary || frames.back().payload != msg)
+                    throw Exception("binary message mismatch");
+                if (buf != partial.left(partial.size() - 1))
+                    throw Exception("leftover data mismatch");
+                // feed the last byte, now the leftover message should parse
+                buf += partial.right(1);
+                std::size_t n = 0;
+                Deser::parseBufferInPlace(buf, Deser::RequireMasked, [&](const Deser::FrameView &fv) {
+                    ++n;
+                    if (fv.type != FrameType::Text || fv.payload != ByteView{msg2})
+                        throw Exception("text message mismatch");
+                });
+                if (n != 1 || !buf.isEmpty())
+                    throw Exception("expected exactly 1 frame and no leftovers");
+                Log() << "parseBuffer: ok";
+            }
+            // 3. an incomplete fragmented message followed by a complete control frame: the control frame is
+            //    extracted, and the fragments are left in the buffer (still masked) for next time
+            {
+                const QByteArray msg = randomBytes(200), pong = "pong";
+                const QByteArray frags = Ser::wrapText(msg, true, 100);
+                QByteArray buf = frags.left(106) + Ser::makePongFrame(pong, true);
+                const auto frames = Deser::parseBuffer(buf, Deser::RequireMasked);
+                if (frames.size() != 1 || frames.front().type != FrameType::Ctl_Pong || frames.front().payload != pong)
+                    throw Exception("pong frame mismatch");
+                if (buf != frags.left(106))
+                    throw Exception("leftover fragment mismatch");
+                buf += frags.mid(106);
+                const auto frames2 = Deser::parseBuffer(buf, Deser::RequireMasked);
+                if (frames2.size() != 1 || frames2.front().payload != msg || !buf.isEmpty())
+                    throw Exception("reassembled text message mismatch");
+                Log() << "fragment leftovers: ok";
+            }
+            // 4. mask enforcement
+            {
+                QByteArray buf = Ser::wrapText("hello", false);
+                bool threw = false;
+                try { Deser::parseBuffer(buf, Deser::RequireMasked); } catch (const Deser::ProtocolError &) { threw = true; }
+                if (!threw)
+                    throw Exception("expected a ProtocolError for an unmasked frame");
+                Log() << "mask enforcement: ok";
+            }
+        }
+
+        // ---bench websocket
+        void bench() {
+            constexpr std::size_t nFrames = 1'000'000, framesPerChunk = 10'000;
+            // A rough approximation of what Electrum clients send us: mostly small requests (subscribe, get_history,
+            // etc), some medium-sized ones (batches, broadcasts of typical txs), and the rare big one.
+            const auto randomSize = [] {
+                const auto r = QRandomGenerator::global()->bounded(1000);
+                if (r < 900) return 60 + QRandomGenerator::global()->bounded(200);   // 90%: 60 - 259 bytes
+                if (r < 995) return 260 + QRandomGenerator::global()->bounded(4000); // 9.5%: 260 - 4259 bytes
+                return 4260 + QRandomGenerator::global()->bounded(60000);            // 0.5%: 4260 - 64259 bytes
+            };
+            QByteArray wire;
+            std::size_t payloadBytes = 0;
+            for (std::size_t i = 0; i < framesPerChunk; ++i) {
+                const auto sz = std::size_t(randomSize());
+                payloadBytes += sz;
+                wire += Ser::wrapText(randomBytes(sz), true); // default fragment size of 4096 bytes
+            }
+            const std::size_t nChunks = nFrames / framesPerChunk;
+            Log() << "Parsing " << nFrames << " masked frames (" << QString::number(payloadBytes * nChunks / 1e6, 'f', 1)
+                  << " MB payload, " << QString::number(wire.size() * double(nChunks) / 1e6, 'f', 1) << " MB on the wire) ...";
+
+            const auto run = [&](const char *name, auto && parseFunc) {
+                qint64 nsec = 0;
+                std::size_t n = 0, bytes = 0;
+                for (std::size_t chunk = 0; chunk < nChunks; ++chunk) {
+                    QByteArray buf(wire.constData(), wire.size()); // deep copy outside of the timed section
+                    const auto t0 = Util::getTimeNS();
+                    parseFunc(buf, n, bytes);
+                    nsec += Util::getTimeNS() - t0;
+                    if (!buf.isEmpty()) throw Exception(QString("%1: unexpected leftovers").arg(name));
+                }
+                if (n != framesPerChunk * nChunks || bytes != payloadBytes * nChunks)
+                    throw Exception(QString("%1: unexpected frame count or byte count: %2, %3").arg(name).arg(n).arg(bytes));
+                Log() << name << ": " << QString::number(nsec / 1e6, 'f', 3) << " msec, "
+                      << QString::number(n / (nsec / 1e9) / 1e6, 'f', 3) << " Mframes/sec, "
+                      << QString::number(bytes / (nsec / 1e9) / 1e9, 'f', 3) << " GB/sec";
+            };
+            run("parseBuffer (copying)", [](QByteArray &buf, std::size_t &n, std::size_t &bytes) {
+                for (const auto & f : Deser::parseBuffer(buf, Deser::RequireMasked)) {
+                    ++n;
+                    bytes += std::size_t(f.payload.size());
+                }
+            });
+            run("parseBufferInPlace", [](QByteArray &buf, std::size_t &n, std::size_t &bytes) {
+                n += Deser::parseBufferInPlace(buf, Deser::RequireMasked, [&bytes](const Deser::FrameView &fv) {
+                    bytes += fv.payload.size();
+                });
+            });
+
+            // raw unmask kernel throughput vs. the byte-at-a-time loop it replaced
+            {
+                QByteArray big = randomBytes(64 * 1024 * 1024);
+                const std::array<std::uint8_t, 4> mask = {0xde, 0xad, 0xbe, 0xef};
+                auto *p = reinterpret_cast<std::uint8_t *>(big.data());
+                const auto sz = std::size_t(big.size());
+                Tic t0;
+                applyMask(p, sz, mask.data());
+                t0.fin();
+                Tic t1;
+                scalarMask(p, sz, mask.data(), 0);
+                t1.fin();
+                Log() << "applyMask: " << QString::number(sz / t0.secs() / 1e9, 'f', 3) << " GB/sec, byte-at-a-time: "
+                      << QString::number(sz / t1.secs() / 1e9, 'f', 3) << " GB/sec";
+            }
+        }
+
+        const auto test_ = App::registerTest("websocket", &test);
+        const auto bench_ = App::registerBench("websocket", &bench);
+    } // namespace
+} // namespace WebSocket
+#endif // ENABLE_TESTS
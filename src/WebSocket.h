@@ -18,6 +18,7 @@
 //
 #pragma once
 
+#include "ByteView.h"
 #include "Common.h"
 
 #include <QByteArray>
@@ -29,6 +30,8 @@
 #include <QTcpSocket>
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <list>
 #include <optional>
 
@@ -61,6 +64,12 @@ namespace WebSocket
 
     QString frameTypeName(FrameType);
 
+    /// XOR `len` bytes at `buf` in-place with the 4-byte RFC 6455 masking key `mask`. `maskOffset` is the position
+    /// of `buf[0]` relative to the start of the masked payload (only its value modulo 4 matters). Applying this twice
+    /// with the same arguments restores the original data. Uses AVX2 or SSE2 (if compiled-in), 8 bytes at a time
+    /// otherwise, falling back to a byte-at-a-time loop for the tail.
+    void applyMask(std::uint8_t *buf, std::size_t len, const std::uint8_t mask[4], std::size_t maskOffset = 0) noexcept;
+
     /// The below codes are all from RFC 6455
     enum CloseCode : std::uint16_t {
         /// 1000 indicates a normal closure, meaning that the purpose for which the connection was established has been fulfilled.
@@ -192,6 +201,18 @@ namespace WebSocket
             inline constexpr bool isControl() const noexcept { return type & 0x08; }
         };
 
+        /// Like Frame, except that the payload is a non-owning view into the buffer passed to parseBufferInPlace().
+        /// Text/Binary payloads are always fully assembled from all fragments and already unmasked.
+        struct FrameView {
+            FrameType type = FrameType::Text;
+            bool masked{};
+            ByteView payload;
+
+            inline constexpr bool isControl() const noexcept { return type & 0x08; }
+            /// Returns a Frame that owns a deep copy of the payload data
+            Frame toFrame() const { return Frame{type, masked, payload.toByteArray()}; }
+        };
+
         /// Thrown if the incoming wire data is out-of-spec and/or invalid.
         struct ProtocolError : public Error { using Error::Error; ~ProtocolError() override; };
 
@@ -214,6 +235,18 @@ namespace WebSocket
         /// to catch that exception as well and abort the app in that case.
         std::list<Frame> parseBuffer(QByteArray &buf, MaskEnforcement maskEnforcement = DontCare);
 
+        using FrameViewFunc = std::function<void(const FrameView &)>;
+
+        /// Zero-copy version of parseBuffer(). Accepted frames are unmasked in-place in `buf` (and fragmented messages
+        /// are coalesced in-place), then `func` is called once per frame, in the same order parseBuffer() would
+        /// return them (control frames first, then data messages). The FrameView passed to `func` points into `buf`
+        /// and is only valid for the duration of that call. On return, `buf` contains only the unprocessed data, as
+        /// with parseBuffer(). Returns the number of frames delivered to `func`.
+        ///
+        /// Throws the same exceptions as parseBuffer(). If an exception is thrown (by this function or by `func`),
+        /// `buf` is left in an unspecified state and the connection it came from should be closed.
+        std::size_t parseBufferInPlace(QByteArray &buf, MaskEnforcement maskEnforcement, const FrameViewFunc &func);
+
         /// Convenience helper for parsing out the CloseCode and the reason from a Close frame.
         struct CloseFrameInfo {
             std::optional<quint16> code; // see enum CloseCode for possible codes specified in RFC. This may !has_value() if no code was specified.
@@ -441,6 +474,11 @@ namespace WebSocket
         /// The default message mode to use when generating frames for the QIODevice::write() function
         MessageMode messageMode() const { return _messageMode; }
         void setMessageMode(MessageMode m) { _messageMode = m; }
+        /// Writes `frame`, which must be a complete data frame produced by Ser::wrapPayload() for our messageMode()
+        /// (such as one shared by many connections), straight to the socket. `payloadLen` is the size of the payload it
+        /// wraps, and is what bytesWritten() reports. Only valid in ServerMode, since shared frames are unmasked.
+        /// Returns `payloadLen` on success or -1 on failure.
+        qint64 writeFrame(const QByteArray &frame, qint64 payloadLen);
         /// If true, we will auto-reply to pings asynchronously in this object's thread's event loop
         bool autoPingReply() const { return autopingreply; }
         void setAutoPingReply(bool b) { autopingreply = b; }